@@ -0,0 +1,635 @@
+//
+// Copyright 2021-2022 Ettus Research, a National Instruments Brand
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+//
+
+// Host I/O benchmarks. Measures, with synthetic sc16 data, the sustained rate and
+// the per call latency of the capture sinks, the PipeFile transport, the sample
+// format conversions, the sc16 compression and the ChunkQueue handoff over a grid of
+// channel counts, samples per buffer and write targets. Results are written as JSON.
+//
+//      Arch_benchmarks --channels 1 4 16 --spb 10000 1000000
+//          --target /mnt/md0 /mnt/md1 --output results.json
+
+#include "CaptureSinks.hpp"
+#include "FileSystem.hpp"
+#include "SampleConvert.hpp"
+#include "Sc16Codec.hpp"
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/utsname.h>
+#include <unistd.h>
+#include <boost/program_options.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <complex>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+const size_t SAMPLE_SIZE = sizeof(std::complex<int16_t>);
+
+struct BenchmarkOptions
+{
+    std::vector<std::string> benchmarks;
+    std::vector<size_t> channels;
+    std::vector<size_t> spb;
+    std::vector<std::string> targets;
+    double seconds;
+    uint64_t max_file_size;
+    size_t queue_depth;
+    bool sync;
+    bool keep_files;
+    std::string output;
+};
+
+struct BenchmarkResult
+{
+    std::string benchmark;
+    std::string target;
+    size_t channels   = 0;
+    size_t spb        = 0;
+    size_t call_bytes = 0;
+    uint64_t bytes    = 0;
+    // Bytes produced by the compression benchmarks
+    uint64_t output_bytes = 0;
+    double seconds        = 0;
+    std::vector<uint64_t> latency_ns;
+    std::string error;
+};
+
+/**
+ * @brief Page aligned buffer filled with an sc16 ramp.
+ */
+class SampleBuffer
+{
+public:
+    SampleBuffer(size_t nbytes)
+    {
+        if (posix_memalign(&buffer_data, 4096, std::max<size_t>(nbytes, 1)) != 0) {
+            throw std::runtime_error("Unable to allocate benchmark buffer");
+        }
+        int16_t* samples = (int16_t*)buffer_data;
+        for (size_t i = 0; i < nbytes / sizeof(int16_t); i++) {
+            samples[i] = int16_t(i);
+        }
+    }
+    ~SampleBuffer()
+    {
+        free(buffer_data);
+    }
+    void* data()
+    {
+        return buffer_data;
+    }
+
+private:
+    void* buffer_data = nullptr;
+};
+
+uint64_t elapsedNs(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - start)
+        .count();
+}
+
+/**
+ * @brief Runs body(channel, result) on one thread per channel and merges the
+ *  per channel results. The run takes as long as the slowest channel.
+ */
+template <typename Body>
+void runChannels(BenchmarkResult& result, Body body)
+{
+    std::vector<BenchmarkResult> channel_results(result.channels);
+    std::vector<std::string> errors(result.channels);
+    std::vector<std::thread> threads;
+    for (size_t ch = 0; ch < result.channels; ch++) {
+        threads.emplace_back([&, ch]() {
+            try {
+                body(ch, channel_results[ch]);
+            } catch (const std::exception& e) {
+                errors[ch] = e.what();
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    for (size_t ch = 0; ch < result.channels; ch++) {
+        result.bytes += channel_results[ch].bytes;
+        result.output_bytes += channel_results[ch].output_bytes;
+        result.seconds = std::max(result.seconds, channel_results[ch].seconds);
+        result.latency_ns.insert(result.latency_ns.end(),
+            channel_results[ch].latency_ns.begin(),
+            channel_results[ch].latency_ns.end());
+        if (result.error.empty()) {
+            result.error = errors[ch];
+        }
+    }
+}
+
+std::string benchmarkFile(const BenchmarkResult& result, size_t ch)
+{
+    return result.target + "/arch_benchmark_" + result.benchmark + "_"
+           + std::to_string(ch) + ".dat";
+}
+
+void runSink(BenchmarkResult& result, const BenchmarkOptions& options)
+{
+    // O_DIRECT needs whole blocks, round the writes up
+    const size_t align =
+        CaptureSink::make(result.benchmark, options.queue_depth)->alignment();
+    const size_t call_bytes = (result.spb * SAMPLE_SIZE + align - 1) / align * align;
+    const uint64_t max_size =
+        std::max<uint64_t>(options.max_file_size / call_bytes, 1) * call_bytes;
+    result.call_bytes = call_bytes;
+    runChannels(result, [&](size_t ch, BenchmarkResult& channel) {
+        auto sink = CaptureSink::make(result.benchmark, options.queue_depth);
+        std::vector<std::unique_ptr<SampleBuffer>> buffers;
+        for (size_t i = 0; i < sink->buffers(); i++) {
+            buffers.emplace_back(new SampleBuffer(call_bytes));
+        }
+        const std::string path = benchmarkFile(result, ch);
+        sink->open(path, max_size);
+        const auto start = std::chrono::steady_clock::now();
+        uint64_t offset  = 0;
+        size_t call      = 0;
+        try {
+            while (elapsedNs(start) < options.seconds * 1e9) {
+                if (offset + call_bytes > max_size) {
+                    offset = 0;
+                }
+                const auto call_start = std::chrono::steady_clock::now();
+                sink->write(buffers[call % buffers.size()]->data(), call_bytes, offset);
+                channel.latency_ns.push_back(elapsedNs(call_start));
+                offset += call_bytes;
+                channel.bytes += call_bytes;
+                call++;
+            }
+            sink->close(options.sync);
+        } catch (...) {
+            sink->close(false);
+            throw;
+        }
+        channel.seconds = elapsedNs(start) / 1e9;
+        if (!options.keep_files) {
+            unlink(path.c_str());
+        }
+    });
+}
+
+void runPipe(BenchmarkResult& result, const BenchmarkOptions& options)
+{
+    const bool vmsplice = result.benchmark == "pipe-vmsplice";
+    result.call_bytes   = result.spb * SAMPLE_SIZE;
+    runChannels(result, [&](size_t ch, BenchmarkResult& channel) {
+        const std::string path = benchmarkFile(result, ch);
+        unlink(path.c_str());
+        if (mkfifo(path.c_str(), 0666) < 0) {
+            throw std::runtime_error("Unable to create pipe " + path);
+        }
+        // Consumer: reads as fast as it can, like a client that keeps up
+        std::thread reader([&path]() {
+            std::vector<char> buffer(1 << 20);
+            int file_id = open(path.c_str(), O_RDONLY);
+            while (file_id >= 0 && read(file_id, buffer.data(), buffer.size()) > 0) {
+            }
+            close(file_id);
+        });
+        PipeFile pipe(path);
+        pipe.setWriteMode(vmsplice ? PIPE_VMSPLICE : PIPE_WRITE);
+        while (!pipe.openFile(O_WRONLY)) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        SampleBuffer write_buffer(result.call_bytes);
+        const auto start = std::chrono::steady_clock::now();
+        while (elapsedNs(start) < options.seconds * 1e9) {
+            uint8_t* buf = (uint8_t*)(vmsplice ? pipe.acquireBuffer(result.call_bytes)
+                                               : write_buffer.data());
+            const auto call_start = std::chrono::steady_clock::now();
+            size_t written        = 0;
+            while (written < result.call_bytes) {
+                int returned =
+                    pipe.writeSamples(buf + written, result.call_bytes - written);
+                if (returned > 0) {
+                    written += returned;
+                } else if (returned < 0 && errno != EAGAIN) {
+                    break;
+                } else {
+                    pipe.waitWritable(10);
+                }
+            }
+            channel.latency_ns.push_back(elapsedNs(call_start));
+            channel.bytes += written;
+            if (vmsplice) {
+                pipe.releaseBuffer(buf);
+            }
+            if (written < result.call_bytes) {
+                break;
+            }
+        }
+        while (!pipe.waitDrained(100)) {
+        }
+        channel.seconds = elapsedNs(start) / 1e9;
+        pipe.closeFile();
+        reader.join();
+        unlink(path.c_str());
+    });
+}
+
+/**
+ * @brief Scalar sc16 to complex float conversion, scaled to +/-1.0 like UHD. The per
+ *  sample reference for the SampleConvert kernels, as tools/dat_analysis converts.
+ */
+template <typename T>
+void convertSc16(const std::complex<int16_t>* in, std::complex<T>* out, size_t nsamps)
+{
+    const T scale = T(1.0 / 32768.0);
+    for (size_t i = 0; i < nsamps; i++) {
+        out[i] = std::complex<T>(in[i].real() * scale, in[i].imag() * scale);
+    }
+}
+
+/**
+ * @brief Converts spb sc16 samples per channel with kernel(in, out, nsamps), out
+ *  holding out_sample_size bytes per sample. The rate is counted in sc16 bytes.
+ */
+template <typename Kernel>
+void runConvert(BenchmarkResult& result,
+    const BenchmarkOptions& options,
+    size_t out_sample_size,
+    Kernel kernel)
+{
+    result.call_bytes = result.spb * SAMPLE_SIZE;
+    runChannels(result, [&](size_t, BenchmarkResult& channel) {
+        SampleBuffer input(result.call_bytes);
+        SampleBuffer output(result.spb * out_sample_size);
+        const auto start = std::chrono::steady_clock::now();
+        while (elapsedNs(start) < options.seconds * 1e9) {
+            const auto call_start = std::chrono::steady_clock::now();
+            kernel((const std::complex<int16_t>*)input.data(), output.data(), result.spb);
+            channel.latency_ns.push_back(elapsedNs(call_start));
+            channel.bytes += result.call_bytes;
+        }
+        channel.seconds = elapsedNs(start) / 1e9;
+    });
+}
+
+/**
+ * @brief Compresses spb sc16 samples per channel with compressSc16(). The input is
+ *  Gaussian noise about 40 dB below full scale, a low SNR capture, since the ramp of
+ *  SampleBuffer would compress to nothing. The rate is counted in sc16 bytes.
+ */
+void runCompress(BenchmarkResult& result, const BenchmarkOptions& options, ConvertIsa isa)
+{
+    result.call_bytes = result.spb * SAMPLE_SIZE;
+    runChannels(result, [&](size_t ch, BenchmarkResult& channel) {
+        std::vector<std::complex<int16_t>> input(result.spb);
+        std::mt19937 generator(ch);
+        std::normal_distribution<float> noise(0, 300);
+        for (auto& sample : input) {
+            sample = {int16_t(std::lround(noise(generator))),
+                int16_t(std::lround(noise(generator)))};
+        }
+        std::vector<uint8_t> output(sc16CompressBound(result.spb));
+        const auto start = std::chrono::steady_clock::now();
+        while (elapsedNs(start) < options.seconds * 1e9) {
+            const auto call_start = std::chrono::steady_clock::now();
+            channel.output_bytes +=
+                compressSc16(input.data(), result.spb, output.data(), isa);
+            channel.latency_ns.push_back(elapsedNs(call_start));
+            channel.bytes += result.call_bytes;
+        }
+        channel.seconds = elapsedNs(start) / 1e9;
+    });
+}
+
+/**
+ * @brief Hands chunks of one buffer per channel from a producer to a consumer thread
+ *  through ChunkQueue, as Arch_pipe does with PipeStreaming. The latency is the time
+ *  a chunk waits in the queue.
+ */
+void runHandoff(BenchmarkResult& result, const BenchmarkOptions& options)
+{
+    result.call_bytes = result.spb * SAMPLE_SIZE * result.channels;
+    ChunkQueue queue(options.queue_depth);
+    // depth chunks queued, one being filled and one being consumed
+    std::vector<std::unique_ptr<SampleBuffer>> pool;
+    for (size_t i = 0; i < (options.queue_depth + 2) * result.channels; i++) {
+        pool.emplace_back(new SampleBuffer(result.spb * SAMPLE_SIZE));
+    }
+    const auto start = std::chrono::steady_clock::now();
+    std::thread producer([&]() {
+        size_t set = 0;
+        while (elapsedNs(start) < options.seconds * 1e9) {
+            ChunkQueue::Chunk chunk;
+            for (size_t ch = 0; ch < result.channels; ch++) {
+                chunk.buffers.push_back(pool[set * result.channels + ch]->data());
+                chunk.nbytes.push_back(result.spb * SAMPLE_SIZE);
+            }
+            chunk.received = std::chrono::steady_clock::now();
+            if (!queue.push(std::move(chunk))) {
+                break;
+            }
+            set = (set + 1) % (options.queue_depth + 2);
+        }
+        queue.close();
+    });
+    ChunkQueue::Chunk chunk;
+    volatile uint8_t touched = 0;
+    while (queue.pop(chunk)) {
+        result.latency_ns.push_back(elapsedNs(chunk.received));
+        for (size_t ch = 0; ch < chunk.buffers.size(); ch++) {
+            touched = touched + *(uint8_t*)chunk.buffers[ch];
+            result.bytes += chunk.nbytes[ch];
+        }
+    }
+    result.seconds = elapsedNs(start) / 1e9;
+    producer.join();
+}
+
+bool usesTarget(const std::string& benchmark)
+{
+    return benchmark == "ofstream" || benchmark == "odirect" || benchmark == "iouring"
+           || benchmark == "mmap" || benchmark == "pipe" || benchmark == "pipe-vmsplice";
+}
+
+BenchmarkResult runBenchmark(const std::string& benchmark,
+    const std::string& target,
+    size_t channels,
+    size_t spb,
+    const BenchmarkOptions& options)
+{
+    BenchmarkResult result;
+    result.benchmark = benchmark;
+    result.target    = target;
+    result.channels  = channels;
+    result.spb       = spb;
+    try {
+        if (benchmark == "pipe" || benchmark == "pipe-vmsplice") {
+            runPipe(result, options);
+        } else if (usesTarget(benchmark)) {
+            runSink(result, options);
+        } else if (benchmark == "convert-fc32") {
+            runConvert(result,
+                options,
+                sizeof(std::complex<float>),
+                [](const std::complex<int16_t>* in, void* out, size_t nsamps) {
+                    convertSc16<float>(in, (std::complex<float>*)out, nsamps);
+                });
+        } else if (benchmark == "convert-fc64") {
+            runConvert(result,
+                options,
+                sizeof(std::complex<double>),
+                [](const std::complex<int16_t>* in, void* out, size_t nsamps) {
+                    convertSc16<double>(in, (std::complex<double>*)out, nsamps);
+                });
+        } else if (benchmark == "convert-fc32-simd") {
+            runConvert(result,
+                options,
+                sizeof(std::complex<float>),
+                [](const std::complex<int16_t>* in, void* out, size_t nsamps) {
+                    convertSc16ToFc32(
+                        in, (std::complex<float>*)out, nsamps, 1.0f / 32768);
+                });
+        } else if (benchmark == "convert-fc16" || benchmark == "convert-fc16-simd") {
+            const ConvertIsa isa =
+                benchmark == "convert-fc16" ? CONVERT_SCALAR : bestConvertIsa();
+            runConvert(result,
+                options,
+                2 * sizeof(uint16_t),
+                [isa](const std::complex<int16_t>* in, void* out, size_t nsamps) {
+                    convertSc16ToFc16(in, (uint16_t*)out, nsamps, 1.0f / 32768, isa);
+                });
+        } else if (benchmark == "compress-sc16" || benchmark == "compress-sc16-simd") {
+            runCompress(result,
+                options,
+                benchmark == "compress-sc16" ? CONVERT_SCALAR : bestConvertIsa());
+        } else if (benchmark == "handoff") {
+            runHandoff(result, options);
+        } else {
+            throw std::runtime_error("Unknown benchmark " + benchmark);
+        }
+    } catch (const std::exception& e) {
+        result.error = e.what();
+    }
+    return result;
+}
+
+double percentile(const std::vector<uint64_t>& sorted, double fraction)
+{
+    if (sorted.empty()) {
+        return 0;
+    }
+    const size_t index = std::min(sorted.size() - 1, size_t(fraction * sorted.size()));
+    return sorted[index] / 1e3;
+}
+
+std::string jsonString(const std::string& value)
+{
+    std::ostringstream out;
+    out << '"';
+    for (char c : value) {
+        if (c == '"' || c == '\\') {
+            out << '\\' << c;
+        } else if ((unsigned char)c < 0x20) {
+            out << "\\u" << std::hex << std::setw(4) << std::setfill('0') << int(c)
+                << std::dec;
+        } else {
+            out << c;
+        }
+    }
+    out << '"';
+    return out.str();
+}
+
+template <typename T>
+std::string jsonList(const std::vector<T>& values)
+{
+    std::ostringstream out;
+    out << '[';
+    for (size_t i = 0; i < values.size(); i++) {
+        out << (i ? ", " : "") << values[i];
+    }
+    out << ']';
+    return out.str();
+}
+
+std::string jsonStringList(const std::vector<std::string>& values)
+{
+    std::vector<std::string> quoted;
+    for (const auto& value : values) {
+        quoted.push_back(jsonString(value));
+    }
+    return jsonList(quoted);
+}
+
+void writeJson(std::ostream& out,
+    const BenchmarkOptions& options,
+    std::vector<BenchmarkResult>& results)
+{
+    char hostname[256] = {0};
+    gethostname(hostname, sizeof(hostname) - 1);
+    struct utsname system_name;
+    uname(&system_name);
+    char timestamp[32];
+    const std::time_t now = std::time(nullptr);
+    std::strftime(timestamp, sizeof(timestamp), "%Y-%m-%dT%H:%M:%SZ", std::gmtime(&now));
+
+    out << std::fixed << std::setprecision(3);
+    out << "{\n";
+    out << "  \"system\": {\"hostname\": " << jsonString(hostname)
+        << ", \"kernel\": " << jsonString(system_name.release)
+        << ", \"cpus\": " << std::thread::hardware_concurrency()
+        << ", \"timestamp\": " << jsonString(timestamp) << "},\n";
+    out << "  \"config\": {\"benchmarks\": " << jsonStringList(options.benchmarks)
+        << ", \"channels\": " << jsonList(options.channels)
+        << ", \"spb\": " << jsonList(options.spb)
+        << ", \"targets\": " << jsonStringList(options.targets)
+        << ", \"seconds\": " << options.seconds
+        << ", \"max_file_size\": " << options.max_file_size
+        << ", \"queue_depth\": " << options.queue_depth
+        << ", \"sync\": " << (options.sync ? "true" : "false") << "},\n";
+    out << "  \"results\": [";
+    for (size_t i = 0; i < results.size(); i++) {
+        BenchmarkResult& result = results[i];
+        std::sort(result.latency_ns.begin(), result.latency_ns.end());
+        double mean = 0;
+        for (uint64_t latency : result.latency_ns) {
+            mean += latency / 1e3;
+        }
+        mean /= std::max<size_t>(result.latency_ns.size(), 1);
+        const double rate = result.seconds > 0 ? result.bytes / result.seconds : 0;
+        out << (i ? "," : "") << "\n    {\"benchmark\": " << jsonString(result.benchmark)
+            << ", \"target\": " << jsonString(result.target)
+            << ", \"channels\": " << result.channels << ", \"spb\": " << result.spb
+            << ", \"call_bytes\": " << result.call_bytes
+            << ", \"bytes\": " << result.bytes << ", \"seconds\": " << result.seconds
+            << ", \"MBps\": " << rate / 1e6
+            << ", \"Msps\": " << rate / SAMPLE_SIZE / 1e6
+            << ", \"calls\": " << result.latency_ns.size() << ", \"latency_us\": {"
+            << "\"mean\": " << mean
+            << ", \"p50\": " << percentile(result.latency_ns, 0.5)
+            << ", \"p90\": " << percentile(result.latency_ns, 0.9)
+            << ", \"p99\": " << percentile(result.latency_ns, 0.99)
+            << ", \"p999\": " << percentile(result.latency_ns, 0.999)
+            << ", \"max\": " << percentile(result.latency_ns, 1.0) << "}";
+        if (result.output_bytes > 0) {
+            out << ", \"ratio\": " << double(result.bytes) / result.output_bytes;
+        }
+        if (!result.error.empty()) {
+            out << ", \"error\": " << jsonString(result.error);
+        }
+        out << "}";
+    }
+    out << "\n  ]\n}\n";
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    namespace po = boost::program_options;
+    BenchmarkOptions options;
+    po::options_description desc("Arch_benchmarks options");
+    // clang-format off
+    desc.add_options()
+        ("help", "print this message")
+        ("benchmarks",
+            po::value<std::vector<std::string>>(&options.benchmarks)->multitoken()
+            ->default_value({"ofstream", "odirect", "iouring", "mmap", "pipe",
+                "pipe-vmsplice", "convert-fc32", "convert-fc64", "convert-fc32-simd",
+                "convert-fc16", "convert-fc16-simd", "compress-sc16",
+                "compress-sc16-simd", "handoff"},
+                "all"),
+            "benchmarks to run: ofstream odirect iouring mmap pipe pipe-vmsplice "
+            "convert-fc32 convert-fc64 convert-fc32-simd convert-fc16 "
+            "convert-fc16-simd compress-sc16 compress-sc16-simd handoff")
+        ("channels",
+            po::value<std::vector<size_t>>(&options.channels)->multitoken()
+            ->default_value({1, 2, 4}, "1 2 4"),
+            "channel counts, one writer thread per channel")
+        ("spb",
+            po::value<std::vector<size_t>>(&options.spb)->multitoken()
+            ->default_value({10000, 100000, 1000000}, "10000 100000 1000000"),
+            "samples per buffer (sc16) written per call")
+        ("target",
+            po::value<std::vector<std::string>>(&options.targets)->multitoken()
+            ->default_value({"/tmp"}, "/tmp"),
+            "directories the file and pipe benchmarks write to")
+        ("seconds",
+            po::value<double>(&options.seconds)->default_value(2.0),
+            "duration of each run")
+        ("max-file-size",
+            po::value<uint64_t>(&options.max_file_size)->default_value(1073741824),
+            "bytes written per channel before the file is rewritten from the start")
+        ("queue-depth",
+            po::value<size_t>(&options.queue_depth)->default_value(16),
+            "writes in flight for iouring, chunks queued for handoff")
+        ("sync",
+            po::value<bool>(&options.sync)->default_value(true),
+            "flush the files to the device at the end of each run, included in the rate")
+        ("keep-files",
+            po::value<bool>(&options.keep_files)->default_value(false),
+            "keep the files written by the benchmarks")
+        ("output",
+            po::value<std::string>(&options.output)->default_value(""),
+            "JSON output file, stdout if empty")
+        ;
+    // clang-format on
+    po::variables_map vm;
+    po::store(po::parse_command_line(argc, argv, desc), vm);
+    if (vm.count("help")) {
+        std::cout << desc << std::endl;
+        return EXIT_SUCCESS;
+    }
+    po::notify(vm);
+
+    std::vector<BenchmarkResult> results;
+    for (const auto& benchmark : options.benchmarks) {
+        const std::vector<std::string> targets =
+            usesTarget(benchmark) ? options.targets : std::vector<std::string>{""};
+        for (const auto& target : targets) {
+            for (size_t channels : options.channels) {
+                for (size_t spb : options.spb) {
+                    results.push_back(
+                        runBenchmark(benchmark, target, channels, spb, options));
+                    const BenchmarkResult& result = results.back();
+                    std::cerr << benchmark << (target.empty() ? "" : " ") << target
+                              << " " << channels << " ch " << spb << " spb: ";
+                    if (result.error.empty()) {
+                        std::cerr << (result.seconds > 0
+                                             ? result.bytes / result.seconds / 1e6
+                                             : 0)
+                                  << " MB/s" << std::endl;
+                    } else {
+                        std::cerr << result.error << std::endl;
+                    }
+                }
+            }
+        }
+    }
+
+    if (options.output.empty()) {
+        writeJson(std::cout, options, results);
+    } else {
+        std::ofstream outfile(options.output);
+        writeJson(outfile, options, results);
+        std::cerr << "Results written to " << options.output << std::endl;
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,295 @@
+//
+// Copyright 2021-2022 Ettus Research, a National Instruments Brand
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+//
+
+#include "CaptureSinks.hpp"
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+namespace {
+std::runtime_error sinkError(const std::string& what, const std::string& path)
+{
+    return std::runtime_error(what + " " + path + ": " + strerror(errno));
+}
+
+void writeAll(int file_id, const uint8_t* buf, size_t nbytes, uint64_t offset)
+{
+    while (nbytes > 0) {
+        ssize_t written = pwrite(file_id, buf, nbytes, offset);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw sinkError("pwrite", "");
+        }
+        buf += written;
+        offset += written;
+        nbytes -= written;
+    }
+}
+
+unsigned loadAcquire(const unsigned* value)
+{
+    return __atomic_load_n(value, __ATOMIC_ACQUIRE);
+}
+
+void storeRelease(unsigned* value, unsigned new_value)
+{
+    __atomic_store_n(value, new_value, __ATOMIC_RELEASE);
+}
+
+void* mapRing(int ring_id, size_t size, off_t offset)
+{
+    return mmap(nullptr,
+        size,
+        PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE,
+        ring_id,
+        offset);
+}
+
+int uringEnter(int ring_id, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+    return syscall(
+        __NR_io_uring_enter, ring_id, to_submit, min_complete, flags, nullptr, 0);
+}
+} // namespace
+
+std::unique_ptr<CaptureSink> CaptureSink::make(
+    const std::string& name, size_t queue_depth)
+{
+    if (name == "ofstream") {
+        return std::unique_ptr<CaptureSink>(new OfstreamSink());
+    } else if (name == "odirect") {
+        return std::unique_ptr<CaptureSink>(new DirectSink());
+    } else if (name == "iouring") {
+        return std::unique_ptr<CaptureSink>(new UringSink(queue_depth));
+    } else if (name == "mmap") {
+        return std::unique_ptr<CaptureSink>(new MmapSink());
+    }
+    throw std::runtime_error("Unknown capture sink " + name);
+}
+
+void OfstreamSink::open(const std::string& path, uint64_t)
+{
+    file_path = path;
+    outfile.open(path, std::ofstream::binary | std::ofstream::trunc);
+    if (!outfile.is_open()) {
+        throw sinkError("Unable to open", path);
+    }
+    position = 0;
+}
+
+void OfstreamSink::write(void* buf, size_t nbytes, uint64_t offset)
+{
+    if (offset != position) {
+        outfile.seekp(offset);
+    }
+    outfile.write((const char*)buf, nbytes);
+    if (!outfile) {
+        throw sinkError("Unable to write", file_path);
+    }
+    position = offset + nbytes;
+}
+
+void OfstreamSink::close(bool sync)
+{
+    outfile.close();
+    if (sync) {
+        // ofstream has no fsync, sync the file through a second descriptor
+        int file_id = ::open(file_path.c_str(), O_WRONLY);
+        if (file_id >= 0) {
+            fdatasync(file_id);
+            ::close(file_id);
+        }
+    }
+}
+
+void DirectSink::open(const std::string& path, uint64_t)
+{
+    file_id = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+    if (file_id < 0) {
+        throw sinkError("Unable to open with O_DIRECT", path);
+    }
+}
+
+void DirectSink::write(void* buf, size_t nbytes, uint64_t offset)
+{
+    writeAll(file_id, (const uint8_t*)buf, nbytes, offset);
+}
+
+void DirectSink::close(bool sync)
+{
+    if (file_id >= 0) {
+        if (sync) {
+            fdatasync(file_id);
+        }
+        ::close(file_id);
+        file_id = -1;
+    }
+}
+
+UringSink::UringSink(size_t queue_depth) : queue_depth(queue_depth) {}
+
+UringSink::~UringSink()
+{
+    close(false);
+}
+
+void UringSink::open(const std::string& path, uint64_t)
+{
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    ring_id = syscall(__NR_io_uring_setup, unsigned(queue_depth), &params);
+    if (ring_id < 0) {
+        throw sinkError("io_uring_setup failed for", path);
+    }
+    sq_size   = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_size   = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    sq_ring   = mapRing(ring_id, sq_size, IORING_OFF_SQ_RING);
+    cq_ring   = mapRing(ring_id, cq_size, IORING_OFF_CQ_RING);
+    sqes      = mapRing(ring_id, sqes_size, IORING_OFF_SQES);
+    if (sq_ring == MAP_FAILED || cq_ring == MAP_FAILED || sqes == MAP_FAILED) {
+        unmapRing();
+        throw sinkError("Unable to map the io_uring of", path);
+    }
+    uint8_t* sq = (uint8_t*)sq_ring;
+    uint8_t* cq = (uint8_t*)cq_ring;
+    sq_head     = (unsigned*)(sq + params.sq_off.head);
+    sq_tail     = (unsigned*)(sq + params.sq_off.tail);
+    sq_mask     = (unsigned*)(sq + params.sq_off.ring_mask);
+    sq_array    = (unsigned*)(sq + params.sq_off.array);
+    cq_head     = (unsigned*)(cq + params.cq_off.head);
+    cq_tail     = (unsigned*)(cq + params.cq_off.tail);
+    cq_mask     = (unsigned*)(cq + params.cq_off.ring_mask);
+    cqes        = cq + params.cq_off.cqes;
+
+    file_id = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+    if (file_id < 0) {
+        unmapRing();
+        throw sinkError("Unable to open with O_DIRECT", path);
+    }
+    in_flight = 0;
+}
+
+void UringSink::write(void* buf, size_t nbytes, uint64_t offset)
+{
+    // Keep a slot free, the caller reuses buf after queue_depth calls
+    reap(queue_depth - 1);
+    const unsigned tail      = *sq_tail;
+    const unsigned slot      = tail & *sq_mask;
+    struct io_uring_sqe* sqe = (struct io_uring_sqe*)sqes + slot;
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode    = IORING_OP_WRITE;
+    sqe->fd        = file_id;
+    sqe->addr      = (uint64_t)buf;
+    sqe->len       = nbytes;
+    sqe->off       = offset;
+    sq_array[slot] = slot;
+    storeRelease(sq_tail, tail + 1);
+    if (uringEnter(ring_id, 1, 0, 0) < 0) {
+        throw sinkError("io_uring_enter", "");
+    }
+    in_flight++;
+}
+
+void UringSink::reap(size_t max_in_flight)
+{
+    while (in_flight > max_in_flight) {
+        unsigned head = *cq_head;
+        if (head == loadAcquire(cq_tail)) {
+            if (uringEnter(ring_id, 0, 1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR) {
+                throw sinkError("io_uring_enter", "");
+            }
+            continue;
+        }
+        const struct io_uring_cqe* cqe =
+            (const struct io_uring_cqe*)cqes + (head & *cq_mask);
+        const int result = cqe->res;
+        storeRelease(cq_head, head + 1);
+        in_flight--;
+        if (result < 0) {
+            errno = -result;
+            throw sinkError("io_uring write", "");
+        }
+    }
+}
+
+void UringSink::unmapRing()
+{
+    if (sq_ring && sq_ring != MAP_FAILED) {
+        munmap(sq_ring, sq_size);
+    }
+    if (cq_ring && cq_ring != MAP_FAILED) {
+        munmap(cq_ring, cq_size);
+    }
+    if (sqes && sqes != MAP_FAILED) {
+        munmap(sqes, sqes_size);
+    }
+    sq_ring = cq_ring = sqes = nullptr;
+    if (ring_id >= 0) {
+        ::close(ring_id);
+        ring_id = -1;
+    }
+}
+
+void UringSink::close(bool sync)
+{
+    if (ring_id >= 0) {
+        reap(0);
+        unmapRing();
+    }
+    if (file_id >= 0) {
+        if (sync) {
+            fdatasync(file_id);
+        }
+        ::close(file_id);
+        file_id = -1;
+    }
+}
+
+void MmapSink::open(const std::string& path, uint64_t max_size)
+{
+    file_id = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (file_id < 0) {
+        throw sinkError("Unable to open", path);
+    }
+    if (ftruncate(file_id, max_size) < 0) {
+        throw sinkError("Unable to size", path);
+    }
+    data = (uint8_t*)mmap(nullptr, max_size, PROT_WRITE, MAP_SHARED, file_id, 0);
+    if (data == MAP_FAILED) {
+        data = nullptr;
+        throw sinkError("Unable to map", path);
+    }
+    length = max_size;
+}
+
+void MmapSink::write(void* buf, size_t nbytes, uint64_t offset)
+{
+    memcpy(data + offset, buf, nbytes);
+}
+
+void MmapSink::close(bool sync)
+{
+    if (data) {
+        if (sync) {
+            msync(data, length, MS_SYNC);
+        }
+        munmap(data, length);
+        data = nullptr;
+    }
+    if (file_id >= 0) {
+        ::close(file_id);
+        file_id = -1;
+    }
+}
@@ -0,0 +1,179 @@
+//
+// Copyright 2021-2022 Ettus Research, a National Instruments Brand
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+//
+
+#ifndef CAPTURESINKS_H
+#define CAPTURESINKS_H
+
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+/**
+ * @brief A way of writing captured samples to a file, as benchmarked by
+ *  Arch_benchmarks. Errors are thrown as std::runtime_error.
+ */
+class CaptureSink
+{
+public:
+    virtual ~CaptureSink() {}
+    virtual std::string name() const = 0;
+    /**
+     * @brief Creates or truncates path. max_size is the largest offset + nbytes
+     *  write() will be called with.
+     */
+    virtual void open(const std::string& path, uint64_t max_size) = 0;
+    /**
+     * @brief Writes nbytes at offset. buf is only reused after buffers() more calls.
+     */
+    virtual void write(void* buf, size_t nbytes, uint64_t offset) = 0;
+    /**
+     * @brief Finishes outstanding writes and closes the file.
+     *
+     * @param sync also flush the data to the device
+     */
+    virtual void close(bool sync) = 0;
+    /**
+     * @brief Number of buffers the caller rotates through, writes may still be in
+     *  flight for the previous buffers()-1 calls.
+     */
+    virtual size_t buffers() const
+    {
+        return 1;
+    }
+    /**
+     * @brief Required alignment of buffers, sizes and offsets.
+     */
+    virtual size_t alignment() const
+    {
+        return 1;
+    }
+
+    /**
+     * @brief Creates the sink called name: ofstream, odirect, iouring or mmap.
+     *
+     * @param queue_depth writes kept in flight by the asynchronous sinks
+     */
+    static std::unique_ptr<CaptureSink> make(const std::string& name, size_t queue_depth);
+};
+
+/**
+ * @brief std::ofstream, as used by the examples that stream to file.
+ */
+class OfstreamSink : public CaptureSink
+{
+public:
+    std::string name() const override
+    {
+        return "ofstream";
+    }
+    void open(const std::string& path, uint64_t max_size) override;
+    void write(void* buf, size_t nbytes, uint64_t offset) override;
+    void close(bool sync) override;
+
+private:
+    std::ofstream outfile;
+    std::string file_path;
+    uint64_t position = 0;
+};
+
+/**
+ * @brief pwrite() on a file opened with O_DIRECT, bypassing the page cache.
+ */
+class DirectSink : public CaptureSink
+{
+public:
+    std::string name() const override
+    {
+        return "odirect";
+    }
+    void open(const std::string& path, uint64_t max_size) override;
+    void write(void* buf, size_t nbytes, uint64_t offset) override;
+    void close(bool sync) override;
+    size_t alignment() const override
+    {
+        return 4096;
+    }
+
+private:
+    int file_id = -1;
+};
+
+/**
+ * @brief io_uring writes to an O_DIRECT file with queue_depth writes in flight. Uses
+ *  the raw system calls so no liburing is needed.
+ */
+class UringSink : public CaptureSink
+{
+public:
+    UringSink(size_t queue_depth);
+    ~UringSink();
+    std::string name() const override
+    {
+        return "iouring";
+    }
+    void open(const std::string& path, uint64_t max_size) override;
+    void write(void* buf, size_t nbytes, uint64_t offset) override;
+    void close(bool sync) override;
+    size_t buffers() const override
+    {
+        return queue_depth;
+    }
+    size_t alignment() const override
+    {
+        return 4096;
+    }
+
+private:
+    /**
+     * @brief Waits for completions until at most max_in_flight writes are left.
+     */
+    void reap(size_t max_in_flight);
+    void unmapRing();
+
+    size_t queue_depth;
+    size_t in_flight = 0;
+    int file_id      = -1;
+    int ring_id      = -1;
+    // Mappings of the submission queue, completion queue and submission entries
+    void* sq_ring      = nullptr;
+    size_t sq_size     = 0;
+    void* cq_ring      = nullptr;
+    size_t cq_size     = 0;
+    void* sqes         = nullptr;
+    size_t sqes_size   = 0;
+    unsigned* sq_head  = nullptr;
+    unsigned* sq_tail  = nullptr;
+    unsigned* sq_mask  = nullptr;
+    unsigned* sq_array = nullptr;
+    unsigned* cq_head  = nullptr;
+    unsigned* cq_tail  = nullptr;
+    unsigned* cq_mask  = nullptr;
+    void* cqes         = nullptr;
+};
+
+/**
+ * @brief memcpy into a shared mapping of the whole file.
+ */
+class MmapSink : public CaptureSink
+{
+public:
+    std::string name() const override
+    {
+        return "mmap";
+    }
+    void open(const std::string& path, uint64_t max_size) override;
+    void write(void* buf, size_t nbytes, uint64_t offset) override;
+    void close(bool sync) override;
+
+private:
+    int file_id     = -1;
+    uint8_t* data   = nullptr;
+    uint64_t length = 0;
+};
+
+#endif
@@ -12,12 +12,14 @@ continuously. The multithreaded version
 currently has each USRP in its own thread. This version uses one RX streamer per device.
 *******************************************************************************************************************/
 
+#include "LoopbackCorrelator.hpp"
 #include "RefArch.hpp"
 #include <uhd/rfnoc/mb_controller.hpp>
 #include <uhd/utils/safe_main.hpp>
 #include <uhd/utils/thread.hpp>
 #include <stdio.h>
 #include <boost/circular_buffer.hpp>
+#include <cmath>
 #include <csignal>
 #include <fstream>
 #include <memory>
@@ -32,6 +34,11 @@ public:
     size_t run_number;
     double rep_delay; // replay block time
     size_t nruns; // Number of runs to perform
+    // TX to RX delay and gain of every run, measured while streaming
+    bool loopback_delay;
+    LoopbackSettings loopback_settings;
+    std::unique_ptr<LoopbackCorrelator> correlator;
+    std::vector<std::vector<LoopbackPath>> loopback_matrix;
 
     std::string zeropad_to_length(int length, std::string s)
     {
@@ -45,7 +52,89 @@ public:
         RA_desc.add_options()("repeat_delay",
             po::value<double>(&rep_delay)->default_value(0),
             "delay between repeats (seconds)")(
-            "nruns", po::value<size_t>(&nruns)->default_value(1), "number of repeats");
+            "nruns", po::value<size_t>(&nruns)->default_value(1), "number of repeats")(
+            "loopback-delay",
+            po::value<bool>(&loopback_delay)->default_value(false),
+            "correlate every RX channel against file for the TX to RX delay and gain")(
+            "loopback-fft-size",
+            po::value<size_t>(&loopback_settings.fft_size)->default_value(65536),
+            "correlation size, delays up to half of it are found")(
+            "loopback-threads",
+            po::value<size_t>(&loopback_settings.threads)->default_value(0),
+            "correlation threads, 0 for one per CPU");
+    }
+
+    void startLoopback()
+    {
+        if (not loopback_delay) {
+            return;
+        }
+        if (RA_tx_rate != RA_rx_rate) {
+            throw std::runtime_error("loopback-delay requires equal tx-rate and rx-rate");
+        }
+        correlator.reset(new LoopbackCorrelator(
+            loadWaveform(RA_file, loopback_settings.fft_size / 2),
+            RA_rx_stream_vector.size(),
+            loopback_settings));
+    }
+
+    void beginLoopback()
+    {
+        if (correlator) {
+            correlator->begin();
+        }
+    }
+
+    void endLoopback()
+    {
+        if (correlator) {
+            loopback_matrix.push_back(correlator->end());
+        }
+    }
+
+    // Prints the TX x RX delay and gain matrices of the run and appends them to
+    // <folder_name>_loopback.csv in the first rx-file-location
+    void reportLoopback()
+    {
+        if (not correlator or loopback_matrix.empty()) {
+            return;
+        }
+        const std::string path =
+            RA_rx_file_location.front() + folder_name + "_loopback.csv";
+        const bool header = run_number == 0;
+        std::ofstream csv(path, header ? std::ofstream::trunc : std::ofstream::app);
+        if (header) {
+            csv << "run,tx,rx,delay_samples,delay_ns,gain_db,phase_deg,coherence\n";
+        }
+        std::cout << boost::format("Run %d TX to RX delay (ns), up to %d samples")
+                         % run_number % correlator->maxDelay()
+                  << std::endl;
+        for (size_t tx = 0; tx < loopback_matrix.size(); tx++) {
+            std::cout << boost::format("TX %2d") % tx;
+            for (size_t rx = 0; rx < loopback_matrix[tx].size(); rx++) {
+                const LoopbackPath& path = loopback_matrix[tx][rx];
+                const double delay_ns    = path.delay_samples / RA_rx_rate * 1e9;
+                std::cout << (path.valid ? str(boost::format(" %9.1f") % delay_ns)
+                                         : std::string(" ---------"));
+                if (path.valid) {
+                    csv << run_number << ',' << tx << ',' << rx << ','
+                        << path.delay_samples << ',' << delay_ns << ',' << path.gain_db
+                        << ',' << path.phase_deg << ',' << path.coherence << '\n';
+                }
+            }
+            std::cout << std::endl;
+        }
+        std::cout << boost::format("Run %d TX to RX gain (dB)") % run_number << std::endl;
+        for (size_t tx = 0; tx < loopback_matrix.size(); tx++) {
+            std::cout << boost::format("TX %2d") % tx;
+            for (const auto& path : loopback_matrix[tx]) {
+                std::cout << (path.valid ? str(boost::format(" %9.2f") % path.gain_db)
+                                         : std::string(" ---------"));
+            }
+            std::cout << std::endl;
+        }
+        std::cout << "Loopback results written to " << path << std::endl;
+        loopback_matrix.clear();
     }
 
     void localTime()
@@ -62,8 +151,21 @@ public:
         // clang-format on
     }
 
-    void recv(
-        int rx_channel_nums, int threadnum, uhd::rx_streamer::sptr rx_streamer, bool bw_summary, bool stats) override
+    // recv() below handles std::complex<short> only
+    bool recvSupportsFormat(const std::string& format) const override
+    {
+        return format == "sc16";
+    }
+    // recv() below stops on any cancel, without the graceful stop of receiveSamples()
+    bool recvSupportsGracefulStop() const override
+    {
+        return false;
+    }
+
+    void recv(int rx_channel_nums,
+        int threadnum,
+        uhd::rx_streamer::sptr rx_streamer,
+        bool stats) override
     {
         uhd::set_thread_priority_safe(0.9F);
         size_t num_total_samps = 0;
@@ -80,12 +182,11 @@ public:
         // Correctly label output files based on run method, single TX->single RX or
         // single TX
         // -> All RX
-        int rx_identifier = threadnum;
         std::vector<std::shared_ptr<std::ofstream>> outfiles;
         for (size_t i = 0; i < buffs.size(); i++) {
-            // rx_identifier * 2 + i in order to get correct channel number in filename
+            // rxChannel() numbers the files by channel
             const std::string this_filename = generateRxFilename(RA_rx_file,
-                rx_identifier * 2 + i,
+                rxChannel(threadnum, i),
                 RA_singleTX,
                 0,
                 RA_tx_freq,
@@ -112,15 +213,16 @@ public:
         const auto start_time = std::chrono::steady_clock::now();
         const auto stop_time =
         start_time + std::chrono::milliseconds(int64_t(1000 * RA_time_requested+1000*RA_delay_start_time));
-        // Track time and samps between updating the BW summary
-        auto last_update                     = start_time;
-        unsigned long long last_update_samps = 0;
+        MetricsSlot& rx_metrics = metricsSlot("rx", threadnum);
         int loop_num = 0;
-        while (not RA_stop_signal_called
+        while (not RA_cancel.cancelled()
            and (RA_nsamps >= num_total_samps or RA_nsamps == 0)
            and (RA_time_requested == 0.0 or std::chrono::steady_clock::now() <= stop_time)) {
-            const auto now = std::chrono::steady_clock::now();
             size_t num_rx_samps = rx_streamer->recv(buff_ptrs, RA_spb, md, RA_rx_timeout);
+            rx_metrics.recordRecv(md,
+                num_rx_samps,
+                rx_streamer->get_num_channels(),
+                sizeof(std::complex<short>));
             loop_num += 1;
             if (md.error_code == uhd::rx_metadata_t::ERROR_CODE_TIMEOUT) {
                 std::cout << boost::format("Timeout while streaming") << std::endl;
@@ -156,16 +258,16 @@ public:
                 outfiles[i]->write((const char*)buff_ptrs[i],
                     num_rx_samps * sizeof(std::complex<short>));
             }
-            if(bw_summary){
-                last_update_samps += num_rx_samps;
-                const auto time_since_last_update = now - last_update;
-                if (time_since_last_update > std::chrono::seconds(1)) {
-                    const double time_since_last_update_s =
-                        std::chrono::duration<double>(time_since_last_update).count();
-                    const double rate = double(last_update_samps) / time_since_last_update_s;
-                    std::cout << "\t" << (rate / 1e6) << " Msps" << std::endl;
-                    last_update_samps = 0;
-                    last_update       = now;
+            if (correlator) {
+                // Sample periods since the start time, when the replay started
+                const int64_t tick = std::llround(
+                    double(md.time_spec.get_full_secs() - RA_start_time.get_full_secs())
+                        * RA_rx_rate
+                    + (md.time_spec.get_frac_secs() - RA_start_time.get_frac_secs())
+                          * RA_rx_rate);
+                for (size_t i = 0; i < buffs.size(); i++) {
+                    correlator->push(
+                        rxChannel(threadnum, i), tick, buff_ptrs[i], num_rx_samps);
                 }
             }
         }
@@ -215,6 +317,11 @@ int UHD_SAFE_MAIN(int argc, char* argv[])
     usrpSystem.buildDDCDUC();
     // Setup Replay Blocks
     usrpSystem.buildReplay();
+    // Every iteration transmits from one Replay port, without any there is nothing
+    // to run
+    if (usrpSystem.numReplayPorts() == 0) {
+        throw std::runtime_error("No Replay blocks to iterate over");
+    }
     // Setup LO distribution
     usrpSystem.setLOsfromConfig();
     // Set Radio Block Settings
@@ -254,26 +361,30 @@ int UHD_SAFE_MAIN(int argc, char* argv[])
     // Begin TX and RX
     // INFO: Comment what each initialization does what type of data is stored in each.
     usrpSystem.localTime();
+    usrpSystem.startLoopback();
     std::signal(SIGINT, usrpSystem.sigIntHandler);
     int saved_user_delay_time = usrpSystem.RA_delay_start_time;
     for (usrpSystem.run_number = 0; usrpSystem.run_number < usrpSystem.nruns;
          usrpSystem.run_number++) {
         for (usrpSystem.RA_singleTX = 0;
-             usrpSystem.RA_singleTX < usrpSystem.RA_replay_ctrls.size();
+             usrpSystem.RA_singleTX < usrpSystem.numReplayPorts();
              usrpSystem.RA_singleTX++) {
             // Calculate starttime for threads
             usrpSystem.updateDelayedStartTime();
             usrpSystem.updateDelayedStartTime();
+            usrpSystem.beginLoopback();
             usrpSystem.transmitFromReplay();
             usrpSystem.spawnReceiveThreads();
             // Join Threads
             usrpSystem.joinAllThreads();
+            usrpSystem.endLoopback();
             // Next iteration use saved_user_delay_time
             usrpSystem.RA_delay_start_time = saved_user_delay_time;
-            if(usrpSystem.RA_stop_signal_called){
+            if(usrpSystem.RA_cancel.cancelled()){
                 break;
             }
         }
+        usrpSystem.reportLoopback();
         // Next iteration use RA_rep_delay
         usrpSystem.RA_delay_start_time = usrpSystem.rep_delay;
     }
@@ -10,6 +10,11 @@ single TX -> ALL RX.
 If the user sets the number of samples to zero, this function will stream
 continuously. The multithreaded version
 currently has each USRP in its own thread. This version uses one RX streamer per device.
+
+Sweeps from sweep_start to sweep_stop in sweep_step increments. With timed_sweep the
+streamers are started once and every step is a fixed window on the device timeline:
+sweep_settle seconds for the retune followed by nsamps samples of capture. Retunes are
+queued as timed commands by a scheduler thread while the previous step is captured.
 *******************************************************************************************************************/
 
 #include "RefArch.hpp"
@@ -18,9 +23,14 @@ currently has each USRP in its own thread. This version uses one RX streamer per
 #include <uhd/utils/thread.hpp>
 #include <stdio.h>
 #include <boost/circular_buffer.hpp>
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <condition_variable>
 #include <csignal>
 #include <fstream>
 #include <memory>
+#include <mutex>
 #include <thread>
 
 class Arch_multifreq_loopback : public RefArch
@@ -30,6 +40,109 @@ public:
     using RefArch::tuneRX;
     using RefArch::tuneTX;
     std::string folder_name;
+    double sweep_start;
+    double sweep_stop;
+    double sweep_step;
+    double sweep_settle; // retune time at the start of each step (seconds)
+    double sweep_lead; // how early the next retune is queued (seconds), < 0 for auto
+    bool timed_sweep;
+    bool sweep_prewarm;
+    std::vector<double> sweep_freqs;
+    std::atomic<bool> sweep_done{false};
+    // Wakes the sweep scheduler when the RX threads are done
+    std::mutex sweep_mutex;
+    std::condition_variable sweep_cv;
+
+    // Easy way of adding custom values to configuration file.
+    void addAdditionalOptions() override
+    {
+        namespace po = boost::program_options;
+        // clang-format off
+        RA_desc.add_options()
+        ("sweep_start",
+            po::value<double>(&sweep_start)->default_value(1000e6),
+            "first frequency of the sweep in Hz")
+        ("sweep_stop",
+            po::value<double>(&sweep_stop)->default_value(5500e6),
+            "last frequency of the sweep in Hz")
+        ("sweep_step",
+            po::value<double>(&sweep_step)->default_value(100e6),
+            "frequency step of the sweep in Hz")
+        ("timed_sweep",
+            po::value<bool>(&timed_sweep)->default_value(true),
+            "keep streaming across steps and retune with timed commands")
+        ("sweep_settle",
+            po::value<double>(&sweep_settle)->default_value(0.1),
+            "time reserved for retuning before each step's capture (seconds)")
+        ("sweep_lead",
+            po::value<double>(&sweep_lead)->default_value(-1),
+            "how long before the end of a capture the next timed retune is queued "
+            "(seconds), negative for half a capture, or 0 with lo sharing")
+        ("sweep_prewarm",
+            po::value<bool>(&sweep_prewarm)->default_value(false),
+            "tune through the sweep once before streaming to fill the tune cache")
+        ;
+        // clang-format on
+    }
+
+    void buildSweep()
+    {
+        if (sweep_step <= 0 or sweep_stop < sweep_start) {
+            throw std::runtime_error("Invalid sweep configuration");
+        }
+        const size_t num_steps =
+            size_t(std::floor((sweep_stop - sweep_start) / sweep_step + 1e-9)) + 1;
+        sweep_freqs.clear();
+        for (size_t step = 0; step < num_steps; step++) {
+            sweep_freqs.push_back(sweep_start + step * sweep_step);
+        }
+        std::cout << "Sweeping " << num_steps << " steps from " << (sweep_start / 1e6)
+                  << " MHz to " << (sweep_freqs.back() / 1e6) << " MHz" << std::endl;
+        if (sweep_prewarm) {
+            prewarmTuneCache(sweep_freqs);
+            for (size_t step = 0; step < num_steps; step++) {
+                const double freq = sweep_freqs[step];
+                std::cout << "Step " << step << ": " << (freq / 1e6)
+                          << " MHz, coerced RX " << (getCoercedRXFrequency(0, freq) / 1e6)
+                          << " MHz, coerced TX " << (getCoercedTXFrequency(0, freq) / 1e6)
+                          << " MHz" << std::endl;
+            }
+        }
+    }
+
+    // Step timeline in ticks of RA_rx_rate, relative to RA_start_time:
+    // [ settle | nsamps of capture ][ settle | nsamps of capture ] ...
+    long long settleTicks()
+    {
+        return std::llround(sweep_settle * RA_rx_rate);
+    }
+    long long stepTicks()
+    {
+        return settleTicks() + (long long)RA_nsamps;
+    }
+    uhd::time_spec_t stepTuneTime(size_t step)
+    {
+        return RA_start_time
+               + uhd::time_spec_t::from_ticks(step * stepTicks(), RA_rx_rate);
+    }
+    uhd::time_spec_t stepCaptureEnd(size_t step)
+    {
+        return stepTuneTime(step + 1);
+    }
+    // The configured sweep_lead, or by default half a capture, so the next retune is
+    // queued while the previous step is still captured. The shared LOs of lo = source,
+    // distributor or terminal are set through MPM when the call is made, not at the
+    // command time, so those retune only once the capture has ended.
+    double sweepLead()
+    {
+        if (sweep_lead >= 0) {
+            return sweep_lead;
+        }
+        const bool mpm_los = std::any_of(RA_lo.begin(), RA_lo.end(), [](const auto& lo) {
+            return lo == "source" or lo == "distributor" or lo == "terminal";
+        });
+        return mpm_los ? 0.0 : 0.5 * RA_nsamps / RA_rx_rate;
+    }
 
     std::string zeropad_to_length(int length, std::string s)
     {
@@ -61,9 +174,26 @@ public:
         // clang-format on
     }
 
-    void recv(
-        int rx_channel_nums, int threadnum, uhd::rx_streamer::sptr rx_streamer, bool bw_summary, bool stats) override
+    // recv() below handles std::complex<short> only
+    bool recvSupportsFormat(const std::string& format) const override
+    {
+        return format == "sc16";
+    }
+    // recv() below stops on any cancel, without the graceful stop of receiveSamples()
+    bool recvSupportsGracefulStop() const override
+    {
+        return false;
+    }
+
+    void recv(int rx_channel_nums,
+        int threadnum,
+        uhd::rx_streamer::sptr rx_streamer,
+        bool stats) override
     {
+        if (timed_sweep) {
+            recvSweep(rx_channel_nums, threadnum, rx_streamer, stats);
+            return;
+        }
         uhd::set_thread_priority_safe(0.9F);
         size_t num_total_samps = 0;
         std::unique_ptr<char[]> buf(new char[RA_spb]);
@@ -79,12 +209,11 @@ public:
         // Correctly label output files based on run method, single TX->single RX or
         // single TX
         // -> All RX
-        int rx_identifier = threadnum;
         std::vector<std::shared_ptr<std::ofstream>> outfiles;
         for (size_t i = 0; i < buffs.size(); i++) {
-            // rx_identifier * 2 + i in order to get correct channel number in filename
+            // rxChannel() numbers the files by channel
             const std::string this_filename = generateRxFilename(RA_rx_file,
-                rx_identifier * 2 + i,
+                rxChannel(threadnum, i),
                 RA_singleTX,
                 0,
                 RA_tx_freq,
@@ -111,15 +240,16 @@ public:
         const auto start_time = std::chrono::steady_clock::now();
         const auto stop_time =
         start_time + std::chrono::milliseconds(int64_t(1000 * RA_time_requested+1000*RA_delay_start_time));
-        // Track time and samps between updating the BW summary
-        auto last_update                     = start_time;
-        unsigned long long last_update_samps = 0;
+        MetricsSlot& rx_metrics = metricsSlot("rx", threadnum);
         int loop_num = 0;
-        while (not RA_stop_signal_called
+        while (not RA_cancel.cancelled()
            and (RA_nsamps >= num_total_samps or RA_nsamps == 0)
            and (RA_time_requested == 0.0 or std::chrono::steady_clock::now() <= stop_time)) {
-            const auto now = std::chrono::steady_clock::now();
             size_t num_rx_samps = rx_streamer->recv(buff_ptrs, RA_spb, md, RA_rx_timeout);
+            rx_metrics.recordRecv(md,
+                num_rx_samps,
+                rx_streamer->get_num_channels(),
+                sizeof(std::complex<short>));
             loop_num += 1;
             if (md.error_code == uhd::rx_metadata_t::ERROR_CODE_TIMEOUT) {
                 std::cout << boost::format("Timeout while streaming") << std::endl;
@@ -155,18 +285,6 @@ public:
                 outfiles[i]->write((const char*)buff_ptrs[i],
                     num_rx_samps * sizeof(std::complex<short>));
             }
-            if(bw_summary){
-                last_update_samps += num_rx_samps;
-                const auto time_since_last_update = now - last_update;
-                if (time_since_last_update > std::chrono::seconds(1)) {
-                    const double time_since_last_update_s =
-                        std::chrono::duration<double>(time_since_last_update).count();
-                    const double rate = double(last_update_samps) / time_since_last_update_s;
-                    std::cout << "\t" << (rate / 1e6) << " Msps" << std::endl;
-                    last_update_samps = 0;
-                    last_update       = now;
-                }
-            }
         }
         const auto actual_stop_time = std::chrono::steady_clock::now();
 
@@ -195,6 +313,248 @@ public:
 
         }
     }
+
+    /**
+     * @brief Receives the whole sweep with a single continuous stream. Every buffer is
+     *          split on the step boundaries of the device timeline, samples inside a
+     *          settle window are dropped and the rest go to the files of their step.
+     */
+    void recvSweep(int rx_channel_nums,
+        int threadnum,
+        uhd::rx_streamer::sptr rx_streamer,
+        bool stats)
+    {
+        uhd::set_thread_priority_safe(0.9F);
+        size_t num_total_samps = 0;
+        // Prepare buffers for received samples and metadata
+        uhd::rx_metadata_t md;
+        std::vector<boost::circular_buffer<std::complex<short>>> buffs(
+            rx_channel_nums, boost::circular_buffer<std::complex<short>>(RA_spb + 1));
+        // create a vector of pointers to point to each of the channel buffers
+        std::vector<std::complex<short>*> buff_ptrs;
+        for (size_t i = 0; i < buffs.size(); i++) {
+            buff_ptrs.push_back(&buffs[i].front());
+        }
+        std::vector<std::unique_ptr<char[]>> file_bufs;
+        for (size_t i = 0; i < buffs.size(); i++) {
+            file_bufs.emplace_back(new char[RA_spb]);
+        }
+        std::vector<std::shared_ptr<std::ofstream>> outfiles;
+        size_t file_step = sweep_freqs.size();
+        auto openStepFiles = [&](size_t step) {
+            for (auto& outfile : outfiles) {
+                outfile->close();
+            }
+            outfiles.clear();
+            for (size_t i = 0; i < buffs.size(); i++) {
+                // rxChannel() numbers the files by channel
+                const std::string this_filename = generateRxFilename(RA_rx_file,
+                    rxChannel(threadnum, i),
+                    RA_singleTX,
+                    0,
+                    sweep_freqs[step],
+                    folder_name,
+                    RA_rx_file_channels,
+                    RA_rx_file_location);
+                auto outstream = std::make_shared<std::ofstream>();
+                outstream->rdbuf()->pubsetbuf(file_bufs[i].get(), RA_spb); // Important
+                outstream->open(this_filename.c_str(), std::ofstream::binary);
+                outfiles.push_back(outstream);
+            }
+            file_step = step;
+        };
+        bool overflow_message = true;
+        // One continuous stream for the whole sweep
+        uhd::stream_cmd_t stream_cmd(uhd::stream_cmd_t::STREAM_MODE_START_CONTINUOUS);
+        stream_cmd.stream_now = false;
+        stream_cmd.time_spec  = RA_start_time;
+        rx_streamer->issue_stream_cmd(stream_cmd);
+
+        const long long start_tick  = RA_start_time.to_ticks(RA_rx_rate);
+        const long long settle      = settleTicks();
+        const long long step_length = stepTicks();
+        const auto start_time       = std::chrono::steady_clock::now();
+        MetricsSlot& rx_metrics     = metricsSlot("rx", threadnum);
+        int loop_num  = 0;
+        bool finished = false;
+        while (not RA_cancel.cancelled() and not finished) {
+            size_t num_rx_samps = rx_streamer->recv(buff_ptrs, RA_spb, md, RA_rx_timeout);
+            rx_metrics.recordRecv(md,
+                num_rx_samps,
+                rx_streamer->get_num_channels(),
+                sizeof(std::complex<short>));
+            loop_num += 1;
+            if (md.error_code == uhd::rx_metadata_t::ERROR_CODE_TIMEOUT) {
+                std::cout << boost::format("Timeout while streaming") << std::endl;
+                break;
+            }
+            if (md.error_code == uhd::rx_metadata_t::ERROR_CODE_OVERFLOW) {
+                // Sample times come from the metadata, so the steps stay labeled
+                // correctly across an overflow. Only the dropped samples are missing.
+                if (overflow_message) {
+                    overflow_message    = false;
+                    std::string tempstr = "\n thread:" + std::to_string(threadnum) + '\n'
+                                          + "loop_num:" + std::to_string(loop_num) + '\n';
+                    std::cout << tempstr;
+                }
+                continue;
+            }
+            if (md.error_code != uhd::rx_metadata_t::ERROR_CODE_NONE) {
+                throw std::runtime_error(
+                    str(boost::format("Receiver error %s") % md.strerror()));
+            }
+            if (not md.has_time_spec) {
+                throw std::runtime_error("Timed sweep requires timestamped samples");
+            }
+            num_total_samps += num_rx_samps * rx_streamer->get_num_channels();
+            const long long buff_tick = md.time_spec.to_ticks(RA_rx_rate) - start_tick;
+            size_t pos = 0;
+            while (pos < num_rx_samps) {
+                const long long tick = buff_tick + (long long)pos;
+                if (tick < 0) {
+                    pos = std::min(num_rx_samps, pos + size_t(-tick));
+                    continue;
+                }
+                const size_t step      = size_t(tick / step_length);
+                const long long offset = tick % step_length;
+                if (step >= sweep_freqs.size()) {
+                    finished = true;
+                    break;
+                }
+                if (offset < settle) {
+                    // Inside the retune window, drop these samples.
+                    pos = std::min(num_rx_samps, pos + size_t(settle - offset));
+                    continue;
+                }
+                const size_t count =
+                    std::min(num_rx_samps - pos, size_t(step_length - offset));
+                if (step != file_step) {
+                    openStepFiles(step);
+                }
+                for (size_t i = 0; i < outfiles.size(); i++) {
+                    outfiles[i]->write((const char*)(buff_ptrs[i] + pos),
+                        count * sizeof(std::complex<short>));
+                }
+                pos += count;
+            }
+        }
+        const auto actual_stop_time = std::chrono::steady_clock::now();
+
+        // Shut down receiver
+        stream_cmd.stream_mode = uhd::stream_cmd_t::STREAM_MODE_STOP_CONTINUOUS;
+        stream_cmd.stream_now  = true;
+        rx_streamer->issue_stream_cmd(stream_cmd);
+
+        for (auto& outfile : outfiles) {
+            outfile->close();
+        }
+        if (stats) {
+            const double actual_duration_seconds =
+                std::chrono::duration<float>(actual_stop_time - start_time).count();
+            std::cout << std::endl
+                      << boost::format(
+                             "Thread: %d Received %d samples for %d steps in %f seconds")
+                             % threadnum % num_total_samps % sweep_freqs.size()
+                             % actual_duration_seconds
+                      << std::endl;
+        }
+    }
+
+    /**
+     * @brief Queues the retune of every step as timed commands on all radios. A step
+     *          is queued sweepLead() seconds before the capture of the previous step
+     *          ends, so only one retune is outstanding on each radio's command queue.
+     *
+     * @details The device time is read once, every queue time is slept for on the host
+     *          clock. Front-end settings that are not timed by the device (such as the
+     *          shared N32x LOs, which are programmed through MPM) take effect when the
+     *          call is made, so sweepLead() is 0 for those and sweep_settle has to cover
+     *          the reported retune duration.
+     */
+    void scheduleSweep()
+    {
+        const double lead                 = sweepLead();
+        const uhd::time_spec_t device_now = getTimeNow();
+        const auto host_now               = std::chrono::steady_clock::now();
+        for (size_t step = 1; step < sweep_freqs.size(); step++) {
+            const uhd::time_spec_t queue_time =
+                stepCaptureEnd(step - 1) - uhd::time_spec_t(lead);
+            using host_duration = std::chrono::steady_clock::duration;
+            const std::chrono::duration<double> wait_time(
+                (queue_time - device_now).get_real_secs());
+            const auto host_queue_time =
+                host_now + std::chrono::duration_cast<host_duration>(wait_time);
+            {
+                std::unique_lock<std::mutex> lock(sweep_mutex);
+                if (sweep_cv.wait_until(
+                        lock, host_queue_time, [this] { return sweep_done.load(); })) {
+                    return;
+                }
+            }
+            if (RA_cancel.cancelled()) {
+                return;
+            }
+            const uhd::time_spec_t cmd_time = stepTuneTime(step);
+            // The mock has no radios to retune
+            const size_t num_channels = RA_mock ? 0 : RA_topology.numChannels();
+            for (size_t channel = 0; channel < num_channels; channel++) {
+                const TopologyChannel& path = RA_topology.channel(channel);
+                RA_radio_ctrls[path.radio]->set_command_time(cmd_time, path.radio_port);
+                tuneRXRadio(channel, sweep_freqs[step]);
+                tuneTXRadio(channel, sweep_freqs[step]);
+                RA_radio_ctrls[path.radio]->clear_command_time(path.radio_port);
+            }
+            const uhd::time_spec_t done_time = getTimeNow();
+            const uhd::time_spec_t capture_start =
+                cmd_time + uhd::time_spec_t(sweep_settle);
+            std::cout << "Step " << step << ": " << (sweep_freqs[step] / 1e6)
+                      << " MHz queued for " << cmd_time.get_real_secs() << " s"
+                      << std::endl;
+            if (done_time > capture_start) {
+                UHD_LOG_WARNING("Sweep",
+                    "Retune of step " << step << " finished "
+                                      << (done_time - capture_start).get_real_secs()
+                                      << " s after its capture started. Increase "
+                                         "sweep_settle.");
+            }
+        }
+    }
+
+    /**
+     * @brief Runs the whole sweep with one stream start, one replay start and one set
+     *          of RX threads instead of a full start/stop cycle per frequency.
+     */
+    void runTimedSweep()
+    {
+        if (RA_nsamps == 0) {
+            throw std::runtime_error("Timed sweep requires nsamps samples per step");
+        }
+        tuneRX(sweep_freqs[0]);
+        tuneTX(sweep_freqs[0]);
+        RA_tx_freq = sweep_freqs[0];
+        updateDelayedStartTime();
+        // Replay continuously for the whole sweep, nsamps is the capture length per step
+        const size_t step_nsamps = RA_nsamps;
+        RA_nsamps                = 0;
+        transmitFromReplay();
+        RA_nsamps  = step_nsamps;
+        sweep_done = false;
+        std::thread scheduler([this]() { scheduleSweep(); });
+        const auto sweep_begin = std::chrono::steady_clock::now();
+        spawnReceiveThreads();
+        joinAllThreads();
+        {
+            std::lock_guard<std::mutex> lock(sweep_mutex);
+            sweep_done = true;
+        }
+        sweep_cv.notify_all();
+        scheduler.join();
+        std::cout << "Sweep of " << sweep_freqs.size() << " steps took "
+                  << std::chrono::duration<double>(
+                         std::chrono::steady_clock::now() - sweep_begin)
+                         .count()
+                  << " seconds" << std::endl;
+    }
 };
 /***********************************************************************
  * Main function
@@ -253,22 +613,27 @@ int UHD_SAFE_MAIN(int argc, char* argv[])
     // Begin TX and RX
     // INFO: Comment what each initialization does what type of data is stored in each.
     usrpSystem.localTime();
-    
-    
-    std::signal(SIGINT, usrpSystem.sigIntHandler);
-    double freq = 1000000000;
-    while (freq <= 5500000000 and not usrpSystem.RA_stop_signal_called) {
+    // Build the list of sweep frequencies
+    usrpSystem.buildSweep();
 
-        usrpSystem.tuneRX(freq);
-        usrpSystem.tuneTX(freq);
-        usrpSystem.updateDelayedStartTime();
-        usrpSystem.transmitFromReplay();
-        usrpSystem.spawnReceiveThreads();
-        // Join Threads
-        usrpSystem.joinAllThreads();
-        freq += 100000000;
+    std::signal(SIGINT, usrpSystem.sigIntHandler);
+    if (usrpSystem.timed_sweep) {
+        usrpSystem.runTimedSweep();
+    } else {
+        for (double freq : usrpSystem.sweep_freqs) {
+            if (usrpSystem.RA_cancel.cancelled()) {
+                break;
+            }
+            usrpSystem.tuneRX(freq);
+            usrpSystem.tuneTX(freq);
+            usrpSystem.updateDelayedStartTime();
+            usrpSystem.transmitFromReplay();
+            usrpSystem.spawnReceiveThreads();
+            // Join Threads
+            usrpSystem.joinAllThreads();
+        }
     }
-    
+
     std::signal(SIGINT, SIG_DFL);
     std::cout << "Run complete." << std::endl;
     usrpSystem.stopReplay();
@@ -9,17 +9,23 @@ This examples uses pipes to interface with another application.
 The example opens a number of pipes equal to the number of USRPs then
 reads a u16 from each file and returns that number of samples.
 
+With PipeTransport = shm the pipes are replaced by shared memory rings
+(see lib/SharedRing.h). The samples are received directly into the rings
+and the other application reads them in place.
+
 single TX -> # of RX.
 ************************************************************/
 
 #include "FileSystem.hpp"
 #include "RefArch.hpp"
+#include "SampleConvert.hpp"
 #include <uhd/rfnoc/mb_controller.hpp>
 #include <uhd/utils/safe_main.hpp>
 #include <uhd/utils/thread.hpp>
 #include <fcntl.h>
 #include <stdio.h>
 #include <boost/circular_buffer.hpp>
+#include <algorithm>
 #include <chrono>
 #include <csignal>
 #include <fstream>
@@ -35,7 +41,18 @@ public:
     std::string pipe_folder_location;
     int pipe_file_buffer_size;
     std::vector<std::shared_ptr<PipeFile>> outfiles;
+    std::shared_ptr<PipeEventLoop> pipe_events;
     int32_t maximum_number_of_samples = 0;
+    std::string pipe_transport;
+    uint64_t shm_ring_size;
+    std::string pipe_write_mode;
+    bool pipe_streaming;
+    size_t pipe_stream_depth;
+    std::vector<std::shared_ptr<SharedRing>> rings;
+    std::vector<int32_t> requested_samples;
+    std::string pipe_format;
+    float pipe_scale;
+    SampleConverter pipe_converter;
 
     /**
      * @brief Used to add options to the configuration file.
@@ -48,7 +65,30 @@ public:
             po::value<std::string>(&pipe_folder_location)->required(),
             "Absolute location of PipeFile")("PipeFileBufferSize",
             po::value<int>(&pipe_file_buffer_size)->required(),
-            "Number of samples to read or write to file");
+            "Number of samples to read or write to file")("PipeTransport",
+            po::value<std::string>(&pipe_transport)->default_value("fifo"),
+            "fifo for named pipes, shm for shared memory rings")("ShmRingSize",
+            po::value<uint64_t>(&shm_ring_size)->default_value(67108864),
+            "Size of each shared memory ring in bytes")("PipeWriteMode",
+            po::value<std::string>(&pipe_write_mode)->default_value("write"),
+            "write copies samples into the pipe, vmsplice moves the pages without a "
+            "copy")("PipeStreaming",
+            po::value<bool>(&pipe_streaming)->default_value(false),
+            "forward every recv chunk to the pipe instead of capturing the whole "
+            "request first")("PipeStreamDepth",
+            po::value<size_t>(&pipe_stream_depth)->default_value(16),
+            "number of chunks buffered between recv and the pipe when streaming")(
+            "PipeFormat",
+            po::value<std::string>(&pipe_format)->default_value("sc16"),
+            "sample format handed to the consumer: sc16, or fc32/fc16 converted on the "
+            "host")("PipeScale",
+            po::value<float>(&pipe_scale)->default_value(1.0f / 32768),
+            "factor applied when converting to fc32/fc16, 1/32768 gives +/-1.0");
+    }
+
+    bool useSharedMemory()
+    {
+        return pipe_transport == "shm";
     }
 
     /**
@@ -59,13 +99,13 @@ public:
      */
     void transmitFromReplay() override
     {
-        if (maximum_number_of_samples <= 0)
+        if (maximum_number_of_samples <= 0 or RA_replay_ctrls.empty())
             return;
         std::cout << "Replaying data (Press Ctrl+C to stop)..." << std::endl;
         uhd::stream_cmd_t stream_cmd(uhd::stream_cmd_t::STREAM_MODE_NUM_SAMPS_AND_MORE);
         if (RA_TX_All_Chan == true) {
-            for (int i = 0; i < RA_replay_ctrls.size(); i = i + 2) {
-                // Replay Block Channel (output) 0
+            for (size_t i = 0; i < RA_replay_ctrls.size(); i++) {
+                // Every output port of every Replay Block
                 std::cout << RA_replay_ctrls[i]->get_block_id()
                           << " Port: " << RA_replay_chan_vector[i] << std::endl
                           << RA_replay_ctrls[i]->get_block_id()
@@ -78,20 +118,6 @@ public:
                 stream_cmd.time_spec  = RA_start_time;
                 RA_replay_ctrls[i]->issue_stream_cmd(
                     stream_cmd, RA_replay_chan_vector[i]);
-                // Replay Block Channel (output) 1
-                std::cout << RA_replay_ctrls[i]->get_block_id()
-                          << " Port: " << RA_replay_chan_vector[i + 1] << std::endl
-                          << RA_replay_ctrls[i]->get_block_id()
-                          << " Issuing replay command for " << maximum_number_of_samples
-                          << " samps..." << std::endl;
-                RA_replay_ctrls[i]->config_play(RA_replay_buff_addr,
-                    RA_replay_buff_size,
-                    RA_replay_chan_vector[i + 1]);
-                stream_cmd.num_samps  = maximum_number_of_samples;
-                stream_cmd.stream_now = false;
-                stream_cmd.time_spec  = RA_start_time;
-                RA_replay_ctrls[i]->issue_stream_cmd(
-                    stream_cmd, RA_replay_chan_vector[i + 1]);
             }
         } else {
             // Single TX Channel Output
@@ -111,6 +137,35 @@ public:
         }
     }
 
+    // recv() below handles std::complex<short> only
+    bool recvSupportsFormat(const std::string& format) const override
+    {
+        return format == "sc16";
+    }
+    // recv() below stops on any cancel, without the graceful stop of receiveSamples()
+    bool recvSupportsGracefulStop() const override
+    {
+        return false;
+    }
+
+    /**
+     * @brief Hands a block of received sc16 samples to the spectrum monitor, if the
+     *  monitor option is set.
+     */
+    template <typename Buffers>
+    void tapMonitor(
+        int threadnum, int rx_channel_nums, const Buffers& buffs, size_t nsamps)
+    {
+        if (!RA_spectrum_monitor) {
+            return;
+        }
+        for (int i = 0; i < rx_channel_nums; i++) {
+            RA_spectrum_monitor->tap(rxChannel(threadnum, i),
+                (const std::complex<short>*)buffs[i],
+                nsamps);
+        }
+    }
+
     /**
      * @brief is a background process that reads the data from each channel. Changed
      *          so that it uses STREAM_MODE_NUM_SAMPS_AND_MORE and will end if
@@ -122,32 +177,57 @@ public:
      * @param rx_channel_nums number of rx channels
      * @param threadnum The thread number
      * @param rx_streamer sptr to the rx_streamer
-     * @param bw_summary bandwidth summary
      * @param stats additonal information about the run
      */
-    void recv(
-        int rx_channel_nums, int threadnum, uhd::rx_streamer::sptr rx_streamer, bool bw_summary, bool stats) override
+    void recv(int rx_channel_nums,
+        int threadnum,
+        uhd::rx_streamer::sptr rx_streamer,
+        bool stats) override
     {
+        if (useSharedMemory()) {
+            recvToRings(rx_channel_nums, threadnum, rx_streamer);
+            return;
+        }
+        if (pipe_streaming) {
+            recvStreaming(rx_channel_nums, threadnum, rx_streamer);
+            return;
+        }
         std::vector<std::shared_ptr<PipeFile>> thread_files;
         for (int i = 0; i < rx_channel_nums; i++) {
-            thread_files.push_back(outfiles[threadnum * rx_channel_nums + i]);
+            thread_files.push_back(outfiles[rxChannel(threadnum, i)]);
         }
         uhd::set_thread_priority_safe(0.9F);
         int total_num_samples_returned = 0;
-        // Prepare buffers for received samples and metadata
-        std::vector<boost::circular_buffer<std::complex<short>>> buffs(rx_channel_nums,
+        // Prepare buffers for received samples and metadata. With vmsplice the samples
+        // are received into page aligned buffers owned by the pipe so they can be
+        // handed to the pipe without a copy.
+        const bool splice_buffers = pipe_write_mode == "vmsplice";
+        std::vector<boost::circular_buffer<std::complex<short>>> buffs(
+            splice_buffers ? 0 : rx_channel_nums,
             boost::circular_buffer<std::complex<short>>(maximum_number_of_samples + 1));
         // create a vector of pointers to point to each of the channel buffers
         std::vector<std::complex<short>*> buff_ptrs;
         for (size_t i = 0; i < buffs.size(); i++) {
             buff_ptrs.push_back(&buffs[i].front());
         }
+        for (auto file : thread_files) {
+            file->resetWriteStats();
+        }
+        if (splice_buffers and maximum_number_of_samples > 0) {
+            for (auto file : thread_files) {
+                buff_ptrs.push_back((std::complex<short>*)file->acquireBuffer(
+                    (maximum_number_of_samples + 1) * sizeof(std::complex<short>)));
+            }
+        }
         bool overflow_message = true;
         // setup streaming
         uhd::rx_metadata_t md;
         uhd::stream_cmd_t stream_cmd(uhd::stream_cmd_t::STREAM_MODE_NUM_SAMPS_AND_MORE);
-        stream_cmd.num_samps = std::max(
-            thread_files[0]->returnedValues()[0], thread_files[1]->returnedValues()[0]);
+        int32_t requested = 0;
+        for (auto file : thread_files) {
+            requested = std::max(requested, file->returnedValues()[0]);
+        }
+        stream_cmd.num_samps = requested;
 
         stream_cmd.stream_now = false;
         stream_cmd.time_spec  = RA_start_time;
@@ -159,16 +239,21 @@ public:
             return;
         }
         rx_streamer->issue_stream_cmd(stream_cmd);
-        int loop_num = 0;
+        MetricsSlot& rx_metrics     = metricsSlot("rx", threadnum);
+        MetricsSlot& writer_metrics = metricsSlot("writer", threadnum);
+        int loop_num                = 0;
         typedef std::chrono::high_resolution_clock Clock;
         auto overTime = Clock::now();
-        while (not RA_stop_signal_called
+        while (not RA_cancel.cancelled()
                and stream_cmd.num_samps > total_num_samples_returned
                and !stream_cmd.num_samps == 0) {
             auto TempTime = Clock::now();
             printf("%d::Receieve\n", threadnum);
             size_t samps_retuned =
                 rx_streamer->recv(buff_ptrs, stream_cmd.num_samps, md, RA_rx_timeout);
+            const auto received = std::chrono::steady_clock::now();
+            rx_metrics.recordRecv(
+                md, samps_retuned, rx_channel_nums, sizeof(std::complex<short>));
             loop_num += 1;
             printf("%d::Error check\n", threadnum);
             if (md.error_code == uhd::rx_metadata_t::ERROR_CODE_TIMEOUT) {
@@ -205,6 +290,7 @@ public:
             }
             // Write to Pipe Implimentation
             total_num_samples_returned += samps_retuned;
+            tapMonitor(threadnum, rx_channel_nums, buff_ptrs, samps_retuned);
             int buffer_number = 0;
 
             int total_sent = 0;
@@ -223,12 +309,20 @@ public:
                 uint iterations                     = 0; // used for benchmarking
                 double combined_rate_in_miliseconds = 0; // used for benchmarking
                 auto timer = Clock::now(); // used for benchmarking
-                while (samples_remaining > 0 && !RA_stop_signal_called) {
+                while (samples_remaining > 0 && !RA_cancel.cancelled()) {
                     int num_of_bytes_to_write =
                         std::min(samples_remaining * sizeof(std::complex<short>),
                             size_t(pipe_file_buffer_size));
                     std::complex<short>* it = buff_ptrs[buffer_number] + file_write_index;
-                    int returned_num_bytes  = file->writeFile(it, num_of_bytes_to_write);
+                    const auto write_start  = std::chrono::steady_clock::now();
+                    int returned_num_bytes =
+                        file->writeSamples(it, num_of_bytes_to_write);
+                    writer_metrics.recordWrite(
+                        std::max(returned_num_bytes, 0) / sizeof(std::complex<short>),
+                        std::max(returned_num_bytes, 0),
+                        std::chrono::duration_cast<std::chrono::nanoseconds>(
+                            std::chrono::steady_clock::now() - write_start)
+                            .count());
                     if (returned_num_bytes != -1) {
                         file_write_index +=
                             returned_num_bytes / sizeof(std::complex<short>);
@@ -262,10 +356,10 @@ public:
                             << "##########################" << std::endl;
                         break;
                     }
-                    // Try to write again. Waiting a small delay.
+                    // Try to write again once the reader has made room.
                     else {
                         --number_of_tries;
-                        std::this_thread::sleep_for(std::chrono::microseconds(10));
+                        file->waitWritable(1);
                     }
                 }
                 // Code used to benchmark the write rate. Just benchmarking first thread
@@ -282,28 +376,398 @@ public:
                           << "        Total Time: " << deltaTimeMS << std::endl
                           << "         Rate KS/s:" << speed << std::endl
                           << "        iterations:" << iterations << std::endl
-                          << "             total:" << total_sent << std::endl; //}
+                          << "             total:" << total_sent << std::endl
+                          << "        Write mode:"
+                          << (file->writeMode() == PIPE_VMSPLICE ? "vmsplice" : "write")
+                          << std::endl
+                          << "     Pipe MB/s:" << file->writeStats().rateMBps()
+                          << " (" << file->writeStats().calls << " calls, "
+                          << file->writeStats().partial_writes << " partial)"
+                          << std::endl; //}
                 ++buffer_number;
             }
+            writer_metrics.record(METRIC_SINK_LATENCY,
+                std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now() - received)
+                    .count());
         }
         // End of recv
-        for (auto file : thread_files) {
+        for (size_t i = 0; i < thread_files.size(); i++) {
             printf("%d::closingFiles\n", threadnum);
+            if (splice_buffers) {
+                thread_files[i]->releaseBuffer(buff_ptrs[i]);
+            }
+            // The next request is read from the same pipe, wait for the consumer first
+            while (!RA_cancel.cancelled() && !thread_files[i]->waitDrained(100)) {
+            }
+            thread_files[i]->closeFile();
+        }
+    }
+
+    /**
+     * @brief Pipelined version of recv. Every recv() chunk is queued and written to
+     *          the pipes by a second thread while the next chunk is received, so the
+     *          consumer gets its first samples after one chunk instead of after the
+     *          whole request. At most PipeStreamDepth chunks are buffered; a slow
+     *          consumer backs up into the streamer and shows up as an overflow.
+     *
+     * @param rx_channel_nums number of rx channels
+     * @param threadnum The thread number
+     * @param rx_streamer sptr to the rx_streamer
+     */
+    void recvStreaming(
+        int rx_channel_nums, int threadnum, uhd::rx_streamer::sptr rx_streamer)
+    {
+        uhd::set_thread_priority_safe(0.9F);
+        std::vector<std::shared_ptr<PipeFile>> thread_files;
+        std::vector<std::shared_ptr<SampleSink>> thread_sinks;
+        std::vector<size_t> samples_remaining;
+        for (int i = 0; i < rx_channel_nums; i++) {
+            auto file = outfiles[rxChannel(threadnum, i)];
+            file->resetWriteStats();
+            thread_files.push_back(file);
+            thread_sinks.push_back(file);
+            samples_remaining.push_back(std::max(0, file->returnedValues()[0]));
+        }
+        const size_t spb = RA_spb == 0 ? rx_streamer->get_max_num_samps() : RA_spb;
+        bool overflow_message = true;
+        // setup streaming
+        uhd::rx_metadata_t md;
+        uhd::stream_cmd_t stream_cmd(uhd::stream_cmd_t::STREAM_MODE_NUM_SAMPS_AND_MORE);
+        stream_cmd.num_samps =
+            *std::max_element(samples_remaining.begin(), samples_remaining.end());
+        stream_cmd.stream_now = false;
+        stream_cmd.time_spec  = RA_start_time;
+        if (stream_cmd.num_samps == 0) {
+            return;
+        }
+        ChunkQueue queue(pipe_stream_depth);
+        std::thread writer([&]() { writeChunks(queue, thread_sinks, threadnum); });
+        rx_streamer->issue_stream_cmd(stream_cmd);
+        MetricsSlot& rx_metrics           = metricsSlot("rx", threadnum);
+        size_t total_num_samples_returned = 0;
+        int loop_num                      = 0;
+        while (not RA_cancel.cancelled()
+               and stream_cmd.num_samps > total_num_samples_returned) {
+            const size_t nsamps =
+                std::min(spb, stream_cmd.num_samps - total_num_samples_returned);
+            ChunkQueue::Chunk chunk;
+            for (auto sink : thread_sinks) {
+                chunk.buffers.push_back(
+                    sink->acquireBuffer(spb * sizeof(std::complex<short>)));
+            }
+            size_t samps_returned =
+                rx_streamer->recv(chunk.buffers, nsamps, md, RA_rx_timeout);
+            chunk.received = std::chrono::steady_clock::now();
+            rx_metrics.recordRecv(
+                md, samps_returned, rx_channel_nums, sizeof(std::complex<short>));
+            loop_num += 1;
+            if (md.error_code != uhd::rx_metadata_t::ERROR_CODE_NONE) {
+                for (int i = 0; i < rx_channel_nums; i++) {
+                    thread_sinks[i]->releaseBuffer(chunk.buffers[i]);
+                }
+            }
+            if (md.error_code == uhd::rx_metadata_t::ERROR_CODE_TIMEOUT) {
+                std::cout << boost::format("Timeout while streaming") << std::endl
+                          << std::flush;
+                break;
+            }
+            if (md.error_code == uhd::rx_metadata_t::ERROR_CODE_OVERFLOW) {
+                if (overflow_message) {
+                    overflow_message    = false;
+                    std::string tempstr = "\n thread:" + std::to_string(threadnum) + '\n'
+                                          + "loop_num:" + std::to_string(loop_num) + '\n';
+                    std::cout << tempstr << std::flush;
+                }
+                if (md.out_of_sequence != true) {
+                    std::cerr
+                        << boost::format(
+                               "Got an overflow indication. Please consider the "
+                               "following:\n"
+                               "  Your consumer must sustain a rate of %fMB/s.\n"
+                               "  Dropped samples will not be written to the pipe.\n"
+                               "  This message will not appear again.\n")
+                               % (RA_rx_rate * sizeof(std::complex<short>) / 1e6);
+                    break;
+                }
+                continue;
+            }
+            if (md.error_code != uhd::rx_metadata_t::ERROR_CODE_NONE) {
+                queue.close();
+                writer.join();
+                throw std::runtime_error(
+                    str(boost::format("Receiver error %s") % md.strerror()));
+            }
+            total_num_samples_returned += samps_returned;
+            tapMonitor(threadnum, rx_channel_nums, chunk.buffers, samps_returned);
+            for (int i = 0; i < rx_channel_nums; i++) {
+                const size_t samples_to_write =
+                    std::min(samps_returned, samples_remaining[i]);
+                chunk.nbytes.push_back(samples_to_write * sizeof(std::complex<short>));
+                samples_remaining[i] -= samples_to_write;
+            }
+            if (!queue.push(chunk)) {
+                // The writer gave up on a pipe
+                for (int i = 0; i < rx_channel_nums; i++) {
+                    thread_sinks[i]->releaseBuffer(chunk.buffers[i]);
+                }
+                break;
+            }
+        }
+        queue.close();
+        writer.join();
+        for (auto file : thread_files) {
+            std::cout << "Thread " << threadnum << " pipe MB/s:"
+                      << file->writeStats().rateMBps() << " ("
+                      << file->writeStats().calls << " calls, "
+                      << file->writeStats().partial_writes << " partial)" << std::endl;
+            // The next request is read from the same pipe, wait for the consumer first
+            while (!RA_cancel.cancelled() && !file->waitDrained(100)) {
+            }
             file->closeFile();
         }
     }
 
     /**
-     * @brief Create a Pipes object at file location
+     * @brief Writer side of recvStreaming. Writes each chunk to its sinks in order and
+     *          hands the buffers back. Closes the queue if a sink stops accepting
+     *          data so recvStreaming does not block on a full queue.
+     *
+     * @param queue Chunks produced by recvStreaming
+     * @param sinks One sink per channel, in the order of the chunk buffers
+     * @param threadnum The thread number
+     */
+    void writeChunks(ChunkQueue& queue,
+        std::vector<std::shared_ptr<SampleSink>>& sinks,
+        int threadnum)
+    {
+        MetricsSlot& writer_metrics = metricsSlot("writer", threadnum);
+        ChunkQueue::Chunk chunk;
+        bool first_chunk         = true;
+        bool sink_failed         = false;
+        const size_t sample_size = pipe_converter.sampleSize();
+        while (queue.pop(chunk)) {
+            writer_metrics.set(METRIC_QUEUE_DEPTH, queue.size());
+            for (size_t i = 0; i < sinks.size(); i++) {
+                if (pipe_converter.enabled() and chunk.nbytes[i] > 0) {
+                    // Convert into a buffer of the sink, the sc16 one is done with
+                    const size_t nsamps = chunk.nbytes[i] / sizeof(std::complex<short>);
+                    void* converted =
+                        sinks[i]->acquireBuffer(nsamps * pipe_converter.sampleSize());
+                    pipe_converter.convert(chunk.buffers[i], converted, nsamps);
+                    sinks[i]->releaseBuffer(chunk.buffers[i]);
+                    chunk.buffers[i] = converted;
+                    chunk.nbytes[i]  = nsamps * pipe_converter.sampleSize();
+                }
+                size_t written      = 0;
+                int number_of_tries = NumberOfTriesToMake;
+                while (!sink_failed and !RA_cancel.cancelled()
+                       and written < chunk.nbytes[i]) {
+                    const size_t num_of_bytes_to_write = std::min(
+                        chunk.nbytes[i] - written, size_t(pipe_file_buffer_size));
+                    const auto write_start = std::chrono::steady_clock::now();
+                    int returned_num_bytes = sinks[i]->writeSamples(
+                        (uint8_t*)chunk.buffers[i] + written, num_of_bytes_to_write);
+                    // A write may end inside a sample, count the samples it completed
+                    const size_t written_now = written + std::max(returned_num_bytes, 0);
+                    writer_metrics.recordWrite(
+                        written_now / sample_size - written / sample_size,
+                        std::max(returned_num_bytes, 0),
+                        std::chrono::duration_cast<std::chrono::nanoseconds>(
+                            std::chrono::steady_clock::now() - write_start)
+                            .count());
+                    if (returned_num_bytes > 0) {
+                        written += returned_num_bytes;
+                        number_of_tries = NumberOfTriesToMake;
+                    } else if (--number_of_tries <= 0) {
+                        std::cout << std::endl
+                                  << "#######Broke Early########\n"
+                                  << "                   Thread:" << threadnum
+                                  << std::endl
+                                  << "               FileNumber:" << i << std::endl
+                                  << "##########################" << std::endl;
+                        sink_failed = true;
+                        queue.close();
+                    } else {
+                        sinks[i]->waitWritable(1);
+                    }
+                }
+                sinks[i]->releaseBuffer(chunk.buffers[i]);
+            }
+            writer_metrics.record(METRIC_SINK_LATENCY,
+                std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now() - chunk.received)
+                    .count());
+            if (first_chunk) {
+                first_chunk = false;
+                // Time from the first recv() returning to its samples being in the pipe
+                std::cout << "Thread " << threadnum << " time to first sample: "
+                          << std::chrono::duration<double, std::milli>(
+                                 std::chrono::steady_clock::now() - chunk.received)
+                                 .count()
+                          << " ms" << std::endl;
+            }
+        }
+    }
+
+    /**
+     * @brief Shared memory version of recv. Every recv() lands directly in the rings,
+     *          which the consumer reads in place. Channels that already have all of
+     *          their requested samples receive into a scratch buffer.
+     *
+     * @param rx_channel_nums number of rx channels
+     * @param threadnum The thread number
+     * @param rx_streamer sptr to the rx_streamer
+     */
+    void recvToRings(
+        int rx_channel_nums, int threadnum, uhd::rx_streamer::sptr rx_streamer)
+    {
+        uhd::set_thread_priority_safe(0.9F);
+        std::vector<std::shared_ptr<SharedRing>> thread_rings;
+        std::vector<size_t> samples_remaining;
+        for (int i = 0; i < rx_channel_nums; i++) {
+            thread_rings.push_back(rings[rxChannel(threadnum, i)]);
+            samples_remaining.push_back(
+                std::max(0, requested_samples[rxChannel(threadnum, i)]));
+        }
+        const size_t spb = RA_spb == 0 ? rx_streamer->get_max_num_samps() : RA_spb;
+        std::vector<std::complex<short>> scratch(spb);
+        std::vector<void*> buff_ptrs(rx_channel_nums);
+        // When converting, recv() lands in sc16 buffers that are converted into the rings
+        const bool convert = pipe_converter.enabled();
+        const size_t ring_sample_size =
+            convert ? pipe_converter.sampleSize() : sizeof(std::complex<short>);
+        std::vector<void*> ring_ptrs(rx_channel_nums);
+        std::vector<std::vector<std::complex<short>>> convert_buffs(
+            convert ? rx_channel_nums : 0, std::vector<std::complex<short>>(spb));
+        bool overflow_message = true;
+        // setup streaming
+        uhd::rx_metadata_t md;
+        uhd::stream_cmd_t stream_cmd(uhd::stream_cmd_t::STREAM_MODE_NUM_SAMPS_AND_MORE);
+        stream_cmd.num_samps =
+            *std::max_element(samples_remaining.begin(), samples_remaining.end());
+        stream_cmd.stream_now = false;
+        stream_cmd.time_spec  = RA_start_time;
+        if (stream_cmd.num_samps == 0) {
+            return;
+        }
+        rx_streamer->issue_stream_cmd(stream_cmd);
+        MetricsSlot& rx_metrics           = metricsSlot("rx", threadnum);
+        size_t total_num_samples_returned = 0;
+        int loop_num                      = 0;
+        while (not RA_cancel.cancelled()
+               and stream_cmd.num_samps > total_num_samples_returned) {
+            size_t nsamps =
+                std::min(spb, stream_cmd.num_samps - total_num_samples_returned);
+            for (int i = 0; i < rx_channel_nums; i++) {
+                buff_ptrs[i] = scratch.data();
+                if (samples_remaining[i] == 0) {
+                    continue;
+                }
+                const uint64_t wanted_bytes = std::min(
+                    thread_rings[i]->capacity(), uint64_t(nsamps * ring_sample_size));
+                int64_t free_bytes = 0;
+                while (free_bytes == 0 and not RA_cancel.cancelled()) {
+                    // The consumer is behind, wait for it to release some of the ring.
+                    free_bytes =
+                        thread_rings[i]->acquireWrite(&ring_ptrs[i], wanted_bytes, 100);
+                }
+                buff_ptrs[i] = convert ? convert_buffs[i].data() : ring_ptrs[i];
+                nsamps       = std::min(nsamps, size_t(free_bytes) / ring_sample_size);
+            }
+            if (RA_cancel.cancelled()) {
+                break;
+            }
+            size_t samps_returned =
+                rx_streamer->recv(buff_ptrs, nsamps, md, RA_rx_timeout);
+            rx_metrics.recordRecv(
+                md, samps_returned, rx_channel_nums, sizeof(std::complex<short>));
+            loop_num += 1;
+            if (md.error_code == uhd::rx_metadata_t::ERROR_CODE_TIMEOUT) {
+                std::cout << boost::format("Timeout while streaming") << std::endl
+                          << std::flush;
+                break;
+            }
+            if (md.error_code == uhd::rx_metadata_t::ERROR_CODE_OVERFLOW) {
+                if (overflow_message) {
+                    overflow_message    = false;
+                    std::string tempstr = "\n thread:" + std::to_string(threadnum) + '\n'
+                                          + "loop_num:" + std::to_string(loop_num) + '\n';
+                    std::cout << tempstr << std::flush;
+                }
+                if (md.out_of_sequence != true) {
+                    std::cerr
+                        << boost::format(
+                               "Got an overflow indication. Please consider the "
+                               "following:\n"
+                               "  Your consumer must sustain a rate of %fMB/s.\n"
+                               "  Dropped samples will not be written to the ring.\n"
+                               "  This message will not appear again.\n")
+                               % (RA_rx_rate * sizeof(std::complex<short>) / 1e6);
+                    break;
+                }
+                continue;
+            }
+            if (md.error_code != uhd::rx_metadata_t::ERROR_CODE_NONE) {
+                throw std::runtime_error(
+                    str(boost::format("Receiver error %s") % md.strerror()));
+            }
+            total_num_samples_returned += samps_returned;
+            tapMonitor(threadnum, rx_channel_nums, buff_ptrs, samps_returned);
+            for (int i = 0; i < rx_channel_nums; i++) {
+                const size_t samples_to_commit =
+                    std::min(samps_returned, samples_remaining[i]);
+                if (samples_to_commit > 0) {
+                    if (convert) {
+                        pipe_converter.convert(
+                            buff_ptrs[i], ring_ptrs[i], samples_to_commit);
+                    }
+                    thread_rings[i]->commitWrite(samples_to_commit * ring_sample_size);
+                    samples_remaining[i] -= samples_to_commit;
+                }
+            }
+        }
+    }
+
+    /**
+     * @brief Create a Pipes object at file location and the event loop that drives
+     *          them, or the shared memory rings
+     *          refarch_ring_<channel> when PipeTransport is shm.
      *
      */
     void createPipes()
     {
+        pipe_converter = SampleConverter(pipe_format, pipe_scale);
+        if (pipe_converter.enabled()) {
+            if (not useSharedMemory() and not pipe_streaming) {
+                throw std::runtime_error("PipeFormat " + pipe_format
+                                         + " needs PipeStreaming or PipeTransport shm");
+            }
+            std::cout << "Converting the samples to " << pipe_format << " ("
+                      << convertIsaName(bestConvertIsa()) << ")" << std::endl;
+        }
+        if (useSharedMemory()) {
+            const uint32_t ring_format = pipe_format == "fc32" ? RA_RING_FORMAT_FC32
+                                         : pipe_format == "fc16" ? RA_RING_FORMAT_FC16
+                                                                 : RA_RING_FORMAT_SC16;
+            for (size_t i = 0; i < RA_rx_stream_vector.size(); i++) {
+                const std::string ring_name = "refarch_ring_" + std::to_string(i);
+                rings.push_back(
+                    std::make_shared<SharedRing>(ring_name, shm_ring_size, ring_format));
+                std::cout << "Created shared ring /dev/shm/" << ring_name << std::endl;
+            }
+            return;
+        }
+        pipe_events = std::make_shared<PipeEventLoop>();
+        pipe_events->watchCancel(RA_cancel.fd());
         for (size_t i = 0; i < RA_rx_stream_vector.size(); i++) {
             const std::string this_filename =
                 pipe_folder_location + "/" + std::to_string(i) + ".fifo";
             auto Pipe = std::shared_ptr<PipeFile>(new PipeFile(this_filename));
+            Pipe->setWriteMode(
+                pipe_write_mode == "vmsplice" ? PIPE_VMSPLICE : PIPE_WRITE);
             outfiles.push_back(Pipe);
+            pipe_events->add(Pipe);
         }
     }
 
@@ -314,18 +778,16 @@ public:
      */
     void testFileSize()
     {
+        if (useSharedMemory()) {
+            return;
+        }
         const std::string this_filename = pipe_folder_location + "/" + "test.fifo";
         PipeFile read_pipe(this_filename);
         PipeFile write_pipe(this_filename);
-        write_pipe.openFile(O_WRONLY);
-        read_pipe.openFile(O_RDONLY);
-        bool all_returned;
-        do {
-            all_returned = true;
-            all_returned &= write_pipe.isFileOpen();
-            all_returned &= read_pipe.isFileOpen();
-            std::this_thread::sleep_for(std::chrono::milliseconds(100));
-        } while (!RA_stop_signal_called && !all_returned);
+        // The reader has to exist before a FIFO can be opened for writing
+        if (!read_pipe.openFile(O_RDONLY) || !write_pipe.openFile(O_WRONLY)) {
+            throw std::runtime_error("Unable to open test pipe " + this_filename);
+        }
         int file_size_buffer = write_pipe.setfileSize(pipe_file_buffer_size);
         if (file_size_buffer != pipe_file_buffer_size) {
             UHD_LOGGER_ERROR("Configuration File")
@@ -341,64 +803,92 @@ public:
     }
 
     /**
-     * @brief Spawns background processes to read from the pipe. If all files return
-     *          OR the the RA_stop_signal_called is true it will return. Stores
+     * @brief Reads a request from every pipe through the event loop. If all files
+     *          return OR the RA_cancel is cancelled it will return. Stores
      *          data inside the maximum_number_of_samples. Initially sets
      *          maximum_number_of_samples to 0;
      *
-     * @param pollRateMs rate to poll for all returned samples.
+     * @param pollRateMs longest wait before checking RA_cancel
      */
     void readPipes(int pollRateMs)
     {
+        if (useSharedMemory()) {
+            readRingRequests(pollRateMs);
+            return;
+        }
         for (auto pipe : outfiles) {
-            pipe->readSamplesNonBlocking(1);
-            printf("Calling readSamplesNonBlocking\n");
+            pipe_events->readSamples(pipe, 1);
+        }
+        auto all_returned = [this]() {
+            return RA_cancel.cancelled()
+                   || std::all_of(outfiles.begin(), outfiles.end(), [](auto pipe) {
+                          return pipe->didBackgroundReturn();
+                      });
+        };
+        while (!pipe_events->waitFor(all_returned, pollRateMs)) {
         }
-        bool all_returned;
         maximum_number_of_samples = 0;
-        int index_not_returned =
-            0; // This is done so we don't traverse over the returned ones
-        do {
-            all_returned = true;
-            for (; index_not_returned < outfiles.size(); index_not_returned++) {
-                all_returned &= outfiles[index_not_returned]->didBackgroundReturn();
-                if (all_returned) {
-                    maximum_number_of_samples = std::max(maximum_number_of_samples,
-                        outfiles[index_not_returned]->returnedValues()[0]);
-                } else {
-                    break;
-                }
+        if (RA_cancel.cancelled()) {
+            pipe_events->cancel();
+        } else {
+            for (auto pipe : outfiles) {
+                maximum_number_of_samples =
+                    std::max(maximum_number_of_samples, pipe->returnedValues()[0]);
             }
-            std::this_thread::sleep_for(std::chrono::milliseconds(pollRateMs));
-        } while (!RA_stop_signal_called && !all_returned);
+        }
         for (auto pipe : outfiles) {
             pipe->closeFile();
         }
     }
 
+    /**
+     * @brief Waits until every ring has a new request and stores the largest one in
+     *          maximum_number_of_samples. Sleeps on the rings' futexes, pollRateMs only
+     *          bounds how long a stop signal can go unnoticed.
+     *
+     * @param pollRateMs longest wait before checking RA_cancel
+     */
+    void readRingRequests(int pollRateMs)
+    {
+        requested_samples.assign(rings.size(), 0);
+        maximum_number_of_samples = 0;
+        for (size_t i = 0; i < rings.size() and not RA_cancel.cancelled(); i++) {
+            while (not RA_cancel.cancelled()
+                   and not rings[i]->waitForRequest(requested_samples[i], pollRateMs)) {
+            }
+            maximum_number_of_samples =
+                std::max(maximum_number_of_samples, requested_samples[i]);
+        }
+    }
+
+    /**
+     * @brief Opens every pipe for writing through the event loop, each one as soon as
+     *          its reader shows up.
+     *
+     * @param pollRateMs longest wait before checking RA_cancel
+     */
     void openPipesForWriting(int pollRateMs)
     {
+        if (useSharedMemory()) {
+            return;
+        }
         for (auto outfile : outfiles) {
-            outfile->openFile(O_WRONLY);
-        }
-        bool all_returned;
-        int index_not_returned =
-            0; // This is done so we don't traverse over the returned ones
-        do {
-            all_returned = true;
-            for (; index_not_returned < outfiles.size(); index_not_returned++) {
-                all_returned &= outfiles[index_not_returned]->isFileOpen();
-                if (!all_returned) {
-                    break;
-                }
-            }
-            std::cout << "index1:" << index_not_returned << std::endl;
-            std::this_thread::sleep_for(std::chrono::milliseconds(pollRateMs));
-        } while (!RA_stop_signal_called && !all_returned);
-        if (all_returned) {
-            for (auto outfile : outfiles) {
-                outfile->setfileSize(pipe_file_buffer_size); // todo: Need error handeler
-            }
+            pipe_events->openForWriting(outfile);
+        }
+        auto all_open = [this]() {
+            return RA_cancel.cancelled()
+                   || std::all_of(outfiles.begin(), outfiles.end(), [](auto outfile) {
+                          return outfile->isFileOpen();
+                      });
+        };
+        while (!pipe_events->waitFor(all_open, pollRateMs)) {
+        }
+        if (RA_cancel.cancelled()) {
+            pipe_events->cancel();
+            return;
+        }
+        for (auto outfile : outfiles) {
+            outfile->setfileSize(pipe_file_buffer_size); // todo: Need error handeler
         }
     }
 };
@@ -469,11 +959,11 @@ int UHD_SAFE_MAIN(int argc, char* argv[])
             usrpSystem.joinAllThreads();
             std::cout << " DONE  GENERATING: " << std::endl << std::endl << std::endl;
         } else
-            usrpSystem.RA_stop_signal_called = true;
+            usrpSystem.RA_cancel.cancel();
         usrpSystem.stopReplay();
         std::cout << "END:" << usrpSystem.maximum_number_of_samples << std::endl
                   << std::flush;
-    } while (!usrpSystem.RA_stop_signal_called);
+    } while (!usrpSystem.RA_cancel.cancelled());
 
     std::signal(SIGINT, SIG_DFL);
     std::cout << "Run complete." << std::endl;
@@ -17,7 +17,6 @@ currently has each USRP in its own thread. This version uses one RX streamer per
 #include <uhd/utils/safe_main.hpp>
 #include <uhd/utils/thread.hpp>
 #include <stdio.h>
-#include <boost/circular_buffer.hpp>
 #include <csignal>
 #include <fstream>
 #include <memory>
@@ -47,138 +46,111 @@ public:
         // clang-format on
     }
 
-   void recv(
-        int rx_channel_nums, int threadnum, uhd::rx_streamer::sptr rx_streamer, bool bw_summary, bool stats) override
+    void recv(int rx_channel_nums,
+        int threadnum,
+        uhd::rx_streamer::sptr rx_streamer,
+        bool stats) override
     {
-        uhd::set_thread_priority_safe(0.9F);
-        size_t num_total_samps = 0;
-        std::unique_ptr<char[]> buf(new char[RA_spb]);
-        // Prepare buffers for received samples and metadata
-        uhd::rx_metadata_t md;
-        std::vector<boost::circular_buffer<std::complex<short>>> buffs(
-            rx_channel_nums, boost::circular_buffer<std::complex<short>>(RA_spb + 1));
-        // create a vector of pointers to point to each of the channel buffers
-        std::vector<std::complex<short>*> buff_ptrs;
-        for (size_t i = 0; i < buffs.size(); i++) {
-            buff_ptrs.push_back(&buffs[i].front());
-        }
+        dispatchFormat(rx_channel_nums, [&](auto sample, auto channels) {
+            recvToFiles<decltype(sample), decltype(channels)::value>(
+                threadnum, rx_streamer, stats);
+        });
+    }
+
+    /**
+     * @brief Writes every channel of rx_streamer to its own file in the --format
+     *  sample type, so fc32 and fc64 are captured without a conversion pass. With
+     *  --rx-compress every sc16 block is compressed in this thread before the write.
+     */
+    template <typename samp_type, size_t static_channels>
+    void recvToFiles(int threadnum, uhd::rx_streamer::sptr rx_streamer, bool stats)
+    {
+        using refarch_detail::PerChannel;
+        const size_t num_channels =
+            refarch_detail::streamerChannels<static_channels>(rx_streamer);
         // Correctly label output files based on run method, single TX->single RX or
         // single TX
         // -> All RX
-        int rx_identifier = threadnum;
-        std::vector<std::shared_ptr<std::ofstream>> outfiles;
-        for (size_t i = 0; i < buffs.size(); i++) {
-            // rx_identifier * 2 + i in order to get correct channel number in filename
+        auto outfiles = PerChannel<std::ofstream, static_channels>::make(num_channels);
+        auto file_buffs =
+            PerChannel<std::unique_ptr<char[]>, static_channels>::make(num_channels);
+        auto indexes =
+            PerChannel<std::unique_ptr<TimeIndexWriter>, static_channels>::make(
+                num_channels);
+        std::vector<uint8_t> compressed(RA_rx_compress ? sc16CompressBound(RA_spb) : 0);
+        uint64_t raw_bytes     = 0;
+        uint64_t written_bytes = 0;
+        for (size_t i = 0; i < num_channels; i++) {
+            // rxChannel() numbers the files by channel
             const std::string this_filename = generateRxFilename(RA_rx_file,
-                rx_identifier * 2 + i,
+                rxChannel(threadnum, i),
                 RA_singleTX,
                 0,
                 RA_tx_freq,
                 folder_name,
                 RA_rx_file_channels,
                 RA_rx_file_location);
-            auto outstream = std::shared_ptr<std::ofstream>(new std::ofstream());
-            outstream->rdbuf()->pubsetbuf(buf.get(), RA_spb); // Important
-            outstream->open(this_filename.c_str(), std::ofstream::binary);
-            outfiles.push_back(std::shared_ptr<std::ofstream>(outstream));
+            file_buffs[i].reset(new char[RA_spb]);
+            outfiles[i].rdbuf()->pubsetbuf(file_buffs[i].get(), RA_spb); // Important
+            outfiles[i].open(
+                RA_rx_compress ? this_filename + ".sc16z" : this_filename,
+                std::ofstream::binary);
+            indexes[i] = openTimeIndex(this_filename, sizeof(samp_type));
         }
-        UHD_ASSERT_THROW(outfiles.size() == buffs.size());
-        UHD_ASSERT_THROW(buffs.size() == rx_channel_nums);
-        bool overflow_message = true;
-        // setup streaming
-        uhd::stream_cmd_t stream_cmd(
-            (RA_nsamps == 0) ? uhd::stream_cmd_t::STREAM_MODE_START_CONTINUOUS
-                             : uhd::stream_cmd_t::STREAM_MODE_NUM_SAMPS_AND_DONE);
-        stream_cmd.num_samps  = RA_nsamps;
-        stream_cmd.stream_now = false;
-        stream_cmd.time_spec  = RA_start_time;
-        
-        rx_streamer->issue_stream_cmd(stream_cmd);
-        const auto start_time = std::chrono::steady_clock::now();
-        const auto stop_time =
-        start_time + std::chrono::milliseconds(int64_t(1000 * RA_time_requested+1000 * RA_delay_start_time));
-        // Track time and samps between updating the BW summary
-        auto last_update                     = start_time;
-        unsigned long long last_update_samps = 0;
-        int loop_num = 0;
-        while (not RA_stop_signal_called
-           and (RA_nsamps >= num_total_samps or RA_nsamps == 0)
-           and (RA_time_requested == 0.0 or std::chrono::steady_clock::now() <= stop_time)) {
-            const auto now = std::chrono::steady_clock::now();
-            size_t num_rx_samps = rx_streamer->recv(buff_ptrs, RA_spb, md, RA_rx_timeout);
-            loop_num += 1;
-            if (md.error_code == uhd::rx_metadata_t::ERROR_CODE_TIMEOUT) {
-                std::cout << boost::format("Timeout while streaming") << std::endl;
-                break;
-            }
-            if (md.error_code == uhd::rx_metadata_t::ERROR_CODE_OVERFLOW) {
-                if (overflow_message) {
-                    overflow_message    = false;
-                    std::string tempstr = "\n thread:" + std::to_string(threadnum) + '\n'
-                                          + "loop_num:" + std::to_string(loop_num) + '\n';
-                    std::cout << tempstr;
-                }
-                if (md.out_of_sequence != true) {
-                    std::cerr
-                        << boost::format(
-                               "Got an overflow indication. Please consider the "
-                               "following:\n"
-                               "  Your write medium must sustain a rate of %fMB/s.\n"
-                               "  Dropped samples will not be written to the file.\n"
-                               "  Please modify this example for your purposes.\n"
-                               "  This message will not appear again.\n")
-                               % (RA_rx_rate * sizeof(std::complex<short>) / 1e6);
-                    break;
-                }
-                continue;
-            }
-            if (md.error_code != uhd::rx_metadata_t::ERROR_CODE_NONE) {
-                throw std::runtime_error(
-                    str(boost::format("Receiver error %s") % md.strerror()));
-            }
-            num_total_samps += num_rx_samps * rx_streamer->get_num_channels();
-            for (size_t i = 0; i < outfiles.size(); i++) {
-                outfiles[i]->write((const char*)buff_ptrs[i],
-                    num_rx_samps * sizeof(std::complex<short>));
-            }
-            if(bw_summary){
-                last_update_samps += num_rx_samps;
-                const auto time_since_last_update = now - last_update;
-                if (time_since_last_update > std::chrono::seconds(1)) {
-                    const double time_since_last_update_s =
-                        std::chrono::duration<double>(time_since_last_update).count();
-                    const double rate = double(last_update_samps) / time_since_last_update_s;
-                    std::cout << "\t" << (rate / 1e6) << " Msps" << std::endl;
-                    last_update_samps = 0;
-                    last_update       = now;
+        MetricsSlot& writer_metrics = metricsSlot("writer", threadnum);
+        receiveSamples<samp_type, static_channels>(threadnum,
+            rx_streamer,
+            stats,
+            [&](const typename PerChannel<samp_type*, static_channels>::type& buff_ptrs,
+                size_t num_rx_samps,
+                std::chrono::steady_clock::time_point received,
+                const uhd::rx_metadata_t& md) {
+                const auto write_start = std::chrono::steady_clock::now();
+                const uint64_t written_before = written_bytes;
+                for (size_t i = 0; i < num_channels; i++) {
+                    if (RA_rx_compress) {
+                        // sc16 only, checked by spawnReceiveThreads()
+                        const size_t nbytes = compressSc16(
+                            (const std::complex<int16_t>*)buff_ptrs[i],
+                            num_rx_samps,
+                            compressed.data());
+                        outfiles[i].write((const char*)compressed.data(), nbytes);
+                        written_bytes += nbytes;
+                    } else {
+                        outfiles[i].write((const char*)buff_ptrs[i],
+                            num_rx_samps * sizeof(samp_type));
+                        written_bytes += num_rx_samps * sizeof(samp_type);
+                    }
+                    if (indexes[i]) {
+                        indexes[i]->record(md.time_spec.get_full_secs(),
+                            md.time_spec.get_frac_secs(),
+                            num_rx_samps);
+                    }
                 }
+                const auto write_end = std::chrono::steady_clock::now();
+                raw_bytes += num_channels * num_rx_samps * sizeof(samp_type);
+                writer_metrics.recordWrite(num_channels * num_rx_samps,
+                    written_bytes - written_before,
+                    std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        write_end - write_start)
+                        .count());
+                // recv() returned just before the write started
+                writer_metrics.record(METRIC_SINK_LATENCY,
+                    std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        write_end - received)
+                        .count());
+            });
+        for (size_t i = 0; i < num_channels; i++) {
+            outfiles[i].close();
+            if (indexes[i]) {
+                indexes[i]->close();
             }
         }
-        const auto actual_stop_time = std::chrono::steady_clock::now();
-
-        // Shut down receiver
-        stream_cmd.stream_mode = uhd::stream_cmd_t::STREAM_MODE_STOP_CONTINUOUS;
-        rx_streamer->issue_stream_cmd(stream_cmd);
-
-        for (size_t i = 0; i < outfiles.size(); i++) {
-            outfiles[i]->close();
-        }
-        if (stats) {
-            std::cout << std::endl;
-            if (RA_nsamps > 0){
-                std::cout << num_total_samps << " Samples Recieved: rerun with timed run for accurate stats." << std::endl;
-               return;
-            }
-            const double actual_duration_seconds =
-                std::chrono::duration<float>(actual_stop_time - start_time).count()-RA_delay_start_time;
-            size_t adjusted_samples = num_total_samps/rx_streamer->get_num_channels();
-            std::cout << std::endl;
-            std::cout << boost::format("Thread: %d Received %d samples in %f seconds") % threadnum % num_total_samps
-                            % actual_duration_seconds
-                    << std::endl;
-            const double rate = (double)adjusted_samples / actual_duration_seconds;
-            std::cout << (rate / 1e6) << " Msps" << std::endl;
-
+        if (RA_rx_compress and stats and written_bytes > 0) {
+            std::cout << boost::format("Thread: %d compressed %.1f MB to %.1f MB (%.2fx)")
+                             % threadnum % (raw_bytes / 1e6) % (written_bytes / 1e6)
+                             % (double(raw_bytes) / written_bytes)
+                      << std::endl;
         }
     }
 };
@@ -28,15 +28,22 @@ public:
         std::signal(SIGINT, this->sigIntHandler);
         std::vector<std::thread> vectorThread;
         // Receive RA_rx_stream_vector.size()
-        if (RA_format == "sc16") {
-            for (int i = 0; i < RA_rx_stream_vector.size(); i = i + 2) {
+        if (recvSupportsFormat(RA_format)) {
+            startRxTaps();
+            // One thread per streamer
+            for (const auto& channels : RA_rx_streamer_channels) {
                 std::cout << "Spawning RX Thread.." << threadnum << std::endl;
                 std::thread t(
-                    [this](int threadnum, uhd::rx_streamer::sptr rx_streamer, bool bw_summary, bool stats) {
-                        recv(2, threadnum, rx_streamer, bw_summary, stats);
+                    [this](int rx_channel_nums,
+                        int threadnum,
+                        uhd::rx_streamer::sptr rx_streamer,
+                        bool stats) {
+                        recv(rx_channel_nums, threadnum, rx_streamer, stats);
                     },
+                    channels.size(),
                     threadnum,
-                    RA_rx_stream_vector[i], RA_bw_summary, RA_stats);
+                    RA_rx_stream_vector[channels.front()],
+                    RA_stats);
 
                 vectorThread.push_back(std::move(t));
                 threadnum++;
@@ -49,6 +56,7 @@ public:
         for (auto& i : vectorThread) {
             i.join();
         }
+        stopRxTaps();
         std::signal(SIGINT, SIG_DFL);
 
         return;
@@ -57,29 +65,12 @@ public:
     {
         // This is the function that connects the graph for the multithreaded
         // implementation The difference is that each device gets its own RX streamer.
+        if (RA_mock) {
+            return;
+        }
         UHD_LOG_INFO("CogRF", "Connecting graph...");
-        std::cout << RA_rx_stream_vector.size();
-        std::cout << RA_radio_ctrls.size();
         // Connect Graph
-        for (int i = 0; i < RA_radio_ctrls.size(); i++) {
-            // connect radios to ddc
-            RA_graph->connect(
-                RA_radio_block_list[i], 0, RA_ddc_ctrls[i]->get_block_id(), 0);
-            std::cout << "Connected " << RA_radio_block_list[i] << " to "
-                      << RA_ddc_ctrls[i]->get_block_id() << std::endl;
-        }
-
-        for (int j = 0; j < RA_ddc_ctrls.size(); j++) {
-            // Connect DDC to streamers
-            // Reusing replay chan vector, need a vector of zeros and ones
-            RA_graph->connect(RA_ddc_ctrls[j]->get_block_id(),
-                0,
-                RA_rx_stream_vector[j],
-                div(j, 2).rem);
-
-            std::cout << "Connected " << RA_ddc_ctrls[j]->get_block_id() << " to "
-                      << RA_rx_stream_vector[j] << " Port " << div(j, 2).rem << std::endl;
-        }
+        connectRxChannels();
     }
 };
 
@@ -136,6 +127,8 @@ int UHD_SAFE_MAIN(int argc, char* argv[])
     usrpSystem.syncAllDevices();
     // Begin TX and RX
     // INFO: Comment what each initilization does what type of data is stored in each.
+    // Reject a burst capture that does not fit in memory and prefault it
+    usrpSystem.planBurstCapture();
     // Sync times across threads
     usrpSystem.updateDelayedStartTime();
     usrpSystem.spawnReceiveThreads();
@@ -0,0 +1,102 @@
+//
+// Copyright 2021-2022 Ettus Research, a National Instruments Brand
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+//
+
+/*******************************************************************************************************************
+Sharded capture across NUMA nodes.
+Splits the address list of the configuration file over shards worker processes, each
+running shard-worker (an example such as Arch_rx_to_mem) with the same configuration file
+and its own addresses. Every worker is bound to the CPUs and memory of one NUMA node, so
+its RX threads, buffers and UHD I/O stay next to the NIC and RAID of that node. The
+coordinator sets one PPS aligned time base and start time on all shards and reports
+their metrics.
+*******************************************************************************************************************/
+
+#include "RefArch.hpp"
+#include "Shard.hpp"
+#include <uhd/utils/safe_main.hpp>
+#include <csignal>
+
+class Arch_shard : public RefArch
+{
+    using RefArch::RefArch;
+
+public:
+    size_t shards;
+    std::string shard_worker;
+    std::vector<int> shard_numa_nodes;
+    std::vector<std::string> shard_args;
+    double shard_sync_margin;
+
+    void addAdditionalOptions() override
+    {
+        namespace po = boost::program_options;
+        // clang-format off
+        RA_desc.add_options()
+            ("shards",
+                po::value<size_t>(&shards)->default_value(2),
+                "worker processes the addresses are split over")
+            ("shard-worker",
+                po::value<std::string>(&shard_worker)->default_value("./Arch_rx_to_mem"),
+                "example every shard runs")
+            ("shard-numa-nodes",
+                po::value<std::vector<int>>(&shard_numa_nodes),
+                "NUMA node of every shard, -1 for unbound, default shard i on node i")
+            ("shard-args",
+                po::value<std::vector<std::string>>(&shard_args),
+                "extra arguments of every shard, e.g. its --rx-file-location")
+            ("shard-sync-margin",
+                po::value<double>(&shard_sync_margin)->default_value(2),
+                "seconds from the last shard ready to the common PPS epoch")
+            ;
+        // clang-format on
+    }
+    ShardSettings shardSettings() const
+    {
+        ShardSettings settings;
+        settings.worker           = shard_worker;
+        settings.worker_args      = {"--cfgFile", RA_cfgFile};
+        settings.addresses        = RA_address;
+        settings.shards           = shards;
+        settings.numa_nodes       = shard_numa_nodes;
+        settings.shard_args       = shard_args;
+        settings.sync_margin      = shard_sync_margin;
+        settings.start_delay      = RA_delay_start_time;
+        settings.metrics_file     = RA_metrics_file;
+        settings.metrics_interval = RA_metrics_interval;
+        settings.rx_file          = RA_rx_file;
+        return settings;
+    }
+};
+
+static ShardCoordinator* coordinator = nullptr;
+
+static void forwardSigInt(int)
+{
+    // The workers have their own process group, Ctrl+C only reaches them from here
+    if (coordinator) {
+        coordinator->interrupt();
+    }
+}
+
+int UHD_SAFE_MAIN(int argc, char* argv[])
+{
+    // find configuration file -cfgFile adds to "desc" variable
+    Arch_shard shardSystem(argc, argv);
+    shardSystem.parseConfig();
+    ShardCoordinator shardCoordinator(shardSystem.shardSettings());
+    coordinator = &shardCoordinator;
+    std::signal(SIGINT, forwardSigInt);
+    // Start one worker per shard
+    shardCoordinator.start();
+    // Common PPS epoch and start time
+    shardCoordinator.synchronize();
+    // Report metrics until every shard is done
+    const int failed = shardCoordinator.wait();
+    std::signal(SIGINT, SIG_DFL);
+    coordinator = nullptr;
+    std::cout << "Sharded run complete, " << failed << " shards failed." << std::endl;
+    return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -50,8 +50,21 @@ public:
             month + day + year + "_" + hour + minute + seconds + "_" + RA_rx_file;
     }
 
-    void recv(
-        int rx_channel_nums, int threadnum, uhd::rx_streamer::sptr rx_streamer, bool bw_summary, bool stats) override
+    // recv() below handles std::complex<short> only
+    bool recvSupportsFormat(const std::string& format) const override
+    {
+        return format == "sc16";
+    }
+    // recv() below stops on any cancel, without the graceful stop of receiveSamples()
+    bool recvSupportsGracefulStop() const override
+    {
+        return false;
+    }
+
+    void recv(int rx_channel_nums,
+        int threadnum,
+        uhd::rx_streamer::sptr rx_streamer,
+        bool stats) override
     {
         uhd::set_thread_priority_safe(0.9F);
         size_t num_total_samps = 0;
@@ -68,12 +81,11 @@ public:
         // Correctly label output files based on run method, single TX->single RX or
         // single TX
         // -> All RX
-        int rx_identifier = threadnum;
         std::vector<std::shared_ptr<std::ofstream>> outfiles;
         for (size_t i = 0; i < buffs.size(); i++) {
-            // rx_identifier * 2 + i in order to get correct channel number in filename
+            // rxChannel() numbers the files by channel
             const std::string this_filename = generateRxFilename(RA_rx_file,
-                rx_identifier * 2 + i,
+                rxChannel(threadnum, i),
                 RA_singleTX,
                 0,
                 RA_tx_freq,
@@ -100,15 +112,16 @@ public:
         const auto start_time = std::chrono::steady_clock::now();
         const auto stop_time =
         start_time + std::chrono::milliseconds(int64_t(1000 * RA_time_requested+1000*RA_delay_start_time));
-        // Track time and samps between updating the BW summary
-        auto last_update                     = start_time;
-        unsigned long long last_update_samps = 0;
+        MetricsSlot& rx_metrics = metricsSlot("rx", threadnum);
         int loop_num = 0;
-        while (not RA_stop_signal_called
+        while (not RA_cancel.cancelled()
            and (RA_nsamps >= num_total_samps or RA_nsamps == 0)
            and (RA_time_requested == 0.0 or std::chrono::steady_clock::now() <= stop_time)) {
-            const auto now = std::chrono::steady_clock::now();
             size_t num_rx_samps = rx_streamer->recv(buff_ptrs, RA_spb, md, RA_rx_timeout);
+            rx_metrics.recordRecv(md,
+                num_rx_samps,
+                rx_streamer->get_num_channels(),
+                sizeof(std::complex<short>));
             loop_num += 1;
             if (md.error_code == uhd::rx_metadata_t::ERROR_CODE_TIMEOUT) {
                 std::cout << boost::format("Timeout while streaming") << std::endl;
@@ -144,18 +157,6 @@ public:
                 outfiles[i]->write((const char*)buff_ptrs[i],
                     num_rx_samps * sizeof(std::complex<short>));
             }
-            if(bw_summary){
-                last_update_samps += num_rx_samps;
-                const auto time_since_last_update = now - last_update;
-                if (time_since_last_update > std::chrono::seconds(1)) {
-                    const double time_since_last_update_s =
-                        std::chrono::duration<double>(time_since_last_update).count();
-                    const double rate = double(last_update_samps) / time_since_last_update_s;
-                    std::cout << "\t" << (rate / 1e6) << " Msps" << std::endl;
-                    last_update_samps = 0;
-                    last_update       = now;
-                }
-            }
         }
         const auto actual_stop_time = std::chrono::steady_clock::now();
 
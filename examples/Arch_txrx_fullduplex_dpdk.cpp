@@ -52,8 +52,16 @@ public:
     }
     
 
-   void recv(
-        int rx_channel_nums, int threadnum, uhd::rx_streamer::sptr rx_streamer, bool bw_summary, bool stats) override
+    // recv() below stops on any cancel, without the graceful stop of receiveSamples()
+    bool recvSupportsGracefulStop() const override
+    {
+        return false;
+    }
+
+   void recv(int rx_channel_nums,
+       int threadnum,
+       uhd::rx_streamer::sptr rx_streamer,
+       bool stats) override
     {
         uhd::set_thread_priority_safe(0.9F);
         size_t num_total_samps = 0;
@@ -70,12 +78,11 @@ public:
         // Correctly label output files based on run method, single TX->single RX or
         // single TX
         // -> All RX
-        int rx_identifier = threadnum;
         std::vector<std::shared_ptr<std::ofstream>> outfiles;
         for (size_t i = 0; i < buffs.size(); i++) {
-            // rx_identifier * 2 + i in order to get correct channel number in filename
+            // rxChannel() numbers the files by channel
             const std::string this_filename = generateRxFilename(RA_rx_file,
-                threadnum,
+                rxChannel(threadnum, i),
                 RA_singleTX,
                 0,
                 RA_tx_freq,
@@ -102,15 +109,16 @@ public:
         const auto start_time = std::chrono::steady_clock::now();
         const auto stop_time =
         start_time + std::chrono::milliseconds(int64_t(1000 * RA_time_requested+1000*RA_delay_start_time));
-        // Track time and samps between updating the BW summary
-        auto last_update                     = start_time;
-        unsigned long long last_update_samps = 0;
+        MetricsSlot& rx_metrics = metricsSlot("rx", threadnum);
         int loop_num = 0;
-        while (not RA_stop_signal_called
+        while (not RA_cancel.cancelled()
            and (RA_nsamps >= num_total_samps or RA_nsamps == 0)
            and (RA_time_requested == 0.0 or std::chrono::steady_clock::now() <= stop_time)) {
-            const auto now = std::chrono::steady_clock::now();
             size_t num_rx_samps = rx_streamer->recv(buff_ptrs, RA_spb, md, RA_rx_timeout);
+            rx_metrics.recordRecv(md,
+                num_rx_samps,
+                rx_streamer->get_num_channels(),
+                sizeof(std::complex<short>));
             loop_num += 1;
             if (md.error_code == uhd::rx_metadata_t::ERROR_CODE_TIMEOUT) {
                 std::cout << boost::format("Timeout while streaming") << std::endl;
@@ -146,18 +154,6 @@ public:
                 outfiles[i]->write((const char*)buff_ptrs[i],
                     num_rx_samps * sizeof(std::complex<short>));
             }
-            if(bw_summary){
-                last_update_samps += num_rx_samps;
-                const auto time_since_last_update = now - last_update;
-                if (time_since_last_update > std::chrono::seconds(1)) {
-                    const double time_since_last_update_s =
-                        std::chrono::duration<double>(time_since_last_update).count();
-                    const double rate = double(last_update_samps) / time_since_last_update_s;
-                    std::cout << "\t" << (rate / 1e6) << " Msps" << std::endl;
-                    last_update_samps = 0;
-                    last_update       = now;
-                }
-            }
         }
         const auto actual_stop_time = std::chrono::steady_clock::now();
 
@@ -190,7 +186,7 @@ public:
 {
     // Build Streams for multithreaded implementation
     // TX streams from Host, not replay.
-    // Each Device gets its own RX streamer.
+    // RX streamers follow the rx-streamers layout.
     // Each Channel gets its own TX streamer.
 
     // Constants related to the Replay block
@@ -203,17 +199,14 @@ public:
     uhd::stream_args_t stream_args(RA_format, RA_otw);
     stream_args.args = streamer_args;
     std::cout << "Using streamer args: " << stream_args.args.to_string() << std::endl;
-    // One stream per channel
-    for (int rx_count = 0; rx_count < RA_radio_ctrls.size(); rx_count++) {
-        RA_rx_stream = RA_graph->create_rx_streamer(1, stream_args);
-        RA_rx_stream_vector.push_back(RA_rx_stream);
-    }
+    buildRxStreamers(stream_args);
     /************************************************************************
      * Set up TX streamer from host
      ***********************************************************************/
-    for (int i_s2r = 0; i_s2r < RA_radio_ctrls.size(); i_s2r = i_s2r + 1) {
-        streamer_args["block_id"]   = RA_duc_ctrls[i_s2r]->get_block_id().to_string();
-        streamer_args["block_port"] = std::to_string(0);
+    for (size_t i_s2r = 0; i_s2r < RA_topology.numChannels(); i_s2r = i_s2r + 1) {
+        const TopologyChannel& channel = RA_topology.channel(i_s2r);
+        streamer_args["block_id"] = RA_duc_ctrls[channel.duc]->get_block_id().to_string();
+        streamer_args["block_port"] = std::to_string(channel.duc_port);
         stream_args.args            = streamer_args;
         stream_args.channels        = {0};
 
@@ -231,49 +224,34 @@ void connectGraphMultithreadHostTX() override
     // streaming from host.
     UHD_LOG_INFO("CogRF", "Connecting graph...");
     // Connect Graph
-    for (size_t i = 0; i < RA_radio_ctrls.size(); i++) {
+    for (size_t i = 0; i < RA_topology.numChannels(); i++) {
+        const TopologyChannel& channel = RA_topology.channel(i);
+        const auto& radio              = RA_radio_block_list[channel.radio];
+        const auto ddc                 = RA_ddc_ctrls[channel.ddc]->get_block_id();
         // connect radios to ddc
-        RA_graph->connect(RA_radio_block_list[i], 0, RA_ddc_ctrls[i]->get_block_id(), 0);
-        std::cout << "Connected " << RA_radio_block_list[i] << " to "
-                  << RA_ddc_ctrls[i]->get_block_id() << std::endl;
-                   std::this_thread::sleep_for(std::chrono::milliseconds(100));
-    }
-    // Vector of streamer channels.
-    for (size_t i_chan = 0; i_chan < RA_rx_stream_vector.size(); i_chan++) {
-        if (i_chan % 2 == 0) {
-            RA_rx_stream_chan_vector.push_back(0);
-        } else {
-            RA_rx_stream_chan_vector.push_back(0);
-        }
-    }
-    for (size_t j = 0; j < RA_ddc_ctrls.size(); j++) {
-        // Connect DDC to streamers
-        // Reusing replay chan vector, need a vector of zeros and ones
-        RA_graph->connect(RA_ddc_ctrls[j]->get_block_id(),
-            0,
-            RA_rx_stream_vector[j],
-            RA_rx_stream_chan_vector[j]);
-        std::cout << "Connected " << RA_ddc_ctrls[j]->get_block_id() << " to "
-                  << RA_rx_stream_vector[j] << " Port " << RA_rx_stream_chan_vector[j]
-                  << std::endl;
-                   std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        RA_graph->connect(radio, channel.radio_port, ddc, channel.ddc_port);
+        std::cout << "Connected " << radio << " to " << ddc << std::endl;
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        // Connect DDC to the channel's port on its streamer
+        RA_graph->connect(
+            ddc, channel.ddc_port, RA_rx_stream_vector[i], RA_rx_stream_chan_vector[i]);
+        std::cout << "Connected " << ddc << " to " << RA_rx_stream_vector[i] << " Port "
+                  << RA_rx_stream_chan_vector[i] << std::endl;
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
     }
-    int pos2 = 0;
+    for (size_t i = 0; i < RA_topology.numChannels(); i++) {
+        const TopologyChannel& channel = RA_topology.channel(i);
+        const auto& radio              = RA_radio_block_list[channel.radio];
+        const auto duc                 = RA_duc_ctrls[channel.duc]->get_block_id();
+        RA_graph->connect(duc, channel.duc_port, radio, channel.radio_port);
+        std::cout << "Connected " << duc << " port " << channel.duc_port << " to radio "
+                  << radio << " port " << channel.radio_port << std::endl;
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
 
-    for (auto& rctrl : RA_radio_ctrls) {
-        RA_graph->connect(
-            RA_duc_ctrls[pos2]->get_block_id(), RA_duc_chan, rctrl->get_block_id(), 0);
-        std::cout << "Connected " << RA_duc_ctrls[pos2]->get_block_id() << " port "
-                  << RA_duc_chan << " to radio " << rctrl->get_block_id() << " port " << 0
+        RA_graph->connect(RA_tx_stream_vector[i], 0, duc, channel.duc_port);
+        std::cout << "Streamer: " << RA_tx_stream_vector[i] << " connected to " << duc
                   << std::endl;
-                   std::this_thread::sleep_for(std::chrono::milliseconds(100));
-
-        RA_graph->connect(
-            RA_tx_stream_vector[pos2], 0, RA_duc_ctrls[pos2]->get_block_id(), 0);
-        std::cout << "Streamer: " << RA_tx_stream_vector[pos2] << " connected to "
-                  << RA_replay_ctrls[pos2]->get_block_id() << std::endl;
-                   std::this_thread::sleep_for(std::chrono::milliseconds(100));
-        pos2++;
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
     }
 }
 
@@ -284,14 +262,19 @@ void spawnReceiveThreads() override
 
     // Receive RA_rx_stream_vector.size()
     if (RA_format == "sc16") {
-        for (size_t i = 0; i < RA_rx_stream_vector.size(); i = i + 1) {
+        for (size_t i = 0; i < RA_rx_streamer_channels.size(); i = i + 1) {
             std::cout << "Spawning RX Thread.." << threadnum << std::endl;
             std::thread t(
-                [this](int threadnum, uhd::rx_streamer::sptr rx_streamer, bool bw_summary, bool stats) {
-                    recv(1, threadnum, rx_streamer, bw_summary, stats);
+                [this](int threadnum,
+                    size_t num_channels,
+                    uhd::rx_streamer::sptr rx_streamer,
+                    bool stats) {
+                    recv(num_channels, threadnum, rx_streamer, stats);
                 },
                 threadnum,
-                RA_rx_stream_vector[i], RA_bw_summary, RA_stats);
+                RA_rx_streamer_channels[i].size(),
+                RA_rx_stream_vector[RA_rx_streamer_channels[i].front()],
+                RA_stats);
         
             pthread_setname_np(t.native_handle(), "rx_thread");    
             RA_rx_vector_thread.push_back(std::move(t));
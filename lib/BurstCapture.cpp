@@ -0,0 +1,239 @@
+//
+// Copyright 2021-2022 Ettus Research, a National Instruments Brand
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+//
+
+#include "BurstCapture.hpp"
+#include "TimeIndex.hpp"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+
+namespace {
+const uint64_t default_hugepage_size = 2 << 20;
+// Bytes per write() of the flush
+const size_t flush_chunk = 64 << 20;
+
+/**
+ * @brief Value of a /proc/meminfo field in bytes, 0 if it is missing. Page counts
+ *  such as HugePages_Free are returned as is.
+ */
+uint64_t memInfo(const std::string& field)
+{
+    std::ifstream meminfo("/proc/meminfo");
+    std::string name;
+    uint64_t value;
+    std::string unit;
+    while (meminfo >> name >> value) {
+        std::getline(meminfo, unit);
+        if (name == field + ":") {
+            return unit.find("kB") != std::string::npos ? value << 10 : value;
+        }
+    }
+    return 0;
+}
+
+uint64_t roundUp(uint64_t bytes, uint64_t align)
+{
+    return (bytes + align - 1) / align * align;
+}
+} // namespace
+
+BurstPlan BurstCapture::plan(size_t num_channels, uint64_t nsamps, size_t sample_size)
+{
+    if (nsamps == 0) {
+        throw std::runtime_error("A burst capture needs nsamps");
+    }
+    BurstPlan plan;
+    plan.mem_available  = memInfo("MemAvailable");
+    plan.hugepage_size  = memInfo("Hugepagesize");
+    plan.hugepages_free = memInfo("HugePages_Free") * plan.hugepage_size;
+    if (plan.hugepage_size == 0) {
+        plan.hugepage_size = default_hugepage_size;
+    }
+    plan.bytes = roundUp(nsamps * sample_size, plan.hugepage_size) * num_channels;
+    plan.hugepages = plan.bytes <= plan.hugepages_free;
+    // Leave an eighth of the available memory to the page cache the flush writes
+    // through and to everything else on the host
+    const uint64_t usable = plan.mem_available - plan.mem_available / 8;
+    if (!plan.hugepages && plan.bytes > usable) {
+        throw std::runtime_error("Burst capture of " + std::to_string(nsamps)
+                                 + " samples on " + std::to_string(num_channels)
+                                 + " channels needs " + std::to_string(plan.bytes >> 20)
+                                 + " MB, " + std::to_string(usable >> 20)
+                                 + " MB of memory and "
+                                 + std::to_string(plan.hugepages_free >> 20)
+                                 + " MB of hugepages are available");
+    }
+    return plan;
+}
+
+BurstCapture::BurstCapture(const BurstPlan& plan,
+    size_t num_channels,
+    uint64_t nsamps,
+    size_t sample_size,
+    size_t block_samps)
+    : channels(num_channels), capacity(nsamps), sample_size(sample_size)
+{
+    // The last block of the capture and one cut short by a stop are partial
+    const uint64_t blocks = nsamps / std::max<size_t>(block_samps, 1) + 2;
+    for (auto& ch : channels) {
+        ch.blocks.reserve(blocks);
+    }
+    const uint64_t channel_bytes = roundUp(nsamps * sample_size, plan.hugepage_size);
+    mapping_size                 = channel_bytes * num_channels;
+    const auto started           = std::chrono::steady_clock::now();
+    // Populated here, before the start time, so the RX threads never fault
+    if (plan.hugepages) {
+        mapping = mmap(nullptr,
+            mapping_size,
+            PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_POPULATE,
+            -1,
+            0);
+    }
+    if (!plan.hugepages || mapping == MAP_FAILED) {
+        mapping = mmap(nullptr,
+            mapping_size,
+            PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS,
+            -1,
+            0);
+        if (mapping != MAP_FAILED) {
+            madvise(mapping, mapping_size, MADV_HUGEPAGE);
+            // Faulted after the advice, MAP_POPULATE would map small pages before it
+            for (size_t offset = 0; offset < mapping_size; offset += 4096) {
+                ((volatile uint8_t*)mapping)[offset] = 0;
+            }
+        }
+    }
+    if (mapping == MAP_FAILED) {
+        mapping = nullptr;
+        throw std::runtime_error("Unable to allocate "
+                                 + std::to_string(mapping_size >> 20)
+                                 + " MB for the burst capture: " + std::strerror(errno));
+    }
+    // Locked so the capture cannot be swapped out between receiving and flushing,
+    // best effort as it needs CAP_IPC_LOCK or a high RLIMIT_MEMLOCK
+    const bool locked = mlock(mapping, mapping_size) == 0;
+    for (size_t i = 0; i < num_channels; i++) {
+        channels[i].data = (uint8_t*)mapping + i * channel_bytes;
+    }
+    std::cout << "Burst capture: " << (mapping_size >> 20) << " MB for " << nsamps
+              << " samples on " << num_channels << " channels, "
+              << (plan.hugepages ? "hugepages" : "transparent hugepages")
+              << (locked ? ", locked" : "") << ", prefaulted in "
+              << std::chrono::duration<double>(std::chrono::steady_clock::now() - started)
+                     .count()
+              << " s" << std::endl;
+}
+
+BurstCapture::~BurstCapture()
+{
+    if (mapping != nullptr) {
+        munmap(mapping, mapping_size);
+    }
+}
+
+void BurstCapture::commit(
+    size_t channel, int64_t full_secs, double frac_secs, size_t nsamps)
+{
+    Channel& ch = channels[channel];
+    nsamps      = std::min<uint64_t>(nsamps, capacity - ch.received);
+    if (nsamps == 0) {
+        return;
+    }
+    ch.received += nsamps;
+    ch.blocks.push_back({full_secs, frac_secs, nsamps});
+}
+
+uint64_t BurstCapture::flush(const PathFn& path_for,
+    double sample_rate,
+    size_t index_interval,
+    size_t max_threads)
+{
+    // Paths first, generating them creates the folders
+    std::vector<std::string> paths;
+    uint64_t bytes = 0;
+    for (size_t channel = 0; channel < channels.size(); channel++) {
+        paths.push_back(path_for(channel));
+        bytes += channels[channel].received * sample_size;
+    }
+    const auto started = std::chrono::steady_clock::now();
+    std::atomic<size_t> next_channel{0};
+    std::mutex error_mutex;
+    std::string error;
+    std::vector<std::thread> writers;
+    const size_t num_threads =
+        std::max<size_t>(1, std::min(max_threads, channels.size()));
+    for (size_t i = 0; i < num_threads; i++) {
+        writers.emplace_back([&]() {
+            for (size_t channel = next_channel++; channel < channels.size();
+                 channel      = next_channel++) {
+                try {
+                    flushChannel(channel, paths[channel], sample_rate, index_interval);
+                } catch (const std::exception& e) {
+                    std::lock_guard<std::mutex> lock(error_mutex);
+                    error = e.what();
+                }
+            }
+        });
+    }
+    for (auto& writer : writers) {
+        writer.join();
+    }
+    if (!error.empty()) {
+        throw std::runtime_error(error);
+    }
+    const double seconds =
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+    std::cout << "Burst capture: flushed " << (bytes >> 20) << " MB on " << num_threads
+              << " threads in " << seconds << " s ("
+              << (seconds > 0 ? bytes / seconds / 1e6 : 0) << " MB/s)" << std::endl;
+    return bytes;
+}
+
+void BurstCapture::flushChannel(
+    size_t channel, const std::string& path, double sample_rate, size_t interval)
+{
+    const Channel& ch = channels[channel];
+    const int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        throw std::runtime_error(
+            "Unable to create " + path + ": " + std::strerror(errno));
+    }
+    const uint8_t* data = ch.data;
+    uint64_t left       = ch.received * sample_size;
+    while (left > 0) {
+        const ssize_t written = write(fd, data, std::min<uint64_t>(left, flush_chunk));
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+        if (written <= 0) {
+            const std::string reason = std::strerror(errno);
+            close(fd);
+            throw std::runtime_error("Failed writing " + path + ": " + reason);
+        }
+        data += written;
+        left -= written;
+    }
+    close(fd);
+    if (interval > 0) {
+        TimeIndexWriter index(path + ".idx", sample_rate, sample_size, interval);
+        for (const Block& block : ch.blocks) {
+            index.record(block.full_secs, block.frac_secs, block.nsamps);
+        }
+    }
+}
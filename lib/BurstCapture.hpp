@@ -0,0 +1,123 @@
+//
+// Copyright 2021-2022 Ettus Research, a National Instruments Brand
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+//
+
+#ifndef BURSTCAPTURE_H
+#define BURSTCAPTURE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+/**
+ * @brief Memory needed by a burst capture and where it comes from, see
+ *  BurstCapture::plan().
+ */
+struct BurstPlan
+{
+    uint64_t bytes          = 0;
+    uint64_t mem_available  = 0;
+    uint64_t hugepages_free = 0;
+    uint64_t hugepage_size  = 0;
+    // Whole capture fits the free preallocated hugepages
+    bool hugepages = false;
+};
+
+/**
+ * @brief Bounded capture of every channel into RAM. The whole capture is allocated
+ *  and prefaulted before streaming, from the preallocated hugepages when they hold it
+ *  and from transparent hugepages otherwise, so the RX threads receive straight into
+ *  it without page faults or I/O. flush() writes the channels to their files in
+ *  parallel once streaming stopped.
+ */
+class BurstCapture
+{
+public:
+    /**
+     * @brief Capture file of a channel, e.g. from RefArch::generateRxFilename().
+     */
+    using PathFn = std::function<std::string(size_t channel)>;
+
+    /**
+     * @brief Sizes a capture of nsamps samples of sample_size bytes per channel
+     *  against /proc/meminfo. Throws if it does not fit the free hugepages or the
+     *  available memory less a margin for the rest of the system.
+     */
+    static BurstPlan plan(size_t num_channels, uint64_t nsamps, size_t sample_size);
+
+    /**
+     * @brief Allocates the capture, and the time of a block per block_samps samples of
+     *  every channel, block_samps being what each recv() asks for, so commit() does not
+     *  allocate while streaming.
+     */
+    BurstCapture(const BurstPlan& plan,
+        size_t num_channels,
+        uint64_t nsamps,
+        size_t sample_size,
+        size_t block_samps);
+    ~BurstCapture();
+    BurstCapture(const BurstCapture&) = delete;
+    BurstCapture& operator=(const BurstCapture&) = delete;
+
+    /**
+     * @brief Where the next samples of channel go, room for remaining(channel) of them.
+     */
+    void* next(size_t channel)
+    {
+        return channels[channel].data + channels[channel].received * sample_size;
+    }
+    uint64_t remaining(size_t channel) const
+    {
+        return capacity - channels[channel].received;
+    }
+    /**
+     * @brief Accepts the nsamps samples received into next(channel), the first of them
+     *  at device time full_secs + frac_secs. Only a recv() short of block_samps, such as
+     *  the last one before a stop, takes a block beyond those reserved.
+     */
+    void commit(size_t channel, int64_t full_secs, double frac_secs, size_t nsamps);
+    uint64_t received(size_t channel) const
+    {
+        return channels[channel].received;
+    }
+
+    /**
+     * @brief Writes the received samples of every channel to path_for(channel), and
+     *  its time index when index_interval is not 0, on up to max_threads threads.
+     *
+     * @return uint64_t bytes written
+     */
+    uint64_t flush(const PathFn& path_for,
+        double sample_rate,
+        size_t index_interval,
+        size_t max_threads);
+
+private:
+    struct Block
+    {
+        int64_t full_secs;
+        double frac_secs;
+        uint64_t nsamps;
+    };
+    struct Channel
+    {
+        uint8_t* data     = nullptr;
+        uint64_t received = 0;
+        // Time of every received block, for the time index
+        std::vector<Block> blocks;
+    };
+    void flushChannel(
+        size_t channel, const std::string& path, double sample_rate, size_t interval);
+
+    std::vector<Channel> channels;
+    uint64_t capacity;
+    size_t sample_size;
+    void* mapping       = nullptr;
+    size_t mapping_size = 0;
+};
+
+#endif
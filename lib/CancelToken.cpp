@@ -0,0 +1,73 @@
+//
+// Copyright 2021-2022 Ettus Research, a National Instruments Brand
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+//
+
+#include "CancelToken.hpp"
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <stdexcept>
+
+CancelToken::CancelToken()
+{
+    event_id = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (event_id < 0) {
+        throw std::runtime_error("Unable to create the cancellation eventfd");
+    }
+}
+
+CancelToken::~CancelToken()
+{
+    close(event_id);
+}
+
+void CancelToken::cancel(CancelReason reason)
+{
+    state.fetch_or(reason, std::memory_order_acq_rel);
+    wake();
+}
+
+void CancelToken::clear(CancelReason reason)
+{
+    if ((state.fetch_and(~reason, std::memory_order_acq_rel) & ~reason) == 0) {
+        uint64_t drain;
+        while (read(event_id, &drain, sizeof(drain)) > 0) {
+        }
+        // A cancel() may have raced with the drain, keep the eventfd readable for it
+        if (cancelled()) {
+            wake();
+        }
+    }
+}
+
+void CancelToken::signal()
+{
+    if (graceful_on_signal.load() && !cancelled()) {
+        cancel(CANCEL_GRACEFUL);
+    } else {
+        cancel(CANCEL_IMMEDIATE);
+    }
+}
+
+void CancelToken::wake()
+{
+    // Only write() is used, this runs in the signal handler. It can only fail when the
+    // counter is about to overflow, in which case the eventfd is readable anyway.
+    const uint64_t one = 1;
+    ssize_t written    = write(event_id, &one, sizeof(one));
+    (void)written;
+}
+
+bool CancelToken::wait(int timeout_ms) const
+{
+    if (cancelled()) {
+        return true;
+    }
+    struct pollfd poll_fd;
+    poll_fd.fd     = event_id;
+    poll_fd.events = POLLIN;
+    poll(&poll_fd, 1, timeout_ms);
+    return cancelled();
+}
@@ -0,0 +1,95 @@
+//
+// Copyright 2021-2022 Ettus Research, a National Instruments Brand
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+//
+
+#ifndef CANCELTOKEN_H
+#define CANCELTOKEN_H
+
+#include <atomic>
+
+/**
+ * @brief Why a CancelToken was cancelled. Several reasons can be set at once.
+ */
+enum CancelReason {
+    // Stop every loop now (second Ctrl+C, or Ctrl+C without graceful-stop)
+    CANCEL_IMMEDIATE = 1,
+    // Stop the streams at a common time and drain them (first Ctrl+C with graceful-stop)
+    CANCEL_GRACEFUL = 2,
+    // RefArch::joinAllThreads() stopping the TX threads once RX is done
+    CANCEL_TX = 4
+};
+
+/**
+ * @brief Cooperative cancellation shared by the RX and TX threads and the signal
+ *  handler. The state is a lock-free atomic and an eventfd that is readable while the
+ *  token is cancelled, so threads sleeping in poll()/epoll can be woken instead of
+ *  polling the flag. cancel() and signal() are async-signal-safe.
+ */
+class CancelToken
+{
+public:
+    CancelToken();
+    ~CancelToken();
+    CancelToken(const CancelToken&) = delete;
+    CancelToken& operator=(const CancelToken&) = delete;
+
+    void cancel(CancelReason reason = CANCEL_IMMEDIATE);
+    /**
+     * @brief Clears reason. The eventfd is drained once no reason is left.
+     */
+    void clear(CancelReason reason);
+    /**
+     * @brief For the SIGINT handler: requests a graceful stop the first time if
+     *  enabled with setGracefulOnSignal(), an immediate stop otherwise.
+     */
+    void signal();
+    void setGracefulOnSignal(bool graceful)
+    {
+        graceful_on_signal.store(graceful);
+    }
+    bool cancelled() const
+    {
+        return state.load(std::memory_order_acquire) != 0;
+    }
+    /**
+     * @brief Only a graceful stop was requested, loops that support it keep going
+     *  until the stop time.
+     */
+    bool graceful() const
+    {
+        return state.load(std::memory_order_acquire) == CANCEL_GRACEFUL;
+    }
+    /**
+     * @brief Cancelled for any reason other than a graceful stop.
+     */
+    bool stopNow() const
+    {
+        return (state.load(std::memory_order_acquire) & ~CANCEL_GRACEFUL) != 0;
+    }
+    /**
+     * @brief eventfd that is readable while the token is cancelled. Writes are made on
+     *  every cancel(), so it can also be watched edge triggered.
+     */
+    int fd() const
+    {
+        return event_id;
+    }
+    /**
+     * @brief Sleeps up to timeout_ms or until cancelled.
+     *
+     * @return bool cancelled()
+     */
+    bool wait(int timeout_ms) const;
+
+private:
+    void wake();
+
+    static_assert(std::atomic<int>::is_always_lock_free, "signal handler needs this");
+    std::atomic<int> state{0};
+    std::atomic<bool> graceful_on_signal{false};
+    int event_id;
+};
+
+#endif
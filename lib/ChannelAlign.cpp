@@ -0,0 +1,313 @@
+//
+// Copyright 2021-2022 Ettus Research, a National Instruments Brand
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+//
+
+#include "ChannelAlign.hpp"
+#include "DatReader.hpp"
+#include "Fft.hpp"
+#include "SampleConvert.hpp"
+#include <boost/filesystem.hpp>
+#include <algorithm>
+#include <cmath>
+#include <complex>
+#include <regex>
+#include <stdexcept>
+#include <thread>
+#if defined(__x86_64__) || defined(__i386__)
+#    include <immintrin.h>
+#    define RA_ALIGN_X86 1
+#endif
+
+namespace {
+void crossAccumulateScalar(std::complex<float>* cross,
+    const std::complex<float>* spectrum,
+    const std::complex<float>* reference,
+    size_t size)
+{
+    for (size_t k = 0; k < size; k++) {
+        const float a = spectrum[k].real(), b = spectrum[k].imag();
+        const float c = reference[k].real(), d = reference[k].imag();
+        cross[k] += std::complex<float>(a * c + b * d, b * c - a * d);
+    }
+}
+
+#ifdef RA_ALIGN_X86
+// cross += spectrum * conj(reference), four bins per iteration
+__attribute__((target("avx2"))) void crossAccumulateAvx2(std::complex<float>* cross,
+    const std::complex<float>* spectrum,
+    const std::complex<float>* reference,
+    size_t size)
+{
+    float* acc        = (float*)cross;
+    const float* x    = (const float*)spectrum;
+    const float* r    = (const float*)reference;
+    const __m256 sign = _mm256_set1_ps(-0.0f);
+    size_t k          = 0;
+    for (; k + 4 <= size; k += 4) {
+        // x = a + bi, r = c + di
+        const __m256 xv      = _mm256_loadu_ps(x + 2 * k);
+        const __m256 rv      = _mm256_loadu_ps(r + 2 * k);
+        const __m256 ac_bc   = _mm256_mul_ps(xv, _mm256_moveldup_ps(rv));
+        const __m256 ba      = _mm256_permute_ps(xv, 0xb1);
+        const __m256 bd_ad   = _mm256_mul_ps(ba, _mm256_movehdup_ps(rv));
+        // Even lanes ac + bd, odd lanes bc - ad
+        const __m256 product = _mm256_addsub_ps(ac_bc, _mm256_xor_ps(bd_ad, sign));
+        const __m256 sum     = _mm256_add_ps(_mm256_loadu_ps(acc + 2 * k), product);
+        _mm256_storeu_ps(acc + 2 * k, sum);
+    }
+    crossAccumulateScalar(cross + k, spectrum + k, reference + k, size - k);
+}
+#endif
+
+void crossAccumulate(std::complex<float>* cross,
+    const std::complex<float>* spectrum,
+    const std::complex<float>* reference,
+    size_t size)
+{
+#ifdef RA_ALIGN_X86
+    if (bestConvertIsa() != CONVERT_SCALAR) {
+        crossAccumulateAvx2(cross, spectrum, reference, size);
+        return;
+    }
+#endif
+    crossAccumulateScalar(cross, spectrum, reference, size);
+}
+
+double energy(const std::complex<float>* spectrum, size_t size)
+{
+    double sum = 0;
+    for (size_t k = 0; k < size; k++) {
+        sum += std::norm(spectrum[k]);
+    }
+    return sum;
+}
+
+/**
+ * @brief Frequency of FFT bin k in cycles per sample, -0.5 to 0.5.
+ */
+double binFrequency(size_t k, size_t size)
+{
+    return (k < size / 2 ? double(k) : double(k) - double(size)) / double(size);
+}
+
+/**
+ * @brief Delay of the cross spectrum beyond the integer lag peak, from a weighted
+ *  least squares fit of its phase over frequency. With the integer lag removed the
+ *  phase turns by less than pi/2 across the band, so it needs no unwrapping. Returns
+ *  0 when the energy is in a single bin (a tone), whose delay is ambiguous.
+ */
+double fractionalDelay(const std::vector<std::complex<double>>& cross, long peak)
+{
+    const size_t size = cross.size();
+    std::vector<std::complex<double>> derotated(size);
+    std::complex<double> sum = 0;
+    for (size_t k = 0; k < size; k++) {
+        const double turn = 2 * M_PI * binFrequency(k, size) * peak;
+        derotated[k]      = cross[k] * std::polar(1.0, turn);
+        sum += derotated[k];
+    }
+    const std::complex<double> center = std::polar(1.0, -std::arg(sum));
+    double w = 0, wf = 0, wff = 0, wp = 0, wfp = 0;
+    for (size_t k = 0; k < size; k++) {
+        const double weight = std::abs(derotated[k]);
+        const double f      = binFrequency(k, size);
+        const double phase  = std::arg(derotated[k] * center);
+        w += weight;
+        wf += weight * f;
+        wff += weight * f * f;
+        wp += weight * phase;
+        wfp += weight * f * phase;
+    }
+    const double spread = wff - wf * wf / std::max(w, 1e-300);
+    if (w <= 0 || spread <= 1e-9 * w) {
+        return 0;
+    }
+    // phase = phase_0 - 2 pi f delay
+    const double slope = (wfp - wf * wp / w) / spread;
+    return -slope / (2 * M_PI);
+}
+
+/**
+ * @brief Cross spectra and spectral energies of one worker's blocks.
+ */
+struct Accumulator
+{
+    std::vector<std::vector<std::complex<float>>> cross;
+    std::vector<double> energy;
+};
+
+void accumulateBlocks(const DatReader& captures,
+    size_t reference,
+    const Fft& fft,
+    uint64_t offset,
+    uint64_t first_block,
+    uint64_t last_block,
+    Accumulator& accumulator)
+{
+    const size_t size  = fft.size();
+    const size_t block = size / 2;
+    accumulator.cross.assign(
+        captures.channels(), std::vector<std::complex<float>>(size, {0.0f, 0.0f}));
+    accumulator.energy.assign(captures.channels(), 0);
+    // The transforms run in place, the zero padding is restored for every block
+    std::vector<std::complex<float>> reference_spectrum(size);
+    std::vector<std::complex<float>> spectrum(size);
+    for (uint64_t b = first_block; b < last_block; b++) {
+        const uint64_t start = offset + b * block;
+        std::fill(reference_spectrum.begin() + block, reference_spectrum.end(), 0.0f);
+        convertSc16ToFc32(captures.data(reference) + start,
+            reference_spectrum.data(),
+            block,
+            1.0f / 32768);
+        fft.forward(reference_spectrum.data());
+        for (size_t c = 0; c < captures.channels(); c++) {
+            const std::complex<float>* channel_spectrum = reference_spectrum.data();
+            if (c != reference) {
+                std::fill(spectrum.begin() + block, spectrum.end(), 0.0f);
+                convertSc16ToFc32(
+                    captures.data(c) + start, spectrum.data(), block, 1.0f / 32768);
+                fft.forward(spectrum.data());
+                channel_spectrum = spectrum.data();
+            }
+            crossAccumulate(accumulator.cross[c].data(),
+                channel_spectrum,
+                reference_spectrum.data(),
+                size);
+            accumulator.energy[c] += energy(channel_spectrum, size);
+        }
+    }
+}
+} // namespace
+
+std::vector<CaptureFile> findCaptureFiles(const std::vector<std::string>& paths)
+{
+    namespace fs = boost::filesystem;
+    const std::regex pattern("tx_([0-9]+)_rx_([0-9]+)_run_([0-9]+)_cw_.*\\.dat$");
+    std::vector<CaptureFile> files;
+    auto add = [&](const fs::path& path) {
+        std::smatch match;
+        const std::string name = path.filename().string();
+        if (fs::is_regular_file(path) && std::regex_search(name, match, pattern)) {
+            files.push_back({path.string(),
+                std::stoi(match[1]),
+                size_t(std::stoul(match[2])),
+                std::stoi(match[3])});
+        }
+    };
+    for (const auto& path : paths) {
+        if (fs::is_directory(path)) {
+            for (fs::recursive_directory_iterator it(path), end; it != end; ++it) {
+                add(it->path());
+            }
+        } else if (fs::exists(path)) {
+            add(path);
+        } else {
+            throw std::runtime_error("No such capture file or directory " + path);
+        }
+    }
+    std::sort(files.begin(), files.end(), [](const CaptureFile& a, const CaptureFile& b) {
+        return a.run != b.run ? a.run < b.run : a.rx_channel < b.rx_channel;
+    });
+    return files;
+}
+
+std::vector<ChannelAlignment> alignChannels(const std::vector<CaptureFile>& files,
+    size_t reference,
+    const AlignSettings& settings)
+{
+    if (reference >= files.size()) {
+        throw std::runtime_error("The reference channel has no capture");
+    }
+    const Fft fft(settings.fft_size);
+    const size_t size  = settings.fft_size;
+    const size_t block = size / 2;
+    if (settings.max_lag >= block) {
+        throw std::runtime_error("max-lag must be less than half the FFT size");
+    }
+    size_t threads = settings.threads;
+    if (threads == 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    std::vector<std::string> paths;
+    for (const auto& file : files) {
+        paths.push_back(file.path);
+    }
+    DatReader captures(paths, threads);
+    uint64_t samples = captures.commonSamples();
+    samples          = samples > settings.offset ? samples - settings.offset : 0;
+    if (settings.max_samples > 0) {
+        samples = std::min(samples, settings.max_samples);
+    }
+    const uint64_t blocks = samples / block;
+    if (blocks == 0) {
+        throw std::runtime_error("The captures are shorter than one correlation block");
+    }
+    // Contiguous block ranges per thread keep the reads sequential
+    threads = std::min<uint64_t>(threads, blocks);
+    std::vector<Accumulator> accumulators(threads);
+    captures.pool().parallelFor(threads, [&](size_t t) {
+        accumulateBlocks(captures,
+            reference,
+            fft,
+            settings.offset,
+            blocks * t / threads,
+            blocks * (t + 1) / threads,
+            accumulators[t]);
+    });
+
+    std::vector<ChannelAlignment> alignments;
+    std::vector<std::complex<double>> total(size);
+    std::vector<std::complex<float>> correlation(size);
+    double reference_energy = 0;
+    for (const auto& accumulator : accumulators) {
+        reference_energy += accumulator.energy[reference];
+    }
+    for (size_t c = 0; c < captures.channels(); c++) {
+        std::fill(total.begin(), total.end(), 0.0);
+        double channel_energy = 0;
+        for (const auto& accumulator : accumulators) {
+            for (size_t k = 0; k < size; k++) {
+                total[k] += std::complex<double>(accumulator.cross[c][k]);
+            }
+            channel_energy += accumulator.energy[c];
+        }
+        for (size_t k = 0; k < size; k++) {
+            correlation[k] = std::complex<float>(total[k]);
+        }
+        fft.inverse(correlation.data());
+
+        // Lag l of the correlation is at index l mod size
+        auto magnitude = [&](long lag) {
+            return std::norm(correlation[(lag + long(size)) % long(size)]);
+        };
+        const long max_lag = long(settings.max_lag);
+        long peak          = 0;
+        for (long lag = -max_lag; lag <= max_lag; lag++) {
+            if (magnitude(lag) > magnitude(peak)) {
+                peak = lag;
+            }
+        }
+        const double fraction = fractionalDelay(total, peak);
+        // The correlation at the fractional lag, the unscaled inverse DFT at one point
+        std::complex<double> value = 0;
+        for (size_t k = 0; k < size; k++) {
+            const double turn = 2 * M_PI * binFrequency(k, size) * (peak + fraction);
+            value += total[k] * std::polar(1.0, turn);
+        }
+
+        ChannelAlignment alignment;
+        alignment.rx_channel    = files[c].rx_channel;
+        alignment.delay_samples = double(peak) + fraction;
+        alignment.phase_deg     = std::arg(value) * 180.0 / M_PI;
+        alignment.amplitude_db  = 10 * std::log10(
+            std::max(channel_energy, 1e-30) / std::max(reference_energy, 1e-30));
+        // Unscaled inverse DFT against the spectral energies, the 1/size factors cancel
+        const double energies = std::max(channel_energy * reference_energy, 1e-60);
+        alignment.coherence   = std::abs(value) / std::sqrt(energies);
+        alignment.samples     = blocks * block;
+        alignments.push_back(alignment);
+    }
+    return alignments;
+}
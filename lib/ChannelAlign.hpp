@@ -0,0 +1,74 @@
+//
+// Copyright 2021-2022 Ettus Research, a National Instruments Brand
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+//
+
+#ifndef CHANNELALIGN_H
+#define CHANNELALIGN_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+ * @brief A per channel sc16 capture, named by RefArch::generateRxFilename()
+ *  (<base>.tx_<tx>_rx_<rx>_run_<run>_cw_<freq>.dat).
+ */
+struct CaptureFile
+{
+    std::string path;
+    int tx_channel;
+    size_t rx_channel;
+    int run;
+};
+
+/**
+ * @brief Captures named by generateRxFilename() in paths, which are files or
+ *  directories searched recursively, sorted by run and rx channel.
+ */
+std::vector<CaptureFile> findCaptureFiles(const std::vector<std::string>& paths);
+
+struct AlignSettings
+{
+    // Correlation FFT size, a power of two. Each block holds fft_size / 2 samples
+    // zero padded to fft_size, so the correlation is linear up to that lag.
+    size_t fft_size = 16384;
+    // Lags searched for the peak, less than fft_size / 2
+    size_t max_lag = 1000;
+    // Samples skipped at the start of every file, e.g. the settling of the radios
+    uint64_t offset = 0;
+    // Samples analyzed per channel, 0 for the length of the shortest file
+    uint64_t max_samples = 0;
+    // Worker threads, 0 for one per CPU
+    size_t threads = 0;
+};
+
+struct ChannelAlignment
+{
+    size_t rx_channel;
+    // Delay of the channel behind the reference, positive when it is late. Only the
+    // phase is meaningful for a single tone, whose correlation has no unique peak.
+    double delay_samples;
+    // Phase of the channel relative to the reference at the correlation peak
+    double phase_deg;
+    // Power of the channel relative to the reference
+    double amplitude_db;
+    // Correlation peak normalized by the channel energies, 1.0 for identical signals
+    double coherence;
+    uint64_t samples;
+};
+
+/**
+ * @brief Cross correlates every capture in files against files[reference]. The files
+ *  are memory mapped by a DatReader and split into blocks that the worker threads
+ *  transform and accumulate as cross spectra, so the whole capture is averaged with
+ *  one inverse FFT per channel at the end. The sub sample delay comes from the phase
+ *  slope of the averaged cross spectrum.
+ */
+std::vector<ChannelAlignment> alignChannels(const std::vector<CaptureFile>& files,
+    size_t reference,
+    const AlignSettings& settings);
+
+#endif
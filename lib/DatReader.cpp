@@ -0,0 +1,433 @@
+//
+// Copyright 2021-2022 Ettus Research, a National Instruments Brand
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+//
+
+#include "DatReader.hpp"
+#include "SampleConvert.hpp"
+#include "Sc16Codec.hpp"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+
+#ifndef MADV_POPULATE_READ
+#    define MADV_POPULATE_READ 22 /* Linux 5.14 */
+#endif
+
+namespace {
+const uint64_t SAMPLE_SIZE = sizeof(std::complex<int16_t>);
+
+size_t poolSize(size_t files, size_t threads)
+{
+    if (threads > 0) {
+        return threads;
+    }
+    return std::max<size_t>(
+        1, std::min<size_t>(files, std::thread::hardware_concurrency()));
+}
+
+/**
+ * @brief Page aligned span covering bytes [offset, offset + nbytes) of a mapping.
+ */
+std::pair<uint8_t*, size_t> pageSpan(void* base, uint64_t offset, uint64_t nbytes)
+{
+    static const uint64_t page_size = sysconf(_SC_PAGESIZE);
+    const uint64_t first            = offset / page_size * page_size;
+    const uint64_t last = (offset + nbytes + page_size - 1) / page_size * page_size;
+    return {(uint8_t*)base + first, last - first};
+}
+} // namespace
+
+TaskPool::TaskPool(size_t threads)
+{
+    for (size_t i = 0; i < std::max<size_t>(threads, 1); i++) {
+        workers.emplace_back([this]() { run(); });
+    }
+}
+
+TaskPool::~TaskPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(pool_mutex);
+        stopping = true;
+    }
+    task_cv.notify_all();
+    for (auto& worker : workers) {
+        worker.join();
+    }
+}
+
+void TaskPool::submit(std::function<void()> task)
+{
+    {
+        std::lock_guard<std::mutex> lock(pool_mutex);
+        tasks.push_back(std::move(task));
+        pending++;
+    }
+    task_cv.notify_one();
+}
+
+void TaskPool::wait()
+{
+    std::unique_lock<std::mutex> lock(pool_mutex);
+    done_cv.wait(lock, [this]() { return pending == 0; });
+}
+
+void TaskPool::parallelFor(size_t count, const std::function<void(size_t)>& fn)
+{
+    for (size_t i = 0; i < count; i++) {
+        submit([&fn, i]() { fn(i); });
+    }
+    wait();
+}
+
+void TaskPool::run()
+{
+    std::unique_lock<std::mutex> lock(pool_mutex);
+    while (true) {
+        task_cv.wait(lock, [this]() { return stopping || !tasks.empty(); });
+        if (tasks.empty()) {
+            return;
+        }
+        std::function<void()> task = std::move(tasks.front());
+        tasks.pop_front();
+        lock.unlock();
+        try {
+            task();
+        } catch (const std::exception& e) {
+            std::cerr << "Task failed: " << e.what() << std::endl;
+        }
+        lock.lock();
+        if (--pending == 0) {
+            done_cv.notify_all();
+        }
+    }
+}
+
+DatReader::DatReader(const std::vector<std::string>& paths, size_t threads)
+    : task_pool(poolSize(paths.size(), threads))
+{
+    for (const auto& path : paths) {
+        try {
+            files.push_back(mapFile(path));
+        } catch (const std::runtime_error&) {
+            unmapFiles();
+            throw;
+        }
+    }
+}
+
+DatReader::MappedFile DatReader::mapFile(const std::string& path)
+{
+    MappedFile file;
+    file.path                    = path;
+    const std::string index_path = path + ".idx";
+    if (access(index_path.c_str(), F_OK) == 0) {
+        try {
+            file.index.reset(new TimeIndex(index_path));
+        } catch (const std::runtime_error& e) {
+            std::cerr << e.what() << ", seeking by time is unavailable" << std::endl;
+        }
+    }
+    // The index records the sample size, captures without one are taken to be sc16
+    if (file.index && file.index->sampleSize() != SAMPLE_SIZE) {
+        throw std::runtime_error("Capture " + path + " holds "
+                                 + std::to_string(file.index->sampleSize())
+                                 + " byte samples, only sc16 captures can be read");
+    }
+    const int fd = open(path.c_str(), O_RDONLY);
+    struct stat info;
+    if (fd < 0 || fstat(fd, &info) != 0) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        throw std::runtime_error("Unable to open capture " + path);
+    }
+    file.samples = info.st_size / SAMPLE_SIZE;
+    if (file.samples > 0) {
+        void* mapping =
+            mmap(nullptr, file.samples * SAMPLE_SIZE, PROT_READ, MAP_SHARED, fd, 0);
+        if (mapping == MAP_FAILED) {
+            close(fd);
+            throw std::runtime_error("Unable to map capture " + path);
+        }
+        // Read front to back, the kernel may read ahead further than the prefetch
+        madvise(mapping, file.samples * SAMPLE_SIZE, MADV_SEQUENTIAL);
+        file.data = (std::complex<int16_t>*)mapping;
+    }
+    close(fd);
+    return file;
+}
+
+void DatReader::unmapFiles()
+{
+    for (const auto& file : files) {
+        if (file.data != nullptr) {
+            munmap(file.data, file.samples * SAMPLE_SIZE);
+        }
+    }
+    files.clear();
+}
+
+DatReader::~DatReader()
+{
+    task_pool.wait();
+    unmapFiles();
+}
+
+uint64_t DatReader::commonSamples() const
+{
+    uint64_t common = files.empty() ? 0 : UINT64_MAX;
+    for (const auto& file : files) {
+        common = std::min(common, file.samples);
+    }
+    return common;
+}
+
+uint64_t DatReader::sampleAt(size_t channel, int64_t full_secs, double frac_secs) const
+{
+    if (channel >= files.size() || !files[channel].index) {
+        throw std::runtime_error("No time index for channel " + std::to_string(channel));
+    }
+    return std::min(
+        files[channel].index->sampleAt(full_secs, frac_secs), files[channel].samples);
+}
+
+void DatReader::setRange(uint64_t start, uint64_t count, uint64_t chunk_samples)
+{
+    task_pool.wait();
+    const uint64_t common = commonSamples();
+    if (start > common) {
+        throw std::runtime_error("Range starts past the end of the captures");
+    }
+    if (count == 0 || count > common - start) {
+        count = common - start;
+    }
+    this->chunk_samples = std::max<uint64_t>(chunk_samples, 1);
+    position            = start;
+    range_end           = start + count;
+    previous_count      = 0;
+    prefetch(position, std::min(this->chunk_samples, range_end - position));
+}
+
+bool DatReader::next(Chunk& chunk)
+{
+    // Wait for the faults of this chunk, then queue those of the following one
+    task_pool.wait();
+    if (previous_count > 0) {
+        release(previous, previous_count);
+        previous_count = 0;
+    }
+    if (position >= range_end) {
+        return false;
+    }
+    chunk.start = position;
+    chunk.count = std::min(chunk_samples, range_end - position);
+    chunk.samples.resize(files.size());
+    for (size_t i = 0; i < files.size(); i++) {
+        chunk.samples[i] = files[i].data + position;
+    }
+    previous       = position;
+    previous_count = chunk.count;
+    position += chunk.count;
+    if (position < range_end) {
+        prefetch(position, std::min(chunk_samples, range_end - position));
+    }
+    return true;
+}
+
+void DatReader::prefetch(uint64_t start, uint64_t count)
+{
+    for (const auto& file : files) {
+        if (file.data == nullptr) {
+            continue;
+        }
+        const auto span = pageSpan(file.data, start * SAMPLE_SIZE, count * SAMPLE_SIZE);
+        task_pool.submit([span]() {
+            if (madvise(span.first, span.second, MADV_POPULATE_READ) == 0) {
+                return;
+            }
+            // Kernels before 5.14, touch every page instead
+            static const size_t page_size = sysconf(_SC_PAGESIZE);
+            volatile uint8_t sum          = 0;
+            for (size_t offset = 0; offset < span.second; offset += page_size) {
+                sum += span.first[offset];
+            }
+        });
+    }
+}
+
+void DatReader::release(uint64_t start, uint64_t count)
+{
+    // The pages stay in the page cache, only the process mapping is dropped. The
+    // partial pages at both ends are shared with the neighbouring chunks.
+    static const uint64_t page_size = sysconf(_SC_PAGESIZE);
+    const uint64_t first = (start * SAMPLE_SIZE + page_size - 1) / page_size * page_size;
+    const uint64_t last  = (start + count) * SAMPLE_SIZE / page_size * page_size;
+    if (last <= first) {
+        return;
+    }
+    for (const auto& file : files) {
+        if (file.data != nullptr) {
+            madvise((uint8_t*)file.data + first, last - first, MADV_DONTNEED);
+        }
+    }
+}
+
+uint64_t DatReader::readFc32(
+    uint64_t start, uint64_t count, std::complex<float>* const* out)
+{
+    const uint64_t common = commonSamples();
+    if (start >= common) {
+        return 0;
+    }
+    count = std::min(count, common - start);
+    task_pool.parallelFor(files.size(), [&](size_t i) {
+        convertSc16ToFc32(files[i].data + start, out[i], count, 1.0f / 32768);
+    });
+    return count;
+}
+
+extern "C" {
+
+ra_dat_reader* ra_dat_open(const char* const* paths, uint32_t num_paths, uint32_t threads)
+{
+    try {
+        return (ra_dat_reader*)new DatReader(
+            std::vector<std::string>(paths, paths + num_paths), threads);
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return nullptr;
+    }
+}
+
+void ra_dat_close(ra_dat_reader* reader)
+{
+    delete (DatReader*)reader;
+}
+
+uint32_t ra_dat_channels(const ra_dat_reader* reader)
+{
+    return ((const DatReader*)reader)->channels();
+}
+
+uint64_t ra_dat_samples(const ra_dat_reader* reader, uint32_t channel)
+{
+    const DatReader* dat = (const DatReader*)reader;
+    return channel < dat->channels() ? dat->samples(channel) : 0;
+}
+
+uint64_t ra_dat_common_samples(const ra_dat_reader* reader)
+{
+    return ((const DatReader*)reader)->commonSamples();
+}
+
+const void* ra_dat_data(const ra_dat_reader* reader, uint32_t channel)
+{
+    const DatReader* dat = (const DatReader*)reader;
+    return channel < dat->channels() ? dat->data(channel) : nullptr;
+}
+
+int ra_dat_set_range(
+    ra_dat_reader* reader, uint64_t start, uint64_t count, uint64_t chunk_samples)
+{
+    try {
+        ((DatReader*)reader)->setRange(start, count, chunk_samples);
+        return 0;
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return -1;
+    }
+}
+
+int64_t ra_dat_next(ra_dat_reader* reader, const void** spans, uint64_t* start)
+{
+    DatReader::Chunk chunk;
+    if (!((DatReader*)reader)->next(chunk)) {
+        return 0;
+    }
+    for (size_t i = 0; i < chunk.samples.size(); i++) {
+        spans[i] = chunk.samples[i];
+    }
+    if (start != nullptr) {
+        *start = chunk.start;
+    }
+    return chunk.count;
+}
+
+int64_t ra_dat_sample_at(
+    const ra_dat_reader* reader, uint32_t channel, int64_t full_secs, double frac_secs)
+{
+    try {
+        return ((const DatReader*)reader)->sampleAt(channel, full_secs, frac_secs);
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return -1;
+    }
+}
+
+int ra_dat_start_time(
+    const ra_dat_reader* reader, uint32_t channel, int64_t* full_secs, double* frac_secs)
+{
+    const DatReader* dat = (const DatReader*)reader;
+    if (channel >= dat->channels() || dat->timeIndex(channel) == nullptr) {
+        return -1;
+    }
+    *full_secs = dat->timeIndex(channel)->startFullSecs();
+    *frac_secs = dat->timeIndex(channel)->startFracSecs();
+    return 0;
+}
+
+int64_t ra_dat_read_fc32(
+    ra_dat_reader* reader, uint64_t start, uint64_t count, float* const* out)
+{
+    try {
+        return ((DatReader*)reader)
+            ->readFc32(start, count, (std::complex<float>* const*)out);
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return -1;
+    }
+}
+
+int64_t ra_dat_decompress(const char* src, const char* dst)
+{
+    try {
+        return decompressCapture(src, dst);
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return -1;
+    }
+}
+
+int64_t ra_dat_decompress_block(const void* in,
+    uint64_t nbytes,
+    void* out,
+    uint64_t max_samples,
+    uint64_t* samples)
+{
+    try {
+        const size_t size = sc16BlockSize((const uint8_t*)in, nbytes);
+        if (size == 0) {
+            return 0;
+        }
+        const size_t block_samples = sc16BlockSamples((const uint8_t*)in);
+        if (block_samples > max_samples) {
+            throw std::runtime_error("Output too small for the compressed block");
+        }
+        decompressSc16((const uint8_t*)in, (std::complex<int16_t>*)out);
+        if (samples != nullptr) {
+            *samples = block_samples;
+        }
+        return size;
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return -1;
+    }
+}
+}
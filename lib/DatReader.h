@@ -0,0 +1,113 @@
+/*
+ * Copyright 2021-2022 Ettus Research, a National Instruments Brand
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+/*
+ * C API for reading the per channel sc16 captures (.dat) written by the examples.
+ *
+ * Every file is memory mapped, nothing is loaded up front. The chunks returned by
+ * ra_dat_next() point into the mappings, one span per channel covering the same
+ * sample range, so captures larger than RAM are streamed without copying. While
+ * the caller works on a chunk the reader's threads fault in the next chunk of every
+ * file in parallel and drop the pages of the previous one from the process.
+ *
+ * Typical loop:
+ *      const char* paths[] = {"rx_00.dat", "rx_01.dat"};
+ *      ra_dat_reader* reader = ra_dat_open(paths, 2, 0);
+ *      ra_dat_set_range(reader, 0, 0, 1 << 20);
+ *      const void* spans[2];
+ *      uint64_t start;
+ *      int64_t n;
+ *      while ((n = ra_dat_next(reader, spans, &start)) > 0) {
+ *          ... n interleaved int16 I/Q samples of channel c at spans[c] ...
+ *      }
+ *      ra_dat_close(reader);
+ */
+
+#ifndef DAT_READER_H
+#define DAT_READER_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct ra_dat_reader ra_dat_reader;
+
+/*
+ * Maps num_paths captures, channel i being paths[i]. threads is the size of the
+ * prefetch and conversion pool, 0 for one per file up to the CPU count. Returns NULL
+ * if a file cannot be mapped or its time index records a sample size other than sc16
+ * (captures written with --format fc32 or fc64).
+ */
+ra_dat_reader* ra_dat_open(
+    const char* const* paths, uint32_t num_paths, uint32_t threads);
+void ra_dat_close(ra_dat_reader* reader);
+uint32_t ra_dat_channels(const ra_dat_reader* reader);
+/* Samples in the file of channel. */
+uint64_t ra_dat_samples(const ra_dat_reader* reader, uint32_t channel);
+/* Samples every file has, the length of the lockstep iteration. */
+uint64_t ra_dat_common_samples(const ra_dat_reader* reader);
+/* The whole mapping of channel, valid until ra_dat_close(). */
+const void* ra_dat_data(const ra_dat_reader* reader, uint32_t channel);
+
+/*
+ * Restarts the iteration at sample start for count samples (0 for up to the common
+ * length), chunk_samples per chunk. Returns 0, or -1 if start is past the end.
+ */
+int ra_dat_set_range(
+    ra_dat_reader* reader, uint64_t start, uint64_t count, uint64_t chunk_samples);
+/*
+ * Next chunk of the range: spans[channel] receives a pointer to its samples and
+ * *start the index of the first one. Returns the samples per channel, 0 at the end.
+ * The spans stay valid until ra_dat_close().
+ */
+int64_t ra_dat_next(ra_dat_reader* reader, const void** spans, uint64_t* start);
+
+/*
+ * Seeking by device time uses the time index written next to each capture
+ * (<capture>.idx, see TimeIndex.hpp), loaded by ra_dat_open() when present. Returns the
+ * sample of channel at full_secs + frac_secs, or the first one after it if it was
+ * dropped, clamped to the file length. -1 if the channel has no index.
+ */
+int64_t ra_dat_sample_at(
+    const ra_dat_reader* reader, uint32_t channel, int64_t full_secs, double frac_secs);
+/* Device time of the first sample of channel. Returns 0, or -1 without an index. */
+int ra_dat_start_time(
+    const ra_dat_reader* reader, uint32_t channel, int64_t* full_secs, double* frac_secs);
+
+/*
+ * Converts samples [start, start + count) of every channel to interleaved float I/Q
+ * scaled to +/-1.0, channel c into out[c], the channels in parallel. Returns the
+ * samples converted per channel, clamped to the common length, or -1.
+ */
+int64_t ra_dat_read_fc32(
+    ra_dat_reader* reader, uint64_t start, uint64_t count, float* const* out);
+
+/*
+ * Captures written with --rx-compress (<capture>.sc16z) are a sequence of
+ * self-describing compressed blocks, see Sc16Codec.hpp. ra_dat_decompress() expands
+ * one into the plain sc16 capture dst, which ra_dat_open() reads. Returns the samples
+ * written, or -1.
+ */
+int64_t ra_dat_decompress(const char* src, const char* dst);
+/*
+ * Decodes the compressed block at in, of which nbytes are available, into out, which
+ * holds max_samples samples, for consumers streaming the blocks themselves. *samples
+ * receives the samples decoded. Returns the size of the block, 0 if in holds less than
+ * a whole block, or -1 if the block is corrupt or does not fit out.
+ */
+int64_t ra_dat_decompress_block(const void* in,
+    uint64_t nbytes,
+    void* out,
+    uint64_t max_samples,
+    uint64_t* samples);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DAT_READER_H */
@@ -0,0 +1,162 @@
+//
+// Copyright 2021-2022 Ettus Research, a National Instruments Brand
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+//
+
+#ifndef DATREADER_H
+#define DATREADER_H
+
+#include "DatReader.h"
+#include "TimeIndex.hpp"
+#include <complex>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief Fixed set of worker threads running queued tasks, with a wait for all of
+ *  them to finish.
+ */
+class TaskPool
+{
+public:
+    explicit TaskPool(size_t threads);
+    ~TaskPool();
+    void submit(std::function<void()> task);
+    /**
+     * @brief Blocks until every submitted task has finished.
+     */
+    void wait();
+    /**
+     * @brief Runs fn(0) .. fn(count - 1) on the pool and waits for them.
+     */
+    void parallelFor(size_t count, const std::function<void(size_t)>& fn);
+    size_t size() const
+    {
+        return workers.size();
+    }
+
+private:
+    void run();
+
+    std::vector<std::thread> workers;
+    std::deque<std::function<void()>> tasks;
+    size_t pending = 0;
+    bool stopping  = false;
+    std::mutex pool_mutex;
+    std::condition_variable task_cv;
+    std::condition_variable done_cv;
+};
+
+/**
+ * @brief Memory mapped reader of the per channel sc16 captures. The files are read
+ *  in lockstep chunks that point into the mappings. The pool faults in the next chunk
+ *  of every file in parallel while the caller works on the current one, and drops the
+ *  pages of the previous chunk so terabyte captures do not fill the process memory.
+ *  The C API in DatReader.h wraps this class.
+ */
+class DatReader
+{
+public:
+    struct Chunk
+    {
+        uint64_t start = 0;
+        uint64_t count = 0;
+        std::vector<const std::complex<int16_t>*> samples;
+    };
+
+    /**
+     * @param paths One capture per channel
+     * @param threads Pool size, 0 for one per file up to the CPU count
+     */
+    DatReader(const std::vector<std::string>& paths, size_t threads = 0);
+    ~DatReader();
+    DatReader(const DatReader&) = delete;
+    DatReader& operator=(const DatReader&) = delete;
+
+    size_t channels() const
+    {
+        return files.size();
+    }
+    uint64_t samples(size_t channel) const
+    {
+        return files[channel].samples;
+    }
+    /**
+     * @brief Samples every file has, the length of the lockstep iteration.
+     */
+    uint64_t commonSamples() const;
+    const std::complex<int16_t>* data(size_t channel) const
+    {
+        return files[channel].data;
+    }
+    const std::string& path(size_t channel) const
+    {
+        return files[channel].path;
+    }
+    /**
+     * @brief The time index of channel (<path>.idx), nullptr if it has none.
+     */
+    const TimeIndex* timeIndex(size_t channel) const
+    {
+        return files[channel].index.get();
+    }
+    /**
+     * @brief The sample of channel at device time full_secs + frac_secs from its time
+     *  index, clamped to the file length. Throws if the channel has no index.
+     */
+    uint64_t sampleAt(size_t channel, int64_t full_secs, double frac_secs) const;
+    /**
+     * @brief Restarts the iteration at start for count samples (0 for up to the
+     *  common length) in chunks of chunk_samples.
+     */
+    void setRange(uint64_t start, uint64_t count, uint64_t chunk_samples);
+    /**
+     * @brief Next chunk of the range, false at the end.
+     */
+    bool next(Chunk& chunk);
+    /**
+     * @brief Converts samples [start, start + count) of every channel to complex float
+     *  scaled to +/-1.0 into out[channel], the channels in parallel.
+     *
+     * @return uint64_t samples converted per channel, clamped to the common length
+     */
+    uint64_t readFc32(uint64_t start, uint64_t count, std::complex<float>* const* out);
+    TaskPool& pool()
+    {
+        return task_pool;
+    }
+
+private:
+    struct MappedFile
+    {
+        std::string path;
+        std::complex<int16_t>* data = nullptr;
+        uint64_t samples            = 0;
+        std::unique_ptr<TimeIndex> index;
+    };
+    MappedFile mapFile(const std::string& path);
+    void unmapFiles();
+    /**
+     * @brief Queues the page faults of samples [start, start + count) of every file.
+     */
+    void prefetch(uint64_t start, uint64_t count);
+    void release(uint64_t start, uint64_t count);
+
+    std::vector<MappedFile> files;
+    TaskPool task_pool;
+    uint64_t range_end      = 0;
+    uint64_t position       = 0;
+    uint64_t chunk_samples  = 0;
+    uint64_t previous       = 0;
+    uint64_t previous_count = 0;
+};
+
+#endif
@@ -0,0 +1,162 @@
+//
+// Copyright 2021-2022 Ettus Research, a National Instruments Brand
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+//
+
+#include "Fft.hpp"
+#include <cmath>
+#include <stdexcept>
+#include <utility>
+#if defined(__x86_64__) || defined(__i386__)
+#    include <immintrin.h>
+#    define RA_FFT_X86 1
+#endif
+
+namespace {
+// One radix-2 stage, half butterflies per group, twiddle holds the half twiddles of
+// the stage as float pairs
+void butterflyScalar(float* values, size_t size, size_t half, const float* twiddle)
+{
+    for (size_t start = 0; start < size; start += 2 * half) {
+        float* lo = values + 2 * start;
+        float* hi = values + 2 * (start + half);
+        for (size_t j = 0; j < half; j++) {
+            const float w_re = twiddle[2 * j];
+            const float w_im = twiddle[2 * j + 1];
+            const float v_re = hi[2 * j] * w_re - hi[2 * j + 1] * w_im;
+            const float v_im = hi[2 * j] * w_im + hi[2 * j + 1] * w_re;
+            hi[2 * j]        = lo[2 * j] - v_re;
+            hi[2 * j + 1]    = lo[2 * j + 1] - v_im;
+            lo[2 * j] += v_re;
+            lo[2 * j + 1] += v_im;
+        }
+    }
+}
+
+// The first two stages, whose twiddles are 1 and -i (i for the inverse), as one
+// radix-4 pass
+void firstStages(std::complex<float>* data, size_t size, bool inverse)
+{
+    const float sign = inverse ? -1.0f : 1.0f;
+    for (size_t start = 0; start + 4 <= size; start += 4) {
+        std::complex<float>* x = data + start;
+        const float s0_re = x[0].real() + x[1].real(), s0_im = x[0].imag() + x[1].imag();
+        const float d0_re = x[0].real() - x[1].real(), d0_im = x[0].imag() - x[1].imag();
+        const float s1_re = x[2].real() + x[3].real(), s1_im = x[2].imag() + x[3].imag();
+        const float d1_re = x[2].real() - x[3].real(), d1_im = x[2].imag() - x[3].imag();
+        // d1 * -i
+        const float r_re = sign * d1_im, r_im = -sign * d1_re;
+        x[0] = std::complex<float>(s0_re + s1_re, s0_im + s1_im);
+        x[2] = std::complex<float>(s0_re - s1_re, s0_im - s1_im);
+        x[1] = std::complex<float>(d0_re + r_re, d0_im + r_im);
+        x[3] = std::complex<float>(d0_re - r_re, d0_im - r_im);
+    }
+}
+
+#ifdef RA_FFT_X86
+// Four butterflies per iteration, half must be a multiple of four
+__attribute__((target("avx2"))) void butterflyAvx2(
+    float* values, size_t size, size_t half, const float* twiddle)
+{
+    for (size_t start = 0; start < size; start += 2 * half) {
+        float* lo = values + 2 * start;
+        float* hi = values + 2 * (start + half);
+        for (size_t j = 0; j < half; j += 4) {
+            const __m256 w  = _mm256_loadu_ps(twiddle + 2 * j);
+            const __m256 h  = _mm256_loadu_ps(hi + 2 * j);
+            const __m256 l  = _mm256_loadu_ps(lo + 2 * j);
+            // h * w as (h_re w_re - h_im w_im, h_im w_re + h_re w_im)
+            const __m256 hw = _mm256_mul_ps(h, _mm256_moveldup_ps(w));
+            const __m256 sw = _mm256_mul_ps(
+                _mm256_permute_ps(h, 0xb1), _mm256_movehdup_ps(w));
+            const __m256 v  = _mm256_addsub_ps(hw, sw);
+            _mm256_storeu_ps(hi + 2 * j, _mm256_sub_ps(l, v));
+            _mm256_storeu_ps(lo + 2 * j, _mm256_add_ps(l, v));
+        }
+    }
+}
+#endif
+} // namespace
+
+Fft::Fft(size_t size) : fft_size(size)
+{
+    if (size < 2 || (size & (size - 1)) != 0 || size > (size_t(1) << 31)) {
+        throw std::runtime_error("FFT size must be a power of two");
+    }
+    size_t bits = 0;
+    while ((size_t(1) << bits) < size) {
+        bits++;
+    }
+    // Only the pairs that move, swapped without a branch per element
+    for (size_t i = 0; i < size; i++) {
+        uint32_t reversed = 0;
+        for (size_t bit = 0; bit < bits; bit++) {
+            reversed |= uint32_t((i >> bit) & 1) << (bits - 1 - bit);
+        }
+        if (i < reversed) {
+            swaps.emplace_back(uint32_t(i), reversed);
+        }
+    }
+    // The twiddles of each stage are stored contiguously, the stage with half
+    // butterflies per group at offset half - 1, so the butterflies load them in order
+    twiddles.resize(size - 1);
+    inverse_twiddles.resize(size - 1);
+    for (size_t half = 1; half < size; half <<= 1) {
+        for (size_t j = 0; j < half; j++) {
+            const double angle = -M_PI * double(j) / double(half);
+            twiddles[half - 1 + j] =
+                std::complex<float>(float(std::cos(angle)), float(std::sin(angle)));
+            inverse_twiddles[half - 1 + j] = std::conj(twiddles[half - 1 + j]);
+        }
+    }
+#ifdef RA_FFT_X86
+    __builtin_cpu_init();
+    use_avx2 = __builtin_cpu_supports("avx2");
+#endif
+}
+
+void Fft::forward(std::complex<float>* data) const
+{
+    transform(data, false);
+}
+
+void Fft::inverse(std::complex<float>* data) const
+{
+    transform(data, true);
+}
+
+void Fft::transform(std::complex<float>* data, bool inverse) const
+{
+    for (const auto& swap : swaps) {
+        std::swap(data[swap.first], data[swap.second]);
+    }
+    // The butterflies work on the float pairs directly, std::complex multiplication
+    // checks for NaN and keeps the loops from vectorizing
+    float* values = (float*)data;
+    const std::vector<std::complex<float>>& table = inverse ? inverse_twiddles : twiddles;
+    size_t half = 1;
+    if (fft_size >= 4) {
+        firstStages(data, fft_size, inverse);
+        half = 4;
+    }
+    for (; half < fft_size; half <<= 1) {
+        const float* twiddle = (const float*)(table.data() + half - 1);
+#ifdef RA_FFT_X86
+        if (use_avx2 && half >= 4) {
+            butterflyAvx2(values, fft_size, half, twiddle);
+            continue;
+        }
+#endif
+        butterflyScalar(values, fft_size, half, twiddle);
+    }
+}
+
+std::vector<float> hannWindow(size_t size)
+{
+    std::vector<float> window(size);
+    for (size_t n = 0; n < size; n++) {
+        window[n] = float(0.5 - 0.5 * std::cos(2.0 * M_PI * double(n) / double(size)));
+    }
+    return window;
+}
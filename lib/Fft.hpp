@@ -0,0 +1,51 @@
+//
+// Copyright 2021-2022 Ettus Research, a National Instruments Brand
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+//
+
+#ifndef FFT_H
+#define FFT_H
+
+#include <complex>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+/**
+ * @brief In place radix-2 complex FFT of a fixed power of two size. The bit reversal
+ *  table and the twiddles are computed once, transforms are const and can run on
+ *  several threads at the same time. The butterflies use AVX2 when the CPU has it.
+ */
+class Fft
+{
+public:
+    explicit Fft(size_t size);
+    size_t size() const
+    {
+        return fft_size;
+    }
+    void forward(std::complex<float>* data) const;
+    /**
+     * @brief Inverse transform without the 1/size scaling.
+     */
+    void inverse(std::complex<float>* data) const;
+
+private:
+    void transform(std::complex<float>* data, bool inverse) const;
+
+    size_t fft_size;
+    // Index pairs exchanged by the bit reversal permutation
+    std::vector<std::pair<uint32_t, uint32_t>> swaps;
+    std::vector<std::complex<float>> twiddles;
+    std::vector<std::complex<float>> inverse_twiddles;
+    bool use_avx2 = false;
+};
+
+/**
+ * @brief Hann window of size points, coherent gain 0.5.
+ */
+std::vector<float> hannWindow(size_t size);
+
+#endif
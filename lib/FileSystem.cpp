@@ -6,9 +6,26 @@
 
 #include "FileSystem.hpp"
 #include <fcntl.h>
+#include <linux/futex.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
 #include <boost/filesystem.hpp>
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <cstring>
 #include <iostream>
+#include <stdexcept>
+#include <system_error>
 #include <thread>
 //#include <uhd/transport/buffer_pool.hpp> Might want to reuse buffer creation for higher
 //throughput
@@ -27,32 +44,18 @@ FileLinux::FileLinux(const std::string& file)
 }
 
 /**
- * @brief Background process for opening file tries every 100ms
+ * @brief Tries once to open the file without blocking. A FIFO can only be opened
+ *          for writing once it has a reader, PipeEventLoop retries until then.
  *
- * @param oFlag Flag that is | with O_NONBLOCK
+ * @param oFlag IO flag (O_WRONLY, O_RDONLY), | with O_NONBLOCK
+ * @return bool true if the file is open
  */
-void FileLinux::backgroundOpen(int oFlag)
+bool FileLinux::openFile(int oFlag)
 {
-    do {
+    if (!isFileOpen()) {
         file_id = open(file_location.c_str(), oFlag | O_NONBLOCK);
-        // Delay to give some time for reader or writer to catchup.
-        std::this_thread::sleep_for(std::chrono::milliseconds(100));
-    } while (!isFileOpen() && !stop_all_file_threads);
-    background_open_active = false;
-}
-/**
- * @brief Spawns background process to open file. This could take a few ms.
- *
- * @param oFlag IO flag (O_WRONLY, O_RDONLY)
- */
-void FileLinux::openFile(int oFlag)
-{
-    stop_all_file_threads = false;
-    if (!background_open_active) {
-        background_open_active = true;
-        std::thread t([this](int oFlag) { backgroundOpen(oFlag); }, oFlag);
-        threads.push_back(std::move(t));
     }
+    return isFileOpen();
 }
 /**
  * @brief Automatically opens and tries to read file.
@@ -64,34 +67,24 @@ void FileLinux::openFile(int oFlag)
  */
 ssize_t FileLinux::readFileBlocking(void* buf, size_t n_bytes)
 {
-    if (isFileOpen())
-        return read(file_id, buf, n_bytes);
-    else if (!background_open_active) {
-        openFile(O_RDONLY);
-        // delay to open the File and try again
-        std::this_thread::sleep_for(std::chrono::milliseconds(200));
-        return readFileBlocking(buf, n_bytes);
-    } else
-        return isFileOpen();
+    if (!openFile(O_RDONLY)) {
+        return -1;
+    }
+    return read(file_id, buf, n_bytes);
 }
 /**
  * @brief Automatically opens and tries to write to file.
  *
  * @param buf Buffer to populate
  * @param n_bytes Number of values
- * @return int Returns the number written, -1 for errors.
+ * @return int Returns the number written, -1 for errors or if there is no reader yet.
  */
 int FileLinux::writeFile(void* buf, size_t n_bytes)
 {
-    if (isFileOpen()) {
-        return write(file_id, buf, n_bytes);
-    } else if (!background_open_active) {
-        openFile(O_WRONLY);
-        // delay to open the File and try again
-        std::this_thread::sleep_for(std::chrono::milliseconds(200));
-        return writeFile(buf, n_bytes);
-    } else
-        return isFileOpen();
+    if (!openFile(O_WRONLY)) {
+        return -1;
+    }
+    return write(file_id, buf, n_bytes);
 }
 
 /**
@@ -100,7 +93,6 @@ int FileLinux::writeFile(void* buf, size_t n_bytes)
  */
 void FileLinux::closeFile()
 {
-    stop_all_file_threads = true;
     if (isFileOpen()) {
         close(file_id);
         file_id = NOT_OPEN;
@@ -121,39 +113,42 @@ PipeFile::PipeFile(const std::string& file) : FileLinux(file)
     }
 }
 /**
- * @brief Starts a background process to read num_of_samples from file
+ * @brief Starts a new request of num_of_samples int32 values. The values are read
+ *          by continueRead as they arrive.
  *
  * @param num_of_samples number of samples to read of size int32
- * @return int
- */
-int PipeFile::readSamplesNonBlocking(uint16_t num_of_samples)
-{
-    if (!pipe_background_process) {
-        pipe_background_process = true;
-        amount_of_data_returned = 0;
-        std::thread t(
-            [this](uint16_t num_of_samples) { readSamplesBlocking(num_of_samples); },
-            num_of_samples);
-        threads.push_back(std::move(t));
-        return 0;
-    } else
-        return -1;
+ */
+void PipeFile::startRead(uint16_t num_of_samples)
+{
+    recv_buff.clear();
+    recv_buff.resize(num_of_samples);
+    recv_bytes              = 0;
+    amount_of_data_returned = 0;
 }
+
 /**
- * @brief reads the samples blocking unless stop_all_file_threads or the
- *          data is returned
+ * @brief Reads whatever is available of the request started with startRead without
+ *          blocking.
  *
- * @param num_of_samples
+ * @return bool true once all the values have been read
  */
-void PipeFile::readSamplesBlocking(uint16_t num_of_samples)
+bool PipeFile::continueRead()
 {
-    recv_buff.clear();
-    recv_buff.resize(num_of_samples);
-    buf = &recv_buff.front();
-    do {
-        amount_of_data_returned = readFileBlocking(buf, sizeof(int32_t) * num_of_samples);
-    } while (amount_of_data_returned <= 0 && !stop_all_file_threads);
-    pipe_background_process = false;
+    const size_t wanted_bytes = recv_buff.size() * sizeof(int32_t);
+    while (isFileOpen() && recv_bytes < wanted_bytes) {
+        ssize_t returned = read(file_id,
+            (uint8_t*)recv_buff.data() + recv_bytes,
+            wanted_bytes - recv_bytes);
+        if (returned <= 0) {
+            break;
+        }
+        recv_bytes += returned;
+    }
+    if (recv_bytes < wanted_bytes) {
+        return false;
+    }
+    amount_of_data_returned = recv_bytes;
+    return true;
 }
 
 /**
@@ -170,16 +165,1146 @@ int PipeFile::setfileSize(int file_size)
     return fcntl(file_id, F_GETPIPE_SZ);
 }
 
+/**
+ * @brief Writes to the pipe using the selected PipeWriteMode and updates the
+ *          throughput counters.
+ *
+ * @param buf Buffer to write. Must come from acquireBuffer for PIPE_VMSPLICE.
+ * @param n_bytes Number of bytes
+ * @return int Returns the number written, -1 for errors.
+ */
+int PipeFile::writeSamples(void* buf, size_t n_bytes)
+{
+    if (write_mode == PIPE_VMSPLICE && isFileOpen()) {
+        return spliceFile(buf, n_bytes);
+    }
+    const auto start = std::chrono::steady_clock::now();
+    int returned     = writeFile(buf, n_bytes);
+    write_stats.seconds +=
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    write_stats.calls++;
+    if (returned > 0) {
+        write_stats.bytes += returned;
+        bytes_queued += returned;
+        if (size_t(returned) < n_bytes) {
+            write_stats.partial_writes++;
+        }
+    }
+    return returned;
+}
+
+/**
+ * @brief Moves the pages of buf into the pipe with vmsplice instead of copying them.
+ *          vmsplice may take only part of the buffer when the pipe is nearly full,
+ *          the remainder is retried until the pipe stops accepting data. Falls back to
+ *          write() for good if the file does not support vmsplice.
+ *
+ * @param buf Page aligned buffer from acquireBuffer
+ * @param n_bytes Number of bytes
+ * @return int Returns the number written, -1 for errors.
+ */
+int PipeFile::spliceFile(void* buf, size_t n_bytes)
+{
+    const auto start = std::chrono::steady_clock::now();
+    size_t spliced   = 0;
+    while (spliced < n_bytes) {
+        struct iovec iov;
+        iov.iov_base = (uint8_t*)buf + spliced;
+        iov.iov_len  = n_bytes - spliced;
+        ssize_t ret  = vmsplice(file_id, &iov, 1, SPLICE_F_GIFT | SPLICE_F_NONBLOCK);
+        write_stats.calls++;
+        if (ret < 0) {
+            if ((errno == EINVAL || errno == ENOSYS || errno == EBADF) && spliced == 0) {
+                std::cerr << "vmsplice is not supported for " << file_location
+                          << ", falling back to write()" << std::endl;
+                write_mode = PIPE_WRITE;
+                write_stats.fallbacks++;
+                return writeSamples(buf, n_bytes);
+            }
+            break;
+        }
+        if (ret == 0) {
+            break;
+        }
+        spliced += ret;
+        if (spliced < n_bytes) {
+            write_stats.partial_writes++;
+        }
+    }
+    write_stats.seconds +=
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    write_stats.bytes += spliced;
+    bytes_queued += spliced;
+    return spliced > 0 ? int(spliced) : -1;
+}
+
+/**
+ * @brief Number of bytes the reader has taken out of the pipe since it was opened.
+ */
+uint64_t PipeFile::bytesConsumed()
+{
+    const int unread = unreadBytes();
+    return unread < 0 ? 0 : bytes_queued - unread;
+}
+
+/**
+ * @brief Number of bytes in the pipe the reader has not read yet, -1 if unknown.
+ */
+int PipeFile::unreadBytes()
+{
+    int unread = 0;
+    if (!isFileOpen() || ioctl(file_id, FIONREAD, &unread) != 0) {
+        return -1;
+    }
+    return unread;
+}
+
+/**
+ * @brief With vmsplice a released buffer is still in the pipe until the reader has
+ *          consumed everything written so far. Copied buffers can be reused at once.
+ */
+uint64_t PipeFile::releaseOffset()
+{
+    return write_mode == PIPE_VMSPLICE ? bytes_queued.load() : 0;
+}
+
+/**
+ * @brief Closes the pipe. Buffers the reader has not consumed yet are unmapped
+ *          rather than reused, the pipe keeps its own references to the pages so
+ *          this is safe, and the offsets restart with the next open.
+ *
+ */
+void PipeFile::closeFile()
+{
+    std::lock_guard<std::mutex> lock(sink_buffer_mutex);
+    const uint64_t consumed = bytesConsumed();
+    for (auto it = sink_buffers.begin(); it != sink_buffers.end();) {
+        if (!it->in_use && it->sink_offset > consumed) {
+            munmap(it->data, it->size);
+            it = sink_buffers.erase(it);
+        } else {
+            it->sink_offset = 0;
+            ++it;
+        }
+    }
+    bytes_queued = 0;
+    FileLinux::closeFile();
+}
+
 /**
  * @brief Destroy the Pipe File:: Pipe File object
  *
  */
 PipeFile::~PipeFile()
 {
-    stop_all_file_threads = true;
     closeFile();
     unlink(file_location.c_str());
-    for (auto& thread : threads) {
-        thread.join();
+}
+
+/**
+ * @brief Waits until the reader has made room in the pipe.
+ *
+ * @param timeout_ms longest time to wait
+ * @return bool true if the pipe is writable
+ */
+bool PipeFile::waitWritable(int timeout_ms)
+{
+    if (event_loop) {
+        return event_loop->waitWritable(*this, timeout_ms);
+    }
+    struct pollfd pipe_poll;
+    pipe_poll.fd     = file_id;
+    pipe_poll.events = POLLOUT;
+    return poll(&pipe_poll, 1, timeout_ms) > 0;
+}
+
+/**
+ * @brief Waits until the reader has read everything written or has closed the pipe.
+ *          The pipes carry requests in the other direction too, so opening one for
+ *          reading while samples are still in it would take them from the consumer.
+ *
+ * @param timeout_ms longest time to wait
+ * @return bool true if nothing is left for the reader
+ */
+bool PipeFile::waitDrained(int timeout_ms)
+{
+    if (event_loop) {
+        return event_loop->waitDrained(*this, timeout_ms);
+    }
+    // Without a loop, POLLERR still reports the reader closing
+    struct pollfd pipe_poll;
+    pipe_poll.fd     = file_id;
+    pipe_poll.events = 0;
+    return unreadBytes() <= 0 || poll(&pipe_poll, 1, timeout_ms) > 0
+           || unreadBytes() <= 0;
+}
+
+/**
+ * @brief Sinks that cannot signal when they are ready just wait out the timeout.
+ *
+ * @param timeout_ms time to wait
+ * @return bool always true
+ */
+bool SampleSink::waitWritable(int timeout_ms)
+{
+    std::this_thread::sleep_for(std::chrono::milliseconds(timeout_ms));
+    return true;
+}
+
+/**
+ * @brief Unmaps the pooled buffers. The pipe keeps its own references to pages it
+ *          still holds.
+ *
+ */
+SampleSink::~SampleSink()
+{
+    for (auto& buffer : sink_buffers) {
+        munmap(buffer.data, buffer.size);
+    }
+}
+
+/**
+ * @brief Returns a page aligned buffer of at least n_bytes that is safe to write to.
+ *          A buffer the sink has finished with is reused when one is large enough,
+ *          otherwise a new one is mapped.
+ *
+ * @param n_bytes Size of the buffer in bytes
+ * @return void* The buffer, hand it back with releaseBuffer
+ */
+void* SampleSink::acquireBuffer(size_t n_bytes)
+{
+    std::lock_guard<std::mutex> lock(sink_buffer_mutex);
+    const size_t page_size  = sysconf(_SC_PAGESIZE);
+    n_bytes                 = (n_bytes + page_size - 1) / page_size * page_size;
+    const uint64_t consumed = bytesConsumed();
+    for (auto& buffer : sink_buffers) {
+        if (!buffer.in_use && buffer.size >= n_bytes && buffer.sink_offset <= consumed) {
+            buffer.in_use = true;
+            return buffer.data;
+        }
+    }
+    void* data = mmap(nullptr,
+        n_bytes,
+        PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE,
+        -1,
+        0);
+    if (data == MAP_FAILED) {
+        throw std::runtime_error("Unable to allocate sample buffer");
+    }
+    sink_buffers.push_back({data, n_bytes, 0, true});
+    return data;
+}
+
+/**
+ * @brief Hands a buffer back to the pool. It is not reused until the sink has
+ *          consumed everything written so far.
+ *
+ * @param buffer Buffer returned by acquireBuffer
+ */
+void SampleSink::releaseBuffer(void* buffer)
+{
+    std::lock_guard<std::mutex> lock(sink_buffer_mutex);
+    for (auto& sink_buffer : sink_buffers) {
+        if (sink_buffer.data == buffer) {
+            sink_buffer.in_use      = false;
+            sink_buffer.sink_offset = releaseOffset();
+        }
+    }
+}
+
+/**
+ * @brief Construct a new Chunk Queue
+ *
+ * @param depth Number of chunks that can be queued before push blocks
+ */
+ChunkQueue::ChunkQueue(size_t depth) : queue_depth(std::max(depth, size_t(1))) {}
+
+/**
+ * @brief Queues a chunk, waiting while the queue is full.
+ *
+ * @return bool false if the queue was closed, the chunk was not queued
+ */
+bool ChunkQueue::push(Chunk chunk)
+{
+    std::unique_lock<std::mutex> lock(chunk_mutex);
+    chunk_cv.wait(lock, [this] { return closed || chunks.size() < queue_depth; });
+    if (closed) {
+        return false;
+    }
+    chunks.push_back(std::move(chunk));
+    chunk_cv.notify_all();
+    return true;
+}
+
+/**
+ * @brief Takes the oldest chunk, waiting while the queue is empty.
+ *
+ * @return bool false once the queue is closed and empty
+ */
+bool ChunkQueue::pop(Chunk& chunk)
+{
+    std::unique_lock<std::mutex> lock(chunk_mutex);
+    chunk_cv.wait(lock, [this] { return closed || !chunks.empty(); });
+    if (chunks.empty()) {
+        return false;
+    }
+    chunk = std::move(chunks.front());
+    chunks.pop_front();
+    chunk_cv.notify_all();
+    return true;
+}
+
+/**
+ * @brief No more chunks will be pushed. Wakes both sides, queued chunks can still be
+ *          popped.
+ *
+ */
+void ChunkQueue::close()
+{
+    std::lock_guard<std::mutex> lock(chunk_mutex);
+    closed = true;
+    chunk_cv.notify_all();
+}
+
+/**
+ * @brief Number of queued chunks.
+ *
+ */
+size_t ChunkQueue::size()
+{
+    std::lock_guard<std::mutex> lock(chunk_mutex);
+    return chunks.size();
+}
+
+
+/**
+ * @brief Construct a new Pipe Event Loop and start its thread
+ *
+ */
+PipeEventLoop::PipeEventLoop()
+{
+    epoll_id   = epoll_create1(EPOLL_CLOEXEC);
+    inotify_id = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    wake_id    = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (epoll_id < 0 || inotify_id < 0 || wake_id < 0) {
+        throw std::runtime_error("Unable to create the pipe event loop");
+    }
+    // The control fds are told apart from the pipes by the address of their member
+    for (int* control_id : {&inotify_id, &wake_id}) {
+        struct epoll_event event;
+        event.events   = EPOLLIN;
+        event.data.ptr = control_id;
+        epoll_ctl(epoll_id, EPOLL_CTL_ADD, *control_id, &event);
+    }
+    loop_thread = std::thread([this]() { run(); });
+}
+
+/**
+ * @brief Stops the loop thread. The pipes themselves are left open.
+ *
+ */
+PipeEventLoop::~PipeEventLoop()
+{
+    {
+        std::lock_guard<std::mutex> lock(loop_mutex);
+        stop_loop = true;
+    }
+    uint64_t wake = 1;
+    if (write(wake_id, &wake, sizeof(wake)) < 0) {
+        std::cerr << "Unable to wake the pipe event loop" << std::endl;
+    }
+    loop_thread.join();
+    for (auto& watch : watches) {
+        watch->pipe->event_loop = nullptr;
+        closePlaceholder(*watch);
+        close(watch->drain_id);
+    }
+    close(epoll_id);
+    close(inotify_id);
+    close(wake_id);
+}
+
+/**
+ * @brief Hands a pipe to the loop. Its FIFO is watched for opens by other processes.
+ *
+ * @param pipe PipeFile to drive
+ */
+void PipeEventLoop::add(std::shared_ptr<PipeFile> pipe)
+{
+    std::lock_guard<std::mutex> lock(loop_mutex);
+    if (findWatch(*pipe)) {
+        return;
+    }
+    std::unique_ptr<Watch> watch(new Watch);
+    watch->pipe       = pipe;
+    watch->drain_id   = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    watch->inotify_wd =
+        inotify_add_watch(inotify_id, pipe->fileLocation().c_str(), IN_OPEN);
+    if (watch->drain_id < 0 || watch->inotify_wd < 0) {
+        close(watch->drain_id);
+        throw std::runtime_error("Unable to watch " + pipe->fileLocation());
+    }
+    pipe->event_loop = this;
+    watches.push_back(std::move(watch));
+}
+
+/**
+ * @brief Opens the pipe for reading and reads num_of_samples int32 values in the
+ *          background. Check PipeFile::didBackgroundReturn with waitFor.
+ *
+ * @param pipe PipeFile added with add()
+ * @param num_of_samples number of samples to read of size int32
+ */
+void PipeEventLoop::readSamples(std::shared_ptr<PipeFile> pipe, uint16_t num_of_samples)
+{
+    std::lock_guard<std::mutex> lock(loop_mutex);
+    Watch* watch = findWatch(*pipe);
+    if (!watch) {
+        throw std::runtime_error(
+            pipe->fileLocation() + " was not added to the event loop");
+    }
+    pipe->startRead(num_of_samples);
+    if (!pipe->openFile(O_RDONLY)) {
+        throw std::runtime_error("Unable to open " + pipe->fileLocation());
+    }
+    if (pipe->continueRead()) {
+        loop_cv.notify_all();
+        return;
+    }
+    watch->state = WATCH_READ;
+    watchFd(*watch, EPOLLIN);
+}
+
+/**
+ * @brief Opens the pipe for writing as soon as it has a reader. Check
+ *          FileLinux::isFileOpen with waitFor. Without a reader yet, the FIFO is held
+ *          open O_RDWR until the IN_OPEN of the reader, which is the first open after
+ *          that of the placeholder.
+ *
+ * @param pipe PipeFile added with add()
+ */
+void PipeEventLoop::openForWriting(std::shared_ptr<PipeFile> pipe)
+{
+    std::lock_guard<std::mutex> lock(loop_mutex);
+    Watch* watch = findWatch(*pipe);
+    if (!watch) {
+        throw std::runtime_error(
+            pipe->fileLocation() + " was not added to the event loop");
+    }
+    // Opens from before, such as that of the last request, are not the reader
+    readInotify();
+    watch->state = WATCH_OPEN_WRITE;
+    tryOpenForWriting(*watch);
+    if (watch->state == WATCH_OPEN_WRITE && watch->placeholder_id == NOT_OPEN) {
+        watch->own_opens      = 1;
+        watch->placeholder_id = open(pipe->fileLocation().c_str(), O_RDWR | O_NONBLOCK);
+        if (watch->placeholder_id < 0) {
+            watch->state = WATCH_IDLE;
+            throw std::runtime_error("Unable to open " + pipe->fileLocation());
+        }
+    }
+    loop_cv.notify_all();
+}
+
+/**
+ * @brief Waits until the reader has made room in the pipe.
+ *
+ * @param pipe PipeFile open for writing
+ * @param timeout_ms longest time to wait
+ * @return bool true if the pipe is writable
+ */
+bool PipeEventLoop::waitWritable(PipeFile& pipe, int timeout_ms)
+{
+    std::unique_lock<std::mutex> lock(loop_mutex);
+    Watch* watch = findWatch(pipe);
+    if (!watch || !pipe.isFileOpen()) {
+        return false;
+    }
+    watch->writable      = false;
+    watch->want_writable = true;
+    watchFd(*watch, EPOLLOUT | EPOLLONESHOT);
+    loop_cv.wait_for(lock, std::chrono::milliseconds(timeout_ms), [watch, this]() {
+        return watch->writable || stop_loop;
+    });
+    watch->want_writable = false;
+    return watch->writable;
+}
+
+/**
+ * @brief Waits until the reader has read everything in the pipe or closed it. A
+ *          reader closing is an EPOLLERR on the write end, every read of a reader
+ *          that keeps the pipe open an IN_ACCESS. The loop checks the pipe on those
+ *          and signals the watch's eventfd, which is polled here together with the
+ *          cancellation eventfd.
+ *
+ * @param pipe PipeFile open for writing
+ * @param timeout_ms longest time to wait
+ * @return bool true if nothing is left for the reader
+ */
+bool PipeEventLoop::waitDrained(PipeFile& pipe, int timeout_ms)
+{
+    Watch* watch = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(loop_mutex);
+        watch = findWatch(pipe);
+        if (!watch || !pipe.isFileOpen()) {
+            return true;
+        }
+        watch->reader_closed = false;
+        watch->want_drained  = true;
+        inotify_add_watch(inotify_id, pipe.fileLocation().c_str(), IN_OPEN | IN_ACCESS);
+        // EPOLLERR is reported whether or not it is asked for
+        watchFd(*watch, EPOLLONESHOT);
+        signalIfDrained(*watch);
+    }
+    struct pollfd waits[2];
+    waits[0].fd     = watch->drain_id;
+    waits[0].events = POLLIN;
+    waits[1].fd     = cancel_id;
+    waits[1].events = POLLIN;
+    poll(waits, cancel_id == NOT_OPEN ? 1 : 2, timeout_ms);
+
+    std::lock_guard<std::mutex> lock(loop_mutex);
+    uint64_t signalled = 0;
+    if (read(watch->drain_id, &signalled, sizeof(signalled)) < 0) {
+        signalled = 0;
+    }
+    watch->want_drained = false;
+    inotify_add_watch(inotify_id, pipe.fileLocation().c_str(), IN_OPEN);
+    return signalled > 0 || watch->reader_closed || pipe.unreadBytes() <= 0;
+}
+
+/**
+ * @brief Waits until done() is true. done() is evaluated under the loop's lock, so it
+ *          can look at the state of the pipes safely.
+ *
+ * @param done condition to wait for
+ * @param timeout_ms longest time to wait
+ * @return bool the final value of done()
+ */
+bool PipeEventLoop::waitFor(const std::function<bool()>& done, int timeout_ms)
+{
+    std::unique_lock<std::mutex> lock(loop_mutex);
+    return loop_cv.wait_for(lock, std::chrono::milliseconds(timeout_ms), done);
+}
+
+/**
+ * @brief Wakes every waitFor when fd becomes readable, so a cancellation eventfd
+ *          (CancelToken::fd) ends the waits without waiting out their timeout. The
+ *          fd is watched edge triggered and never read, it stays owned by the caller.
+ *
+ * @param fd eventfd to watch
+ */
+void PipeEventLoop::watchCancel(int fd)
+{
+    std::lock_guard<std::mutex> lock(loop_mutex);
+    cancel_id = fd;
+    struct epoll_event event;
+    event.events   = EPOLLIN | EPOLLET;
+    event.data.ptr = &cancel_id;
+    if (epoll_ctl(epoll_id, EPOLL_CTL_ADD, cancel_id, &event) < 0) {
+        throw std::runtime_error("Unable to watch the cancellation eventfd");
+    }
+}
+
+/**
+ * @brief Drops every outstanding read and open, used when stopping.
+ *
+ */
+void PipeEventLoop::cancel()
+{
+    std::lock_guard<std::mutex> lock(loop_mutex);
+    for (auto& watch : watches) {
+        if (watch->state == WATCH_READ) {
+            unwatchFd(*watch);
+        }
+        closePlaceholder(*watch);
+        watch->state = WATCH_IDLE;
+    }
+}
+
+PipeEventLoop::Watch* PipeEventLoop::findWatch(const PipeFile& pipe)
+{
+    for (auto& watch : watches) {
+        if (watch->pipe.get() == &pipe) {
+            return watch.get();
+        }
+    }
+    return nullptr;
+}
+
+/**
+ * @brief Registers the pipe's current fd for events. A closed fd drops out of epoll
+ *          on its own, so the registration is refreshed rather than assumed.
+ */
+void PipeEventLoop::watchFd(Watch& watch, uint32_t events)
+{
+    struct epoll_event event;
+    event.events   = events;
+    event.data.ptr = &watch;
+    if (epoll_ctl(epoll_id, EPOLL_CTL_MOD, watch.pipe->fileId(), &event) != 0) {
+        epoll_ctl(epoll_id, EPOLL_CTL_ADD, watch.pipe->fileId(), &event);
+    }
+}
+
+void PipeEventLoop::unwatchFd(Watch& watch)
+{
+    if (watch.pipe->isFileOpen()) {
+        epoll_ctl(epoll_id, EPOLL_CTL_DEL, watch.pipe->fileId(), nullptr);
+    }
+}
+
+/**
+ * @brief Opens the pipe for writing if it has a reader. The placeholder is closed only
+ *          after the write end is open, so the reader never sees the pipe without a
+ *          writer.
+ */
+void PipeEventLoop::tryOpenForWriting(Watch& watch)
+{
+    if (watch.pipe->openFile(O_WRONLY)) {
+        watch.state = WATCH_IDLE;
+        closePlaceholder(watch);
+    }
+}
+
+void PipeEventLoop::closePlaceholder(Watch& watch)
+{
+    if (watch.placeholder_id != NOT_OPEN) {
+        close(watch.placeholder_id);
+        watch.placeholder_id = NOT_OPEN;
+    }
+    watch.own_opens = 0;
+}
+
+/**
+ * @brief Wakes waitDrained once the reader has read everything or closed the pipe.
+ */
+void PipeEventLoop::signalIfDrained(Watch& watch)
+{
+    if (!watch.want_drained
+        || (!watch.reader_closed && watch.pipe->unreadBytes() > 0)) {
+        return;
+    }
+    uint64_t drained = 1;
+    if (write(watch.drain_id, &drained, sizeof(drained)) < 0) {
+        std::cerr << "Unable to signal " << watch.pipe->fileLocation() << " drained"
+                  << std::endl;
+    }
+    watch.want_drained = false;
+}
+
+/**
+ * @brief Hands every queued inotify event to the watch of its FIFO.
+ */
+void PipeEventLoop::readInotify()
+{
+    alignas(struct inotify_event) uint8_t buffer[4096];
+    ssize_t length;
+    while ((length = read(inotify_id, buffer, sizeof(buffer))) > 0) {
+        for (uint8_t* next = buffer; next < buffer + length;) {
+            const auto* event = (const struct inotify_event*)next;
+            next += sizeof(struct inotify_event) + event->len;
+            for (auto& watch : watches) {
+                if (watch->inotify_wd == event->wd) {
+                    handleInotifyEvent(*watch, event->mask);
+                }
+            }
+        }
+    }
+}
+
+/**
+ * @brief An IN_OPEN while a writer open is pending is either the placeholder's own or
+ *          the reader's, whose open the placeholder let complete. An IN_ACCESS is a
+ *          read of the reader.
+ */
+void PipeEventLoop::handleInotifyEvent(Watch& watch, uint32_t mask)
+{
+    if ((mask & IN_OPEN) && watch.state == WATCH_OPEN_WRITE) {
+        if (watch.own_opens > 0) {
+            watch.own_opens--;
+        } else {
+            tryOpenForWriting(watch);
+        }
+    }
+    if (mask & IN_ACCESS) {
+        signalIfDrained(watch);
+    }
+}
+
+/**
+ * @brief Handles an epoll event on a pipe. A writer that hangs up before the request
+ *          is complete leaves the FIFO reporting EPOLLHUP, so it is reopened and the
+ *          request starts over.
+ */
+void PipeEventLoop::handlePipeEvent(Watch& watch, uint32_t events)
+{
+    if (watch.want_writable && (events & (EPOLLOUT | EPOLLERR | EPOLLHUP))) {
+        watch.writable      = true;
+        watch.want_writable = false;
+    }
+    if (watch.want_drained && (events & (EPOLLERR | EPOLLHUP))) {
+        watch.reader_closed = true;
+        signalIfDrained(watch);
+    }
+    if (watch.state != WATCH_READ) {
+        return;
+    }
+    if (watch.pipe->continueRead()) {
+        unwatchFd(watch);
+        watch.state = WATCH_IDLE;
+    } else if (events & (EPOLLHUP | EPOLLERR)) {
+        unwatchFd(watch);
+        watch.pipe->FileLinux::closeFile();
+        watch.pipe->startRead(watch.pipe->recv_buff.size());
+        if (watch.pipe->openFile(O_RDONLY)) {
+            watchFd(watch, EPOLLIN);
+        }
+    }
+}
+
+void PipeEventLoop::run()
+{
+    const int max_events = 64;
+    struct epoll_event events[max_events];
+    while (true) {
+        int num_events = epoll_wait(epoll_id, events, max_events, -1);
+        if (num_events < 0 && errno != EINTR) {
+            std::cerr << "Pipe event loop failed: " << strerror(errno) << std::endl;
+            return;
+        }
+        std::lock_guard<std::mutex> lock(loop_mutex);
+        if (stop_loop) {
+            loop_cv.notify_all();
+            return;
+        }
+        for (int i = 0; i < num_events; i++) {
+            void* source = events[i].data.ptr;
+            if (source == &inotify_id) {
+                readInotify();
+            } else if (source != &wake_id && source != &cancel_id) {
+                handlePipeEvent(*(Watch*)source, events[i].events);
+            }
+        }
+        loop_cv.notify_all();
+    }
+}
+
+
+static_assert(sizeof(ra_ring_header) == 256, "ra_ring_header layout changed");
+
+/**
+ * @brief Waits on a futex word in shared memory until it changes from observed.
+ *          waiters is incremented while sleeping so the other side only pays for a
+ *          wake up syscall when somebody is actually waiting.
+ *
+ * @param seq futex word
+ * @param waiters waiter count that belongs to seq
+ * @param observed value of seq when the condition was last checked
+ * @param timeout_ms -1 to wait forever
+ */
+static void ringWait(uint32_t* seq, uint32_t* waiters, uint32_t observed, int timeout_ms)
+{
+    if (timeout_ms == 0) {
+        return;
+    }
+    struct timespec timeout;
+    timeout.tv_sec  = timeout_ms / 1000;
+    timeout.tv_nsec = (timeout_ms % 1000) * 1000000L;
+    __atomic_add_fetch(waiters, 1, __ATOMIC_SEQ_CST);
+    syscall(SYS_futex, seq, FUTEX_WAIT, observed, timeout_ms < 0 ? nullptr : &timeout,
+        nullptr, 0);
+    __atomic_sub_fetch(waiters, 1, __ATOMIC_SEQ_CST);
+}
+
+/**
+ * @brief Milliseconds left until deadline, -1 if there is no deadline.
+ */
+static int ringRemainingMs(
+    const std::chrono::steady_clock::time_point& deadline, int timeout_ms)
+{
+    if (timeout_ms < 0) {
+        return -1;
+    }
+    const auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+        deadline - std::chrono::steady_clock::now());
+    return std::max(0, int(remaining.count()));
+}
+
+/**
+ * @brief Bumps a futex word and wakes the other side if it is waiting on it.
+ */
+static void ringWake(uint32_t* seq, uint32_t* waiters)
+{
+    __atomic_add_fetch(seq, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(waiters, __ATOMIC_SEQ_CST) > 0) {
+        syscall(SYS_futex, seq, FUTEX_WAKE, INT32_MAX, nullptr, nullptr, 0);
+    }
+}
+
+/**
+ * @brief Create a new Shared Ring. An existing ring with the same name is replaced.
+ *
+ * @param name Name of the shared memory object, without the leading '/'
+ * @param capacity Size of the data area in bytes. Rounded up to the page size.
+ * @param sample_format RA_RING_FORMAT_* of the samples the producer writes
+ */
+SharedRing::SharedRing(const std::string& name, uint64_t capacity, uint32_t sample_format)
+    : ring_name("/" + name), ring_owner(true)
+{
+    checkPageSize();
+    const uint64_t page_size = sysconf(_SC_PAGESIZE);
+    capacity                 = (capacity + page_size - 1) / page_size * page_size;
+    shm_unlink(ring_name.c_str());
+    shm_id = shm_open(ring_name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0666);
+    if (shm_id < 0) {
+        const int error = errno;
+        throw std::system_error(
+            error, std::generic_category(), "Unable to create shared ring " + ring_name);
+    }
+    // The destructor does not run for a throwing constructor, so a half created ring
+    // is closed and removed from /dev/shm here
+    try {
+        if (ftruncate(shm_id, RA_RING_HEADER_SIZE + capacity) != 0) {
+            const int error = errno;
+            throw std::system_error(error,
+                std::generic_category(),
+                "Unable to size shared ring " + ring_name);
+        }
+        mapRing(capacity);
+    } catch (...) {
+        close(shm_id);
+        shm_unlink(ring_name.c_str());
+        throw;
+    }
+    std::memset(header, 0, sizeof(ra_ring_header));
+    header->capacity      = capacity;
+    header->data_offset   = RA_RING_HEADER_SIZE;
+    header->version       = RA_RING_VERSION;
+    header->sample_format = sample_format;
+    // The magic is written last, an attaching process checks it before anything else.
+    __atomic_store_n(&header->magic, RA_RING_MAGIC, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Attach to a Shared Ring created by another process.
+ *
+ * @param name Name the ring was created with
+ */
+SharedRing::SharedRing(const std::string& name) : ring_name("/" + name)
+{
+    checkPageSize();
+    shm_id = shm_open(ring_name.c_str(), O_RDWR, 0666);
+    if (shm_id < 0) {
+        const int error = errno;
+        throw std::system_error(
+            error, std::generic_category(), "Unable to open shared ring " + ring_name);
+    }
+    ra_ring_header peek;
+    if (pread(shm_id, &peek, sizeof(peek), 0) != sizeof(peek)
+        || peek.magic != RA_RING_MAGIC) {
+        close(shm_id);
+        // The producer has not finished creating the ring yet
+        throw std::system_error(EAGAIN,
+            std::generic_category(),
+            "Shared ring " + ring_name + " is not initialized");
+    }
+    if (peek.version != RA_RING_VERSION) {
+        close(shm_id);
+        throw std::system_error(EPROTO,
+            std::generic_category(),
+            "Shared ring " + ring_name + " has version " + std::to_string(peek.version)
+                + ", expected " + std::to_string(RA_RING_VERSION));
+    }
+    try {
+        mapRing(peek.capacity);
+    } catch (...) {
+        close(shm_id);
+        throw;
+    }
+    last_request_seq = __atomic_load_n(&header->request_seq, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * @brief The data area is mapped at offset RA_RING_HEADER_SIZE of the shared memory
+ *          object, which mmap only accepts if that is a multiple of the page size.
+ */
+void SharedRing::checkPageSize() const
+{
+    const long page_size = sysconf(_SC_PAGESIZE);
+    if (page_size <= 0 || RA_RING_HEADER_SIZE % page_size != 0) {
+        throw std::system_error(EINVAL,
+            std::generic_category(),
+            "Shared ring " + ring_name + " needs a page size dividing "
+                + std::to_string(RA_RING_HEADER_SIZE) + " bytes, this host uses "
+                + std::to_string(page_size));
+    }
+}
+
+/**
+ * @brief Maps the header followed by two views of the data area. Writing past the
+ *          end of the first view lands at the start of the data area.
+ *
+ * @param capacity Size of the data area in bytes, multiple of the page size
+ */
+void SharedRing::mapRing(uint64_t capacity)
+{
+    mapping_size = RA_RING_HEADER_SIZE + 2 * capacity;
+    uint8_t* base = (uint8_t*)mmap(
+        nullptr, mapping_size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED) {
+        throw std::runtime_error("Unable to reserve memory for shared ring " + ring_name);
+    }
+    void* first  = mmap(base,
+        RA_RING_HEADER_SIZE + capacity,
+        PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_FIXED,
+        shm_id,
+        0);
+    void* mirror = mmap(base + RA_RING_HEADER_SIZE + capacity,
+        capacity,
+        PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_FIXED,
+        shm_id,
+        RA_RING_HEADER_SIZE);
+    if (first == MAP_FAILED || mirror == MAP_FAILED) {
+        munmap(base, mapping_size);
+        throw std::runtime_error("Unable to map shared ring " + ring_name);
+    }
+    header = (ra_ring_header*)base;
+    data   = base + RA_RING_HEADER_SIZE;
+}
+
+/**
+ * @brief Producer: waits for at least min_bytes of free space.
+ *
+ * @param span Set to the start of the contiguous free space
+ * @param min_bytes Amount of free space to wait for
+ * @param timeout_ms -1 to wait forever
+ * @return int64_t Free bytes at span, 0 on timeout
+ */
+int64_t SharedRing::acquireWrite(void** span, uint64_t min_bytes, int timeout_ms)
+{
+    const uint64_t head = header->head; // Only the producer writes head
+    const auto deadline =
+        std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+    while (true) {
+        const uint32_t seq  = __atomic_load_n(&header->space_seq, __ATOMIC_SEQ_CST);
+        const uint64_t tail = __atomic_load_n(&header->tail, __ATOMIC_ACQUIRE);
+        const uint64_t free_bytes = header->capacity - (head - tail);
+        if (free_bytes >= min_bytes) {
+            *span = data + head % header->capacity;
+            return free_bytes;
+        }
+        const int remaining_ms = ringRemainingMs(deadline, timeout_ms);
+        if (remaining_ms == 0) {
+            return 0;
+        }
+        ringWait(&header->space_seq, &header->space_waiters, seq, remaining_ms);
+    }
+}
+
+/**
+ * @brief Producer: publishes nbytes written at the span from acquireWrite().
+ */
+void SharedRing::commitWrite(uint64_t nbytes)
+{
+    __atomic_store_n(&header->head, header->head + nbytes, __ATOMIC_RELEASE);
+    ringWake(&header->data_seq, &header->data_waiters);
+}
+
+/**
+ * @brief Consumer: waits for at least min_bytes of data.
+ *
+ * @param span Set to the start of the contiguous readable data
+ * @param min_bytes Amount of data to wait for
+ * @param timeout_ms -1 to wait forever
+ * @return int64_t Readable bytes at span, 0 on timeout, -1 if the ring is closed and
+ *          empty
+ */
+int64_t SharedRing::acquireRead(const void** span, uint64_t min_bytes, int timeout_ms)
+{
+    const uint64_t tail = header->tail; // Only the consumer writes tail
+    const auto deadline =
+        std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+    while (true) {
+        const uint32_t seq  = __atomic_load_n(&header->data_seq, __ATOMIC_SEQ_CST);
+        const uint64_t head = __atomic_load_n(&header->head, __ATOMIC_ACQUIRE);
+        if (head - tail >= min_bytes && head != tail) {
+            *span = data + tail % header->capacity;
+            return head - tail;
+        }
+        if (__atomic_load_n(&header->closed, __ATOMIC_ACQUIRE)) {
+            if (head == tail) {
+                return -1;
+            }
+            *span = data + tail % header->capacity;
+            return head - tail;
+        }
+        const int remaining_ms = ringRemainingMs(deadline, timeout_ms);
+        if (remaining_ms == 0) {
+            return 0;
+        }
+        ringWait(&header->data_seq, &header->data_waiters, seq, remaining_ms);
+    }
+}
+
+/**
+ * @brief Consumer: hands nbytes back to the producer.
+ */
+void SharedRing::releaseRead(uint64_t nbytes)
+{
+    __atomic_store_n(&header->tail, header->tail + nbytes, __ATOMIC_RELEASE);
+    ringWake(&header->space_seq, &header->space_waiters);
+}
+
+/**
+ * @brief Consumer: requests num_of_samples samples from the producer.
+ */
+void SharedRing::request(int32_t num_of_samples)
+{
+    __atomic_store_n(&header->request_samples, num_of_samples, __ATOMIC_RELEASE);
+    ringWake(&header->request_seq, &header->request_waiters);
+}
+
+/**
+ * @brief Producer: waits for a request that has not been returned yet.
+ *
+ * @param num_of_samples Set to the requested number of samples
+ * @param timeout_ms -1 to wait forever
+ * @return true if a new request arrived
+ */
+bool SharedRing::waitForRequest(int32_t& num_of_samples, int timeout_ms)
+{
+    const auto deadline =
+        std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+    uint32_t seq = __atomic_load_n(&header->request_seq, __ATOMIC_SEQ_CST);
+    while (seq == last_request_seq) {
+        const int remaining_ms = ringRemainingMs(deadline, timeout_ms);
+        if (remaining_ms == 0) {
+            return false;
+        }
+        ringWait(&header->request_seq, &header->request_waiters, seq, remaining_ms);
+        seq = __atomic_load_n(&header->request_seq, __ATOMIC_SEQ_CST);
+    }
+    last_request_seq = seq;
+    num_of_samples   = __atomic_load_n(&header->request_samples, __ATOMIC_ACQUIRE);
+    return true;
+}
+
+/**
+ * @brief Producer: no more data will be written. Wakes a waiting consumer.
+ */
+void SharedRing::markClosed()
+{
+    __atomic_store_n(&header->closed, 1, __ATOMIC_RELEASE);
+    ringWake(&header->data_seq, &header->data_waiters);
+}
+
+/**
+ * @brief Destroy the Shared Ring object. The creator removes the shared memory object.
+ *
+ */
+SharedRing::~SharedRing()
+{
+    if (ring_owner && header != nullptr) {
+        markClosed();
+    }
+    if (header != nullptr) {
+        munmap(header, mapping_size);
+    }
+    if (shm_id >= 0) {
+        close(shm_id);
+    }
+    if (ring_owner) {
+        shm_unlink(ring_name.c_str());
+    }
+}
+
+/*
+ * C API, see SharedRing.h. The opaque handle is the SharedRing object.
+ */
+extern "C" {
+
+ra_shared_ring* ra_ring_create(const char* name, uint64_t capacity)
+{
+    try {
+        return (ra_shared_ring*)new SharedRing(name, capacity);
+    } catch (const std::system_error& e) {
+        std::cerr << e.what() << std::endl;
+        errno = e.code().value();
+        return nullptr;
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return nullptr;
     }
 }
+
+ra_shared_ring* ra_ring_open(const char* name)
+{
+    try {
+        return (ra_shared_ring*)new SharedRing(std::string(name));
+    } catch (const std::system_error& e) {
+        // Consumers poll until the producer created the ring, stay quiet and leave
+        // the reason in errno
+        errno = e.code().value();
+        return nullptr;
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return nullptr;
+    }
+}
+
+void ra_ring_close(ra_shared_ring* ring)
+{
+    delete (SharedRing*)ring;
+}
+
+uint64_t ra_ring_capacity(const ra_shared_ring* ring)
+{
+    return ((const SharedRing*)ring)->capacity();
+}
+
+uint32_t ra_ring_sample_format(const ra_shared_ring* ring)
+{
+    return ((const SharedRing*)ring)->sampleFormat();
+}
+
+void ra_ring_request(ra_shared_ring* ring, int32_t num_of_samples)
+{
+    ((SharedRing*)ring)->request(num_of_samples);
+}
+
+int64_t ra_ring_acquire_read(
+    ra_shared_ring* ring, const void** data, uint64_t min_bytes, int timeout_ms)
+{
+    return ((SharedRing*)ring)->acquireRead(data, min_bytes, timeout_ms);
+}
+
+void ra_ring_release_read(ra_shared_ring* ring, uint64_t nbytes)
+{
+    ((SharedRing*)ring)->releaseRead(nbytes);
+}
+
+int ra_ring_wait_request(ra_shared_ring* ring, int32_t* num_of_samples, int timeout_ms)
+{
+    return ((SharedRing*)ring)->waitForRequest(*num_of_samples, timeout_ms) ? 1 : 0;
+}
+
+int64_t ra_ring_acquire_write(
+    ra_shared_ring* ring, void** data, uint64_t min_bytes, int timeout_ms)
+{
+    return ((SharedRing*)ring)->acquireWrite(data, min_bytes, timeout_ms);
+}
+
+void ra_ring_commit_write(ra_shared_ring* ring, uint64_t nbytes)
+{
+    ((SharedRing*)ring)->commitWrite(nbytes);
+}
+
+void ra_ring_mark_closed(ra_shared_ring* ring)
+{
+    ((SharedRing*)ring)->markClosed();
+}
+}
@@ -8,6 +8,15 @@
 #define FILESYSTEM_H
 
 
+#include "SharedRing.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
 #include <string>
 #include <thread>
 #include <vector>
@@ -16,15 +25,9 @@
 
 class FileLinux
 {
-private:
-    bool background_open_active = false;
-
 protected:
     int file_id = NOT_OPEN;
     std::string file_location;
-    std::vector<std::thread> threads;
-    bool stop_all_file_threads = false;
-    void backgroundOpen(int oFlag);
 
 public:
     FileLinux(const std::string& file);
@@ -32,21 +35,124 @@ public:
     {
         return file_id >= 0;
     }
-    void openFile(int oFlag);
+    const std::string& fileLocation() const
+    {
+        return file_location;
+    }
+    int fileId() const
+    {
+        return file_id;
+    }
+    bool openFile(int oFlag);
     ssize_t virtual readFileBlocking(void* buf, size_t nbytes);
     int writeFile(void* buf, size_t nbytes);
-    void closeFile();
+    void virtual closeFile();
 };
 
+/**
+ * @brief How PipeFile::writeSamples moves data into the pipe.
+ *  PIPE_WRITE copies with write(), PIPE_VMSPLICE maps the caller's pages into the pipe.
+ */
+enum PipeWriteMode { PIPE_WRITE, PIPE_VMSPLICE };
+
+/**
+ * @brief Throughput counters for PipeFile::writeSamples, used to compare the modes.
+ */
+struct PipeWriteStats
+{
+    uint64_t bytes          = 0;
+    uint64_t calls          = 0;
+    uint64_t partial_writes = 0;
+    uint64_t fallbacks      = 0;
+    double seconds          = 0;
+    double rateMBps() const
+    {
+        return seconds > 0 ? bytes / seconds / 1e6 : 0;
+    }
+};
+
+
+/**
+ * @brief Destination for received samples. Buffers handed out by acquireBuffer are
+ *  page aligned and pooled; a sink that keeps referencing a buffer after
+ *  writeSamples returns (PipeFile in PIPE_VMSPLICE mode) delays its reuse by
+ *  overriding bufferDrained.
+ */
+class SampleSink
+{
+protected:
+    struct SinkBuffer
+    {
+        void* data;
+        size_t size;
+        uint64_t sink_offset;
+        bool in_use;
+    };
+    std::vector<SinkBuffer> sink_buffers;
+    std::mutex sink_buffer_mutex;
+    virtual uint64_t bytesConsumed()
+    {
+        return 0;
+    }
+    virtual uint64_t releaseOffset()
+    {
+        return 0;
+    }
+
+public:
+    virtual ~SampleSink();
+    virtual int writeSamples(void* buf, size_t nbytes) = 0;
+    virtual bool waitWritable(int timeout_ms);
+    void* acquireBuffer(size_t nbytes);
+    void releaseBuffer(void* buffer);
+};
 
-class PipeFile : public FileLinux
+/**
+ * @brief Bounded queue of received chunks between a recv thread and the thread that
+ *  writes them to their sinks. push() blocks while depth chunks are queued, so a slow
+ *  sink backs up into the receive buffers instead of growing memory.
+ */
+class ChunkQueue
+{
+public:
+    struct Chunk
+    {
+        std::vector<void*> buffers;
+        std::vector<size_t> nbytes;
+        std::chrono::steady_clock::time_point received;
+    };
+    ChunkQueue(size_t depth);
+    bool push(Chunk chunk);
+    bool pop(Chunk& chunk);
+    void close();
+    size_t size();
+
+private:
+    std::deque<Chunk> chunks;
+    std::mutex chunk_mutex;
+    std::condition_variable chunk_cv;
+    size_t queue_depth;
+    bool closed = false;
+};
+
+class PipeEventLoop;
+
+class PipeFile : public FileLinux, public SampleSink
 {
 private:
-    bool pipe_background_process = false;
-    void readSamplesBlocking(uint16_t num_of_samples);
     std::vector<int32_t> recv_buff;
+    size_t recv_bytes               = 0;
     ssize_t amount_of_data_returned = 0;
-    int32_t* buf;
+    PipeEventLoop* event_loop       = nullptr;
+    friend class PipeEventLoop;
+    PipeWriteMode write_mode = PIPE_WRITE;
+    PipeWriteStats write_stats;
+    std::atomic<uint64_t> bytes_queued{0};
+    int spliceFile(void* buf, size_t nbytes);
+
+protected:
+    uint64_t bytesConsumed() override;
+    uint64_t releaseOffset() override;
 
 public:
     std::vector<int32_t> returnedValues()
@@ -60,8 +166,137 @@ public:
     void openPipeFile(int oFlag);
     int setfileSize(int file_size);
     PipeFile(const std::string& file);
-    int readSamplesNonBlocking(uint16_t num_of_samples);
+    void startRead(uint16_t num_of_samples);
+    bool continueRead();
+    bool waitWritable(int timeout_ms) override;
+    bool waitDrained(int timeout_ms);
+    int unreadBytes();
+    void setWriteMode(PipeWriteMode mode)
+    {
+        write_mode = mode;
+    }
+    PipeWriteMode writeMode() const
+    {
+        return write_mode;
+    }
+    const PipeWriteStats& writeStats() const
+    {
+        return write_stats;
+    }
+    void resetWriteStats()
+    {
+        write_stats = PipeWriteStats();
+    }
+    int writeSamples(void* buf, size_t nbytes) override;
+    void closeFile() override;
     ~PipeFile();
 };
 
+/**
+ * @brief One thread that drives every PipeFile through epoll instead of a thread per
+ *  pipe and per request. It dispatches
+ *      - readable: requests started with readSamples are read as the data arrives
+ *      - open: openForWriting opens the FIFO as soon as a reader is there
+ *      - writable: waitWritable sleeps until the reader has made room
+ *      - drained: waitDrained sleeps until the reader has read everything
+ *  A writer cannot open a FIFO before it has a reader, and a reader that opens in
+ *  blocking mode only completes its open once a writer exists. A pending writer open
+ *  therefore holds the FIFO open O_RDWR, which lets the reader's open complete, and
+ *  opens for writing on the inotify IN_OPEN of the reader. While a writer waits for
+ *  the pipe to drain, the reader's reads are watched with IN_ACCESS and the loop
+ *  signals the writer's eventfd once nothing is left.
+ */
+class PipeEventLoop
+{
+private:
+    enum WatchState { WATCH_IDLE, WATCH_READ, WATCH_OPEN_WRITE };
+    struct Watch
+    {
+        std::shared_ptr<PipeFile> pipe;
+        WatchState state   = WATCH_IDLE;
+        int inotify_wd     = NOT_OPEN;
+        int placeholder_id = NOT_OPEN; // O_RDWR end held while a writer open is pending
+        int own_opens      = 0; // IN_OPEN events of the placeholder still to come
+        int drain_id       = NOT_OPEN; // eventfd signalled once the pipe has drained
+        bool want_writable = false;
+        bool writable      = false;
+        bool want_drained  = false;
+        bool reader_closed = false;
+    };
+    std::vector<std::unique_ptr<Watch>> watches;
+    int epoll_id   = NOT_OPEN;
+    int inotify_id = NOT_OPEN;
+    int wake_id    = NOT_OPEN;
+    int cancel_id  = NOT_OPEN;
+    bool stop_loop = false;
+    std::mutex loop_mutex;
+    std::condition_variable loop_cv;
+    std::thread loop_thread;
+    void run();
+    Watch* findWatch(const PipeFile& pipe);
+    void watchFd(Watch& watch, uint32_t events);
+    void unwatchFd(Watch& watch);
+    void tryOpenForWriting(Watch& watch);
+    void closePlaceholder(Watch& watch);
+    void signalIfDrained(Watch& watch);
+    void readInotify();
+    void handleInotifyEvent(Watch& watch, uint32_t mask);
+    void handlePipeEvent(Watch& watch, uint32_t events);
+
+public:
+    PipeEventLoop();
+    ~PipeEventLoop();
+    void add(std::shared_ptr<PipeFile> pipe);
+    void readSamples(std::shared_ptr<PipeFile> pipe, uint16_t num_of_samples);
+    void openForWriting(std::shared_ptr<PipeFile> pipe);
+    bool waitWritable(PipeFile& pipe, int timeout_ms);
+    bool waitDrained(PipeFile& pipe, int timeout_ms);
+    bool waitFor(const std::function<bool()>& done, int timeout_ms);
+    void watchCancel(int fd);
+    void cancel();
+};
+
+
+/**
+ * @brief Single producer, single consumer ring buffer in POSIX shared memory.
+ *  The data area is mapped twice back to back so every readable or writable span
+ *  is contiguous and samples can be received into and read from the ring in place.
+ *  See SharedRing.h for the layout and the C API.
+ */
+class SharedRing
+{
+private:
+    std::string ring_name;
+    bool ring_owner           = false;
+    int shm_id                = NOT_OPEN;
+    ra_ring_header* header    = nullptr;
+    uint8_t* data             = nullptr;
+    size_t mapping_size       = 0;
+    uint32_t last_request_seq = 0;
+    void mapRing(uint64_t capacity);
+    void checkPageSize() const;
+
+public:
+    SharedRing(const std::string& name,
+        uint64_t capacity,
+        uint32_t sample_format = RA_RING_FORMAT_SC16);
+    SharedRing(const std::string& name);
+    ~SharedRing();
+    uint64_t capacity() const
+    {
+        return header->capacity;
+    }
+    uint32_t sampleFormat() const
+    {
+        return header->sample_format;
+    }
+    int64_t acquireWrite(void** span, uint64_t min_bytes, int timeout_ms);
+    void commitWrite(uint64_t nbytes);
+    int64_t acquireRead(const void** span, uint64_t min_bytes, int timeout_ms);
+    void releaseRead(uint64_t nbytes);
+    void request(int32_t num_of_samples);
+    bool waitForRequest(int32_t& num_of_samples, int timeout_ms);
+    void markClosed();
+};
+
 #endif
@@ -0,0 +1,184 @@
+//
+// Copyright 2021-2022 Ettus Research, a National Instruments Brand
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+//
+
+#include "LoopbackCorrelator.hpp"
+#include "SampleConvert.hpp"
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <stdexcept>
+#include <thread>
+
+namespace {
+size_t poolSize(size_t threads)
+{
+    return threads > 0 ? threads : std::max(1u, std::thread::hardware_concurrency());
+}
+
+// Correlation peaks within 1 dB of the largest count as arrivals, the earliest one is
+// the delay, so a waveform repeating within the capture gives its first copy
+const double arrival_fraction = 0.79;
+} // namespace
+
+LoopbackCorrelator::LoopbackCorrelator(const std::vector<std::complex<float>>& waveform,
+    size_t num_rx,
+    const LoopbackSettings& settings)
+    : fft(settings.fft_size)
+    , reference_size(std::min(waveform.size(), settings.fft_size / 2))
+    , reference_spectrum(settings.fft_size, {0.0f, 0.0f})
+    , paths(num_rx)
+    , pool(poolSize(settings.threads))
+{
+    if (reference_size == 0) {
+        throw std::runtime_error("The loopback waveform is empty");
+    }
+    std::copy(
+        waveform.begin(), waveform.begin() + reference_size, reference_spectrum.begin());
+    for (size_t n = 0; n < reference_size; n++) {
+        reference_energy += std::norm(std::complex<double>(waveform[n]));
+    }
+    if (reference_energy <= 0) {
+        throw std::runtime_error("The loopback waveform is all zeros");
+    }
+    fft.forward(reference_spectrum.data());
+    for (auto& bin : reference_spectrum) {
+        bin = std::conj(bin);
+    }
+    for (size_t i = 0; i < num_rx; i++) {
+        captures.emplace_back(new Capture);
+        captures.back()->samples.resize(settings.fft_size);
+    }
+}
+
+void LoopbackCorrelator::begin()
+{
+    pool.wait();
+    for (size_t i = 0; i < captures.size(); i++) {
+        captures[i]->filled = 0;
+        captures[i]->queued = false;
+        paths[i]            = LoopbackPath();
+    }
+}
+
+void LoopbackCorrelator::push(
+    size_t rx_channel, int64_t tick, const std::complex<short>* samples, size_t nsamps)
+{
+    Capture& capture   = *captures[rx_channel];
+    const uint64_t end = capture.samples.size();
+    if (capture.queued || tick + int64_t(nsamps) <= int64_t(capture.filled)) {
+        return;
+    }
+    if (tick < int64_t(capture.filled)) {
+        const size_t skip = capture.filled - tick;
+        samples += skip;
+        nsamps -= skip;
+        tick = capture.filled;
+    }
+    // Dropped samples correlate as zeros
+    const uint64_t start = std::min<uint64_t>(tick, end);
+    std::fill(capture.samples.begin() + capture.filled,
+        capture.samples.begin() + start,
+        std::complex<float>(0.0f, 0.0f));
+    const size_t count = std::min<uint64_t>(nsamps, end - start);
+    convertSc16ToFc32((const std::complex<int16_t>*)samples,
+        capture.samples.data() + start,
+        count,
+        1.0f / 32768);
+    capture.filled = start + count;
+    if (capture.filled == end) {
+        queue(rx_channel);
+    }
+}
+
+void LoopbackCorrelator::queue(size_t rx_channel)
+{
+    Capture& capture = *captures[rx_channel];
+    if (capture.queued.exchange(true)) {
+        return;
+    }
+    pool.submit(
+        [this, rx_channel]() { paths[rx_channel] = correlate(*captures[rx_channel]); });
+}
+
+std::vector<LoopbackPath> LoopbackCorrelator::end()
+{
+    for (size_t i = 0; i < captures.size(); i++) {
+        if (captures[i]->filled >= reference_size) {
+            queue(i);
+        }
+    }
+    pool.wait();
+    return paths;
+}
+
+LoopbackPath LoopbackCorrelator::correlate(const Capture& capture) const
+{
+    const size_t size = fft.size();
+    std::vector<std::complex<float>> correlation(capture.samples);
+    std::fill(correlation.begin() + capture.filled, correlation.end(), 0.0f);
+    fft.forward(correlation.data());
+    for (size_t k = 0; k < size; k++) {
+        correlation[k] *= reference_spectrum[k];
+    }
+    fft.inverse(correlation.data());
+
+    // Lags whose window lies in the capture, the rest wrap around
+    const long last = long(capture.filled) - long(reference_size);
+    double largest  = 0;
+    for (long lag = 0; lag <= last; lag++) {
+        largest = std::max(largest, double(std::norm(correlation[lag])));
+    }
+    long peak = 0;
+    while (peak < last && std::norm(correlation[peak]) < arrival_fraction * largest) {
+        peak++;
+    }
+    // Climb to the top of the arrival
+    while (peak < last
+           && std::norm(correlation[peak + 1]) > std::norm(correlation[peak])) {
+        peak++;
+    }
+    LoopbackPath path;
+    path.valid         = true;
+    path.delay_samples = peak;
+    if (peak > 0 && peak < last) {
+        // Parabola through the magnitudes around the peak
+        const double a         = std::abs(correlation[peak - 1]);
+        const double b         = std::abs(correlation[peak]);
+        const double c         = std::abs(correlation[peak + 1]);
+        const double curvature = a - 2 * b + c;
+        if (curvature < 0) {
+            const double offset = 0.5 * (a - c) / curvature;
+            path.delay_samples += std::max(-0.5, std::min(0.5, offset));
+        }
+    }
+    // The inverse transform is unscaled
+    const std::complex<double> value =
+        std::complex<double>(correlation[peak]) / double(size);
+    const std::complex<double> gain = value / reference_energy;
+    path.gain_db     = 20 * std::log10(std::max(std::abs(gain), 1e-15));
+    path.phase_deg   = std::arg(gain) * 180.0 / M_PI;
+    double rx_energy = 0;
+    for (size_t n = peak; n < peak + reference_size; n++) {
+        rx_energy += std::norm(std::complex<double>(capture.samples[n]));
+    }
+    path.coherence =
+        std::abs(value) / std::sqrt(std::max(rx_energy * reference_energy, 1e-60));
+    return path;
+}
+
+std::vector<std::complex<float>> loadWaveform(const std::string& path, size_t nsamps)
+{
+    std::ifstream file(path, std::ifstream::binary);
+    if (!file) {
+        throw std::runtime_error("Unable to open waveform " + path);
+    }
+    std::vector<std::complex<int16_t>> samples(nsamps);
+    file.read((char*)samples.data(), nsamps * sizeof(samples[0]));
+    samples.resize(file.gcount() / sizeof(samples[0]));
+    std::vector<std::complex<float>> waveform(samples.size());
+    convertSc16ToFc32(samples.data(), waveform.data(), samples.size(), 1.0f / 32768);
+    return waveform;
+}
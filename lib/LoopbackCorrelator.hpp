@@ -0,0 +1,113 @@
+//
+// Copyright 2021-2022 Ettus Research, a National Instruments Brand
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+//
+
+#ifndef LOOPBACKCORRELATOR_H
+#define LOOPBACKCORRELATOR_H
+
+#include "DatReader.hpp"
+#include "Fft.hpp"
+#include <atomic>
+#include <complex>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+struct LoopbackSettings
+{
+    // Correlation FFT size, a power of two. Every RX channel captures fft_size samples
+    // from the start time, the reference is the first fft_size / 2 samples of the
+    // waveform, so delays up to fft_size / 2 samples are found.
+    size_t fft_size = 65536;
+    // Worker threads, 0 for one per CPU
+    size_t threads = 0;
+};
+
+/**
+ * @brief Path from one TX channel to one RX channel.
+ */
+struct LoopbackPath
+{
+    bool valid = false;
+    // Arrival of the waveform after the start time, interpolated between samples
+    double delay_samples = 0;
+    // RX over TX amplitude and phase at the peak, both in full scale units
+    double gain_db   = 0;
+    double phase_deg = 0;
+    // Correlation peak normalized by the energies, 1.0 for a perfect copy
+    double coherence = 0;
+};
+
+/**
+ * @brief Measures the delay and gain from the transmitted waveform to every RX channel
+ *  while streaming. The RX threads push() the samples they receive; the first fft_size
+ *  samples from the start time of every channel are kept and, once complete, correlated
+ *  against the waveform on the worker threads with one forward and one inverse FFT.
+ *  begin() and end() bracket each transmission.
+ */
+class LoopbackCorrelator
+{
+public:
+    /**
+     * @param waveform The transmitted samples, from the start of the replay buffer
+     */
+    LoopbackCorrelator(const std::vector<std::complex<float>>& waveform,
+        size_t num_rx,
+        const LoopbackSettings& settings);
+    LoopbackCorrelator(const LoopbackCorrelator&) = delete;
+    LoopbackCorrelator& operator=(const LoopbackCorrelator&) = delete;
+
+    /**
+     * @brief Clears the captures for the next transmission.
+     */
+    void begin();
+    /**
+     * @brief Samples of rx_channel, the first received tick sample periods after the
+     *  start time. Only the RX thread of the channel calls it.
+     */
+    void push(size_t rx_channel,
+        int64_t tick,
+        const std::complex<short>* samples,
+        size_t nsamps);
+    /**
+     * @brief Correlates the channels whose capture fell short and waits for all of them.
+     *
+     * @return std::vector<LoopbackPath> one per RX channel, invalid if the channel
+     *  received less than the reference
+     */
+    std::vector<LoopbackPath> end();
+    size_t maxDelay() const
+    {
+        return fft.size() - reference_size;
+    }
+
+private:
+    struct Capture
+    {
+        std::vector<std::complex<float>> samples;
+        uint64_t filled = 0;
+        std::atomic<bool> queued{false};
+    };
+    void queue(size_t rx_channel);
+    LoopbackPath correlate(const Capture& capture) const;
+
+    Fft fft;
+    size_t reference_size;
+    double reference_energy = 0;
+    // Conjugated spectrum of the zero padded reference
+    std::vector<std::complex<float>> reference_spectrum;
+    std::vector<std::unique_ptr<Capture>> captures;
+    std::vector<LoopbackPath> paths;
+    TaskPool pool;
+};
+
+/**
+ * @brief The first nsamps samples of an sc16 waveform file, such as --file.
+ */
+std::vector<std::complex<float>> loadWaveform(const std::string& path, size_t nsamps);
+
+#endif
@@ -0,0 +1,415 @@
+//
+// Copyright 2021-2022 Ettus Research, a National Instruments Brand
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+//
+
+#include "Metrics.hpp"
+#include <stdio.h>
+#include <boost/format.hpp>
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <complex>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+
+const char* metricName(MetricCounter counter)
+{
+    static const char* names[METRIC_COUNTERS] = {"samples",
+        "bytes",
+        "recv_calls",
+        "send_calls",
+        "write_calls",
+        "write_ns",
+        "overflows",
+        "sequence_errors",
+        "timeouts",
+        "late_packets"};
+    return names[counter];
+}
+
+const char* metricName(MetricGauge gauge)
+{
+    static const char* names[METRIC_GAUGES] = {"queue_depth", "write_max_ns"};
+    return names[gauge];
+}
+
+const char* metricName(MetricHistogram histogram)
+{
+    static const char* names[METRIC_HISTOGRAMS] = {
+        "recv_interval", "sink_latency", "send_duration", "write_duration"};
+    return names[histogram];
+}
+
+uint64_t LatencyHistogram::bucketMax(size_t index)
+{
+    if (index < SUB_BUCKETS) {
+        return index;
+    }
+    const int magnitude = index / SUB_BUCKETS;
+    const uint64_t sub  = index % SUB_BUCKETS;
+    const uint64_t low  = (SUB_BUCKETS + sub) << (magnitude - 1);
+    return low + ((uint64_t(1) << (magnitude - 1)) - 1);
+}
+
+uint64_t LatencyHistogram::percentile(double q) const
+{
+    const uint64_t values = count();
+    if (values == 0) {
+        return 0;
+    }
+    // Rank of the value, rounded up so p100 is the last one
+    const uint64_t rank = std::max(uint64_t(1), uint64_t(std::ceil(q * values)));
+    uint64_t seen       = 0;
+    for (size_t i = 0; i < BUCKETS; i++) {
+        seen += buckets[i].load(std::memory_order_relaxed);
+        if (seen >= rank) {
+            return std::min(bucketMax(i), max());
+        }
+    }
+    return max();
+}
+
+void MetricsSlot::recordRecv(
+    const uhd::rx_metadata_t& md, size_t nsamps, size_t channels, size_t sample_size)
+{
+    const auto now = std::chrono::steady_clock::now();
+    if (last_recv != std::chrono::steady_clock::time_point()) {
+        record(METRIC_RECV_INTERVAL,
+            std::chrono::duration_cast<std::chrono::nanoseconds>(now - last_recv)
+                .count());
+    }
+    last_recv = now;
+    add(METRIC_RECV_CALLS);
+    switch (md.error_code) {
+        case uhd::rx_metadata_t::ERROR_CODE_NONE:
+            break;
+        case uhd::rx_metadata_t::ERROR_CODE_TIMEOUT:
+            add(METRIC_TIMEOUTS);
+            break;
+        case uhd::rx_metadata_t::ERROR_CODE_LATE_COMMAND:
+            add(METRIC_LATE_PACKETS);
+            break;
+        case uhd::rx_metadata_t::ERROR_CODE_OVERFLOW:
+            add(md.out_of_sequence ? METRIC_SEQUENCE_ERRORS : METRIC_OVERFLOWS);
+            break;
+        default:
+            break;
+    }
+    if (nsamps > 0) {
+        add(METRIC_SAMPLES, nsamps * channels);
+        add(METRIC_BYTES, nsamps * channels * sample_size);
+    }
+}
+
+void MetricsSlot::recordWrite(size_t nsamps, size_t nbytes, uint64_t elapsed_ns)
+{
+    add(METRIC_WRITE_CALLS);
+    add(METRIC_WRITE_NS, elapsed_ns);
+    add(METRIC_SAMPLES, nsamps);
+    add(METRIC_BYTES, nbytes);
+    record(METRIC_WRITE_DURATION, elapsed_ns);
+    if (elapsed_ns > gauge(METRIC_WRITE_MAX_NS)) {
+        set(METRIC_WRITE_MAX_NS, elapsed_ns);
+    }
+}
+
+MetricsSlot& MetricsRegistry::slot(const std::string& kind, int id)
+{
+    std::lock_guard<std::mutex> lock(slots_mutex);
+    for (auto& existing : slots) {
+        if (existing->kind == kind && existing->id == id) {
+            return *existing;
+        }
+    }
+    slots.emplace_back(new MetricsSlot(kind, id));
+    return *slots.back();
+}
+
+std::vector<MetricsRegistry::Snapshot> MetricsRegistry::snapshot(bool clear_interval)
+{
+    std::lock_guard<std::mutex> lock(slots_mutex);
+    std::vector<Snapshot> snapshots(slots.size());
+    for (size_t i = 0; i < slots.size(); i++) {
+        snapshots[i].kind = slots[i]->kind;
+        snapshots[i].id   = slots[i]->id;
+        for (int c = 0; c < METRIC_COUNTERS; c++) {
+            snapshots[i].counters[c] = slots[i]->counter(MetricCounter(c));
+        }
+        snapshots[i].gauges[METRIC_QUEUE_DEPTH] = slots[i]->gauge(METRIC_QUEUE_DEPTH);
+        snapshots[i].gauges[METRIC_WRITE_MAX_NS] =
+            clear_interval ? slots[i]->takeGauge(METRIC_WRITE_MAX_NS)
+                           : slots[i]->gauge(METRIC_WRITE_MAX_NS);
+    }
+    return snapshots;
+}
+
+std::string MetricsRegistry::histogramSummary()
+{
+    std::lock_guard<std::mutex> lock(slots_mutex);
+    std::ostringstream out;
+    out << std::fixed << std::setprecision(1);
+    out << boost::format("%-28s %10s %10s %10s %10s %10s\n") % "Latency (us)" % "count"
+               % "p50" % "p99" % "p99.9" % "max";
+    for (const auto& slot : slots) {
+        for (int h = 0; h < METRIC_HISTOGRAMS; h++) {
+            const LatencyHistogram& histogram = slot->histogram(MetricHistogram(h));
+            if (histogram.count() == 0) {
+                continue;
+            }
+            const std::string row = slot->kind + " " + std::to_string(slot->id) + " "
+                                    + metricName(MetricHistogram(h));
+            out << boost::format("%-28s %10d %10.1f %10.1f %10.1f %10.1f\n") % row
+                       % histogram.count() % (histogram.percentile(0.5) / 1e3)
+                       % (histogram.percentile(0.99) / 1e3)
+                       % (histogram.percentile(0.999) / 1e3) % (histogram.max() / 1e3);
+        }
+    }
+    return out.str();
+}
+
+MetricsReporter::MetricsReporter(MetricsRegistry& registry,
+    MetricsFormat format,
+    const std::string& path,
+    double interval_s)
+    : registry(registry), format(format), path(path), interval_s(interval_s)
+{
+}
+
+MetricsReporter::~MetricsReporter()
+{
+    stop();
+}
+
+MetricsFormat MetricsReporter::parseFormat(const std::string& format)
+{
+    if (format == "console") {
+        return METRICS_CONSOLE;
+    } else if (format == "csv") {
+        return METRICS_CSV;
+    } else if (format == "prometheus") {
+        return METRICS_PROMETHEUS;
+    }
+    throw std::runtime_error("Unknown metrics format " + format);
+}
+
+void MetricsReporter::start()
+{
+    if (reporter_thread.joinable()) {
+        return;
+    }
+    stopping        = false;
+    start_time      = std::chrono::steady_clock::now();
+    last_report     = start_time;
+    previous        = registry.snapshot();
+    reporter_thread = std::thread([this]() { run(); });
+}
+
+void MetricsReporter::stop()
+{
+    if (!reporter_thread.joinable()) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(reporter_mutex);
+        stopping = true;
+    }
+    reporter_cv.notify_all();
+    reporter_thread.join();
+    report();
+}
+
+void MetricsReporter::run()
+{
+    const auto interval = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+        std::chrono::duration<double>(interval_s));
+    auto next = std::chrono::steady_clock::now() + interval;
+    std::unique_lock<std::mutex> lock(reporter_mutex);
+    while (!reporter_cv.wait_until(lock, next, [this]() { return stopping; })) {
+        lock.unlock();
+        report();
+        lock.lock();
+        next += interval;
+    }
+}
+
+double MetricsReporter::rate(const MetricsRegistry::Snapshot& snapshot,
+    MetricCounter counter,
+    double elapsed_s) const
+{
+    uint64_t before = 0;
+    for (const auto& old : previous) {
+        if (old.kind == snapshot.kind && old.id == snapshot.id) {
+            before = old.counters[counter];
+        }
+    }
+    return elapsed_s > 0 ? (snapshot.counters[counter] - before) / elapsed_s : 0;
+}
+
+void MetricsReporter::report()
+{
+    const auto now = std::chrono::steady_clock::now();
+    const double elapsed_s = std::chrono::duration<double>(now - last_report).count();
+    std::vector<MetricsRegistry::Snapshot> snapshots = registry.snapshot();
+    // Per kind totals, reported with id -1
+    std::map<std::string, MetricsRegistry::Snapshot> totals;
+    for (const auto& snapshot : snapshots) {
+        auto inserted = totals.emplace(snapshot.kind, MetricsRegistry::Snapshot());
+        MetricsRegistry::Snapshot& total = inserted.first->second;
+        if (inserted.second) {
+            total    = snapshot;
+            total.id = -1;
+            continue;
+        }
+        for (int c = 0; c < METRIC_COUNTERS; c++) {
+            total.counters[c] += snapshot.counters[c];
+        }
+        total.gauges[METRIC_QUEUE_DEPTH] += snapshot.gauges[METRIC_QUEUE_DEPTH];
+        total.gauges[METRIC_WRITE_MAX_NS] = std::max(
+            total.gauges[METRIC_WRITE_MAX_NS], snapshot.gauges[METRIC_WRITE_MAX_NS]);
+    }
+    std::vector<MetricsRegistry::Snapshot> current = snapshots;
+    for (const auto& total : totals) {
+        snapshots.push_back(total.second);
+    }
+    // The totals need previous values too for their rates
+    std::map<std::string, MetricsRegistry::Snapshot> previous_totals;
+    for (const auto& old : previous) {
+        auto inserted = previous_totals.emplace(old.kind, old);
+        if (!inserted.second) {
+            for (int c = 0; c < METRIC_COUNTERS; c++) {
+                inserted.first->second.counters[c] += old.counters[c];
+            }
+        }
+    }
+    for (auto& previous_total : previous_totals) {
+        previous_total.second.id = -1;
+        previous.push_back(previous_total.second);
+    }
+
+    std::string output;
+    switch (format) {
+        case METRICS_CONSOLE:
+            output = formatConsole(snapshots, elapsed_s);
+            std::cout << output << std::flush;
+            break;
+        case METRICS_CSV: {
+            std::ifstream existing(path);
+            const bool new_file = !existing.good() || existing.peek() == EOF;
+            existing.close();
+            std::ofstream outfile(path, std::ofstream::app);
+            if (new_file) {
+                outfile << "time_s,kind,id";
+                for (int c = 0; c < METRIC_COUNTERS; c++) {
+                    outfile << ',' << metricName(MetricCounter(c));
+                }
+                for (int g = 0; g < METRIC_GAUGES; g++) {
+                    outfile << ',' << metricName(MetricGauge(g));
+                }
+                outfile << ",samples_per_s,bytes_per_s\n";
+            }
+            outfile << formatCsv(snapshots, elapsed_s);
+            break;
+        }
+        case METRICS_PROMETHEUS: {
+            // Write then rename so the collector never reads a partial file
+            const std::string temp_path = path + ".tmp";
+            {
+                std::ofstream outfile(temp_path, std::ofstream::trunc);
+                outfile << formatPrometheus(snapshots);
+            }
+            if (rename(temp_path.c_str(), path.c_str()) != 0) {
+                std::cerr << "Unable to update " << path << ": " << strerror(errno)
+                          << std::endl;
+            }
+            break;
+        }
+    }
+    previous    = current;
+    last_report = now;
+}
+
+std::string MetricsReporter::formatConsole(
+    const std::vector<MetricsRegistry::Snapshot>& snapshots, double elapsed_s)
+{
+    std::ostringstream out;
+    out << std::fixed << std::setprecision(2);
+    out << "[metrics "
+        << std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time)
+               .count()
+        << " s]" << std::endl;
+    for (const auto& snapshot : snapshots) {
+        out << "  " << snapshot.kind << " "
+            << (snapshot.id < 0 ? std::string("total") : std::to_string(snapshot.id))
+            << ": " << rate(snapshot, METRIC_SAMPLES, elapsed_s) / 1e6 << " Msps, "
+            << rate(snapshot, METRIC_BYTES, elapsed_s) / 1e6 << " MB/s";
+        if (snapshot.counters[METRIC_WRITE_CALLS] > 0) {
+            out << ", write avg "
+                << snapshot.counters[METRIC_WRITE_NS] / 1e3
+                       / snapshot.counters[METRIC_WRITE_CALLS]
+                << " us max " << snapshot.gauges[METRIC_WRITE_MAX_NS] / 1e3 << " us";
+        }
+        out << ", queue " << snapshot.gauges[METRIC_QUEUE_DEPTH] << ", overflows "
+            << snapshot.counters[METRIC_OVERFLOWS] << ", sequence errors "
+            << snapshot.counters[METRIC_SEQUENCE_ERRORS] << ", timeouts "
+            << snapshot.counters[METRIC_TIMEOUTS] << ", late "
+            << snapshot.counters[METRIC_LATE_PACKETS] << std::endl;
+    }
+    return out.str();
+}
+
+std::string MetricsReporter::formatCsv(
+    const std::vector<MetricsRegistry::Snapshot>& snapshots, double elapsed_s)
+{
+    std::ostringstream out;
+    const double time_s =
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time)
+            .count();
+    for (const auto& snapshot : snapshots) {
+        out << std::fixed << std::setprecision(3) << time_s << ',' << snapshot.kind
+            << ','
+            << (snapshot.id < 0 ? std::string("total") : std::to_string(snapshot.id));
+        for (int c = 0; c < METRIC_COUNTERS; c++) {
+            out << ',' << snapshot.counters[c];
+        }
+        for (int g = 0; g < METRIC_GAUGES; g++) {
+            out << ',' << snapshot.gauges[g];
+        }
+        out << std::setprecision(0) << ',' << rate(snapshot, METRIC_SAMPLES, elapsed_s)
+            << ',' << rate(snapshot, METRIC_BYTES, elapsed_s) << '\n';
+    }
+    return out.str();
+}
+
+std::string MetricsReporter::formatPrometheus(
+    const std::vector<MetricsRegistry::Snapshot>& snapshots)
+{
+    std::ostringstream out;
+    auto labels = [](const MetricsRegistry::Snapshot& snapshot) {
+        return "{kind=\"" + snapshot.kind + "\",id=\""
+               + (snapshot.id < 0 ? std::string("total") : std::to_string(snapshot.id))
+               + "\"}";
+    };
+    for (int c = 0; c < METRIC_COUNTERS; c++) {
+        const std::string name =
+            std::string("refarch_") + metricName(MetricCounter(c)) + "_total";
+        out << "# TYPE " << name << " counter\n";
+        for (const auto& snapshot : snapshots) {
+            out << name << labels(snapshot) << ' ' << snapshot.counters[c] << '\n';
+        }
+    }
+    for (int g = 0; g < METRIC_GAUGES; g++) {
+        const std::string name = std::string("refarch_") + metricName(MetricGauge(g));
+        out << "# TYPE " << name << " gauge\n";
+        for (const auto& snapshot : snapshots) {
+            out << name << labels(snapshot) << ' ' << snapshot.gauges[g] << '\n';
+        }
+    }
+    return out.str();
+}
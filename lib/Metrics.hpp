@@ -0,0 +1,290 @@
+//
+// Copyright 2021-2022 Ettus Research, a National Instruments Brand
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+//
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <uhd/types/metadata.hpp>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+enum MetricCounter {
+    METRIC_SAMPLES,
+    METRIC_BYTES,
+    METRIC_RECV_CALLS,
+    METRIC_SEND_CALLS,
+    METRIC_WRITE_CALLS,
+    METRIC_WRITE_NS,
+    METRIC_OVERFLOWS,
+    METRIC_SEQUENCE_ERRORS,
+    METRIC_TIMEOUTS,
+    METRIC_LATE_PACKETS,
+    METRIC_COUNTERS
+};
+
+enum MetricGauge {
+    // Chunks waiting between a recv thread and its writer
+    METRIC_QUEUE_DEPTH,
+    // Longest write since the last report
+    METRIC_WRITE_MAX_NS,
+    METRIC_GAUGES
+};
+
+enum MetricHistogram {
+    // Time between successive recv() returns
+    METRIC_RECV_INTERVAL,
+    // Time from recv() returning samples to the sink having written them
+    METRIC_SINK_LATENCY,
+    // Duration of tx_streamer::send()
+    METRIC_SEND_DURATION,
+    // Duration of one sink write (ofstream, PipeFile::writeSamples)
+    METRIC_WRITE_DURATION,
+    METRIC_HISTOGRAMS
+};
+
+/**
+ * @brief Name of the counter or gauge, as used in the CSV header and the Prometheus
+ *  metric names.
+ */
+const char* metricName(MetricCounter counter);
+const char* metricName(MetricGauge gauge);
+const char* metricName(MetricHistogram histogram);
+
+/**
+ * @brief Log bucketed histogram of nanosecond latencies, laid out like HdrHistogram:
+ *  16 linear sub-buckets per power of two, so every value from 1 ns to centuries is
+ *  counted within 6.25% in a fixed 8 kB. Recording is an index computation and a
+ *  relaxed increment, with the same single writer rule as MetricsSlot.
+ */
+class LatencyHistogram
+{
+public:
+    static const int SUB_BUCKET_BITS = 4;
+    static const int SUB_BUCKETS     = 1 << SUB_BUCKET_BITS;
+    static const int BUCKETS         = (64 - SUB_BUCKET_BITS + 1) * SUB_BUCKETS;
+
+    void record(uint64_t value_ns)
+    {
+        increment(buckets[bucketIndex(value_ns)]);
+        increment(total);
+        if (value_ns > max_value.load(std::memory_order_relaxed)) {
+            max_value.store(value_ns, std::memory_order_relaxed);
+        }
+    }
+    uint64_t count() const
+    {
+        return total.load(std::memory_order_relaxed);
+    }
+    uint64_t max() const
+    {
+        return max_value.load(std::memory_order_relaxed);
+    }
+    /**
+     * @brief Smallest bucket bound that at least fraction q of the values are at or
+     *  below, capped at the exact maximum. 0 if nothing was recorded.
+     */
+    uint64_t percentile(double q) const;
+    static size_t bucketIndex(uint64_t value)
+    {
+        if (value < SUB_BUCKETS) {
+            return value;
+        }
+        const int msb       = 63 - __builtin_clzll(value);
+        const int magnitude = msb - SUB_BUCKET_BITS + 1;
+        return magnitude * SUB_BUCKETS
+               + ((value >> (msb - SUB_BUCKET_BITS)) & (SUB_BUCKETS - 1));
+    }
+    /**
+     * @brief Largest value counted in bucket index.
+     */
+    static uint64_t bucketMax(size_t index);
+
+private:
+    static void increment(std::atomic<uint64_t>& value)
+    {
+        value.store(value.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+
+    std::atomic<uint64_t> buckets[BUCKETS] = {};
+    std::atomic<uint64_t> total{0};
+    std::atomic<uint64_t> max_value{0};
+};
+
+/**
+ * @brief Counters of one RX, TX or writer thread. Only the owning thread updates a
+ *  slot, so updates are a relaxed load and store instead of a locked read-modify-write,
+ *  and each slot has its own cache lines so threads never share one.
+ *
+ *  An RX slot counts one streamer, whatever channels it receives: recv() returns the
+ *  same samples and one set of metadata for all of them, so an overflow or timeout
+ *  cannot be told apart per channel. The slots are per channel with
+ *  rx-streamers = channel.
+ */
+class alignas(64) MetricsSlot
+{
+public:
+    MetricsSlot(const std::string& kind, int id) : kind(kind), id(id) {}
+    void add(MetricCounter counter, uint64_t n = 1)
+    {
+        counters[counter].store(
+            counters[counter].load(std::memory_order_relaxed) + n,
+            std::memory_order_relaxed);
+    }
+    void set(MetricGauge gauge, uint64_t value)
+    {
+        gauges[gauge].store(value, std::memory_order_relaxed);
+    }
+    /**
+     * @brief Counts one recv() call: samples and bytes (sample_size bytes per sample,
+     *  all channels) on success, the error in md otherwise.
+     */
+    void recordRecv(
+        const uhd::rx_metadata_t& md, size_t nsamps, size_t channels, size_t sample_size);
+    /**
+     * @brief Counts one write of nsamps samples (all channels) in nbytes that took
+     *  elapsed_ns. nbytes differs from the samples when the writer compresses or
+     *  converts them.
+     */
+    void recordWrite(size_t nsamps, size_t nbytes, uint64_t elapsed_ns);
+    void record(MetricHistogram histogram, uint64_t value_ns)
+    {
+        histograms[histogram].record(value_ns);
+    }
+    const LatencyHistogram& histogram(MetricHistogram histogram) const
+    {
+        return histograms[histogram];
+    }
+    /**
+     * @brief Called by the owning thread before it starts streaming, so the first
+     *  recv() interval does not span the setup or a previous run.
+     */
+    void beginStream()
+    {
+        last_recv = std::chrono::steady_clock::time_point();
+    }
+    uint64_t counter(MetricCounter counter) const
+    {
+        return counters[counter].load(std::memory_order_relaxed);
+    }
+    uint64_t gauge(MetricGauge gauge) const
+    {
+        return gauges[gauge].load(std::memory_order_relaxed);
+    }
+    /**
+     * @brief Reads a gauge and clears it, used for the per interval maximum.
+     */
+    uint64_t takeGauge(MetricGauge gauge)
+    {
+        return gauges[gauge].exchange(0, std::memory_order_relaxed);
+    }
+
+    const std::string kind;
+    const int id;
+
+private:
+    std::atomic<uint64_t> counters[METRIC_COUNTERS] = {};
+    std::atomic<uint64_t> gauges[METRIC_GAUGES]     = {};
+    LatencyHistogram histograms[METRIC_HISTOGRAMS];
+    std::chrono::steady_clock::time_point last_recv;
+};
+
+/**
+ * @brief Owns the slots of every thread. Registering takes a lock, updating a slot
+ *  never does.
+ */
+class MetricsRegistry
+{
+public:
+    struct Snapshot
+    {
+        std::string kind;
+        int id;
+        uint64_t counters[METRIC_COUNTERS];
+        uint64_t gauges[METRIC_GAUGES];
+    };
+    /**
+     * @brief Returns the slot of kind ("rx", "tx", "writer", ...) and id, creating it
+     *  on first use. Threads that are spawned again keep counting in the same slot.
+     */
+    MetricsSlot& slot(const std::string& kind, int id);
+    /**
+     * @brief Copies every slot. Interval gauges are cleared unless clear_interval is
+     *  false, for readers other than the reporter.
+     */
+    std::vector<Snapshot> snapshot(bool clear_interval = true);
+    /**
+     * @brief Table of count, p50, p99, p99.9 and max of every histogram that has
+     *  values, one row per thread. Meant for the end of a run.
+     */
+    std::string histogramSummary();
+
+private:
+    std::mutex slots_mutex;
+    std::vector<std::unique_ptr<MetricsSlot>> slots;
+};
+
+enum MetricsFormat { METRICS_CONSOLE, METRICS_CSV, METRICS_PROMETHEUS };
+
+/**
+ * @brief Thread that aggregates a MetricsRegistry every interval and outputs per
+ *  thread rates and per kind totals to the console, appends them to a CSV file or
+ *  rewrites a Prometheus text file (for the node_exporter textfile collector).
+ */
+class MetricsReporter
+{
+public:
+    MetricsReporter(MetricsRegistry& registry,
+        MetricsFormat format,
+        const std::string& path,
+        double interval_s);
+    ~MetricsReporter();
+    /**
+     * @brief Parses console, csv or prometheus.
+     */
+    static MetricsFormat parseFormat(const std::string& format);
+    void start();
+    /**
+     * @brief Stops the thread after a last report.
+     */
+    void stop();
+
+private:
+    void run();
+    void report();
+    std::string formatConsole(const std::vector<MetricsRegistry::Snapshot>& snapshots,
+        double elapsed_s);
+    std::string formatCsv(const std::vector<MetricsRegistry::Snapshot>& snapshots,
+        double elapsed_s);
+    std::string formatPrometheus(
+        const std::vector<MetricsRegistry::Snapshot>& snapshots);
+    /**
+     * @brief Per second rate of counter since the previous report.
+     */
+    double rate(const MetricsRegistry::Snapshot& snapshot,
+        MetricCounter counter,
+        double elapsed_s) const;
+
+    MetricsRegistry& registry;
+    MetricsFormat format;
+    std::string path;
+    double interval_s;
+    std::vector<MetricsRegistry::Snapshot> previous;
+    std::chrono::steady_clock::time_point start_time;
+    std::chrono::steady_clock::time_point last_report;
+    bool stopping = false;
+    std::mutex reporter_mutex;
+    std::condition_variable reporter_cv;
+    std::thread reporter_thread;
+};
+
+#endif
@@ -0,0 +1,545 @@
+//
+// Copyright 2021-2022 Ettus Research, a National Instruments Brand
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+//
+
+#include "MockDevice.hpp"
+#include <algorithm>
+#include <cmath>
+#include <complex>
+#include <cstring>
+#include <stdexcept>
+#include <thread>
+
+namespace {
+// Period of the "tone" waveform in samples
+const size_t TONE_PERIOD = 100;
+
+size_t sampleSize(const std::string& cpu_format)
+{
+    if (cpu_format == "sc16") {
+        return sizeof(std::complex<int16_t>);
+    } else if (cpu_format == "fc32") {
+        return sizeof(std::complex<float>);
+    } else if (cpu_format == "fc64") {
+        return sizeof(std::complex<double>);
+    }
+    throw std::runtime_error("Mock device does not support cpu format " + cpu_format);
+}
+
+/**
+ * @brief Stores the sample (i, q), given in full scale units, in the cpu format.
+ */
+void storeSample(const std::string& cpu_format, char* out, double i, double q)
+{
+    if (cpu_format == "sc16") {
+        std::complex<int16_t> sample(
+            int16_t(std::lround(i * 32767)), int16_t(std::lround(q * 32767)));
+        memcpy(out, &sample, sizeof(sample));
+    } else if (cpu_format == "fc32") {
+        std::complex<float> sample(static_cast<float>(i), static_cast<float>(q));
+        memcpy(out, &sample, sizeof(sample));
+    } else {
+        std::complex<double> sample(i, q);
+        memcpy(out, &sample, sizeof(sample));
+    }
+}
+
+size_t streamArgsSpp(const uhd::stream_args_t& stream_args, size_t spp)
+{
+    const std::string value = stream_args.args.get("spp", "");
+    return value.empty() ? spp : std::stoul(value);
+}
+} // namespace
+
+MockClock::MockClock() : origin(std::chrono::steady_clock::now()) {}
+
+uhd::time_spec_t MockClock::getTimeNow() const
+{
+    std::lock_guard<std::mutex> lock(clock_mutex);
+    const std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - origin;
+    return uhd::time_spec_t(origin_secs + elapsed.count());
+}
+
+void MockClock::setTimeNow(const uhd::time_spec_t& time)
+{
+    std::lock_guard<std::mutex> lock(clock_mutex);
+    origin      = std::chrono::steady_clock::now();
+    origin_secs = time.get_real_secs();
+}
+
+std::chrono::steady_clock::time_point MockClock::toHostTime(
+    const uhd::time_spec_t& time) const
+{
+    std::lock_guard<std::mutex> lock(clock_mutex);
+    return origin
+           + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+               std::chrono::duration<double>(time.get_real_secs() - origin_secs));
+}
+
+void MockReplay::load(std::vector<std::complex<int16_t>> samples)
+{
+    std::lock_guard<std::mutex> lock(replay_mutex);
+    buffer = std::make_shared<const std::vector<std::complex<int16_t>>>(
+        std::move(samples));
+}
+
+void MockReplay::play(const uhd::time_spec_t& time, uint64_t num_samps)
+{
+    std::lock_guard<std::mutex> lock(replay_mutex);
+    if (!buffer || buffer->empty()) {
+        throw std::runtime_error("The mock Replay has no samples to play");
+    }
+    playing    = true;
+    play_start = time;
+    play_samps = num_samps;
+}
+
+void MockReplay::stop()
+{
+    std::lock_guard<std::mutex> lock(replay_mutex);
+    playing = false;
+}
+
+bool MockReplay::active() const
+{
+    std::lock_guard<std::mutex> lock(replay_mutex);
+    return playing;
+}
+
+void MockReplay::fill(std::complex<int16_t>* out,
+    long long first,
+    size_t nsamps,
+    double rate,
+    size_t delay) const
+{
+    std::shared_ptr<const std::vector<std::complex<int16_t>>> samples;
+    long long start = 0;
+    uint64_t length = 0;
+    {
+        std::lock_guard<std::mutex> lock(replay_mutex);
+        if (!playing) {
+            std::fill(out, out + nsamps, std::complex<int16_t>());
+            return;
+        }
+        samples = buffer;
+        start   = play_start.to_ticks(rate) + (long long)delay;
+        length  = play_samps;
+    }
+    size_t done = 0;
+    while (done < nsamps) {
+        const long long offset = first + (long long)done - start;
+        size_t count           = nsamps - done;
+        if (offset < 0 || (length > 0 && uint64_t(offset) >= length)) {
+            // Before the play reached the RX channels or after it ended
+            if (offset < 0) {
+                count = std::min(count, size_t(-offset));
+            }
+            std::fill(out + done, out + done + count, std::complex<int16_t>());
+        } else {
+            const size_t pos = size_t(offset % (long long)samples->size());
+            count            = std::min(count, samples->size() - pos);
+            if (length > 0) {
+                count = std::min<uint64_t>(count, length - offset);
+            }
+            std::copy_n(samples->begin() + pos, count, out + done);
+        }
+        done += count;
+    }
+}
+
+MockRxStreamer::MockRxStreamer(std::shared_ptr<MockClock> clock,
+    std::shared_ptr<MockReplay> replay,
+    const MockSettings& settings,
+    size_t num_channels,
+    double rate,
+    const std::string& cpu_format)
+    : clock(clock)
+    , replay(replay)
+    , settings(settings)
+    , num_channels(num_channels)
+    , rate(rate)
+    , sample_size(sampleSize(cpu_format))
+    , cpu_format(cpu_format)
+{
+    if (settings.waveform == "tone") {
+        period.resize(TONE_PERIOD * sample_size);
+        for (size_t n = 0; n < TONE_PERIOD; n++) {
+            const double phase = 2 * M_PI * n / TONE_PERIOD;
+            storeSample(cpu_format,
+                &period[n * sample_size],
+                0.5 * std::cos(phase),
+                0.5 * std::sin(phase));
+        }
+    } else if (settings.waveform != "counter") {
+        throw std::runtime_error("Unknown mock waveform " + settings.waveform);
+    }
+}
+
+size_t MockRxStreamer::get_num_channels() const
+{
+    return num_channels;
+}
+
+size_t MockRxStreamer::get_max_num_samps() const
+{
+    return settings.spp;
+}
+
+void MockRxStreamer::issue_stream_cmd(const uhd::stream_cmd_t& stream_cmd)
+{
+    std::lock_guard<std::mutex> lock(stream_mutex);
+    switch (stream_cmd.stream_mode) {
+        case uhd::stream_cmd_t::STREAM_MODE_STOP_CONTINUOUS:
+            if (!stream_cmd.stream_now && streaming) {
+                // Timed stop: the burst ends at the last sample before time_spec
+                const long long stop_samps =
+                    (stream_cmd.time_spec - burst_start).to_ticks(rate);
+                const uint64_t end = uint64_t(std::max(stop_samps, 0LL));
+                burst_samps        = continuous ? end : std::min(burst_samps, end);
+                continuous         = false;
+                return;
+            }
+            streaming = false;
+            return;
+        case uhd::stream_cmd_t::STREAM_MODE_START_CONTINUOUS:
+            continuous = true;
+            break;
+        default:
+            continuous  = false;
+            burst_samps = stream_cmd.num_samps;
+            break;
+    }
+    streaming      = true;
+    start_of_burst = true;
+    next_samp      = 0;
+    burst_start = stream_cmd.stream_now ? clock->getTimeNow() : stream_cmd.time_spec;
+}
+
+uint64_t MockRxStreamer::producedSamples() const
+{
+    uint64_t produced = continuous ? UINT64_MAX : burst_samps;
+    if (settings.realtime) {
+        const double elapsed = (clock->getTimeNow() - burst_start).get_real_secs();
+        produced = std::min(produced, uint64_t(std::max(elapsed, 0.0) * rate));
+    }
+    return produced;
+}
+
+void MockRxStreamer::fill(const buffs_type& buffs, uint64_t first, size_t nsamps)
+{
+    if (replay->active()) {
+        loopback.resize(std::max(loopback.size(), nsamps));
+        replay->fill(loopback.data(), first, nsamps, rate, settings.loopback_delay);
+        for (size_t ch = 0; ch < buffs.size(); ch++) {
+            char* out = static_cast<char*>(buffs[ch]);
+            if (cpu_format == "sc16") {
+                memcpy(out, loopback.data(), nsamps * sample_size);
+                continue;
+            }
+            for (size_t n = 0; n < nsamps; n++) {
+                storeSample(cpu_format,
+                    out + n * sample_size,
+                    loopback[n].real() / 32767.0,
+                    loopback[n].imag() / 32767.0);
+            }
+        }
+        return;
+    }
+    for (size_t ch = 0; ch < buffs.size(); ch++) {
+        char* out = static_cast<char*>(buffs[ch]);
+        if (period.empty()) {
+            // Counter: the device tick split over I (low 16 bits) and Q (high 16 bits)
+            for (size_t n = 0; n < nsamps; n++) {
+                const uint64_t tick = first + n;
+                storeSample(cpu_format,
+                    out + n * sample_size,
+                    int16_t(tick & 0xffff) / 32767.0,
+                    int16_t((tick >> 16) & 0xffff) / 32767.0);
+            }
+            continue;
+        }
+        size_t done = 0;
+        while (done < nsamps) {
+            const size_t pos   = (first + done) % TONE_PERIOD;
+            const size_t count = std::min(nsamps - done, TONE_PERIOD - pos);
+            memcpy(out + done * sample_size,
+                &period[pos * sample_size],
+                count * sample_size);
+            done += count;
+        }
+    }
+}
+
+bool MockRxStreamer::inject(size_t every, size_t& count, size_t packets)
+{
+    if (every == 0) {
+        return false;
+    }
+    count += packets;
+    if (count < every) {
+        return false;
+    }
+    count -= every;
+    return true;
+}
+
+size_t MockRxStreamer::recv(const buffs_type& buffs,
+    const size_t nsamps_per_buff,
+    uhd::rx_metadata_t& metadata,
+    const double timeout,
+    const bool one_packet)
+{
+    metadata = uhd::rx_metadata_t();
+    const auto deadline =
+        std::chrono::steady_clock::now()
+        + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+            std::chrono::duration<double>(timeout));
+    const size_t nsamps =
+        one_packet ? std::min(nsamps_per_buff, settings.spp) : nsamps_per_buff;
+    std::unique_lock<std::mutex> lock(stream_mutex);
+    auto timedOut = [&]() {
+        lock.unlock();
+        std::this_thread::sleep_until(deadline);
+        metadata.error_code = uhd::rx_metadata_t::ERROR_CODE_TIMEOUT;
+        return size_t(0);
+    };
+    auto overflow = [&](uint64_t dropped, bool out_of_sequence) {
+        next_samp += dropped;
+        if (!continuous) {
+            next_samp = std::min(next_samp, burst_samps);
+        }
+        metadata.error_code      = uhd::rx_metadata_t::ERROR_CODE_OVERFLOW;
+        metadata.out_of_sequence = out_of_sequence;
+        metadata.has_time_spec   = true;
+        metadata.time_spec = burst_start + uhd::time_spec_t::from_ticks(next_samp, rate);
+        return size_t(0);
+    };
+    if (!streaming || (!continuous && next_samp >= burst_samps)) {
+        return timedOut();
+    }
+    const size_t packets =
+        std::max<size_t>(1, (nsamps + settings.spp - 1) / settings.spp);
+    if (inject(settings.timeout_every, timeout_count, packets)) {
+        if (!settings.realtime) {
+            metadata.error_code = uhd::rx_metadata_t::ERROR_CODE_TIMEOUT;
+            return 0;
+        }
+        return timedOut();
+    }
+    if (inject(settings.overflow_every, overflow_count, packets)) {
+        return overflow(settings.spp, false);
+    }
+    if (inject(settings.gap_every, gap_count, packets)) {
+        return overflow(settings.gap_samples ? settings.gap_samples : settings.spp, true);
+    }
+
+    uint64_t want = nsamps;
+    if (!continuous) {
+        want = std::min(want, burst_samps - next_samp);
+    }
+    if (settings.realtime) {
+        const uint64_t produced = producedSamples();
+        if (produced > next_samp && produced - next_samp > settings.rx_buffer) {
+            // The host fell behind, drop everything that did not fit in the buffer
+            return overflow(produced - next_samp, false);
+        }
+        const auto ready = clock->toHostTime(
+            burst_start + uhd::time_spec_t::from_ticks(next_samp + want, rate));
+        lock.unlock();
+        std::this_thread::sleep_until(std::min(ready, deadline));
+        lock.lock();
+        if (!streaming) {
+            return timedOut();
+        }
+        const uint64_t available = producedSamples();
+        if (available <= next_samp) {
+            metadata.error_code = uhd::rx_metadata_t::ERROR_CODE_TIMEOUT;
+            return 0;
+        }
+        want = std::min(want, available - next_samp);
+    }
+
+    fill(buffs, burst_start.to_ticks(rate) + next_samp, want);
+    metadata.has_time_spec  = true;
+    metadata.time_spec      = burst_start + uhd::time_spec_t::from_ticks(next_samp, rate);
+    metadata.start_of_burst = start_of_burst;
+    start_of_burst          = false;
+    next_samp += want;
+    metadata.end_of_burst = !continuous && next_samp >= burst_samps;
+    return want;
+}
+
+MockTxStreamer::MockTxStreamer(std::shared_ptr<MockClock> clock,
+    const MockSettings& settings,
+    size_t num_channels,
+    double rate)
+    : clock(clock)
+    , settings(settings)
+    , num_channels(num_channels)
+    , consume_rate(settings.tx_consume_rate > 0 ? settings.tx_consume_rate : rate)
+    , last_drain(std::chrono::steady_clock::now())
+{
+}
+
+size_t MockTxStreamer::get_num_channels() const
+{
+    return num_channels;
+}
+
+size_t MockTxStreamer::get_max_num_samps() const
+{
+    return settings.spp;
+}
+
+void MockTxStreamer::pushAsync(uhd::async_metadata_t::event_code_t event_code)
+{
+    for (size_t ch = 0; ch < num_channels; ch++) {
+        uhd::async_metadata_t msg;
+        msg.channel       = ch;
+        msg.has_time_spec = true;
+        msg.time_spec     = clock->getTimeNow();
+        msg.event_code    = event_code;
+        async_msgs.push_back(msg);
+    }
+}
+
+void MockTxStreamer::drain()
+{
+    const auto now = std::chrono::steady_clock::now();
+    if (!in_burst) {
+        last_drain = now;
+        return;
+    }
+    const auto start = clock->toHostTime(burst_start);
+    if (now <= start) {
+        return;
+    }
+    if (settings.realtime) {
+        const std::chrono::duration<double> elapsed = now - std::max(last_drain, start);
+        buffered -= elapsed.count() * consume_rate;
+    } else {
+        buffered = 0;
+    }
+    last_drain = now;
+    if (buffered > 0) {
+        return;
+    }
+    buffered = 0;
+    if (end_of_burst) {
+        pushAsync(uhd::async_metadata_t::EVENT_CODE_BURST_ACK);
+        in_burst     = false;
+        end_of_burst = false;
+    } else if (!underflowed && settings.realtime) {
+        pushAsync(uhd::async_metadata_t::EVENT_CODE_UNDERFLOW);
+        underflowed = true;
+    }
+}
+
+size_t MockTxStreamer::send(const buffs_type&,
+    const size_t nsamps_per_buff,
+    const uhd::tx_metadata_t& metadata,
+    const double timeout)
+{
+    const auto deadline =
+        std::chrono::steady_clock::now()
+        + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+            std::chrono::duration<double>(timeout));
+    std::unique_lock<std::mutex> lock(tx_mutex);
+    drain();
+    if (metadata.start_of_burst || !in_burst) {
+        in_burst     = true;
+        end_of_burst = false;
+        underflowed  = false;
+        burst_start =
+            metadata.has_time_spec ? metadata.time_spec : clock->getTimeNow();
+        last_drain = std::chrono::steady_clock::now();
+    }
+    size_t sent = 0;
+    while (true) {
+        const double space  = std::max(double(settings.tx_buffer) - buffered, 0.0);
+        const size_t accept = std::min(nsamps_per_buff - sent, size_t(space));
+        buffered += accept;
+        sent += accept;
+        if (accept > 0) {
+            underflowed = false;
+        }
+        if (sent == nsamps_per_buff || !settings.realtime
+            || std::chrono::steady_clock::now() >= deadline) {
+            break;
+        }
+        // Sleep until the device made room for the next packet
+        const size_t next = std::min(settings.spp, nsamps_per_buff - sent);
+        const auto wake =
+            std::max(std::chrono::steady_clock::now(), clock->toHostTime(burst_start))
+            + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                std::chrono::duration<double>(
+                    (next - std::min(space - accept, double(next))) / consume_rate));
+        lock.unlock();
+        std::this_thread::sleep_until(std::min(wake, deadline));
+        lock.lock();
+        drain();
+    }
+    if (!settings.realtime) {
+        sent = nsamps_per_buff;
+    }
+    if (metadata.end_of_burst && sent == nsamps_per_buff) {
+        end_of_burst = true;
+        drain();
+    }
+    return sent;
+}
+
+bool MockTxStreamer::recv_async_msg(uhd::async_metadata_t& async_metadata, double timeout)
+{
+    const auto deadline =
+        std::chrono::steady_clock::now()
+        + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+            std::chrono::duration<double>(timeout));
+    std::unique_lock<std::mutex> lock(tx_mutex);
+    while (true) {
+        drain();
+        if (!async_msgs.empty()) {
+            async_metadata = async_msgs.front();
+            async_msgs.pop_front();
+            return true;
+        }
+        if (std::chrono::steady_clock::now() >= deadline) {
+            return false;
+        }
+        lock.unlock();
+        std::this_thread::sleep_until(std::min(
+            deadline, std::chrono::steady_clock::now() + std::chrono::milliseconds(1)));
+        lock.lock();
+    }
+}
+
+MockDevice::MockDevice(const MockSettings& settings)
+    : settings(settings)
+    , clock(std::make_shared<MockClock>())
+    , mock_replay(std::make_shared<MockReplay>())
+{
+}
+
+uhd::rx_streamer::sptr MockDevice::makeRxStreamer(
+    size_t num_channels, double rate, const uhd::stream_args_t& stream_args)
+{
+    MockSettings stream_settings = settings;
+    stream_settings.spp          = streamArgsSpp(stream_args, settings.spp);
+    return std::make_shared<MockRxStreamer>(clock,
+        mock_replay,
+        stream_settings,
+        num_channels,
+        rate,
+        stream_args.cpu_format);
+}
+
+uhd::tx_streamer::sptr MockDevice::makeTxStreamer(
+    size_t num_channels, double rate, const uhd::stream_args_t& stream_args)
+{
+    MockSettings stream_settings = settings;
+    stream_settings.spp          = streamArgsSpp(stream_args, settings.spp);
+    return std::make_shared<MockTxStreamer>(clock, stream_settings, num_channels, rate);
+}
@@ -0,0 +1,256 @@
+//
+// Copyright 2021-2022 Ettus Research, a National Instruments Brand
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+//
+
+#ifndef MOCKDEVICE_H
+#define MOCKDEVICE_H
+
+#include <uhd/stream.hpp>
+#include <uhd/types/metadata.hpp>
+#include <uhd/types/time_spec.hpp>
+#include <chrono>
+#include <complex>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/**
+ * @brief Settings of the simulated USRPs, filled from the mock-* options of RefArch.
+ *  The *_every counters are in packets of spp samples, 0 disables the injection.
+ */
+struct MockSettings
+{
+    size_t num_devices = 1;
+    size_t spp         = 2000;
+    // Single port radios per device, all received by one streamer, and as many ports
+    // of the device's Replay
+    size_t channels_per_device = 2;
+    // Pace the streamers at the sample rates. When false data is produced and consumed
+    // as fast as the host can, which measures the host side only.
+    bool realtime = true;
+    // "tone" (a complex exponential at rx rate / 100) or "counter" (sample index)
+    std::string waveform = "tone";
+    // Samples the host may fall behind the device before an overflow is reported
+    size_t rx_buffer      = 1000000;
+    size_t overflow_every = 0;
+    size_t timeout_every  = 0;
+    size_t gap_every      = 0;
+    // Samples dropped by every injected gap, 0 for one packet
+    size_t gap_samples = 0;
+    // Rate the device drains the TX buffer at, 0 for the TX sample rate
+    double tx_consume_rate = 0;
+    size_t tx_buffer       = 1000000;
+    // Samples from a Replay port playing to the RX channels receiving it
+    size_t loopback_delay = 0;
+};
+
+/**
+ * @brief Time base shared by all the streamers of a MockDevice, standing in for the
+ *  timekeepers of the real devices.
+ */
+class MockClock
+{
+public:
+    MockClock();
+    uhd::time_spec_t getTimeNow() const;
+    void setTimeNow(const uhd::time_spec_t& time);
+    /**
+     * @brief Host time at which the device time reaches time.
+     */
+    std::chrono::steady_clock::time_point toHostTime(const uhd::time_spec_t& time) const;
+
+private:
+    mutable std::mutex clock_mutex;
+    std::chrono::steady_clock::time_point origin;
+    double origin_secs = 0;
+};
+
+/**
+ * @brief Stands in for the Replay blocks of all devices. Every port plays the one
+ *  loaded sc16 buffer, looped, and every RX channel receives what plays, delayed by
+ *  MockSettings::loopback_delay samples, like a loopback through a splitter.
+ */
+class MockReplay
+{
+public:
+    void load(std::vector<std::complex<int16_t>> samples);
+    /**
+     * @brief Plays num_samps samples from time on, 0 to play until stop(). The ports
+     *  all play the same buffer, so which one plays makes no difference.
+     */
+    void play(const uhd::time_spec_t& time, uint64_t num_samps);
+    void stop();
+    /**
+     * @brief Whether a port has played since the last stop(). The RX channels then
+     *  receive the loopback, silence outside the play, instead of the waveform.
+     */
+    bool active() const;
+    /**
+     * @brief Writes the loopback received at device ticks first to first + nsamps - 1
+     *  of rate, as sc16.
+     */
+    void fill(std::complex<int16_t>* out,
+        long long first,
+        size_t nsamps,
+        double rate,
+        size_t delay) const;
+
+private:
+    mutable std::mutex replay_mutex;
+    std::shared_ptr<const std::vector<std::complex<int16_t>>> buffer;
+    bool playing        = false;
+    uint64_t play_samps = 0;
+    uhd::time_spec_t play_start;
+};
+
+/**
+ * @brief rx_streamer producing a generated waveform at the RX rate, or the loopback of
+ *  the MockReplay once it plays. Follows stream
+ *  commands (timed start, num_samps bursts, continuous, stop) and reports overflows
+ *  when the host falls more than MockSettings::rx_buffer samples behind. Overflows,
+ *  timeouts and timestamp gaps can also be injected at fixed packet intervals.
+ */
+class MockRxStreamer : public uhd::rx_streamer
+{
+public:
+    MockRxStreamer(std::shared_ptr<MockClock> clock,
+        std::shared_ptr<MockReplay> replay,
+        const MockSettings& settings,
+        size_t num_channels,
+        double rate,
+        const std::string& cpu_format);
+    size_t get_num_channels() const override;
+    size_t get_max_num_samps() const override;
+    size_t recv(const buffs_type& buffs,
+        const size_t nsamps_per_buff,
+        uhd::rx_metadata_t& metadata,
+        const double timeout = 0.1,
+        const bool one_packet = false) override;
+    void issue_stream_cmd(const uhd::stream_cmd_t& stream_cmd) override;
+
+private:
+    /**
+     * @brief Number of samples of the current burst the device has produced by now.
+     */
+    uint64_t producedSamples() const;
+    /**
+     * @brief Writes nsamps samples of the waveform starting at device tick first.
+     */
+    void fill(const buffs_type& buffs, uint64_t first, size_t nsamps);
+    bool inject(size_t every, size_t& count, size_t packets);
+
+    std::shared_ptr<MockClock> clock;
+    std::shared_ptr<MockReplay> replay;
+    MockSettings settings;
+    size_t num_channels;
+    double rate;
+    size_t sample_size;
+    // One packet of the loopback in sc16, converted for other cpu formats
+    std::vector<std::complex<int16_t>> loopback;
+    // One period of the waveform in the cpu format
+    std::vector<char> period;
+    std::string cpu_format;
+
+    std::mutex stream_mutex;
+    bool streaming       = false;
+    bool continuous      = false;
+    bool start_of_burst  = false;
+    uint64_t burst_samps = 0;
+    uhd::time_spec_t burst_start;
+    // Samples of the current burst delivered or dropped so far
+    uint64_t next_samp = 0;
+    size_t overflow_count = 0;
+    size_t timeout_count  = 0;
+    size_t gap_count      = 0;
+};
+
+/**
+ * @brief tx_streamer draining into a device buffer of MockSettings::tx_buffer samples
+ *  at MockSettings::tx_consume_rate. send() blocks while the buffer is full, which is
+ *  the backpressure a real device applies through flow control. Underflows and burst
+ *  acks are reported through recv_async_msg().
+ */
+class MockTxStreamer : public uhd::tx_streamer
+{
+public:
+    MockTxStreamer(std::shared_ptr<MockClock> clock,
+        const MockSettings& settings,
+        size_t num_channels,
+        double rate);
+    size_t get_num_channels() const override;
+    size_t get_max_num_samps() const override;
+    size_t send(const buffs_type& buffs,
+        const size_t nsamps_per_buff,
+        const uhd::tx_metadata_t& metadata,
+        const double timeout = 0.1) override;
+    bool recv_async_msg(uhd::async_metadata_t& async_metadata,
+        double timeout = 0.1) override;
+
+private:
+    /**
+     * @brief Removes what the device consumed since the last call. Called with
+     *  tx_mutex held.
+     */
+    void drain();
+    void pushAsync(uhd::async_metadata_t::event_code_t event_code);
+
+    std::shared_ptr<MockClock> clock;
+    MockSettings settings;
+    size_t num_channels;
+    double consume_rate;
+
+    std::mutex tx_mutex;
+    double buffered   = 0;
+    bool in_burst     = false;
+    bool end_of_burst = false;
+    bool underflowed  = false;
+    uhd::time_spec_t burst_start;
+    std::chrono::steady_clock::time_point last_drain;
+    std::deque<uhd::async_metadata_t> async_msgs;
+};
+
+/**
+ * @brief Stands in for the USRPs when RefArch runs with mock = true. Each device has
+ *  MockSettings::channels_per_device single port radios and a Replay with a port for
+ *  each.
+ */
+class MockDevice
+{
+public:
+    MockDevice(const MockSettings& settings);
+    size_t numRadios() const
+    {
+        return settings.num_devices * settings.channels_per_device;
+    }
+    const MockSettings& mockSettings() const
+    {
+        return settings;
+    }
+    uhd::time_spec_t getTimeNow() const
+    {
+        return clock->getTimeNow();
+    }
+    void setTimeNow(const uhd::time_spec_t& time)
+    {
+        clock->setTimeNow(time);
+    }
+    uhd::rx_streamer::sptr makeRxStreamer(
+        size_t num_channels, double rate, const uhd::stream_args_t& stream_args);
+    uhd::tx_streamer::sptr makeTxStreamer(
+        size_t num_channels, double rate, const uhd::stream_args_t& stream_args);
+    MockReplay& replay()
+    {
+        return *mock_replay;
+    }
+
+private:
+    MockSettings settings;
+    std::shared_ptr<MockClock> clock;
+    std::shared_ptr<MockReplay> mock_replay;
+};
+
+#endif
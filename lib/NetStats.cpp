@@ -0,0 +1,266 @@
+//
+// Copyright 2021-2022 Ettus Research, a National Instruments Brand
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+//
+
+#include "NetStats.hpp"
+#include <arpa/inet.h>
+#include <ifaddrs.h>
+#include <netinet/in.h>
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+namespace {
+bool readCounter(const std::string& path, uint64_t& value)
+{
+    std::ifstream infile(path);
+    return bool(infile >> value);
+}
+
+bool readInterface(const std::string& name, InterfaceCounters& counters)
+{
+    const std::string dir = "/sys/class/net/" + name + "/statistics/";
+    if (!readCounter(dir + "rx_packets", counters.rx_packets)) {
+        return false;
+    }
+    readCounter(dir + "rx_errors", counters.rx_errors);
+    readCounter(dir + "rx_dropped", counters.rx_dropped);
+    readCounter(dir + "rx_missed_errors", counters.rx_missed_errors);
+    readCounter(dir + "rx_fifo_errors", counters.rx_fifo_errors);
+    readCounter(dir + "rx_over_errors", counters.rx_over_errors);
+    return true;
+}
+
+SoftnetCounters readSoftnet()
+{
+    // One line per CPU of hexadecimal columns, see net/core/net-procfs.c
+    SoftnetCounters counters;
+    std::ifstream infile("/proc/net/softnet_stat");
+    std::string line;
+    while (std::getline(infile, line)) {
+        std::istringstream columns(line);
+        uint64_t processed = 0, dropped = 0, time_squeeze = 0;
+        columns >> std::hex >> processed >> dropped >> time_squeeze;
+        counters.processed += processed;
+        counters.dropped += dropped;
+        counters.time_squeeze += time_squeeze;
+    }
+    return counters;
+}
+
+/**
+ * @brief Values of the addr and second_addr keys of a device address string such as
+ *  "mgmt_addr0=10.0.126.46, addr0=192.168.50.2".
+ */
+std::vector<std::string> dataAddresses(const std::string& address)
+{
+    std::vector<std::string> values;
+    std::istringstream pairs(address);
+    std::string pair;
+    while (std::getline(pairs, pair, ',')) {
+        const size_t equals = pair.find('=');
+        if (equals == std::string::npos) {
+            continue;
+        }
+        std::string key   = pair.substr(0, equals);
+        std::string value = pair.substr(equals + 1);
+        key.erase(std::remove_if(key.begin(), key.end(), ::isspace), key.end());
+        value.erase(std::remove_if(value.begin(), value.end(), ::isspace), value.end());
+        if (key.compare(0, 4, "addr") == 0 || key.compare(0, 11, "second_addr") == 0) {
+            values.push_back(value);
+        }
+    }
+    return values;
+}
+
+int64_t delta(uint64_t before, uint64_t after)
+{
+    return int64_t(after - before);
+}
+} // namespace
+
+NetSnapshot readNetSnapshot(const std::vector<std::string>& interfaces)
+{
+    NetSnapshot snapshot;
+    snapshot.time = std::chrono::steady_clock::now();
+    for (const auto& name : interfaces) {
+        InterfaceCounters counters;
+        if (readInterface(name, counters)) {
+            snapshot.interfaces[name] = counters;
+        }
+    }
+    snapshot.softnet = readSoftnet();
+    return snapshot;
+}
+
+std::vector<std::string> interfacesForAddresses(
+    const std::vector<std::string>& addresses)
+{
+    std::vector<std::string> interfaces;
+    struct ifaddrs* ifaddr = nullptr;
+    if (getifaddrs(&ifaddr) != 0) {
+        return interfaces;
+    }
+    for (const auto& address : addresses) {
+        for (const auto& value : dataAddresses(address)) {
+            struct in_addr device;
+            if (inet_pton(AF_INET, value.c_str(), &device) != 1) {
+                continue;
+            }
+            for (struct ifaddrs* ifa = ifaddr; ifa != nullptr; ifa = ifa->ifa_next) {
+                if (ifa->ifa_addr == nullptr || ifa->ifa_netmask == nullptr
+                    || ifa->ifa_addr->sa_family != AF_INET) {
+                    continue;
+                }
+                const uint32_t host =
+                    ((struct sockaddr_in*)ifa->ifa_addr)->sin_addr.s_addr;
+                const uint32_t mask =
+                    ((struct sockaddr_in*)ifa->ifa_netmask)->sin_addr.s_addr;
+                if ((host & mask) == (device.s_addr & mask)
+                    && std::find(interfaces.begin(), interfaces.end(), ifa->ifa_name)
+                           == interfaces.end()) {
+                    interfaces.push_back(ifa->ifa_name);
+                }
+            }
+        }
+    }
+    freeifaddrs(ifaddr);
+    return interfaces;
+}
+
+NetSampler::NetSampler(MetricsRegistry& registry,
+    const std::vector<std::string>& interfaces,
+    double interval_s)
+    : registry(registry), interfaces(interfaces), interval_s(interval_s)
+{
+}
+
+NetSampler::~NetSampler()
+{
+    stop();
+}
+
+void NetSampler::start()
+{
+    if (sampler_thread.joinable()) {
+        return;
+    }
+    stopping = false;
+    events.clear();
+    previous_overflows.clear();
+    for (const auto& snapshot : registry.snapshot(false)) {
+        if (snapshot.kind == "rx") {
+            previous_overflows[snapshot.id] = snapshot.counters[METRIC_OVERFLOWS]
+                                              + snapshot.counters[METRIC_SEQUENCE_ERRORS];
+        }
+    }
+    first          = readNetSnapshot(interfaces);
+    previous       = first;
+    sampler_thread = std::thread([this]() { run(); });
+}
+
+void NetSampler::stop()
+{
+    if (!sampler_thread.joinable()) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(sampler_mutex);
+        stopping = true;
+    }
+    sampler_cv.notify_all();
+    sampler_thread.join();
+    sample();
+    std::cout << "[net] " << events.size() << " RX overflow events, whole run: "
+              << describeDeltas(first, previous, false) << std::endl;
+}
+
+void NetSampler::run()
+{
+    const auto interval = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+        std::chrono::duration<double>(interval_s));
+    auto next = std::chrono::steady_clock::now() + interval;
+    std::unique_lock<std::mutex> lock(sampler_mutex);
+    while (!sampler_cv.wait_until(lock, next, [this]() { return stopping; })) {
+        lock.unlock();
+        sample();
+        lock.lock();
+        next += interval;
+    }
+}
+
+void NetSampler::sample()
+{
+    const NetSnapshot current = readNetSnapshot(interfaces);
+    std::vector<OverflowEvent> new_events;
+    for (const auto& snapshot : registry.snapshot(false)) {
+        if (snapshot.kind != "rx") {
+            continue;
+        }
+        const uint64_t overflows = snapshot.counters[METRIC_OVERFLOWS]
+                                   + snapshot.counters[METRIC_SEQUENCE_ERRORS];
+        uint64_t& before = previous_overflows[snapshot.id];
+        if (overflows > before) {
+            new_events.push_back(
+                {std::chrono::duration<double>(current.time - first.time).count(),
+                    snapshot.id,
+                    overflows - before});
+        }
+        before = overflows;
+    }
+    if (!new_events.empty()) {
+        const std::string deltas = describeDeltas(previous, current, true);
+        std::ostringstream out;
+        out << std::fixed << std::setprecision(3);
+        for (const auto& event : new_events) {
+            out << "[net] " << event.time_s << " s rx " << event.thread << ": "
+                << event.overflows << " overflow(s), " << deltas << std::endl;
+        }
+        std::cout << out.str() << std::flush;
+        events.insert(events.end(), new_events.begin(), new_events.end());
+    }
+    previous = current;
+}
+
+std::string NetSampler::describeDeltas(
+    const NetSnapshot& before, const NetSnapshot& after, bool attribute)
+{
+    std::ostringstream out;
+    bool nic_drops = false;
+    for (const auto& entry : after.interfaces) {
+        auto old = before.interfaces.find(entry.first);
+        if (old == before.interfaces.end()) {
+            continue;
+        }
+        const InterfaceCounters& a = entry.second;
+        const InterfaceCounters& b = old->second;
+        const int64_t ring_drops   = delta(b.rx_missed_errors, a.rx_missed_errors)
+                                   + delta(b.rx_fifo_errors, a.rx_fifo_errors)
+                                   + delta(b.rx_over_errors, a.rx_over_errors);
+        nic_drops = nic_drops || ring_drops > 0 || delta(b.rx_dropped, a.rx_dropped) > 0;
+        out << entry.first << " packets +" << delta(b.rx_packets, a.rx_packets)
+            << " missed/fifo/over +" << ring_drops << " dropped +"
+            << delta(b.rx_dropped, a.rx_dropped) << " errors +"
+            << delta(b.rx_errors, a.rx_errors) << ", ";
+    }
+    const int64_t softnet_dropped =
+        delta(before.softnet.dropped, after.softnet.dropped);
+    const int64_t squeezed =
+        delta(before.softnet.time_squeeze, after.softnet.time_squeeze);
+    out << "softnet dropped +" << softnet_dropped << " squeezed +" << squeezed;
+    if (!attribute) {
+        return out.str();
+    }
+    if (nic_drops) {
+        out << " -> NIC ring";
+    } else if (softnet_dropped > 0 || squeezed > 0) {
+        out << " -> softirq";
+    } else {
+        out << " -> host threads";
+    }
+    return out.str();
+}
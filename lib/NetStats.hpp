@@ -0,0 +1,118 @@
+//
+// Copyright 2021-2022 Ettus Research, a National Instruments Brand
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+//
+
+#ifndef NETSTATS_H
+#define NETSTATS_H
+
+#include "Metrics.hpp"
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief Receive counters of one interface, from /sys/class/net/<name>/statistics.
+ *  rx_missed_errors and rx_fifo_errors are drops in the NIC ring, rx_dropped are
+ *  packets the kernel dropped after the NIC delivered them.
+ */
+struct InterfaceCounters
+{
+    uint64_t rx_packets       = 0;
+    uint64_t rx_errors        = 0;
+    uint64_t rx_dropped       = 0;
+    uint64_t rx_missed_errors = 0;
+    uint64_t rx_fifo_errors   = 0;
+    uint64_t rx_over_errors   = 0;
+};
+
+/**
+ * @brief /proc/net/softnet_stat summed over the CPUs. dropped counts packets lost
+ *  because netdev_max_backlog was exceeded, time_squeeze the times softirq ran out of
+ *  netdev_budget with work remaining.
+ */
+struct SoftnetCounters
+{
+    uint64_t processed    = 0;
+    uint64_t dropped      = 0;
+    uint64_t time_squeeze = 0;
+};
+
+struct NetSnapshot
+{
+    std::chrono::steady_clock::time_point time;
+    std::map<std::string, InterfaceCounters> interfaces;
+    SoftnetCounters softnet;
+};
+
+/**
+ * @brief Reads the counters of interfaces and /proc/net/softnet_stat. Interfaces that
+ *  cannot be read are left out.
+ */
+NetSnapshot readNetSnapshot(const std::vector<std::string>& interfaces);
+
+/**
+ * @brief Names of the host interfaces on the same subnet as the addr and second_addr
+ *  values of the device address strings (mgmt_addr is ignored).
+ */
+std::vector<std::string> interfacesForAddresses(
+    const std::vector<std::string>& addresses);
+
+/**
+ * @brief Samples the NIC and softirq counters every interval while streaming and
+ *  checks the overflow counters of the "rx" metrics slots. Every interval in which an
+ *  RX thread overflowed is reported with the counter deltas of that interval, and
+ *  attributed to the NIC ring, softirq or the host threads.
+ */
+class NetSampler
+{
+public:
+    NetSampler(MetricsRegistry& registry,
+        const std::vector<std::string>& interfaces,
+        double interval_s);
+    ~NetSampler();
+    void start();
+    /**
+     * @brief Stops sampling and prints the number of overflow events and the deltas
+     *  over the whole run.
+     */
+    void stop();
+
+private:
+    // One RX thread overflowing during one interval
+    struct OverflowEvent
+    {
+        double time_s;
+        int thread;
+        uint64_t overflows;
+    };
+    void run();
+    void sample();
+    /**
+     * @brief One line of counter deltas between two snapshots, with attribute also
+     *  where the drops happened.
+     */
+    std::string describeDeltas(
+        const NetSnapshot& before, const NetSnapshot& after, bool attribute);
+
+    MetricsRegistry& registry;
+    std::vector<std::string> interfaces;
+    double interval_s;
+    NetSnapshot first;
+    NetSnapshot previous;
+    // Overflows plus sequence errors of each rx slot at the previous sample
+    std::map<int, uint64_t> previous_overflows;
+    std::vector<OverflowEvent> events;
+    bool stopping = false;
+    std::mutex sampler_mutex;
+    std::condition_variable sampler_cv;
+    std::thread sampler_thread;
+};
+
+#endif
@@ -5,11 +5,15 @@
 //
 
 #include "RefArch.hpp"
+#include "Shard.hpp"
 #include <uhd/rfnoc/mb_controller.hpp>
 #include <uhd/utils/thread.hpp>
 #include <stdio.h>
-#include <boost/circular_buffer.hpp>
+#include <algorithm>
+#include <cmath>
 #include <csignal>
+#include <cstring>
+#include <ctime>
 #include <fstream>
 
 #if HAS_STD_FILESYSTEM
@@ -34,7 +38,115 @@ namespace RA_filesystem = std::filesystem;
 namespace RA_filesystem = boost::filesystem;
 #endif
 
-bool RefArch::RA_stop_signal_called = false;
+CancelToken RefArch::RA_cancel;
+
+namespace {
+/**
+ * @brief Folder name for the captures of a run, MMDDYYYY_HHMMSS_ and name as the
+ *  examples name theirs.
+ */
+std::string runFolderName(const std::string& name)
+{
+    char started[32];
+    const std::time_t now = std::time(nullptr);
+    std::strftime(started, sizeof(started), "%m%d%Y_%H%M%S_", std::localtime(&now));
+    return started + name;
+}
+
+/**
+ * @brief Whether entry i of a per port vector, such as RA_replay_ctrls, is the first
+ *  port of its block, for the work done once per block.
+ */
+template <typename T>
+bool firstPort(const std::vector<T>& entries, size_t i)
+{
+    return i == 0 or entries[i] != entries[i - 1];
+}
+
+/**
+ * @brief Index of the block id in ctrls, adding its control first if needed.
+ */
+template <typename ctrl_type>
+size_t blockIndex(uhd::rfnoc::rfnoc_graph::sptr graph,
+    std::vector<std::shared_ptr<ctrl_type>>& ctrls,
+    const std::string& id)
+{
+    for (size_t i = 0; i < ctrls.size(); i++) {
+        if (ctrls[i]->get_block_id().to_string() == id) {
+            return i;
+        }
+    }
+    ctrls.push_back(graph->get_block<ctrl_type>(uhd::rfnoc::block_id_t(id)));
+    return ctrls.size() - 1;
+}
+
+/**
+ * @brief Samples one streamer received in seconds during a layout benchmark, and
+ *  whether it overflowed or failed.
+ */
+struct StreamerBenchmark
+{
+    size_t samples = 0;
+    double seconds = 0;
+    bool failed    = false;
+};
+
+/**
+ * @brief Streams rx_streamer continuously from start, discarding the samples, and
+ *  counts the samples received for seconds after the first packet. Stops and drains
+ *  the streamer before returning.
+ */
+StreamerBenchmark benchmarkRxStreamer(uhd::rx_streamer::sptr rx_streamer,
+    const uhd::time_spec_t& start,
+    double start_delay,
+    double seconds,
+    size_t spb,
+    size_t sample_size)
+{
+    StreamerBenchmark result;
+    const size_t num_channels = rx_streamer->get_num_channels();
+    std::vector<std::vector<char>> buffs(
+        num_channels, std::vector<char>(spb * sample_size));
+    std::vector<void*> buff_ptrs;
+    for (auto& buff : buffs) {
+        buff_ptrs.push_back(buff.data());
+    }
+    uhd::stream_cmd_t stream_cmd(uhd::stream_cmd_t::STREAM_MODE_START_CONTINUOUS);
+    stream_cmd.stream_now = false;
+    stream_cmd.time_spec  = start;
+    rx_streamer->issue_stream_cmd(stream_cmd);
+    uhd::rx_metadata_t md;
+    double timeout = start_delay + 0.1;
+    bool started    = false;
+    auto first_time = std::chrono::steady_clock::now();
+    auto stop_time  = first_time;
+    while (not started or std::chrono::steady_clock::now() < stop_time) {
+        const size_t num_rx_samps = rx_streamer->recv(buff_ptrs, spb, md, timeout);
+        if (md.error_code != uhd::rx_metadata_t::ERROR_CODE_NONE) {
+            // Overflows, timeouts and errors all rule the layout out
+            result.failed = true;
+            break;
+        }
+        if (started) {
+            result.samples += num_rx_samps * num_channels;
+            continue;
+        }
+        // Time from the first packet on, not from the start time
+        started    = true;
+        timeout    = 0.1;
+        first_time = std::chrono::steady_clock::now();
+        stop_time  = first_time + std::chrono::microseconds(int64_t(seconds * 1e6));
+    }
+    result.seconds =
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - first_time)
+            .count();
+    stream_cmd.stream_mode = uhd::stream_cmd_t::STREAM_MODE_STOP_CONTINUOUS;
+    rx_streamer->issue_stream_cmd(stream_cmd);
+    while (rx_streamer->recv(buff_ptrs, spb, md, 0.1) > 0) {
+    }
+    return result;
+}
+} // namespace
 
 
 void RefArch::parseConfig()
@@ -82,6 +194,9 @@ void RefArch::addProgramOptions()
         ("rx-freq",
             po::value<double>(&RA_rx_freq)->default_value(2000e6), 
             "receive RF center frequency in Hz")
+        ("tune_cache",
+            po::value<bool>(&RA_tune_cache)->default_value(true),
+            "skip tuning radios that are already at the requested frequency")
         ("address",
             po::value<std::vector<std::string>>(&RA_address), 
             "uhd transmit device address args")
@@ -93,6 +208,12 @@ void RefArch::addProgramOptions()
             "receive antenna selection")
         ("streamargs", po::value<std::string>(&RA_streamargs)
         ->default_value(""),"stream args")
+        ("rx-streamers",
+            po::value<std::string>(&RA_rx_streamers)->default_value("device"),
+            "RX streamer layout: channel, device, global, N channels or auto")
+        ("rx-streamers-bench-time",
+            po::value<double>(&RA_rx_streamers_bench_time)->default_value(1),
+            "seconds every layout streams for when rx-streamers = auto")
         ("tx-bw",
             po::value<double>(&RA_tx_bw)->default_value(0), 
             "analog transmit filter bandwidth in Hz")
@@ -109,6 +230,15 @@ void RefArch::addProgramOptions()
              po::value<std::vector<std::string>>(&RA_rx_file_location))
         ("rx-file-channels",
             po::value<std::vector<std::string>>(&RA_rx_file_channels))
+        ("rx-index-interval",
+            po::value<size_t>(&RA_rx_index_interval)->default_value(1048576),
+            "samples per entry of the <capture>.idx time index, 0 to disable")
+        ("rx-compress",
+            po::value<bool>(&RA_rx_compress)->default_value(false),
+            "write sc16 captures losslessly compressed to <capture>.sc16z")
+        ("rx-burst",
+            po::value<bool>(&RA_rx_burst)->default_value(false),
+            "receive nsamps per channel into RAM and write them once streaming stopped")
         ("otw", 
             po::value<std::string>(&RA_otw)->default_value("sc16"), 
             "specify the over-the-wire sample mode")
@@ -133,6 +263,9 @@ void RefArch::addProgramOptions()
         ("time_delay",
             po::value<double>(&RA_delay_start_time)->default_value(2.0), 
             "TX/RX Time Delay (seconds)")
+        ("shard-fd",
+            po::value<int>(&RA_shard_fd)->default_value(-1),
+            "socket to the Arch_shard coordinator, set by the coordinator")
         ("singleTX",
             po::value<int>(&RA_singleTX)->default_value(0), 
             "TX Channel)")
@@ -148,6 +281,109 @@ void RefArch::addProgramOptions()
         ("stats",
             po::value<bool>(&RA_stats)->default_value(false), 
             "Display RX Stats")
+        ("graceful-stop",
+            po::value<bool>(&RA_graceful_stop)->default_value(false),
+            "first Ctrl+C stops all streams at a common time, the second immediately")
+        ("graceful-stop-delay",
+            po::value<double>(&RA_graceful_stop_delay)->default_value(0.2),
+            "seconds from the graceful stop request to the common stop time")
+        ("mock",
+            po::value<bool>(&RA_mock)->default_value(false),
+            "simulate the USRPs, one per address (at least one), no hardware is used")
+        ("mock-channels",
+            po::value<size_t>(&RA_mock_settings.channels_per_device)->default_value(2),
+            "channels of every mock device, each a single port radio")
+        ("mock-realtime",
+            po::value<bool>(&RA_mock_settings.realtime)->default_value(true),
+            "pace the mock streamers at the sample rates, false runs as fast as possible")
+        ("mock-spp",
+            po::value<size_t>(&RA_mock_settings.spp)->default_value(2000),
+            "samples per packet of the mock streamers")
+        ("mock-waveform",
+            po::value<std::string>(&RA_mock_settings.waveform)->default_value("tone"),
+            "mock RX waveform: tone or counter")
+        ("mock-rx-buffer",
+            po::value<size_t>(&RA_mock_settings.rx_buffer)->default_value(1000000),
+            "samples the host may fall behind before the mock reports an overflow")
+        ("mock-overflow-every",
+            po::value<size_t>(&RA_mock_settings.overflow_every)->default_value(0),
+            "inject an RX overflow every N packets, 0 to disable")
+        ("mock-timeout-every",
+            po::value<size_t>(&RA_mock_settings.timeout_every)->default_value(0),
+            "inject an RX timeout every N packets, 0 to disable")
+        ("mock-gap-every",
+            po::value<size_t>(&RA_mock_settings.gap_every)->default_value(0),
+            "inject an RX timestamp gap every N packets, 0 to disable")
+        ("mock-gap-samples",
+            po::value<size_t>(&RA_mock_settings.gap_samples)->default_value(0),
+            "samples dropped by each injected gap, 0 for one packet")
+        ("mock-tx-rate",
+            po::value<double>(&RA_mock_settings.tx_consume_rate)->default_value(0),
+            "rate the mock device consumes TX samples at, 0 for tx-rate")
+        ("mock-tx-buffer",
+            po::value<size_t>(&RA_mock_settings.tx_buffer)->default_value(1000000),
+            "TX samples the mock device buffers before send() blocks")
+        ("mock-loopback-delay",
+            po::value<size_t>(&RA_mock_settings.loopback_delay)->default_value(0),
+            "samples from the mock Replay playing to the RX channels receiving it")
+        ("metrics",
+            po::value<std::string>(&RA_metrics)->default_value("none"),
+            "report per thread metrics: none, console, csv or prometheus")
+        ("metrics-file",
+            po::value<std::string>(&RA_metrics_file)->default_value(""),
+            "csv or prometheus output file, default metrics.csv or metrics.prom")
+        ("metrics-interval",
+            po::value<double>(&RA_metrics_interval)->default_value(1.0),
+            "seconds between metrics reports")
+        ("net-stats",
+            po::value<bool>(&RA_net_stats)->default_value(false),
+            "sample NIC and softirq drop counters and tag RX overflows with them")
+        ("net-stats-interval",
+            po::value<double>(&RA_net_stats_interval)->default_value(0.1),
+            "seconds between NIC counter samples")
+        ("net-interfaces",
+            po::value<std::vector<std::string>>(&RA_net_interfaces),
+            "interfaces to sample, default those on the subnets of the addresses")
+        ("monitor",
+            po::value<bool>(&RA_monitor)->default_value(false),
+            "monitor RMS, peak, DC offset and spectrum of every RX channel")
+        ("monitor-interval",
+            po::value<double>(&RA_monitor_settings.interval_s)->default_value(0.5),
+            "seconds between monitor snapshots")
+        ("monitor-fft-size",
+            po::value<size_t>(&RA_monitor_settings.fft_size)->default_value(1024),
+            "samples per monitor snapshot, a power of two")
+        ("monitor-output",
+            po::value<std::string>(&RA_monitor_settings.output)->default_value("console"),
+            "console, shm (/dev/shm/refarch_monitor) or both")
+        ("monitor-min-dbfs",
+            po::value<double>(&RA_monitor_settings.min_dbfs)->default_value(-60),
+            "flag channels whose RMS power is below this level")
+        ("trigger",
+            po::value<bool>(&RA_trigger)->default_value(false),
+            "keep the last trigger-ring seconds in RAM and write a window per trigger")
+        ("trigger-ring",
+            po::value<double>(&RA_trigger_settings.ring_s)->default_value(4),
+            "seconds of every RX channel kept in RAM")
+        ("trigger-pre",
+            po::value<double>(&RA_trigger_settings.pre_s)->default_value(0.5),
+            "seconds written before each trigger")
+        ("trigger-post",
+            po::value<double>(&RA_trigger_settings.post_s)->default_value(0.5),
+            "seconds written after each trigger")
+        ("trigger-threshold-dbfs",
+            po::value<double>(&RA_trigger_settings.threshold_dbfs)->default_value(0),
+            "trigger when the power of any channel exceeds this level, 0 to disable")
+        ("trigger-window",
+            po::value<size_t>(&RA_trigger_settings.window)->default_value(256),
+            "samples per power measurement of the threshold trigger")
+        ("trigger-socket",
+            po::value<std::string>(&RA_trigger_settings.socket_path)
+                ->default_value("/tmp/refarch_trigger"),
+            "unix datagram socket any message to which triggers, empty for none")
+        ("trigger-holdoff",
+            po::value<double>(&RA_trigger_settings.holdoff_s)->default_value(0),
+            "seconds after a written window before the next trigger is accepted")
         ;
     // clang-format on
 }
@@ -181,9 +417,23 @@ void RefArch::storeProgramOptions()
         }
     }
     po::notify(RA_vm);
+    if (RA_graceful_stop and not recvSupportsGracefulStop()) {
+        // Its loops would stop right away, each channel at a different sample
+        throw std::runtime_error(
+            "graceful-stop is not supported by this example, only by examples receiving "
+            "through receiveSamples() (Arch_rx_to_mem, Arch_rfnoc_txrx_loopback*)");
+    }
+    RA_cancel.setGracefulOnSignal(RA_graceful_stop);
+    if (RA_metrics != "none") {
+        // Fail here rather than in the first thread that reports
+        MetricsReporter::parseFormat(RA_metrics);
+    }
 }
 void RefArch::setSources()
 {
+    if (RA_mock) {
+        return;
+    }
     // Set clock reference
     std::cout << "Locking motherboard reference/time sources..." << std::endl;
     // Try/Catch Temp fix for TDC issue that will be patched in UHD 4.3
@@ -208,6 +458,18 @@ void RefArch::setSources()
 }
 int RefArch::syncAllDevices()
 {
+    if (RA_shard_fd >= 0) {
+        // The coordinator answers once, later calls keep the time base of the first
+        if (RA_shard_sync_status < 0) {
+            RA_shard_sync_status = syncShard();
+        }
+        return RA_shard_sync_status;
+    }
+    if (RA_mock) {
+        RA_mock_device->setTimeNow(0.0);
+        std::cout << "Synchronized" << std::endl;
+        return EXIT_SUCCESS;
+    }
     // Synchronize Devices
     bool sync_result;
     const uhd::time_spec_t syncTime = 0.0;
@@ -222,8 +484,46 @@ int RefArch::syncAllDevices()
     }
     return EXIT_SUCCESS;
 }
+int RefArch::syncShard()
+{
+    // Blocks until every shard is ready
+    const ShardSync sync = waitForShardSync(RA_shard_fd);
+    RA_shard_start_time  = sync.start;
+    if (RA_mock) {
+        // The host clock stands in for the PPS
+        sleepUntilHostTime(sync.epoch);
+        RA_mock_device->setTimeNow(sync.epoch);
+        std::cout << boost::format("Synchronized to shard epoch %.0f") % sync.epoch
+                  << std::endl;
+        return EXIT_SUCCESS;
+    }
+    // Arm every device half a second before the PPS edge of the epoch, which the
+    // host clock has to be within half a second of
+    sleepUntilHostTime(sync.epoch - 0.5);
+    for (size_t i = 0; i < RA_graph->get_num_mboards(); i++) {
+        RA_graph->get_mb_controller(i)->get_timekeeper(0)->set_time_next_pps(
+            uhd::time_spec_t(sync.epoch));
+    }
+    sleepUntilHostTime(sync.epoch + 0.5);
+    for (size_t i = 0; i < RA_graph->get_num_mboards(); i++) {
+        const uhd::time_spec_t last_pps =
+            RA_graph->get_mb_controller(i)->get_timekeeper(0)->get_time_last_pps();
+        if (std::llround(last_pps.get_real_secs()) != std::llround(sync.epoch)) {
+            std::cout << boost::format("Device %d missed the PPS of shard epoch %.0f") % i
+                             % sync.epoch
+                      << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+    std::cout << boost::format("Synchronized to shard epoch %.0f") % sync.epoch
+              << std::endl;
+    return EXIT_SUCCESS;
+}
 void RefArch::killLOs()
 {
+    if (RA_mock) {
+        return;
+    }
     std::cout << "Shutting Down LOs" << std::endl;
     size_t device = 0;
     while (device < RA_lo.size()) {
@@ -276,6 +576,9 @@ void RefArch::killLOs()
 }
 void RefArch::setLOsfromConfig()
 {
+    if (RA_mock) {
+        return;
+    }
     // Set LOs per config from config file
     int device = 0;
     for (size_t device = 0; device < RA_lo.size(); device++) {
@@ -290,17 +593,16 @@ void RefArch::setLOsfromConfig()
 }
 void RefArch::setSource(int device)
 {
-    std::cout << "Setting Device# " << device << " Radio# " << device * 2 << ", Radio# "
-              << device * 2 + 1 << " to: "
-              << "source" << std::endl;
+    printLOSetting(device, "source");
     // Set Device to System LO Source
     // No difference between RX and TX LOs, just used RX.
-    // TODO: Hardcoded number of channels per device.
-    RA_radio_ctrls[device * 2]->set_tx_lo_export_enabled(false, "lo1", 0);
-    RA_radio_ctrls[device * 2 + 1]->set_tx_lo_export_enabled(false, "lo1", 0);
-
-    RA_radio_ctrls[device * 2]->set_rx_lo_export_enabled(true, "lo1", 0);
-    RA_radio_ctrls[device * 2 + 1]->set_rx_lo_export_enabled(true, "lo1", 0);
+    for (const size_t i : RA_topology.deviceChannels(device)) {
+        const TopologyChannel& channel = RA_topology.channel(i);
+        RA_radio_ctrls[channel.radio]->set_tx_lo_export_enabled(
+            false, "lo1", channel.radio_port);
+        RA_radio_ctrls[channel.radio]->set_rx_lo_export_enabled(
+            true, "lo1", channel.radio_port);
+    }
 
     // TODO: this did not clean up nice. Reformat.
     RA_graph->get_tree()
@@ -345,42 +647,25 @@ void RefArch::setSource(int device)
             % "/Radio#0/dboard/rx_frontends/0/los/lo1/lo_distribution/LO_OUT_3/export"))
         .set(true);
 
-    RA_radio_ctrls[device * 2]->set_tx_lo_source("external", "lo1", 0);
-    RA_radio_ctrls[device * 2 + 1]->set_tx_lo_source("external", "lo1", 0);
-
-    RA_radio_ctrls[device * 2]->set_rx_lo_source("external", "lo1", 0);
-    RA_radio_ctrls[device * 2 + 1]->set_rx_lo_source("external", "lo1", 0);
+    setExternalLOs(device);
 }
 void RefArch::setTerminal(int device)
 {
-    // TODO: Hardcoded number of channels per device.
-    std::cout << "Setting Device# " << device << " Radio# " << device * 2 << ", Radio# "
-              << device * 2 + 1 << " to: "
-              << "terminal" << std::endl;
-    RA_radio_ctrls[device * 2]->set_tx_lo_source("external", "lo1", 0);
-    RA_radio_ctrls[device * 2 + 1]->set_tx_lo_source("external", "lo1", 0);
-
-    RA_radio_ctrls[device * 2]->set_rx_lo_source("external", "lo1", 0);
-    RA_radio_ctrls[device * 2 + 1]->set_rx_lo_source("external", "lo1", 0);
+    printLOSetting(device, "terminal");
+    setExternalLOs(device);
 }
 void RefArch::setDistributor(int device)
 {
-    // TODO: Hardcoded number of channels per device.
-    std::cout << "Setting Device# " << device << " Radio# " << device * 2 << ", Radio# "
-              << device * 2 + 1 << " to: "
-              << "distributor" << std::endl;
-
-    RA_radio_ctrls[device * 2]->set_tx_lo_source("external", "lo1", 0);
-    RA_radio_ctrls[device * 2 + 1]->set_tx_lo_source("external", "lo1", 0);
-
-    RA_radio_ctrls[device * 2]->set_rx_lo_source("external", "lo1", 0);
-    RA_radio_ctrls[device * 2 + 1]->set_rx_lo_source("external", "lo1", 0);
+    printLOSetting(device, "distributor");
+    setExternalLOs(device);
 
-    RA_radio_ctrls[device * 2]->set_tx_lo_export_enabled(false, "lo1", 0);
-    RA_radio_ctrls[device * 2 + 1]->set_tx_lo_export_enabled(false, "lo1", 0);
-
-    RA_radio_ctrls[device * 2]->set_rx_lo_export_enabled(false, "lo1", 0);
-    RA_radio_ctrls[device * 2 + 1]->set_rx_lo_export_enabled(false, "lo1", 0);
+    for (const size_t i : RA_topology.deviceChannels(device)) {
+        const TopologyChannel& channel = RA_topology.channel(i);
+        RA_radio_ctrls[channel.radio]->set_tx_lo_export_enabled(
+            false, "lo1", channel.radio_port);
+        RA_radio_ctrls[channel.radio]->set_rx_lo_export_enabled(
+            false, "lo1", channel.radio_port);
+    }
 
     RA_graph->get_tree()
         ->access<bool>(str(
@@ -424,8 +709,31 @@ void RefArch::setDistributor(int device)
             % "/Radio#0/dboard/rx_frontends/0/los/lo1/lo_distribution/LO_OUT_3/export"))
         .set(true);
 }
+void RefArch::printLOSetting(int device, const std::string& mode)
+{
+    std::cout << "Setting Device# " << device;
+    for (const size_t i : RA_topology.deviceChannels(device)) {
+        const TopologyChannel& channel = RA_topology.channel(i);
+        std::cout << ", " << RA_radio_ctrls[channel.radio]->get_block_id() << " Port "
+                  << channel.radio_port;
+    }
+    std::cout << " to: " << mode << std::endl;
+}
+void RefArch::setExternalLOs(int device)
+{
+    for (const size_t i : RA_topology.deviceChannels(device)) {
+        const TopologyChannel& channel = RA_topology.channel(i);
+        RA_radio_ctrls[channel.radio]->set_tx_lo_source(
+            "external", "lo1", channel.radio_port);
+        RA_radio_ctrls[channel.radio]->set_rx_lo_source(
+            "external", "lo1", channel.radio_port);
+    }
+}
 void RefArch::checkRXSensorLock()
 {
+    if (RA_mock) {
+        return;
+    }
     // Check Locked RX Sensors
     std::vector<std::string> rx_sensor_names;
     for (auto& rctrl : RA_radio_ctrls) {
@@ -444,6 +752,9 @@ void RefArch::checkRXSensorLock()
 }
 void RefArch::checkTXSensorLock()
 {
+    if (RA_mock) {
+        return;
+    }
     // Check Locked TX Sensors
     std::vector<std::string> tx_sensor_names;
     for (auto& rctrl : RA_radio_ctrls) {
@@ -462,11 +773,32 @@ void RefArch::checkTXSensorLock()
 }
 void RefArch::updateDelayedStartTime()
 {
+    if (RA_rx_burst and not RA_burst_capture) {
+        // Planning allocates and prefaults the whole capture, which must not eat into
+        // the start delay. Examples that support rx-burst plan it before this call.
+        throw std::runtime_error("rx-burst is not supported by this example, only by "
+                                 "examples calling planBurstCapture() before the start "
+                                 "time is set (Arch_rx_to_mem)");
+    }
     // This provides a common timebase to synchronize RX and TX threads.
-    uhd::time_spec_t now =
-        RA_graph->get_mb_controller(0)->get_timekeeper(0)->get_time_now();
+    uhd::time_spec_t now = getTimeNow();
+    if (RA_shard_start_time > 0) {
+        // Common to all shards. The delay is what is left of it, as the receive
+        // loops time the run from now plus the delay
+        RA_start_time       = uhd::time_spec_t(RA_shard_start_time);
+        RA_delay_start_time = std::max(0.0, RA_shard_start_time - now.get_real_secs());
+        RA_shard_start_time = 0;
+        return;
+    }
     RA_start_time = uhd::time_spec_t(now + RA_delay_start_time);
 }
+uhd::time_spec_t RefArch::getTimeNow()
+{
+    if (RA_mock) {
+        return RA_mock_device->getTimeNow();
+    }
+    return RA_graph->get_mb_controller(0)->get_timekeeper(0)->get_time_now();
+}
 // replaycontrol
 int RefArch::importData()
 {
@@ -503,7 +835,35 @@ int RefArch::importData()
     // Read file into buffer, rounded down to number of words
     infile.read(tx_buf_ptr, RA_samples_to_replay * sample_size);
     infile.close();
-    for (size_t i = 0; i < RA_replay_ctrls.size(); i = i + 2) {
+    if (RA_mock) {
+        // The mock Replay plays the file, push it through the TX streamers too to
+        // exercise them
+        std::vector<std::complex<int16_t>> samples(RA_samples_to_replay);
+        memcpy(samples.data(), tx_buf_ptr, RA_samples_to_replay * sample_size);
+        RA_mock_device->replay().load(std::move(samples));
+        for (size_t i = 0; i < RA_tx_stream_vector.size(); i++) {
+            if (not firstPort(RA_tx_stream_vector, i)) {
+                continue;
+            }
+            uhd::tx_metadata_t tx_md;
+            tx_md.start_of_burst = true;
+            tx_md.end_of_burst   = true;
+            size_t num_tx_samps  = 0;
+            while (num_tx_samps < RA_samples_to_replay and not RA_cancel.cancelled()) {
+                num_tx_samps += RA_tx_stream_vector[i]->send(
+                    tx_buf_ptr + num_tx_samps * sample_size,
+                    RA_samples_to_replay - num_tx_samps,
+                    tx_md);
+                tx_md.start_of_burst = false;
+            }
+        }
+        return EXIT_SUCCESS;
+    }
+    for (size_t i = 0; i < RA_replay_ctrls.size(); i++) {
+        // Once per Replay block, all its ports play the same buffer
+        if (not firstPort(RA_replay_ctrls, i)) {
+            continue;
+        }
         /************************************************************************
          * Configure replay block
          ***********************************************************************/
@@ -582,13 +942,66 @@ void RefArch::stopReplay()
      * Issue stop command
      ***********************************************************************/
     std::cout << "Stopping replay..." << std::endl;
+    if (RA_mock) {
+        RA_mock_device->replay().stop();
+        return;
+    }
     for (size_t i_kill = 0; i_kill < RA_replay_ctrls.size(); i_kill++) {
         RA_replay_ctrls[i_kill]->stop(RA_replay_chan_vector[i_kill]);
     }
 }
+size_t RefArch::numReplayPorts() const
+{
+    if (RA_mock) {
+        return RA_mock_device->numRadios();
+    }
+    return RA_replay_ctrls.size();
+}
 void RefArch::sigIntHandler(int)
 {
-    RA_stop_signal_called = true;
+    RA_cancel.signal();
+}
+uhd::time_spec_t RefArch::gracefulStopTime()
+{
+    std::lock_guard<std::mutex> lock(RA_stop_time_mutex);
+    if (not RA_stop_time_set) {
+        RA_stop_time     = getTimeNow() + uhd::time_spec_t(RA_graceful_stop_delay);
+        RA_stop_time_set = true;
+        std::cout << "Stopping all streams at " << RA_stop_time.get_real_secs() << " s"
+                  << std::endl;
+    }
+    return RA_stop_time;
+}
+size_t RefArch::samplesBeforeStop(uhd::rx_streamer::sptr rx_streamer,
+    uhd::stream_cmd_t& stream_cmd,
+    const uhd::rx_metadata_t& md,
+    size_t num_rx_samps,
+    bool& done)
+{
+    done = false;
+    if (not RA_cancel.graceful()) {
+        return num_rx_samps;
+    }
+    const uhd::time_spec_t stop_time = gracefulStopTime();
+    if (stream_cmd.stream_mode != uhd::stream_cmd_t::STREAM_MODE_STOP_CONTINUOUS) {
+        stream_cmd.stream_mode = uhd::stream_cmd_t::STREAM_MODE_STOP_CONTINUOUS;
+        stream_cmd.stream_now  = false;
+        stream_cmd.time_spec   = stop_time;
+        rx_streamer->issue_stream_cmd(stream_cmd);
+    }
+    if (md.end_of_burst) {
+        done = true;
+    }
+    if (not md.has_time_spec or num_rx_samps == 0) {
+        return num_rx_samps;
+    }
+    // Samples are cut on the host too, in case the device stopped late
+    const long long before_stop = (stop_time - md.time_spec).to_ticks(RA_rx_rate);
+    if (before_stop <= (long long)num_rx_samps) {
+        done = true;
+        return size_t(std::max(before_stop, 0LL));
+    }
+    return num_rx_samps;
 }
 // receivefunctions
 std::map<int, std::string> RefArch::getStreamerFileLocation(
@@ -645,6 +1058,21 @@ std::string RefArch::generateRxFilename(const std::string& base_fn,
             "One or more file locations were not specified for initialized channel.");
     }
 }
+std::unique_ptr<TimeIndexWriter> RefArch::openTimeIndex(
+    const std::string& path, size_t sample_size)
+{
+    if (RA_rx_index_interval == 0) {
+        return nullptr;
+    }
+    return std::unique_ptr<TimeIndexWriter>(new TimeIndexWriter(
+        path + ".idx", RA_rx_rate, sample_size, RA_rx_index_interval));
+}
+size_t RefArch::rxSampleSize()
+{
+    size_t sample_size = 0;
+    dispatchFormat(1, [&](auto sample, auto) { sample_size = sizeof(sample); });
+    return sample_size;
+}
 // graphassembly
 void RefArch::buildGraph()
 {
@@ -653,11 +1081,24 @@ void RefArch::buildGraph()
      ***********************************************************************/
     // If multiple USRPs are used, they are linked into a single RFNoc graph here.
     std::cout << std::endl;
+    if (RA_mock) {
+        RA_mock_settings.num_devices = std::max<size_t>(RA_address.size(), 1);
+        std::cout << "Creating a mock graph of " << RA_mock_settings.num_devices
+                  << " devices..." << std::endl;
+        RA_mock_device = std::make_shared<MockDevice>(RA_mock_settings);
+        RA_topology    = uniformTopology(
+            RA_mock_settings.num_devices, RA_mock_settings.channels_per_device);
+        std::cout << RA_topology.describe();
+        return;
+    }
     std::cout << "Creating the RFNoC graph with args: " << RA_args << "..." << std::endl;
     RA_graph = uhd::rfnoc::rfnoc_graph::make(RA_args);
 }
 void RefArch::buildRadios()
 {
+    if (RA_mock) {
+        return;
+    }
     /************************************************************************
      * Seek radio blocks on each USRP and assemble a vector of radio
      * controllers.
@@ -665,186 +1106,170 @@ void RefArch::buildRadios()
     std::cout << "Building Radios..." << std::endl;
     // Make radio controllers for multiple channels/devices
     RA_radio_block_list = RA_graph->find_blocks("Radio");
+    // Sorted so the channels are numbered by device, then by radio
+    sort(RA_radio_block_list.begin(), RA_radio_block_list.end());
+    RA_topology.clear();
     // Iterate over each radio block found on each device
     for (auto& elem : RA_radio_block_list) {
         // Create a vector of radio control objects for controlling the radio blocks
         RA_radio_ctrls.push_back(RA_graph->get_block<uhd::rfnoc::radio_control>(elem));
         std::cout << "Using radio " << elem << std::endl;
+        // One channel per port, one per radio on the N32x, two on the N310
+        const size_t radio = RA_radio_ctrls.size() - 1;
+        for (size_t port = 0; port < RA_radio_ctrls[radio]->get_num_output_ports();
+             port++) {
+            RA_topology.addChannel(elem.get_device_no(), radio, port);
+        }
     }
-    // Sort the vectors
-    sort(RA_radio_ctrls.begin(), RA_radio_ctrls.end());
-    sort(RA_radio_block_list.begin(), RA_radio_block_list.end());
+    std::cout << RA_topology.describe();
 }
 void RefArch::buildDDCDUC()
 {
+    if (RA_mock) {
+        return;
+    }
     /*************************************************************************
      * Seek DDCs & DUCs on each USRP and assemble a vector of DDC & DUC controllers.
      ************************************************************************/
     std::cout << "Building DDC/DUCs.." << std::endl;
-    std::vector<std::string> ddc_sources;
-    std::vector<std::string> duc_destinations;
     // Enumerate blocks in the chain
-    auto edges = RA_graph->enumerate_static_connections();
+    const auto edges = RA_graph->enumerate_static_connections();
+    RA_ddc_chan      = 0;
+    RA_duc_chan      = 0;
 
-    // vector of string identifiers for DDC destinations
-    for (auto& rctrl : RA_radio_ctrls) {
-        ddc_sources.push_back(rctrl->get_block_id());
-        duc_destinations.push_back(rctrl->get_block_id());
-    }
-    sort(ddc_sources.begin(), ddc_sources.end());
-    size_t ddc_source_port = 0;
-    size_t duc_dst_port    = 0;
-    auto chain             = std::vector<uhd::rfnoc::graph_edge_t>();
-    RA_ddc_chan            = 0;
-    RA_duc_chan            = 0;
-
-    // Find DDCs connected to the radios
-    // There is a single channel (src_port) included on the stock DDCs & DUCs on the N3xx
-    // XG image, 0.
-    // Look at each connection in the RFNoc graph
-    for (auto& edge : edges) {
-        // Loop over the radio blocks and look for connected DDCs
-        for (auto& src_block : ddc_sources) {
-            if (edge.src_blockid == src_block && edge.src_port == ddc_source_port) {
-                auto blockid = uhd::rfnoc::block_id_t(edge.dst_blockid);
-                if (blockid.match("DDC")) {
-                    // When a DUC is found, assemble a vector of DDC controllers.
-                    RA_ddc_ctrls.push_back(
-                        RA_graph->get_block<uhd::rfnoc::ddc_block_control>(blockid));
-                }
+    // Find the DDC port each radio port feeds and the DUC port feeding it. The stock
+    // DDCs & DUCs have one port per radio port.
+    for (size_t i = 0; i < RA_topology.numChannels(); i++) {
+        TopologyChannel& channel = RA_topology.channel(i);
+        const std::string radio  = RA_radio_block_list[channel.radio].to_string();
+        for (auto& edge : edges) {
+            if (edge.src_blockid == radio and edge.src_port == channel.radio_port
+                and uhd::rfnoc::block_id_t(edge.dst_blockid).match("DDC")) {
+                channel.ddc      = blockIndex(RA_graph, RA_ddc_ctrls, edge.dst_blockid);
+                channel.ddc_port = edge.dst_port;
             }
-        }
-        for (auto& dst_block : duc_destinations) {
-            if (edge.dst_blockid == dst_block && edge.dst_port == duc_dst_port) {
-                auto blockid = uhd::rfnoc::block_id_t(edge.src_blockid);
-                if (blockid.match("DUC")) {
-                    // When a DUC is found, assemble a vector of DUC controllers.
-                    RA_duc_ctrls.push_back(
-                        RA_graph->get_block<uhd::rfnoc::duc_block_control>(blockid));
-                }
+            if (edge.dst_blockid == radio and edge.dst_port == channel.radio_port
+                and uhd::rfnoc::block_id_t(edge.src_blockid).match("DUC")) {
+                channel.duc      = blockIndex(RA_graph, RA_duc_ctrls, edge.src_blockid);
+                channel.duc_port = edge.src_port;
             }
         }
-        chain.push_back(edge);
-    }
-    sort(RA_ddc_ctrls.begin(), RA_ddc_ctrls.end());
-    sort(RA_duc_ctrls.begin(), RA_duc_ctrls.end());
-    // For Display Purposes
-    for (auto& dctrl : RA_ddc_ctrls) {
-        std::cout << "Using DDC " << dctrl->get_block_id() << ", Channel " << RA_ddc_chan
-                  << std::endl;
-    }
-    // For Display Purposes
-    for (auto& dctrl : RA_duc_ctrls) {
-        std::cout << "Using DUC " << dctrl->get_block_id() << ", Channel " << RA_duc_chan
-                  << std::endl;
+        // For Display Purposes
+        if (channel.ddc != TopologyChannel::none) {
+            std::cout << "Using DDC " << RA_ddc_ctrls[channel.ddc]->get_block_id()
+                      << ", Channel " << channel.ddc_port << std::endl;
+        }
+        if (channel.duc != TopologyChannel::none) {
+            std::cout << "Using DUC " << RA_duc_ctrls[channel.duc]->get_block_id()
+                      << ", Channel " << channel.duc_port << std::endl;
+        }
     }
 }
 void RefArch::buildReplay()
 {
+    if (RA_mock) {
+        return;
+    }
     /****************************************************************************
      * Seek Replay blocks on each USRP and assemble a vector of Replay Block Controllers
      ***************************************************************************/
     // Check what replay blocks exist on the device(s)
     RA_replay_block_list = RA_graph->find_blocks("Replay");
+    sort(RA_replay_block_list.begin(), RA_replay_block_list.end());
     for (auto& replay_id : RA_replay_block_list) {
-        // The double entry is intended. There are two channels on each replay block.
-        RA_replay_ctrls.push_back(
-            RA_graph->get_block<uhd::rfnoc::replay_block_control>(replay_id));
-        RA_replay_ctrls.push_back(
-            RA_graph->get_block<uhd::rfnoc::replay_block_control>(replay_id));
-    }
-    sort(RA_replay_ctrls.begin(), RA_replay_ctrls.end());
-    // Each replay block has two channels, 0 and 1.
-    // Vector of replay channels.
-    for (size_t i_chan = 0; i_chan < RA_replay_ctrls.size() * 2; i_chan++) {
-        if (i_chan % 2 == 0) {
-            RA_replay_chan_vector.push_back(0);
-        } else {
-            RA_replay_chan_vector.push_back(1);
+        auto replay_ctrl =
+            RA_graph->get_block<uhd::rfnoc::replay_block_control>(replay_id);
+        // One entry per output port, the control repeated, so the entries line up
+        // with the channels they play to.
+        std::vector<size_t> entries;
+        for (size_t port = 0; port < replay_ctrl->get_num_output_ports(); port++) {
+            entries.push_back(RA_replay_ctrls.size());
+            RA_replay_ctrls.push_back(replay_ctrl);
+            RA_replay_chan_vector.push_back(port);
+            // For Display Purposes
+            std::cout << "Using Replay " << replay_id << ", Channel " << port
+                      << std::endl;
         }
-    }
-    // For Display Purposes
-    int count_replay_chan = 0;
-    for (auto& rctrl : RA_replay_ctrls) {
-        std::cout << "Using Replay " << rctrl->get_block_id() << ", Channel "
-                  << RA_replay_chan_vector[count_replay_chan] << std::endl;
-        count_replay_chan++;
+        RA_topology.assignReplay(replay_id.get_device_no(), entries);
     }
 }
 void RefArch::commitGraph()
 {
+    if (RA_mock) {
+        return;
+    }
     UHD_LOG_INFO("CogRF", "Committing graph...");
     RA_graph->commit();
     UHD_LOG_INFO("CogRF", "Commit complete.");
 }
+void RefArch::connectRxChannels()
+{
+    for (size_t i = 0; i < RA_topology.numChannels(); i++) {
+        const TopologyChannel& channel = RA_topology.channel(i);
+        const auto& radio              = RA_radio_block_list[channel.radio];
+        if (channel.ddc == TopologyChannel::none) {
+            // No DDC, the radio runs at the RX rate
+            RA_graph->connect(radio,
+                channel.radio_port,
+                RA_rx_stream_vector[i],
+                RA_rx_stream_chan_vector[i]);
+            std::cout << "Connected " << radio << " to " << RA_rx_stream_vector[i]
+                      << " Port " << RA_rx_stream_chan_vector[i] << std::endl;
+            continue;
+        }
+        const auto ddc = RA_ddc_ctrls[channel.ddc]->get_block_id();
+        // connect radios to ddc
+        RA_graph->connect(radio, channel.radio_port, ddc, channel.ddc_port);
+        std::cout << "Connected " << radio << " to " << ddc << std::endl;
+        // Connect DDC to streamers
+        RA_graph->connect(
+            ddc, channel.ddc_port, RA_rx_stream_vector[i], RA_rx_stream_chan_vector[i]);
+        std::cout << "Connected " << ddc << " to " << RA_rx_stream_vector[i] << " Port "
+                  << RA_rx_stream_chan_vector[i] << std::endl;
+    }
+}
 void RefArch::connectGraphMultithread()
 {
+    if (RA_mock) {
+        return;
+    }
     // This is the function that connects the graph for the multithreaded implementation
-    // streaming from Replay Block. The difference is that each channel gets its own RX
-    // streamer.
+    // streaming from Replay Block.
     UHD_LOG_INFO("CogRF", "Connecting graph...");
     // Connect Graph
-    for (size_t i = 0; i < RA_radio_ctrls.size(); i++) {
-        // connect radios to ddc
-        RA_graph->connect(RA_radio_block_list[i], 0, RA_ddc_ctrls[i]->get_block_id(), 0);
-        std::cout << "Connected " << RA_radio_block_list[i] << " to "
-                  << RA_ddc_ctrls[i]->get_block_id() << std::endl;
-    }
-    // Each streamer has two channels, 0 and 1.
-    // Vector of streamer channels.
-    for (size_t i_chan = 0; i_chan < RA_rx_stream_vector.size() * 2; i_chan++) {
-        if (i_chan % 2 == 0) {
-            RA_rx_stream_chan_vector.push_back(0);
-        } else {
-            RA_rx_stream_chan_vector.push_back(1);
-        }
-    }
-    for (size_t j = 0; j < RA_ddc_ctrls.size(); j++) {
-        // Connect DDC to streamers
-        RA_graph->connect(RA_ddc_ctrls[j]->get_block_id(),
-            0,
-            RA_rx_stream_vector[j],
-            RA_rx_stream_chan_vector[j]);
-        std::cout << "Connected " << RA_ddc_ctrls[j]->get_block_id() << " to "
-                  << RA_rx_stream_vector[j] << " Port " << RA_rx_stream_chan_vector[j]
-                  << std::endl;
-    }
-    int pos2 = 0;
-    if (RA_duc_ctrls.size() > 0) {
-        for (auto& rctrl : RA_radio_ctrls) {
-            RA_graph->connect(RA_duc_ctrls[pos2]->get_block_id(),
-                RA_duc_chan,
-                rctrl->get_block_id(),
-                0);
-            std::cout << "Connected " << RA_duc_ctrls[pos2]->get_block_id() << " port "
-                      << RA_duc_chan << " to radio " << rctrl->get_block_id() << " port "
-                      << 0 << std::endl;
-            pos2++;
-        }
-        for (size_t i_r2d = 0; i_r2d < RA_duc_ctrls.size(); i_r2d++) {
-            RA_graph->connect(RA_replay_ctrls[i_r2d]->get_block_id(),
-                RA_replay_chan_vector[i_r2d],
-                RA_duc_ctrls[i_r2d]->get_block_id(),
-                RA_duc_chan);
-            std::cout << "Connected " << RA_replay_ctrls[i_r2d]->get_block_id()
-                      << " port " << RA_replay_chan_vector[i_r2d] << " to DUC "
-                      << RA_duc_ctrls[i_r2d]->get_block_id() << " port " << RA_duc_chan
+    connectRxChannels();
+    for (size_t i = 0; i < RA_topology.numChannels(); i++) {
+        const TopologyChannel& channel = RA_topology.channel(i);
+        const auto& radio              = RA_radio_block_list[channel.radio];
+        if (channel.duc != TopologyChannel::none) {
+            const auto duc = RA_duc_ctrls[channel.duc]->get_block_id();
+            RA_graph->connect(duc, channel.duc_port, radio, channel.radio_port);
+            std::cout << "Connected " << duc << " port " << channel.duc_port
+                      << " to radio " << radio << " port " << channel.radio_port
                       << std::endl;
-        }
-    } else {
-        // For the case where the replay block is connected directly to the radio blocks.
-        int pos2 = 0;
-        for (auto& replctrl : RA_replay_ctrls) {
-            for (auto& rctrl : RA_radio_ctrls) {
-                RA_graph->connect(replctrl->get_block_id(),
-                    RA_replay_chan_vector[pos2],
-                    rctrl->get_block_id(),
-                    0);
-                pos2++;
+            if (channel.replay != TopologyChannel::none) {
+                const auto replay = RA_replay_ctrls[channel.replay]->get_block_id();
+                RA_graph->connect(replay,
+                    RA_replay_chan_vector[channel.replay],
+                    duc,
+                    channel.duc_port);
+                std::cout << "Connected " << replay << " port "
+                          << RA_replay_chan_vector[channel.replay] << " to DUC " << duc
+                          << " port " << channel.duc_port << std::endl;
             }
+        } else if (channel.replay != TopologyChannel::none) {
+            // For the case where the replay block is connected directly to the radio
+            // blocks.
+            RA_graph->connect(RA_replay_ctrls[channel.replay]->get_block_id(),
+                RA_replay_chan_vector[channel.replay],
+                radio,
+                channel.radio_port);
         }
     }
-    for (size_t i_s2r = 0; i_s2r < RA_replay_ctrls.size(); i_s2r = i_s2r + 2) {
+    for (size_t i_s2r = 0; i_s2r < RA_replay_ctrls.size(); i_s2r++) {
+        if (not firstPort(RA_replay_ctrls, i_s2r)) {
+            continue;
+        }
         RA_graph->connect(
             RA_tx_stream_vector[i_s2r], 0, RA_replay_ctrls[i_s2r]->get_block_id(), 0);
         std::cout << "Streamer: " << RA_tx_stream_vector[i_s2r] << " connected to "
@@ -853,56 +1278,163 @@ void RefArch::connectGraphMultithread()
 }
 void RefArch::connectGraphMultithreadHostTX()
 {
+    if (RA_mock) {
+        return;
+    }
     // This is the function that connects the graph for the multithreaded implementation
     // streaming from host.
     UHD_LOG_INFO("CogRF", "Connecting graph...");
     // Connect Graph
-    for (size_t i = 0; i < RA_radio_ctrls.size(); i++) {
-        // connect radios to ddc
-        RA_graph->connect(RA_radio_block_list[i], 0, RA_ddc_ctrls[i]->get_block_id(), 0);
-        std::cout << "Connected " << RA_radio_block_list[i] << " to "
-                  << RA_ddc_ctrls[i]->get_block_id() << std::endl;
-    }
-    // Vector of streamer channels.
-    for (size_t i_chan = 0; i_chan < RA_rx_stream_vector.size() * 2; i_chan++) {
-        if (i_chan % 2 == 0) {
-            RA_rx_stream_chan_vector.push_back(0);
-        } else {
-            RA_rx_stream_chan_vector.push_back(1);
+    connectRxChannels();
+    for (size_t i = 0; i < RA_topology.numChannels(); i++) {
+        const TopologyChannel& channel = RA_topology.channel(i);
+        const auto& radio              = RA_radio_block_list[channel.radio];
+        if (channel.duc == TopologyChannel::none) {
+            RA_graph->connect(RA_tx_stream_vector[i], 0, radio, channel.radio_port);
+            std::cout << "Streamer: " << RA_tx_stream_vector[i] << " connected to "
+                      << radio << std::endl;
+            continue;
         }
-    }
-    for (size_t j = 0; j < RA_ddc_ctrls.size(); j++) {
-        // Connect DDC to streamers
-        // Reusing replay chan vector, need a vector of zeros and ones
-        RA_graph->connect(RA_ddc_ctrls[j]->get_block_id(),
-            0,
-            RA_rx_stream_vector[j],
-            RA_rx_stream_chan_vector[j]);
-        std::cout << "Connected " << RA_ddc_ctrls[j]->get_block_id() << " to "
-                  << RA_rx_stream_vector[j] << " Port " << RA_rx_stream_chan_vector[j]
-                  << std::endl;
-    }
-    int pos2 = 0;
+        const auto duc = RA_duc_ctrls[channel.duc]->get_block_id();
+        RA_graph->connect(duc, channel.duc_port, radio, channel.radio_port);
+        std::cout << "Connected " << duc << " port " << channel.duc_port << " to radio "
+                  << radio << " port " << channel.radio_port << std::endl;
 
-    for (auto& rctrl : RA_radio_ctrls) {
-        RA_graph->connect(
-            RA_duc_ctrls[pos2]->get_block_id(), RA_duc_chan, rctrl->get_block_id(), 0);
-        std::cout << "Connected " << RA_duc_ctrls[pos2]->get_block_id() << " port "
-                  << RA_duc_chan << " to radio " << rctrl->get_block_id() << " port " << 0
+        RA_graph->connect(RA_tx_stream_vector[i], 0, duc, channel.duc_port);
+        std::cout << "Streamer: " << RA_tx_stream_vector[i] << " connected to " << duc
                   << std::endl;
-
-        RA_graph->connect(
-            RA_tx_stream_vector[pos2], 0, RA_duc_ctrls[pos2]->get_block_id(), 0);
-        std::cout << "Streamer: " << RA_tx_stream_vector[pos2] << " connected to "
-                  << RA_replay_ctrls[pos2]->get_block_id() << std::endl;
-        pos2++;
     }
 }
+void RefArch::addRxStreamer(
+    const std::vector<size_t>& channels, const uhd::stream_args_t& stream_args)
+{
+    if (RA_mock) {
+        RA_rx_stream =
+            RA_mock_device->makeRxStreamer(channels.size(), RA_rx_rate, stream_args);
+    } else {
+        RA_rx_stream = RA_graph->create_rx_streamer(channels.size(), stream_args);
+    }
+    RA_rx_stream_vector.resize(RA_topology.numChannels());
+    RA_rx_stream_chan_vector.resize(RA_topology.numChannels());
+    for (size_t port = 0; port < channels.size(); port++) {
+        RA_rx_stream_vector[channels[port]]      = RA_rx_stream;
+        RA_rx_stream_chan_vector[channels[port]] = port;
+    }
+    RA_rx_streamer_channels.push_back(channels);
+}
+void RefArch::buildRxStreamers(const uhd::stream_args_t& stream_args)
+{
+    RA_rx_stream_vector.clear();
+    RA_rx_stream_chan_vector.clear();
+    RA_rx_streamer_channels.clear();
+    const std::string layout = (RA_rx_streamers == "auto")
+                                   ? benchmarkRxStreamers(stream_args)
+                                   : RA_rx_streamers;
+    for (const auto& channels : streamerLayout(RA_topology, layout)) {
+        addRxStreamer(channels, stream_args);
+    }
+}
+void RefArch::resetBenchmarkTime()
+{
+    if (RA_mock) {
+        RA_mock_device->setTimeNow(0.0);
+        return;
+    }
+    // No PPS edge to wait for, the devices are apart by the time of these calls, which
+    // the benchmark start delay covers. syncAllDevices() sets the real time base later.
+    for (size_t i = 0; i < RA_graph->get_num_mboards(); i++) {
+        RA_graph->get_mb_controller(i)->get_timekeeper(0)->set_time_now(
+            uhd::time_spec_t(0.0));
+    }
+}
+std::string RefArch::benchmarkRxStreamers(const uhd::stream_args_t& stream_args)
+{
+    const size_t sample_size = rxSampleSize();
+    const double start_delay = std::max(RA_delay_start_time, 0.1);
+    // Streamers spanning devices need a common start time
+    resetBenchmarkTime();
+    std::vector<std::vector<std::vector<size_t>>> benchmarked;
+    std::string best, fastest;
+    double best_rate = 0, fastest_rate = -1;
+    for (const std::string layout : {"device", "channel", "global"}) {
+        const auto streamers = streamerLayout(RA_topology, layout);
+        if (std::find(benchmarked.begin(), benchmarked.end(), streamers)
+            != benchmarked.end()) {
+            // Same streamers as an earlier layout
+            continue;
+        }
+        benchmarked.push_back(streamers);
+        for (const auto& channels : streamers) {
+            addRxStreamer(channels, stream_args);
+        }
+        if (not RA_mock) {
+            connectRxChannels();
+            RA_graph->commit();
+        }
+        const uhd::time_spec_t start = getTimeNow() + start_delay;
+        std::vector<StreamerBenchmark> results(streamers.size());
+        std::vector<std::thread> threads;
+        for (size_t i = 0; i < streamers.size(); i++) {
+            threads.emplace_back([&, i]() {
+                try {
+                    results[i] = benchmarkRxStreamer(
+                        RA_rx_stream_vector[streamers[i].front()],
+                        start,
+                        start_delay,
+                        RA_rx_streamers_bench_time,
+                        RA_spb,
+                        sample_size);
+                } catch (const std::exception& e) {
+                    std::cerr << "Streamer benchmark failed: " << e.what() << std::endl;
+                    results[i].failed = true;
+                }
+            });
+        }
+        double rate = 0;
+        bool failed = false;
+        for (size_t i = 0; i < threads.size(); i++) {
+            threads[i].join();
+            failed = failed or results[i].failed;
+            if (results[i].seconds > 0) {
+                rate += results[i].samples / results[i].seconds;
+            }
+        }
+        std::cout << "Streamer layout " << layout << ": " << streamers.size()
+                  << " streamers, " << (rate / 1e6) << " Msps"
+                  << (failed ? ", overflow or error" : "") << std::endl;
+        // A later layout has to be faster by more than 1% to replace an earlier one
+        if (not failed and rate > best_rate * 1.01) {
+            best      = layout;
+            best_rate = rate;
+        }
+        if (rate > fastest_rate) {
+            fastest      = layout;
+            fastest_rate = rate;
+        }
+        // Releasing the streamers disconnects them from the graph
+        if (not RA_mock) {
+            RA_graph->release();
+        }
+        RA_rx_stream.reset();
+        RA_rx_stream_vector.clear();
+        RA_rx_stream_chan_vector.clear();
+        RA_rx_streamer_channels.clear();
+    }
+    if (fastest.empty()) {
+        throw std::runtime_error("No supported streamer layout to benchmark");
+    }
+    if (best.empty()) {
+        UHD_LOG_WARNING("CogRF",
+            "Every streamer layout overflowed, using the fastest: " << fastest);
+        return fastest;
+    }
+    std::cout << "Using streamer layout " << best << std::endl;
+    return best;
+}
 void RefArch::buildStreamsMultithread()
 {
     // TODO: Think about renaming
     // Build Streams for multithreaded implementation streaming from Replay Block.
-    // Each Channel gets its own RX streamer.
     // Constants related to the Replay block
     const size_t replay_word_size = 8; // Size of words used by replay block
     const size_t sample_size      = 4; // Complex signed 16-bit is 32 bits per sample
@@ -912,16 +1444,26 @@ void RefArch::buildStreamsMultithread()
     uhd::stream_args_t stream_args(RA_format, RA_otw);
     stream_args.args = streamer_args;
     std::cout << "Using streamer args: " << stream_args.args.to_string() << std::endl;
-    // One stream per channel
-    for (size_t rx_count = 0; rx_count < RA_radio_ctrls.size() / 2; rx_count++) {
-        RA_rx_stream = RA_graph->create_rx_streamer(2, stream_args);
-        RA_rx_stream_vector.push_back(RA_rx_stream);
-        RA_rx_stream_vector.push_back(RA_rx_stream);
+    buildRxStreamers(stream_args);
+    if (RA_mock) {
+        // One TX streamer per device, padded like the Replay streamers
+        for (size_t device = 0; device < RA_topology.numDevices(); device++) {
+            RA_tx_stream = RA_mock_device->makeTxStreamer(1, RA_tx_rate, stream_args);
+            RA_tx_stream_vector.insert(RA_tx_stream_vector.end(),
+                RA_topology.deviceChannels(device).size(),
+                RA_tx_stream);
+        }
+        return;
     }
     /************************************************************************
      * Set up streamer to Replay blocks
      ***********************************************************************/
-    for (size_t i_s2r = 0; i_s2r < RA_replay_ctrls.size(); i_s2r = i_s2r + 2) {
+    for (size_t i_s2r = 0; i_s2r < RA_replay_ctrls.size(); i_s2r++) {
+        // Vector of tx streamers, one per Replay block duplicated for every port
+        if (not firstPort(RA_replay_ctrls, i_s2r)) {
+            RA_tx_stream_vector.push_back(RA_tx_stream);
+            continue;
+        }
         streamer_args["block_id"]   = RA_replay_ctrls[i_s2r]->get_block_id().to_string();
         streamer_args["block_port"] = std::to_string(0);
         stream_args.args            = streamer_args;
@@ -938,8 +1480,6 @@ void RefArch::buildStreamsMultithread()
             RA_tx_stream =
                 RA_graph->create_tx_streamer(stream_args.channels.size(), stream_args);
         }
-        // Vector of tx streamers, duplicate for vector length padding.
-        RA_tx_stream_vector.push_back(RA_tx_stream);
         RA_tx_stream_vector.push_back(RA_tx_stream);
     }
 }
@@ -947,7 +1487,6 @@ void RefArch::buildStreamsMultithreadHostTX()
 {
     // Build Streams for multithreaded implementation
     // TX streams from Host, not replay.
-    // Each Device gets its own RX streamer.
     // Each Channel gets its own TX streamer.
     // Constants related to the Replay block
     const size_t replay_word_size = 8; // Size of words used by replay block
@@ -959,20 +1498,29 @@ void RefArch::buildStreamsMultithreadHostTX()
     uhd::stream_args_t stream_args(RA_format, RA_otw);
     stream_args.args = streamer_args;
     std::cout << "Using streamer args: " << stream_args.args.to_string() << std::endl;
-    // One stream per channel
-    for (int rx_count = 0; rx_count < RA_radio_ctrls.size() / 2; rx_count++) {
-        RA_rx_stream = RA_graph->create_rx_streamer(2, stream_args);
-        RA_rx_stream_vector.push_back(RA_rx_stream);
-        RA_rx_stream_vector.push_back(RA_rx_stream);
+    buildRxStreamers(stream_args);
+    if (RA_mock) {
+        for (size_t i = 0; i < RA_topology.numChannels(); i++) {
+            RA_tx_stream_vector.push_back(
+                RA_mock_device->makeTxStreamer(1, RA_tx_rate, stream_args));
+        }
+        return;
     }
     /************************************************************************
-     * Set up streamer to Replay blocks
+     * Set up streamer to the DUCs, or to the radios without one
      ***********************************************************************/
-    for (int i_s2r = 0; i_s2r < RA_radio_ctrls.size(); i_s2r = i_s2r + 1) {
-        streamer_args["block_id"]   = RA_duc_ctrls[i_s2r]->get_block_id().to_string();
-        streamer_args["block_port"] = std::to_string(0);
-        stream_args.args            = streamer_args;
-        stream_args.channels        = {0};
+    for (size_t i = 0; i < RA_topology.numChannels(); i++) {
+        const TopologyChannel& channel = RA_topology.channel(i);
+        if (channel.duc == TopologyChannel::none) {
+            streamer_args["block_id"]   = RA_radio_block_list[channel.radio].to_string();
+            streamer_args["block_port"] = std::to_string(channel.radio_port);
+        } else {
+            streamer_args["block_id"] =
+                RA_duc_ctrls[channel.duc]->get_block_id().to_string();
+            streamer_args["block_port"] = std::to_string(channel.duc_port);
+        }
+        stream_args.args     = streamer_args;
+        stream_args.channels = {0};
 
         RA_tx_stream =
             RA_graph->create_tx_streamer(stream_args.channels.size(), stream_args);
@@ -1007,98 +1555,190 @@ int RefArch::setRadioRates()
         std::cerr << "Please specify a valid TX sample rate" << std::endl;
         return EXIT_FAILURE;
     }
+    if (RA_mock) {
+        return EXIT_SUCCESS;
+    }
     // Set DDC & DUC Sample Rates
     std::cout << boost::format("Setting RX Rate: %f Msps...") % (RA_rx_rate / 1e6)
               << std::endl;
-    // set rates for each DDC Block
+    // set rates for each DDC port, or for the radio of a channel without one
     // TODO: Look at rates here. rate == ....
-    // TODO: Fix Display
-    if (RA_ddc_ctrls.size() > 0) {
-        int count_rx = 0;
-        for (uhd::rfnoc::ddc_block_control::sptr ddcctrl : RA_ddc_ctrls) {
-            std::cout << "DDC block found" << std::endl;
-            double radio_rate = RA_radio_ctrls[count_rx]->get_rate();
-            int decim         = (int)(radio_rate / RA_rx_rate);
-            std::cout << boost::format("Setting decimation value to %d") % decim
-                      << std::endl;
-            ddcctrl->set_property<int>("decim", decim, RA_ddc_chan);
-            decim = ddcctrl->get_property<int>("decim", RA_ddc_chan);
-            std::cout << boost::format("Actual decimation value is %d") % decim
-                      << std::endl;
-            RA_rx_rate = radio_rate / decim;
-            count_rx++;
-        }
-    } else {
-        for (auto& rctrl : RA_radio_ctrls) {
+    for (const TopologyChannel& channel : RA_topology.channels()) {
+        uhd::rfnoc::radio_control::sptr rctrl = RA_radio_ctrls[channel.radio];
+        if (channel.ddc == TopologyChannel::none) {
             RA_rx_rate = rctrl->set_rate(RA_rx_rate);
             std::cout << boost::format("Actual RX Rate: %f Msps...") % (RA_rx_rate / 1e6)
                       << std::endl
                       << std::endl;
+            continue;
         }
+        uhd::rfnoc::ddc_block_control::sptr ddcctrl = RA_ddc_ctrls[channel.ddc];
+        std::cout << "DDC block found " << ddcctrl->get_block_id() << " Port "
+                  << channel.ddc_port << std::endl;
+        double radio_rate = rctrl->get_rate();
+        int decim         = (int)(radio_rate / RA_rx_rate);
+        std::cout << boost::format("Setting decimation value to %d") % decim << std::endl;
+        ddcctrl->set_property<int>("decim", decim, channel.ddc_port);
+        decim = ddcctrl->get_property<int>("decim", channel.ddc_port);
+        std::cout << boost::format("Actual decimation value is %d") % decim << std::endl;
+        RA_rx_rate = radio_rate / decim;
     }
     std::cout << "Actual RX Rate: " << (RA_rx_rate / 1e6) << " Msps..." << std::endl
               << std::endl;
     std::cout << std::resetiosflags(std::ios::fixed);
     std::cout << "Setting TX Rate: " << (RA_tx_rate / 1e6) << " Msps..." << std::endl;
-    if (RA_duc_ctrls.size() > 0) {
-        int radio = 0;
-        for (uhd::rfnoc::duc_block_control::sptr dctrl : RA_duc_ctrls) {
-            std::cout << "DUC block found." << dctrl->get_block_id() << std::endl;
-            dctrl->set_input_rate(RA_tx_rate, RA_duc_chan);
-            dctrl->set_output_rate(RA_radio_ctrls[radio]->get_rate(), RA_duc_chan);
-            std::cout << dctrl->get_block_id() << " Interpolation value is "
-                      << dctrl->get_property<int>("interp", RA_duc_chan) << std::endl;
-            RA_tx_rate = dctrl->get_input_rate(RA_duc_chan);
-            radio++;
-        }
-    } else {
-        for (uhd::rfnoc::radio_control::sptr rctrl : RA_radio_ctrls) {
+    for (const TopologyChannel& channel : RA_topology.channels()) {
+        uhd::rfnoc::radio_control::sptr rctrl = RA_radio_ctrls[channel.radio];
+        if (channel.duc == TopologyChannel::none) {
             RA_tx_rate = rctrl->set_rate(RA_tx_rate);
+            continue;
         }
+        uhd::rfnoc::duc_block_control::sptr dctrl = RA_duc_ctrls[channel.duc];
+        std::cout << "DUC block found." << dctrl->get_block_id() << " Port "
+                  << channel.duc_port << std::endl;
+        dctrl->set_input_rate(RA_tx_rate, channel.duc_port);
+        dctrl->set_output_rate(rctrl->get_rate(), channel.duc_port);
+        std::cout << dctrl->get_block_id() << " Interpolation value is "
+                  << dctrl->get_property<int>("interp", channel.duc_port) << std::endl;
+        RA_tx_rate = dctrl->get_input_rate(channel.duc_port);
     }
     std::cout << "Actual TX Rate: " << (RA_tx_rate / 1e6) << " Msps..." << std::endl
               << std::endl
               << std::resetiosflags(std::ios::fixed);
     return EXIT_SUCCESS;
 }
+void RefArch::resizeTuneCache()
+{
+    const size_t num_channels = RA_topology.numChannels();
+    if (RA_rx_tuned_freq.size() != num_channels) {
+        RA_rx_tune_cache.assign(num_channels, std::map<double, double>());
+        RA_tx_tune_cache.assign(num_channels, std::map<double, double>());
+        RA_rx_tuned_freq.assign(num_channels, std::nan(""));
+        RA_tx_tuned_freq.assign(num_channels, std::nan(""));
+    }
+}
+double RefArch::tuneRXRadio(size_t channel, double freq)
+{
+    resizeTuneCache();
+    // NaN never compares equal, so an untuned channel is always tuned.
+    if (RA_tune_cache and RA_rx_tuned_freq[channel] == freq) {
+        return RA_rx_tune_cache[channel].at(freq);
+    }
+    // set_rx_frequency returns the coerced value, no need to read it back.
+    const TopologyChannel& path     = RA_topology.channel(channel);
+    const double coerced            = RA_radio_ctrls[path.radio]->set_rx_frequency(
+        freq, path.radio_port);
+    RA_rx_tune_cache[channel][freq] = coerced;
+    RA_rx_tuned_freq[channel]       = freq;
+    return coerced;
+}
+double RefArch::tuneTXRadio(size_t channel, double freq)
+{
+    resizeTuneCache();
+    if (RA_tune_cache and RA_tx_tuned_freq[channel] == freq) {
+        return RA_tx_tune_cache[channel].at(freq);
+    }
+    const TopologyChannel& path     = RA_topology.channel(channel);
+    const double coerced            = RA_radio_ctrls[path.radio]->set_tx_frequency(
+        freq, path.radio_port);
+    RA_tx_tune_cache[channel][freq] = coerced;
+    RA_tx_tuned_freq[channel]       = freq;
+    return coerced;
+}
+void RefArch::prewarmTuneCache(const std::vector<double>& freqs)
+{
+    if (RA_mock) {
+        return;
+    }
+    // The radios have no way to compute a tune without applying it, so the cache is
+    // filled by visiting every frequency once before streaming.
+    std::cout << "Prewarming tune cache with " << freqs.size() << " frequencies..."
+              << std::endl;
+    resizeTuneCache();
+    for (size_t channel = 0; channel < RA_topology.numChannels(); channel++) {
+        for (const double freq : freqs) {
+            if (RA_rx_tune_cache[channel].count(freq) == 0) {
+                tuneRXRadio(channel, freq);
+            }
+            if (RA_tx_tune_cache[channel].count(freq) == 0) {
+                tuneTXRadio(channel, freq);
+            }
+        }
+        tuneRXRadio(channel, RA_rx_freq);
+        tuneTXRadio(channel, RA_tx_freq);
+    }
+    std::cout << "Prewarming tune cache: Done!" << std::endl;
+}
+double RefArch::getCoercedRXFrequency(size_t channel, double freq) const
+{
+    if (channel < RA_rx_tune_cache.size()) {
+        const auto cached = RA_rx_tune_cache[channel].find(freq);
+        if (cached != RA_rx_tune_cache[channel].end()) {
+            return cached->second;
+        }
+    }
+    return freq;
+}
+double RefArch::getCoercedTXFrequency(size_t channel, double freq) const
+{
+    if (channel < RA_tx_tune_cache.size()) {
+        const auto cached = RA_tx_tune_cache[channel].find(freq);
+        if (cached != RA_tx_tune_cache[channel].end()) {
+            return cached->second;
+        }
+    }
+    return freq;
+}
 void RefArch::tuneRX()
 {
-    for (auto& rctrl : RA_radio_ctrls) {
+    if (RA_mock) {
+        return;
+    }
+    for (size_t channel = 0; channel < RA_topology.numChannels(); channel++) {
+        const size_t radio = RA_topology.channel(channel).radio;
+        const auto block   = RA_radio_ctrls[radio]->get_block_id();
         // Set USRP RX Frequency for All Devices
         std::cout << std::fixed;
-        std::cout << rctrl->get_block_id() << " Setting RX Freq: " << std::fixed
-                  << (RA_rx_freq / 1e6) << " MHz..." << std::endl;
-
-        rctrl->set_rx_frequency(RA_rx_freq, 0);
-        std::cout << rctrl->get_block_id()
-                  << " Actual RX Freq: " << (rctrl->get_rx_frequency(0) / 1e6)
-                  << " MHz..." << std::endl
+        std::cout << block << " Setting RX Freq: " << std::fixed << (RA_rx_freq / 1e6)
+                  << " MHz..." << std::endl;
+        const double actual_freq = tuneRXRadio(channel, RA_rx_freq);
+        std::cout << block << " Actual RX Freq: " << (actual_freq / 1e6) << " MHz..."
+                  << std::endl
                   << std::endl;
     }
 }
 void RefArch::tuneTX()
 {
-    for (auto& rctrl : RA_radio_ctrls) {
+    if (RA_mock) {
+        return;
+    }
+    for (size_t channel = 0; channel < RA_topology.numChannels(); channel++) {
+        const size_t radio = RA_topology.channel(channel).radio;
+        const auto block   = RA_radio_ctrls[radio]->get_block_id();
         // Set USRP TX Frequency for All devices
         std::cout << std::fixed;
-        std::cout << rctrl->get_block_id() << " Setting TX Freq: " << std::fixed
-                  << (RA_tx_freq / 1e6) << " MHz..." << std::endl;
-        rctrl->set_tx_frequency(RA_tx_freq, 0);
-        std::cout << rctrl->get_block_id()
-                  << " Actual TX Freq: " << (rctrl->get_tx_frequency(0) / 1e6)
-                  << " MHz..." << std::endl
+        std::cout << block << " Setting TX Freq: " << std::fixed << (RA_tx_freq / 1e6)
+                  << " MHz..." << std::endl;
+        const double actual_freq = tuneTXRadio(channel, RA_tx_freq);
+        std::cout << block << " Actual TX Freq: " << (actual_freq / 1e6) << " MHz..."
+                  << std::endl
                   << std::endl;
     }
 }
 void RefArch::setRXGain()
 {
+    if (RA_mock) {
+        return;
+    }
     // Set RX Gain of all Devices (Appears that max in UHD Is 65)
-    for (auto& rctrl : RA_radio_ctrls) {
+    for (const TopologyChannel& channel : RA_topology.channels()) {
+        auto& rctrl = RA_radio_ctrls[channel.radio];
         std::cout << std::fixed;
         std::cout << rctrl->get_block_id() << " Setting RX Gain: " << RA_rx_gain
                   << " dB..." << std::endl;
-        rctrl->set_rx_gain(RA_rx_gain, 0);
-        std::cout << rctrl->get_block_id() << " Actual RX Gain: " << rctrl->get_rx_gain(0)
+        rctrl->set_rx_gain(RA_rx_gain, channel.radio_port);
+        std::cout << rctrl->get_block_id()
+                  << " Actual RX Gain: " << rctrl->get_rx_gain(channel.radio_port)
                   << " dB..." << std::endl
                   << std::endl;
         std::cout << std::resetiosflags(std::ios::fixed);
@@ -1106,13 +1746,18 @@ void RefArch::setRXGain()
 }
 void RefArch::setTXGain()
 {
+    if (RA_mock) {
+        return;
+    }
     // Set TX Gain of all devices (Appears that max in UHD is 65)
-    for (auto& rctrl : RA_radio_ctrls) {
+    for (const TopologyChannel& channel : RA_topology.channels()) {
+        auto& rctrl = RA_radio_ctrls[channel.radio];
         std::cout << std::fixed;
         std::cout << rctrl->get_block_id() << " Setting TX Gain: " << RA_tx_gain
                   << " dB..." << std::endl;
-        rctrl->set_tx_gain(RA_tx_gain, 0);
-        std::cout << rctrl->get_block_id() << " Actual TX Gain: " << rctrl->get_tx_gain(0)
+        rctrl->set_tx_gain(RA_tx_gain, channel.radio_port);
+        std::cout << rctrl->get_block_id()
+                  << " Actual TX Gain: " << rctrl->get_tx_gain(channel.radio_port)
                   << " dB..." << std::endl
                   << std::endl;
         std::cout << std::resetiosflags(std::ios::fixed);
@@ -1121,15 +1766,16 @@ void RefArch::setTXGain()
 void RefArch::setRXBw()
 {
     // Set RX BandWidth for all devices
-    if (RA_rx_bw > 0) {
-        for (auto& rctrl : RA_radio_ctrls) {
+    if (RA_rx_bw > 0 and not RA_mock) {
+        for (const TopologyChannel& channel : RA_topology.channels()) {
+            auto& rctrl = RA_radio_ctrls[channel.radio];
             std::cout << std::fixed;
             std::cout << rctrl->get_block_id()
                       << " Setting RX Bandwidth: " << (RA_rx_bw / 1e6) << " MHz..."
                       << std::endl;
-            rctrl->set_rx_bandwidth(RA_rx_bw, 0);
-            std::cout << rctrl->get_block_id()
-                      << " Actual RX Bandwidth: " << (rctrl->get_rx_bandwidth(0) / 1e6)
+            rctrl->set_rx_bandwidth(RA_rx_bw, channel.radio_port);
+            std::cout << rctrl->get_block_id() << " Actual RX Bandwidth: "
+                      << (rctrl->get_rx_bandwidth(channel.radio_port) / 1e6)
                       << " MHz..." << std::endl
                       << std::endl;
             std::cout << std::resetiosflags(std::ios::fixed);
@@ -1139,15 +1785,16 @@ void RefArch::setRXBw()
 void RefArch::setTXBw()
 {
     // Set TX BandWidth for all devices
-    if (RA_tx_bw > 0) {
-        for (auto& rctrl : RA_radio_ctrls) {
+    if (RA_tx_bw > 0 and not RA_mock) {
+        for (const TopologyChannel& channel : RA_topology.channels()) {
+            auto& rctrl = RA_radio_ctrls[channel.radio];
             std::cout << std::fixed;
             std::cout << rctrl->get_block_id()
                       << " Setting TX Bandwidth: " << (RA_tx_bw / 1e6) << " MHz..."
                       << std::endl;
-            rctrl->set_tx_bandwidth(RA_tx_bw, 0);
-            std::cout << rctrl->get_block_id()
-                      << " Actual TX Bandwidth: " << (rctrl->get_tx_bandwidth(0) / 1e6)
+            rctrl->set_tx_bandwidth(RA_tx_bw, channel.radio_port);
+            std::cout << rctrl->get_block_id() << " Actual TX Bandwidth: "
+                      << (rctrl->get_tx_bandwidth(channel.radio_port) / 1e6)
                       << " MHz..." << std::endl
                       << std::endl;
             std::cout << std::resetiosflags(std::ios::fixed);
@@ -1156,126 +1803,43 @@ void RefArch::setTXBw()
 }
 void RefArch::setRXAnt()
 {
+    if (RA_mock) {
+        return;
+    }
     // Set RX Antenna for all devices
-    for (auto& rctrl : RA_radio_ctrls) {
-        rctrl->set_rx_antenna(RA_rx_ant, 0);
+    for (const TopologyChannel& channel : RA_topology.channels()) {
+        RA_radio_ctrls[channel.radio]->set_rx_antenna(RA_rx_ant, channel.radio_port);
     }
 }
 void RefArch::setTXAnt()
 {
+    if (RA_mock) {
+        return;
+    }
     // Set TX Antenna for all devices
-    for (auto& rctrl : RA_radio_ctrls) {
-        rctrl->set_tx_antenna(RA_tx_ant, 0);
+    for (const TopologyChannel& channel : RA_topology.channels()) {
+        RA_radio_ctrls[channel.radio]->set_tx_antenna(RA_tx_ant, channel.radio_port);
     }
 }
 // recvdata to memory
-void RefArch::recv(
-        int rx_channel_nums, int threadnum, uhd::rx_streamer::sptr rx_streamer, bool bw_summary, bool stats) 
-    {
-        uhd::set_thread_priority_safe(0.9F);
-        size_t num_total_samps = 0;
-        // Prepare buffers for received samples and metadata
-        uhd::rx_metadata_t md;
-        std::vector<boost::circular_buffer<std::complex<short>>> buffs(
-            rx_channel_nums, boost::circular_buffer<std::complex<short>>(RA_spb + 1));
-        // create a vector of pointers to point to each of the channel buffers
-        std::vector<std::complex<short>*> buff_ptrs;
-        for (size_t i = 0; i < buffs.size(); i++) {
-            buff_ptrs.push_back(&buffs[i].front());
-        }
-        // Correctly label output files based on run method, single TX->single RX or
-        // single TX
-        // -> All RX
-        int rx_identifier = threadnum;
-        bool overflow_message = true;
-        // setup streaming
-        uhd::stream_cmd_t stream_cmd(
-            (RA_nsamps == 0) ? uhd::stream_cmd_t::STREAM_MODE_START_CONTINUOUS
-                             : uhd::stream_cmd_t::STREAM_MODE_NUM_SAMPS_AND_DONE);
-        stream_cmd.num_samps  = RA_nsamps;
-        stream_cmd.stream_now = false;
-        stream_cmd.time_spec  = RA_start_time;
-        
-        rx_streamer->issue_stream_cmd(stream_cmd);
-        const auto start_time = std::chrono::steady_clock::now();
-        const auto stop_time =
-        start_time + std::chrono::milliseconds(int64_t(1000 * RA_time_requested+1000 * RA_delay_start_time));
-        // Track time and samps between updating the BW summary
-        auto last_update                     = start_time;
-        unsigned long long last_update_samps = 0;
-        int loop_num = 0;
-        while (not RA_stop_signal_called
-           and (RA_nsamps >= num_total_samps or RA_nsamps == 0)
-           and (RA_time_requested == 0.0 or std::chrono::steady_clock::now() <= stop_time)) {
-            const auto now = std::chrono::steady_clock::now();
-            size_t num_rx_samps = rx_streamer->recv(buff_ptrs, RA_spb, md, RA_rx_timeout);
-            loop_num += 1;
-            if (md.error_code == uhd::rx_metadata_t::ERROR_CODE_TIMEOUT) {
-                std::cout << boost::format("Timeout while streaming") << std::endl;
-                break;
-            }
-            if (md.error_code == uhd::rx_metadata_t::ERROR_CODE_OVERFLOW) {
-                if (overflow_message) {
-                    overflow_message    = false;
-                    std::string tempstr = "\n thread:" + std::to_string(threadnum) + '\n'
-                                          + "loop_num:" + std::to_string(loop_num) + '\n';
-                    std::cout << tempstr;
-                }
-                if (md.out_of_sequence != true) {
-                    std::cerr
-                        << boost::format(
-                               "Got an overflow indication. Please consider the "
-                               "following:\n"
-                               "  Your write medium must sustain a rate of %fMB/s.\n"
-                               "  Dropped samples will not be written to the file.\n"
-                               "  Please modify this example for your purposes.\n"
-                               "  This message will not appear again.\n")
-                               % (RA_rx_rate * sizeof(std::complex<short>) / 1e6);
-                    break;
-                }
-                continue;
-            }
-            if (md.error_code != uhd::rx_metadata_t::ERROR_CODE_NONE) {
-                throw std::runtime_error(
-                    str(boost::format("Receiver error %s") % md.strerror()));
-            }
-            num_total_samps += num_rx_samps * rx_streamer->get_num_channels();
-            if(bw_summary){
-                last_update_samps += num_rx_samps;
-                const auto time_since_last_update = now - last_update;
-                if (time_since_last_update > std::chrono::seconds(1)) {
-                    const double time_since_last_update_s =
-                        std::chrono::duration<double>(time_since_last_update).count();
-                    const double rate = double(last_update_samps) / time_since_last_update_s;
-                    std::cout << "\t" << (rate / 1e6) << " Msps" << std::endl;
-                    last_update_samps = 0;
-                    last_update       = now;
-                }
-            }
-        }
-        const auto actual_stop_time = std::chrono::steady_clock::now();
-
-        // Shut down receiver
-        stream_cmd.stream_mode = uhd::stream_cmd_t::STREAM_MODE_STOP_CONTINUOUS;
-        rx_streamer->issue_stream_cmd(stream_cmd);
-        if (stats) {
-            std::cout << std::endl;
-            if (RA_nsamps > 0){
-                std::cout << num_total_samps << " Samples Recieved: rerun with timed run for accurate stats." << std::endl;
-               return;
-            }
-            const double actual_duration_seconds =
-                std::chrono::duration<float>(actual_stop_time - start_time).count();
-            size_t adjusted_samples = num_total_samps/rx_streamer->get_num_channels();
-            std::cout << std::endl;
-            std::cout << boost::format("Thread: %d Received %d samples in %f seconds") % threadnum % num_total_samps
-                            % actual_duration_seconds
-                    << std::endl;
-            const double rate = (double)adjusted_samples / actual_duration_seconds;
-            std::cout << (rate / 1e6) << " Msps" << std::endl;
-
-        }
-    }
+void RefArch::recv(int rx_channel_nums,
+    int threadnum,
+    uhd::rx_streamer::sptr rx_streamer,
+    bool stats)
+{
+    dispatchFormat(rx_channel_nums, [&](auto sample, auto channels) {
+        receiveSamples<decltype(sample), decltype(channels)::value>(
+            threadnum, rx_streamer, stats, [](const auto&, size_t, auto, const auto&) {});
+    });
+}
+bool RefArch::recvSupportsFormat(const std::string& format) const
+{
+    return format == "sc16" or format == "fc32" or format == "fc64";
+}
+bool RefArch::recvSupportsGracefulStop() const
+{
+    return true;
+}
 void RefArch::transmitFromFile(
     uhd::tx_streamer::sptr tx_streamer, uhd::tx_metadata_t metadata, int num_channels)
 {
@@ -1284,15 +1848,29 @@ void RefArch::transmitFromFile(
     std::vector<std::complex<float>> buff(RA_spb);
     //std::vector<std::complex<float>*> buffs(num_channels, &buff.front());
     std::ifstream infile(RA_file.c_str(), std::ifstream::binary);
+    // One TX streamer per channel, the channel identifies the thread
+    const auto tx_channel =
+        std::find(RA_tx_stream_vector.begin(), RA_tx_stream_vector.end(), tx_streamer)
+        - RA_tx_stream_vector.begin();
+    MetricsSlot& tx_metrics = metricsSlot("tx", tx_channel);
     // send data until  the signal handler gets called
-    while (not metadata.end_of_burst and not  RA_stop_signal_called) {
+    while (not metadata.end_of_burst and not  RA_cancel.cancelled()) {
         infile.read((char*)&buff.front(), buff.size() * sizeof(int16_t));
         size_t num_tx_samps = size_t(infile.gcount() / sizeof(int16_t));
 
         metadata.end_of_burst = infile.eof();
         // send the entire contents of the buffer
+        const auto send_start     = std::chrono::steady_clock::now();
         const size_t samples_sent = tx_streamer->send(&buff.front(), num_tx_samps, metadata);
+        tx_metrics.record(METRIC_SEND_DURATION,
+            std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - send_start)
+                .count());
+        tx_metrics.add(METRIC_SEND_CALLS);
+        tx_metrics.add(METRIC_SAMPLES, samples_sent * num_channels);
+        tx_metrics.add(METRIC_BYTES, samples_sent * num_channels * sizeof(int16_t) * 2);
         if (samples_sent != num_tx_samps) {
+            tx_metrics.add(METRIC_TIMEOUTS);
             UHD_LOG_ERROR("TX-STREAM",
                 "The tx_stream timed out sending " << num_tx_samps << " samples ("
                                                    << samples_sent << " sent).");
@@ -1307,6 +1885,15 @@ void RefArch::transmitFromFile(
 }
 void RefArch::transmitFromReplay()
 {
+    if (RA_mock) {
+        std::cout << "Mock Replay port " << RA_singleTX << " issuing replay command for "
+                  << RA_nsamps << " samps..." << std::endl;
+        RA_mock_device->replay().play(RA_start_time, RA_nsamps);
+        return;
+    }
+    if (RA_replay_ctrls.empty()) {
+        return;
+    }
     // TODO: Separate out replay TX
     std::cout << "Replaying data (Press Ctrl+C to stop)..." << std::endl;
     uhd::stream_cmd_t stream_cmd(uhd::stream_cmd_t::STREAM_MODE_START_CONTINUOUS);
@@ -1320,8 +1907,8 @@ void RefArch::transmitFromReplay()
         stream_cmd.stream_mode = uhd::stream_cmd_t::STREAM_MODE_NUM_SAMPS_AND_DONE;
     }
     if (RA_TX_All_Chan == true) {
-        for (int i = 0; i < RA_replay_ctrls.size(); i = i + 2) {
-            // Replay Block Channel (output) 0
+        for (size_t i = 0; i < RA_replay_ctrls.size(); i++) {
+            // Every output port of every Replay Block
             std::cout << RA_replay_ctrls[i]->get_block_id()
                       << " Port: " << RA_replay_chan_vector[i] << std::endl
                       << RA_replay_ctrls[i]->get_block_id()
@@ -1333,19 +1920,6 @@ void RefArch::transmitFromReplay()
             stream_cmd.stream_now = false;
             stream_cmd.time_spec  = RA_start_time;
             RA_replay_ctrls[i]->issue_stream_cmd(stream_cmd, RA_replay_chan_vector[i]);
-            // Replay Block Channel (output) 1
-            std::cout << RA_replay_ctrls[i]->get_block_id()
-                      << " Port: " << RA_replay_chan_vector[i + 1] << std::endl
-                      << RA_replay_ctrls[i]->get_block_id()
-                      << " Issuing replay command for " << RA_nsamps << " samps..."
-                      << std::endl;
-            RA_replay_ctrls[i]->config_play(
-                RA_replay_buff_addr, RA_replay_buff_size, RA_replay_chan_vector[i + 1]);
-            stream_cmd.num_samps  = RA_nsamps;
-            stream_cmd.stream_now = false;
-            stream_cmd.time_spec  = RA_start_time;
-            RA_replay_ctrls[i]->issue_stream_cmd(
-                stream_cmd, RA_replay_chan_vector[i + 1]);
         }
 
     } else {
@@ -1407,16 +1981,26 @@ void RefArch::spawnTransmitThreads()
 void RefArch::spawnReceiveThreads()
 {
     int threadnum = 0;
+    if (RA_rx_compress and RA_format != "sc16") {
+        throw std::runtime_error("rx-compress requires --format sc16");
+    }
     // Receive RA_rx_stream_vector.size()
-    if (RA_format == "sc16") {
-        for (size_t i = 0; i < RA_rx_stream_vector.size(); i = i + 2) {
+    if (recvSupportsFormat(RA_format)) {
+        startRxTaps();
+        // One thread per streamer
+        for (const auto& channels : RA_rx_streamer_channels) {
             std::cout << "Spawning RX Thread.." << threadnum << std::endl;
             std::thread t(
-                [this](int threadnum, uhd::rx_streamer::sptr rx_streamer, bool bw_summary, bool stats) {
-                    recv(2, threadnum, rx_streamer, bw_summary, stats);
+                [this](int rx_channel_nums,
+                    int threadnum,
+                    uhd::rx_streamer::sptr rx_streamer,
+                    bool stats) {
+                    recv(rx_channel_nums, threadnum, rx_streamer, stats);
                 },
+                channels.size(),
                 threadnum,
-                RA_rx_stream_vector[i], RA_bw_summary, RA_stats);
+                RA_rx_stream_vector[channels.front()],
+                RA_stats);
 
             RA_rx_vector_thread.push_back(std::move(t));
             threadnum++;
@@ -1435,8 +2019,7 @@ void RefArch::joinAllThreads(){
     }
     
     // Stop Transmitting once RX is complete
-    bool temp_stop_signal = RA_stop_signal_called;
-    RA_stop_signal_called = true;
+    RA_cancel.cancel(CANCEL_TX);
 
     RA_rx_vector_thread.clear();
 
@@ -1446,5 +2029,143 @@ void RefArch::joinAllThreads(){
     }
     RA_tx_vector_thread.clear();
     std::cout << "Threads Joined" << std::endl;
-    RA_stop_signal_called = temp_stop_signal; // return stop_signal_called
+    RA_cancel.clear(CANCEL_TX);
+    stopRxTaps();
+    stopMetrics();
+}
+void RefArch::startRxTaps()
+{
+    if (RA_monitor and not RA_spectrum_monitor) {
+        RA_spectrum_monitor.reset(new SpectrumMonitor(
+            RA_rx_stream_vector.size(), RA_rx_rate, RA_monitor_settings));
+        RA_spectrum_monitor->start();
+    }
+    if (RA_trigger and not RA_trigger_capture) {
+        if (RA_rx_file_location.empty()) {
+            throw std::runtime_error("trigger requires rx-file-location");
+        }
+        // One folder per run, one file per channel and trigger
+        const std::string folder_name = runFolderName(RA_rx_file + "_trigger");
+        RA_trigger_settings.index_interval = RA_rx_index_interval;
+        RA_trigger_capture.reset(new TriggerCapture(RA_rx_stream_vector.size(),
+            RA_rx_rate,
+            rxSampleSize(),
+            RA_start_time.get_full_secs(),
+            RA_start_time.get_frac_secs(),
+            RA_trigger_settings,
+            [this, folder_name](size_t channel, size_t event) {
+                return generateRxFilename(RA_rx_file,
+                    channel,
+                    RA_singleTX,
+                    event,
+                    RA_tx_freq,
+                    folder_name,
+                    RA_rx_file_channels,
+                    RA_rx_file_location);
+            }));
+        RA_trigger_capture->start();
+    }
+}
+void RefArch::planBurstCapture()
+{
+    if (not RA_rx_burst or RA_burst_capture) {
+        return;
+    }
+    if (RA_rx_file_location.empty()) {
+        throw std::runtime_error("rx-burst requires rx-file-location");
+    }
+    const size_t sample_size = rxSampleSize();
+    const BurstPlan plan =
+        BurstCapture::plan(RA_rx_stream_vector.size(), RA_nsamps, sample_size);
+    RA_burst_capture.reset(new BurstCapture(
+        plan, RA_rx_stream_vector.size(), RA_nsamps, sample_size, RA_spb));
+}
+void RefArch::stopRxTaps()
+{
+    if (RA_spectrum_monitor) {
+        RA_spectrum_monitor->stop();
+        RA_spectrum_monitor.reset();
+    }
+    if (RA_trigger_capture) {
+        RA_trigger_capture->stop();
+        RA_trigger_capture.reset();
+    }
+    if (RA_burst_capture) {
+        const std::string folder_name = runFolderName(RA_rx_file);
+        RA_burst_capture->flush(
+            [this, &folder_name](size_t channel) {
+                return generateRxFilename(RA_rx_file,
+                    channel,
+                    RA_singleTX,
+                    0,
+                    RA_tx_freq,
+                    folder_name,
+                    RA_rx_file_channels,
+                    RA_rx_file_location);
+            },
+            RA_rx_rate,
+            RA_rx_index_interval,
+            std::thread::hardware_concurrency());
+        RA_burst_capture.reset();
+    }
+}
+MetricsSlot& RefArch::metricsSlot(const std::string& kind, int id)
+{
+    startMetrics();
+    MetricsSlot& slot = RA_metrics_registry.slot(kind, id);
+    slot.beginStream();
+    return slot;
+}
+void RefArch::startMetrics()
+{
+    std::lock_guard<std::mutex> lock(RA_metrics_mutex);
+    if (RA_net_stats and not RA_net_sampler) {
+        std::vector<std::string> interfaces = RA_net_interfaces;
+        if (interfaces.empty()) {
+            interfaces = interfacesForAddresses(RA_address);
+        }
+        std::string names;
+        for (const auto& name : interfaces) {
+            names += " " + name;
+        }
+        std::cout << "Sampling NIC counters of:" << (names.empty() ? " none" : names)
+                  << std::endl;
+        RA_net_sampler.reset(
+            new NetSampler(RA_metrics_registry, interfaces, RA_net_stats_interval));
+        RA_net_sampler->start();
+    }
+    if (RA_metrics_reporter) {
+        return;
+    }
+    std::string format = RA_metrics;
+    if (format == "none") {
+        if (not RA_bw_summary) {
+            return;
+        }
+        format = "console";
+    }
+    const MetricsFormat metrics_format = MetricsReporter::parseFormat(format);
+    std::string path                   = RA_metrics_file;
+    if (path.empty()) {
+        path = (metrics_format == METRICS_PROMETHEUS) ? "metrics.prom" : "metrics.csv";
+    }
+    RA_metrics_reporter.reset(new MetricsReporter(
+        RA_metrics_registry, metrics_format, path, RA_metrics_interval));
+    RA_metrics_reporter->start();
+}
+void RefArch::stopMetrics()
+{
+    std::lock_guard<std::mutex> lock(RA_metrics_mutex);
+    if (RA_net_sampler) {
+        RA_net_sampler->stop();
+        RA_net_sampler.reset();
+    }
+    const bool reporting = bool(RA_metrics_reporter);
+    if (RA_metrics_reporter) {
+        RA_metrics_reporter->stop();
+        RA_metrics_reporter.reset();
+    }
+    if (reporting or RA_stats) {
+        std::cout << RA_metrics_registry.histogramSummary() << std::flush;
+    }
 }
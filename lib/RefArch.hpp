@@ -7,6 +7,17 @@
 #ifndef REFARCH_H
 #define REFARCH_H
 
+#include "BurstCapture.hpp"
+#include "CancelToken.hpp"
+#include "Metrics.hpp"
+#include "MockDevice.hpp"
+#include "NetStats.hpp"
+#include "Sc16Codec.hpp"
+#include "SpectrumMonitor.hpp"
+#include "TimeIndex.hpp"
+#include "Topology.hpp"
+#include "TriggerCapture.hpp"
+#include <uhd/exception.hpp>
 #include <uhd/rfnoc/ddc_block_control.hpp>
 #include <uhd/rfnoc/duc_block_control.hpp>
 #include <uhd/rfnoc/radio_control.hpp>
@@ -14,12 +25,16 @@
 #include <uhd/rfnoc_graph.hpp>
 #include <signal.h>
 #include <stdlib.h>
+#include <boost/format.hpp>
 #include <boost/program_options.hpp>
 #include <thread>
 #include <uhd/utils/thread.hpp>
+#include <array>
 #include <atomic>
-
-// TODO: Need to rethink how to control the stop_signal
+#include <chrono>
+#include <complex>
+#include <iostream>
+#include <map>
 
 class RefArch
 {
@@ -45,6 +60,11 @@ public:
     virtual void setSources();
     /**
      * @brief Sets the next PPS edge as time 0 on all devies
+     *
+     * @details Run as a shard of Arch_shard (--shard-fd), waits for the coordinator
+     *  and sets the time of the PPS edge at its epoch instead, so all shards share
+     *  one time base. The coordinator answers once, so only the first call of a
+     *  shard synchronizes and later ones return its result.
      * @return int Returns 0 for success and 1 for failure.
      */
     virtual int syncAllDevices();
@@ -72,8 +92,23 @@ public:
     /**
      * @brief Gets the current time on controller 0 and sets
      * RA_start_time to that time plus RA_delay_start_time.
+     * The first call of a shard uses the start time of the coordinator.
      */
     virtual void updateDelayedStartTime();
+    /**
+     * @brief Sizes the burst capture of --rx-burst against the available memory,
+     *  throwing if it does not fit, then allocates and prefaults it. Call before
+     *  updateDelayedStartTime(), so neither a rejected configuration nor the
+     *  prefaulting eats into the start delay. Only receive loops built on
+     *  receiveSamples() without their own file writing support it, so
+     *  updateDelayedStartTime() rejects rx-burst in examples that do not call this.
+     */
+    void planBurstCapture();
+    /**
+     * @brief Returns the current time on controller 0, or on the mock device when
+     *  #RA_mock is set.
+     */
+    virtual uhd::time_spec_t getTimeNow();
     /**
      * @brief Uses the #RA_file waveform to fill all the replayblocks
      *
@@ -86,6 +121,11 @@ public:
      * @brief Stops all replay blocks
      */
     virtual void stopReplay();
+    /**
+     * @brief Number of Replay ports #RA_singleTX can select, one per channel of every
+     *  device on the mock.
+     */
+    size_t numReplayPorts() const;
     /**
      * @brief Used to interrupt all threads.
      */
@@ -113,6 +153,19 @@ public:
         const std::string& folder_name,
         const std::vector<std::string>& rx_streamer_string,
         const std::vector<std::string>& rx_file_location);
+    /**
+     * @brief Time index of the capture at path, written to <path>.idx, or nullptr if
+     *  --rx-index-interval is 0. Feed it the time_spec of every block written.
+     *
+     * @param path The capture file
+     * @param sample_size Bytes per sample written to the capture
+     */
+    std::unique_ptr<TimeIndexWriter> openTimeIndex(
+        const std::string& path, size_t sample_size);
+    /**
+     * @brief Bytes per sample of #RA_format.
+     */
+    size_t rxSampleSize();
     /**
      * @brief Create the USRP sessions
      *
@@ -120,43 +173,46 @@ public:
     virtual void buildGraph();
     /**
      * @brief Seek Radio Blocks on each USRP and assemble a vector of radio
-     * controllers.
+     * controllers. Adds a channel to #RA_topology for every radio port.
      */
     virtual void buildRadios();
     /**
      * @brief Seek DDCs & DUCs on each USRP and assemble a vector of DDC & DUC
-     * controllers.
+     * controllers. Records the DDC and DUC port of every channel in #RA_topology.
      */
     virtual void buildDDCDUC();
     /**
      * @brief Seek Replay Blocks on each USRP and assemble a vector of Replay Block
-     * Controllers
+     * Controllers, one entry per port. Gives the ports of every device to its
+     * channels in #RA_topology.
      */
     virtual void buildReplay();
     virtual void commitGraph();
     /**
      * @brief Connects Replay Block to TX
-     *  Connects RX Streamer <- (2)DDC <- (2)RX channels
+     *  Connects RX Streamer <- DDC <- RX channel, see connectRxChannels()
      *  Connects Replay block -> DUC -> TX channel
      *
-     * @details If 0 #RA_duc_ctrls then Replay Block -> TX channel directly
+     * @details Channels without a DUC are connected Replay Block -> TX channel
+     *  directly
      */
     virtual void connectGraphMultithread();
     /**
      * @brief Connects DDC/DUC to streamers
-     *  Connects RX Streamer <- (2)DDC <- (2)RX channels
+     *  Connects RX Streamer <- DDC <- RX channel, see connectRxChannels()
      *  connects TX Streamer -> DUC -> TX Channel
      */
     virtual void connectGraphMultithreadHostTX();
     /**
-     * @brief Builds 1 RX streamer per 2 RX channels.
+     * @brief Builds the RX streamers with buildRxStreamers().
      *  Builds a TX streamer for a Replay Block.
      *
-     * @details Both the TX and RX vectors are padded (duplicate)
+     * @details Both the TX and RX vectors are padded (duplicate), one entry per
+     *  channel and per Replay port
      */
     virtual void buildStreamsMultithread();
     /**
-     * @brief Builds 1 RX streamer per 2 RX channels.
+     * @brief Builds the RX streamers with buildRxStreamers().
      *  Builds 1 TX streamer per 1 TX channel
      *
      * @details RX vector is padded (duplicate)
@@ -176,6 +232,41 @@ public:
      * @brief Set USRP TX Frequency of #RA_tx_freq for All Devices
      */
     virtual void tuneTX();
+    /**
+     * @brief Tunes the RX frequency of a single channel through the tune cache.
+     *  If the channel is already tuned to freq the tune is skipped.
+     *
+     * @param channel channel number in #RA_topology
+     * @param freq requested frequency in Hz
+     * @return double the coerced frequency
+     */
+    virtual double tuneRXRadio(size_t channel, double freq);
+    /**
+     * @brief Tunes the TX frequency of a single channel through the tune cache.
+     *  If the channel is already tuned to freq the tune is skipped.
+     *
+     * @param channel channel number in #RA_topology
+     * @param freq requested frequency in Hz
+     * @return double the coerced frequency
+     */
+    virtual double tuneTXRadio(size_t channel, double freq);
+    /**
+     * @brief Tunes every channel through freqs once to record the coerced RX and TX
+     *  frequencies, then returns the channels to #RA_rx_freq and #RA_tx_freq.
+     *
+     * @param freqs frequencies in Hz that will be used later
+     */
+    virtual void prewarmTuneCache(const std::vector<double>& freqs);
+    /**
+     * @brief Returns the cached coerced RX frequency for channel, or freq if it has
+     *  never been tuned there.
+     */
+    double getCoercedRXFrequency(size_t channel, double freq) const;
+    /**
+     * @brief Returns the cached coerced TX frequency for channel, or freq if it has
+     *  never been tuned there.
+     */
+    double getCoercedTXFrequency(size_t channel, double freq) const;
     /**
      * @brief Set RX Gain of #RA_rx_gain on all Devices
      */
@@ -207,11 +298,20 @@ public:
      */
     virtual void parseConfig();
     /**
-     * @brief Spawns #RA_rx_stream_vector size number of threads calling RefArch::recv()
+     * @brief Spawns a thread calling RefArch::recv() for every RX streamer in
+     * #RA_rx_streamer_channels, threadnum being the index of the streamer.
      * An override of the recv function will result in this spawning instances of that
      * function.
      */
     virtual void spawnReceiveThreads();
+    /**
+     * @brief Channel number of port i of the streamer received by thread threadnum,
+     *  the channel of the rx files, the monitor and the captures.
+     */
+    size_t rxChannel(int threadnum, size_t i) const
+    {
+        return RA_rx_streamer_channels[threadnum][i];
+    }
     /**
      * @brief Spawns either a single TX thread or multiple depending on #RA_TX_All_Chan
      *  In either case an override of RefArch::transmitFromFile() will result in the
@@ -220,6 +320,7 @@ public:
     virtual void spawnTransmitThreads();
     /**
      * @brief Main loop to acquire samples. Typically all examples override this function
+     *  The default receives into memory with RefArch::receiveSamples() in any format.
      *
      * @param rx_channel_nums number of channels per streamer
      * @param threadnum thread number
@@ -227,7 +328,42 @@ public:
      */
     virtual void recv(const int rx_channel_nums,
         const int threadnum,
-        uhd::rx_streamer::sptr rx_streamer, bool bw_summary, bool stats);
+        uhd::rx_streamer::sptr rx_streamer, bool stats);
+    /**
+     * @brief Whether recv() handles #RA_format, checked by spawnReceiveThreads().
+     *  Examples whose recv() is written for std::complex<short> only override this.
+     */
+    virtual bool recvSupportsFormat(const std::string& format) const;
+    /**
+     * @brief Whether recv() drains to a graceful stop, checked by parseConfig(). Examples
+     *  whose recv() has its own loop instead of receiveSamples() override this.
+     */
+    virtual bool recvSupportsGracefulStop() const;
+    /**
+     * @brief Receive loop shared by the recv() implementations. Receives from
+     *  rx_streamer into num_channels buffers of samp_type and hands every block to
+     *  sink(buff_ptrs, num_rx_samps, received, md), buff_ptrs holding the channel
+     *  pointers, received the time recv() returned and md its metadata,
+     *  whose time_spec is that of the first sample. Handles the stream commands,
+     *  overflows, timeouts, the graceful stop, the rx metrics and the stats.
+     *  Sample type and channel count are compile time constants, so the loop and the
+     *  sink run with fixed strides, except for a static_channels of 0, where the count
+     *  comes from the streamer. Instantiate it through dispatchFormat().
+     *
+     * @return size_t samples received over all channels
+     */
+    template <typename samp_type, size_t static_channels, typename Sink>
+    size_t receiveSamples(
+        int threadnum, uhd::rx_streamer::sptr rx_streamer, bool stats, Sink&& sink);
+    /**
+     * @brief Calls fn(samp_type(), std::integral_constant<size_t, num_channels>()) with
+     *  the sample type of #RA_format (sc16, fc32 or fc64) and num_channels (1, 2, 4, 8
+     *  or 16), so fn is compiled for every supported combination and the one matching
+     *  the streamer runs. Other channel counts pass 0, fn then takes the count from the
+     *  streamer and sizes its per-channel state at run time.
+     */
+    template <typename Fn>
+    void dispatchFormat(size_t num_channels, Fn&& fn);
     /**
      * @brief Main loop to stream samples from host. Typically streaming examples
      *  will override this function
@@ -249,9 +385,55 @@ public:
      */
     virtual void joinAllThreads();
     /**
-     * @brief Used to shutdown all threads.
+     * @brief Starts the consumers tapping every received block, the spectrum monitor
+     *  and the trigger capture, if enabled. Called by spawnReceiveThreads(), examples
+     *  overriding it call this before spawning their receive threads.
+     */
+    void startRxTaps();
+    /**
+     * @brief Stops the consumers started by startRxTaps(), dumping pending triggers
+     *  and flushing the burst capture to the rx files. Called by joinAllThreads().
+     */
+    void stopRxTaps();
+    /**
+     * @brief Common device time all streams stop at after a graceful stop request,
+     *  #RA_graceful_stop_delay after the first call following the request.
+     */
+    uhd::time_spec_t gracefulStopTime();
+    /**
+     * @brief For recv loops that support a graceful stop. Returns how many of the
+     *  num_rx_samps samples received with md come before the graceful stop time, all
+     *  of them while no graceful stop was requested. The first call after the request
+     *  issues a stop at the stop time on rx_streamer through stream_cmd. done is set
+     *  once the stream has reached the stop time, so every channel ends at the same
+     *  sample time.
+     */
+    size_t samplesBeforeStop(uhd::rx_streamer::sptr rx_streamer,
+        uhd::stream_cmd_t& stream_cmd,
+        const uhd::rx_metadata_t& md,
+        size_t num_rx_samps,
+        bool& done);
+    /**
+     * @brief Returns the metrics slot of a thread, kind "rx", "tx", "writer", ...
+     *  Starts the reporter selected by #RA_metrics and the NIC sampler on first use.
      */
-    static bool RA_stop_signal_called;
+    MetricsSlot& metricsSlot(const std::string& kind, int id);
+    /**
+     * @brief Starts the metrics reporter. bw_summary without metrics reports to the
+     *  console.
+     */
+    void startMetrics();
+    /**
+     * @brief Stops the metrics reporter and the NIC sampler after a last report and
+     *  prints the latency histograms when metrics or stats are enabled. Called by
+     *  RefArch::joinAllThreads().
+     */
+    void stopMetrics();
+    /**
+     * @brief Used to shutdown all threads. Set by sigIntHandler(), gracefully first
+     *  when #RA_graceful_stop is set, and with CANCEL_TX by joinAllThreads().
+     */
+    static CancelToken RA_cancel;
     std::vector<std::thread> RA_rx_vector_thread;
     std::vector<std::thread> RA_tx_vector_thread;
 
@@ -270,9 +452,21 @@ public:
     // These are used in all examples
     int RA_singleTX;
     double RA_delay_start_time;
+    // Socket to the Arch_shard coordinator, -1 when not running as a shard
+    int RA_shard_fd;
+    // PPS aligned start time from the coordinator, 0 once used
+    double RA_shard_start_time = 0;
+    // Result of the one syncShard() of a shard, -1 until it ran
+    int RA_shard_sync_status = -1;
     bool RA_TX_All_Chan;
     bool RA_bw_summary;
     bool RA_stats;
+    /**
+     * @brief The first Ctrl+C stops the streams at a common time and drains them, the
+     *  second one stops immediately.
+     */
+    bool RA_graceful_stop;
+    double RA_graceful_stop_delay;
 
 protected:
     ///////////////////////////
@@ -290,19 +484,38 @@ protected:
     std::vector<uhd::rfnoc::duc_block_control::sptr> RA_duc_ctrls;
     size_t RA_ddc_chan;
     size_t RA_duc_chan;
+    /**
+     * @brief Channels of the system and the radio, DDC, DUC and Replay ports of each,
+     *  discovered by buildRadios(), buildDDCDUC() and buildReplay() or simulated by
+     *  the mock. The streamer, thread and file layouts are derived from it.
+     */
+    Topology RA_topology;
 
     // Streamer Variables
     uhd::rx_streamer::sptr RA_rx_stream;
     uhd::tx_streamer::sptr RA_tx_stream;
     std::vector<uhd::tx_streamer::sptr> RA_tx_stream_vector;
     /**
-     * @brief Holds each channels streamer. By default each USRP channel 0 and 1
-     *  use the same streamer. RA_rx_stream_vector[0] == RA_rx_stream_vector[1]
+     * @brief Holds each channels streamer, laid out by #RA_rx_streamers. By default
+     *  the channels of a USRP use the same streamer. RA_rx_stream_vector[0] ==
+     *  RA_rx_stream_vector[1] RA_rx_stream_chan_vector holds the port of each channel
+     *  on its streamer.
      */
     std::vector<uhd::rx_streamer::sptr> RA_rx_stream_vector;
     std::vector<size_t> RA_rx_stream_chan_vector;
+    // Channels of every RX streamer in port order, filled by addRxStreamer()
+    std::vector<std::vector<size_t>> RA_rx_streamer_channels;
     // txrx settings
     uhd::time_spec_t RA_start_time;
+    /**
+     * @brief Tune cache. Per channel map of requested to coerced frequency and the
+     *  last requested frequency, NaN if the channel has not been tuned through the
+     *  cache.
+     */
+    std::vector<std::map<double, double>> RA_rx_tune_cache;
+    std::vector<std::map<double, double>> RA_tx_tune_cache;
+    std::vector<double> RA_rx_tuned_freq;
+    std::vector<double> RA_tx_tuned_freq;
 
     //////////////////
     // DeviceSettings//
@@ -316,10 +529,63 @@ protected:
     double RA_tx_rate, RA_tx_freq, RA_tx_gain, RA_tx_bw;
     double RA_rx_rate, RA_rx_freq, RA_rx_gain, RA_rx_bw;
     std::string RA_ref;
+    bool RA_tune_cache;
     std::string RA_tx_ant, RA_rx_ant;
     std::string RA_streamargs;
     std::vector<std::string> RA_address;
     std::vector<std::string> RA_lo;
+    /**
+     * @brief RX streamer layout, see streamerLayout(), or "auto" to benchmark the
+     *  layouts for #RA_rx_streamers_bench_time seconds each and keep the fastest.
+     */
+    std::string RA_rx_streamers;
+    double RA_rx_streamers_bench_time;
+    /**
+     * @brief Simulate the USRPs instead of opening them. The graph and block controls
+     *  stay empty, RA_mock_device provides the streamers and the time.
+     */
+    bool RA_mock;
+    MockSettings RA_mock_settings;
+    std::shared_ptr<MockDevice> RA_mock_device;
+
+    //////////////////
+    // MetricsSettings//
+    //////////////////
+    // none, console, csv or prometheus
+    std::string RA_metrics;
+    std::string RA_metrics_file;
+    double RA_metrics_interval;
+    MetricsRegistry RA_metrics_registry;
+    std::unique_ptr<MetricsReporter> RA_metrics_reporter;
+    std::mutex RA_metrics_mutex;
+    /**
+     * @brief Sample the NIC and softirq counters while streaming and tag every RX
+     *  overflow with their deltas. The interfaces default to those on the subnets of
+     *  the addr values in #RA_address.
+     */
+    bool RA_net_stats;
+    double RA_net_stats_interval;
+    std::vector<std::string> RA_net_interfaces;
+    std::unique_ptr<NetSampler> RA_net_sampler;
+    /**
+     * @brief Tap the RX channels for power and spectrum snapshots, see SpectrumMonitor.
+     *  Started by spawnReceiveThreads() and stopped by joinAllThreads().
+     */
+    bool RA_monitor;
+    MonitorSettings RA_monitor_settings;
+    std::unique_ptr<SpectrumMonitor> RA_spectrum_monitor;
+    /**
+     * @brief Keep the last seconds of every RX channel in RAM and write a window around
+     *  every trigger to the rx files, see TriggerCapture. Started and stopped with the
+     *  spectrum monitor.
+     */
+    bool RA_trigger;
+    TriggerSettings RA_trigger_settings;
+    std::unique_ptr<TriggerCapture> RA_trigger_capture;
+    // Graceful stop time, valid once RA_stop_time_set
+    uhd::time_spec_t RA_stop_time;
+    bool RA_stop_time_set = false;
+    std::mutex RA_stop_time_mutex;
 
     //////////////////
     // SignalSettings//
@@ -329,6 +595,14 @@ protected:
     std::string RA_rx_file;
     std::vector<std::string> RA_rx_file_location;
     std::vector<std::string> RA_rx_file_channels;
+    // Samples per entry of the capture time indexes, 0 for none
+    size_t RA_rx_index_interval;
+    // Compress sc16 captures with compressSc16(), see Sc16Codec.hpp
+    bool RA_rx_compress;
+    // Receive the nsamps of every channel into RAM and write them after streaming,
+    // see BurstCapture.hpp
+    bool RA_rx_burst;
+    std::unique_ptr<BurstCapture> RA_burst_capture;
     std::string RA_otw;
     std::string RA_type;
     size_t RA_spb;
@@ -360,15 +634,271 @@ protected:
     void addProgramOptions();
     void addAddressToArgs();
     void storeProgramOptions();
+    /**
+     * @brief Creates an RX streamer for channels, port i receiving channels[i], and
+     *  records it in #RA_rx_stream_vector, #RA_rx_stream_chan_vector and
+     *  #RA_rx_streamer_channels.
+     */
+    void addRxStreamer(
+        const std::vector<size_t>& channels, const uhd::stream_args_t& stream_args);
+    /**
+     * @brief Builds the RX streamers of #RA_topology in the layout of
+     *  #RA_rx_streamers, benchmarking them first for "auto".
+     */
+    void buildRxStreamers(const uhd::stream_args_t& stream_args);
+    /**
+     * @brief Streams every candidate layout (device, channel, global) for
+     *  #RA_rx_streamers_bench_time seconds and returns the one with the highest rate
+     *  without overflows. The streamers are released before returning. Runs on its
+     *  own time base from resetBenchmarkTime(), never on syncAllDevices(), which a
+     *  shard may only call once.
+     */
+    std::string benchmarkRxStreamers(const uhd::stream_args_t& stream_args);
+    /**
+     * @brief Sets every device time to 0 right away, without waiting for a PPS edge,
+     *  for the streamers of benchmarkRxStreamers() to start together.
+     */
+    void resetBenchmarkTime();
+    /**
+     * @brief Connects every channel of #RA_topology, radio -> DDC -> its port on its
+     *  RX streamer, or radio -> RX streamer without a DDC.
+     */
+    void connectRxChannels();
 
 private:
+    void resizeTuneCache();
     void setSource(int device);
     void setTerminal(int device);
     void setDistributor(int device);
+    void printLOSetting(int device, const std::string& mode);
+    /**
+     * @brief syncAllDevices() of a shard, see Shard.hpp.
+     */
+    int syncShard();
+    void setExternalLOs(int device);
 
     std::map<int, std::string> getStreamerFileLocation(
         const std::vector<std::string>& RA_rx_file_channels,
         const std::vector<std::string>& RA_rx_file_location);
 };
 
+namespace refarch_detail {
+/**
+ * @brief One T per channel of a streamer, a std::array for the channel counts
+ *  dispatchChannels() compiles in and a std::vector sized at run time for num_channels
+ *  0, every other count.
+ */
+template <typename T, size_t num_channels>
+struct PerChannel
+{
+    using type = std::array<T, num_channels>;
+    static type make(size_t) { return type(); }
+};
+template <typename T>
+struct PerChannel<T, 0>
+{
+    using type = std::vector<T>;
+    static type make(size_t channels) { return type(channels); }
+};
+/**
+ * @brief The channel count of rx_streamer, num_channels unless it is the run time
+ *  width 0.
+ */
+template <size_t num_channels>
+size_t streamerChannels(const uhd::rx_streamer::sptr& rx_streamer)
+{
+    const size_t channels = rx_streamer->get_num_channels();
+    UHD_ASSERT_THROW(num_channels == 0 or channels == num_channels);
+    return channels;
+}
+template <typename samp_type, typename Fn>
+void dispatchChannels(size_t num_channels, Fn& fn)
+{
+    switch (num_channels) {
+        case 1:
+            fn(samp_type(), std::integral_constant<size_t, 1>());
+            return;
+        case 2:
+            fn(samp_type(), std::integral_constant<size_t, 2>());
+            return;
+        case 4:
+            fn(samp_type(), std::integral_constant<size_t, 4>());
+            return;
+        case 8:
+            fn(samp_type(), std::integral_constant<size_t, 8>());
+            return;
+        case 16:
+            fn(samp_type(), std::integral_constant<size_t, 16>());
+            return;
+        default:
+            // Any other layout, sized from the streamer at run time
+            fn(samp_type(), std::integral_constant<size_t, 0>());
+            return;
+    }
+}
+} // namespace refarch_detail
+
+template <typename Fn>
+void RefArch::dispatchFormat(size_t num_channels, Fn&& fn)
+{
+    if (RA_format == "sc16") {
+        refarch_detail::dispatchChannels<std::complex<short>>(num_channels, fn);
+    } else if (RA_format == "fc32") {
+        refarch_detail::dispatchChannels<std::complex<float>>(num_channels, fn);
+    } else if (RA_format == "fc64") {
+        refarch_detail::dispatchChannels<std::complex<double>>(num_channels, fn);
+    } else {
+        throw std::runtime_error("Unknown type " + RA_format);
+    }
+}
+
+template <typename samp_type, size_t static_channels, typename Sink>
+size_t RefArch::receiveSamples(
+    int threadnum, uhd::rx_streamer::sptr rx_streamer, bool stats, Sink&& sink)
+{
+    const size_t num_channels =
+        refarch_detail::streamerChannels<static_channels>(rx_streamer);
+    uhd::set_thread_priority_safe(0.9F);
+    size_t num_total_samps = 0;
+    // Prepare buffers for received samples and metadata
+    uhd::rx_metadata_t md;
+    auto buffs =
+        refarch_detail::PerChannel<std::vector<samp_type>, static_channels>::make(
+            num_channels);
+    auto buff_ptrs =
+        refarch_detail::PerChannel<samp_type*, static_channels>::make(num_channels);
+    for (size_t i = 0; i < num_channels; i++) {
+        buffs[i].resize(RA_spb + 1);
+        buff_ptrs[i] = buffs[i].data();
+    }
+    bool overflow_message = true;
+    // setup streaming
+    uhd::stream_cmd_t stream_cmd(
+        (RA_nsamps == 0) ? uhd::stream_cmd_t::STREAM_MODE_START_CONTINUOUS
+                         : uhd::stream_cmd_t::STREAM_MODE_NUM_SAMPS_AND_DONE);
+    stream_cmd.num_samps  = RA_nsamps;
+    stream_cmd.stream_now = false;
+    stream_cmd.time_spec  = RA_start_time;
+
+    rx_streamer->issue_stream_cmd(stream_cmd);
+    const auto start_time = std::chrono::steady_clock::now();
+    const auto stop_time =
+        start_time
+        + std::chrono::milliseconds(
+            int64_t(1000 * RA_time_requested + 1000 * RA_delay_start_time));
+    MetricsSlot& rx_metrics = metricsSlot("rx", threadnum);
+    int loop_num            = 0;
+    bool done               = false;
+    // A burst capture ends once full, checked before every recv(). RA_nsamps is per
+    // channel whatever the streamer layout, num_total_samps counts every channel.
+    while (not RA_cancel.stopNow() and not done
+           and (RA_burst_capture or num_total_samps / num_channels < RA_nsamps
+                or RA_nsamps == 0)
+           and (RA_time_requested == 0.0
+                or std::chrono::steady_clock::now() <= stop_time)) {
+        size_t request = RA_spb;
+        if (RA_burst_capture) {
+            // Straight into the capture, every channel of the streamer is as full
+            for (size_t i = 0; i < num_channels; i++) {
+                buff_ptrs[i] =
+                    (samp_type*)RA_burst_capture->next(rxChannel(threadnum, i));
+            }
+            request = std::min<uint64_t>(
+                RA_spb, RA_burst_capture->remaining(rxChannel(threadnum, 0)));
+            if (request == 0) {
+                break;
+            }
+        }
+        size_t num_rx_samps = rx_streamer->recv(buff_ptrs, request, md, RA_rx_timeout);
+        const auto received = std::chrono::steady_clock::now();
+        rx_metrics.recordRecv(md, num_rx_samps, num_channels, sizeof(samp_type));
+        loop_num += 1;
+        if (md.error_code == uhd::rx_metadata_t::ERROR_CODE_TIMEOUT) {
+            std::cout << boost::format("Timeout while streaming") << std::endl;
+            break;
+        }
+        if (md.error_code == uhd::rx_metadata_t::ERROR_CODE_OVERFLOW) {
+            if (overflow_message) {
+                overflow_message    = false;
+                std::string tempstr = "\n thread:" + std::to_string(threadnum) + '\n'
+                                      + "loop_num:" + std::to_string(loop_num) + '\n';
+                std::cout << tempstr;
+            }
+            if (md.out_of_sequence != true) {
+                std::cerr << boost::format(
+                                 "Got an overflow indication. Please consider the "
+                                 "following:\n"
+                                 "  Your write medium must sustain a rate of %fMB/s.\n"
+                                 "  Dropped samples will not be written to the file.\n"
+                                 "  Please modify this example for your purposes.\n"
+                                 "  This message will not appear again.\n")
+                                 % (RA_rx_rate * sizeof(samp_type) / 1e6);
+                break;
+            }
+            continue;
+        }
+        if (md.error_code != uhd::rx_metadata_t::ERROR_CODE_NONE) {
+            throw std::runtime_error(
+                str(boost::format("Receiver error %s") % md.strerror()));
+        }
+        num_rx_samps = samplesBeforeStop(rx_streamer, stream_cmd, md, num_rx_samps, done);
+        num_total_samps += num_rx_samps * num_channels;
+        if (RA_burst_capture) {
+            for (size_t i = 0; i < num_channels; i++) {
+                RA_burst_capture->commit(rxChannel(threadnum, i),
+                    md.time_spec.get_full_secs(),
+                    md.time_spec.get_frac_secs(),
+                    num_rx_samps);
+            }
+        }
+        sink(buff_ptrs, num_rx_samps, received, md);
+        if (RA_spectrum_monitor) {
+            for (size_t i = 0; i < num_channels; i++) {
+                RA_spectrum_monitor->tap(
+                    rxChannel(threadnum, i), buff_ptrs[i], num_rx_samps);
+            }
+        }
+        if (RA_trigger_capture) {
+            for (size_t i = 0; i < num_channels; i++) {
+                RA_trigger_capture->push(rxChannel(threadnum, i),
+                    md.time_spec.get_full_secs(),
+                    md.time_spec.get_frac_secs(),
+                    buff_ptrs[i],
+                    num_rx_samps);
+            }
+        }
+    }
+    const auto actual_stop_time = std::chrono::steady_clock::now();
+
+    // Shut down receiver
+    stream_cmd.stream_mode = uhd::stream_cmd_t::STREAM_MODE_STOP_CONTINUOUS;
+    rx_streamer->issue_stream_cmd(stream_cmd);
+    if (done) {
+        std::cout << boost::format("Thread: %d drained to the stop time, %d samples "
+                                   "per channel")
+                         % threadnum % (num_total_samps / num_channels)
+                  << std::endl;
+    }
+    if (stats) {
+        std::cout << std::endl;
+        if (RA_nsamps > 0) {
+            std::cout << num_total_samps
+                      << " Samples Recieved: rerun with timed run for accurate stats."
+                      << std::endl;
+            return num_total_samps;
+        }
+        const double actual_duration_seconds =
+            std::chrono::duration<float>(actual_stop_time - start_time).count()
+            - RA_delay_start_time;
+        size_t adjusted_samples = num_total_samps / num_channels;
+        std::cout << std::endl;
+        std::cout << boost::format("Thread: %d Received %d samples in %f seconds")
+                         % threadnum % num_total_samps % actual_duration_seconds
+                  << std::endl;
+        const double rate = (double)adjusted_samples / actual_duration_seconds;
+        std::cout << (rate / 1e6) << " Msps" << std::endl;
+    }
+    return num_total_samps;
+}
+
 #endif
@@ -0,0 +1,241 @@
+//
+// Copyright 2021-2022 Ettus Research, a National Instruments Brand
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+//
+
+#include "SampleConvert.hpp"
+#include <cstring>
+#include <stdexcept>
+#if defined(__x86_64__) || defined(__i386__)
+#    include <immintrin.h>
+#    define RA_CONVERT_X86 1
+#endif
+
+namespace {
+uint32_t floatBits(float value)
+{
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+float bitsFloat(uint32_t bits)
+{
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+// The SIMD kernels convert whole vectors and leave the tail to these
+void sc16ToFc32Scalar(const int16_t* in, float* out, size_t count, float scale)
+{
+    for (size_t i = 0; i < count; i++) {
+        out[i] = in[i] * scale;
+    }
+}
+
+void sc16ToFc16Scalar(const int16_t* in, uint16_t* out, size_t count, float scale)
+{
+    for (size_t i = 0; i < count; i++) {
+        out[i] = floatToHalf(in[i] * scale);
+    }
+}
+
+#ifdef RA_CONVERT_X86
+// count is the number of int16 values, two per sample
+__attribute__((target("avx2"))) void sc16ToFc32Avx2(
+    const int16_t* in, float* out, size_t count, float scale)
+{
+    const __m256 factor = _mm256_set1_ps(scale);
+    size_t i            = 0;
+    for (; i + 16 <= count; i += 16) {
+        const __m256i lo =
+            _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)(in + i)));
+        const __m256i hi =
+            _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)(in + i + 8)));
+        _mm256_storeu_ps(out + i, _mm256_mul_ps(_mm256_cvtepi32_ps(lo), factor));
+        _mm256_storeu_ps(out + i + 8, _mm256_mul_ps(_mm256_cvtepi32_ps(hi), factor));
+    }
+    sc16ToFc32Scalar(in + i, out + i, count - i, scale);
+}
+
+__attribute__((target("avx2,f16c"))) void sc16ToFc16Avx2(
+    const int16_t* in, uint16_t* out, size_t count, float scale)
+{
+    const __m256 factor = _mm256_set1_ps(scale);
+    size_t i            = 0;
+    for (; i + 8 <= count; i += 8) {
+        const __m256i values =
+            _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)(in + i)));
+        const __m128i halves = _mm256_cvtps_ph(
+            _mm256_mul_ps(_mm256_cvtepi32_ps(values), factor), _MM_FROUND_TO_NEAREST_INT);
+        _mm_storeu_si128((__m128i*)(out + i), halves);
+    }
+    sc16ToFc16Scalar(in + i, out + i, count - i, scale);
+}
+
+__attribute__((target("avx512f"))) void sc16ToFc32Avx512(
+    const int16_t* in, float* out, size_t count, float scale)
+{
+    const __m512 factor = _mm512_set1_ps(scale);
+    size_t i            = 0;
+    for (; i + 32 <= count; i += 32) {
+        const __m512i lo =
+            _mm512_cvtepi16_epi32(_mm256_loadu_si256((const __m256i*)(in + i)));
+        const __m512i hi =
+            _mm512_cvtepi16_epi32(_mm256_loadu_si256((const __m256i*)(in + i + 16)));
+        _mm512_storeu_ps(out + i, _mm512_mul_ps(_mm512_cvtepi32_ps(lo), factor));
+        _mm512_storeu_ps(out + i + 16, _mm512_mul_ps(_mm512_cvtepi32_ps(hi), factor));
+    }
+    sc16ToFc32Scalar(in + i, out + i, count - i, scale);
+}
+
+__attribute__((target("avx512f"))) void sc16ToFc16Avx512(
+    const int16_t* in, uint16_t* out, size_t count, float scale)
+{
+    const __m512 factor = _mm512_set1_ps(scale);
+    size_t i            = 0;
+    for (; i + 16 <= count; i += 16) {
+        const __m512i values =
+            _mm512_cvtepi16_epi32(_mm256_loadu_si256((const __m256i*)(in + i)));
+        const __m256i halves = _mm512_cvtps_ph(
+            _mm512_mul_ps(_mm512_cvtepi32_ps(values), factor), _MM_FROUND_TO_NEAREST_INT);
+        _mm256_storeu_si256((__m256i*)(out + i), halves);
+    }
+    sc16ToFc16Scalar(in + i, out + i, count - i, scale);
+}
+#endif
+} // namespace
+
+ConvertIsa bestConvertIsa()
+{
+#ifdef RA_CONVERT_X86
+    static const ConvertIsa best = []() {
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx512f")) {
+            return CONVERT_AVX512;
+        }
+        // The half precision kernel also needs F16C, every AVX2 CPU has it
+        if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("f16c")) {
+            return CONVERT_AVX2;
+        }
+        return CONVERT_SCALAR;
+    }();
+    return best;
+#else
+    return CONVERT_SCALAR;
+#endif
+}
+
+const char* convertIsaName(ConvertIsa isa)
+{
+    switch (isa) {
+        case CONVERT_AVX2:
+            return "avx2";
+        case CONVERT_AVX512:
+            return "avx512";
+        default:
+            return "scalar";
+    }
+}
+
+void convertSc16ToFc32(const std::complex<int16_t>* in,
+    std::complex<float>* out,
+    size_t nsamps,
+    float scale,
+    ConvertIsa isa)
+{
+    const int16_t* values = (const int16_t*)in;
+    float* floats         = (float*)out;
+#ifdef RA_CONVERT_X86
+    if (isa == CONVERT_AVX512) {
+        sc16ToFc32Avx512(values, floats, 2 * nsamps, scale);
+        return;
+    }
+    if (isa == CONVERT_AVX2) {
+        sc16ToFc32Avx2(values, floats, 2 * nsamps, scale);
+        return;
+    }
+#endif
+    sc16ToFc32Scalar(values, floats, 2 * nsamps, scale);
+}
+
+void convertSc16ToFc16(const std::complex<int16_t>* in,
+    uint16_t* out,
+    size_t nsamps,
+    float scale,
+    ConvertIsa isa)
+{
+    const int16_t* values = (const int16_t*)in;
+#ifdef RA_CONVERT_X86
+    if (isa == CONVERT_AVX512) {
+        sc16ToFc16Avx512(values, out, 2 * nsamps, scale);
+        return;
+    }
+    if (isa == CONVERT_AVX2) {
+        sc16ToFc16Avx2(values, out, 2 * nsamps, scale);
+        return;
+    }
+#endif
+    sc16ToFc16Scalar(values, out, 2 * nsamps, scale);
+}
+
+uint16_t floatToHalf(float value)
+{
+    uint32_t bits       = floatBits(value);
+    const uint32_t sign = bits & 0x80000000u;
+    bits ^= sign;
+    uint16_t half;
+    if (bits >= 0x47800000u) {
+        // 65536 and above, infinity and NaN
+        half = bits > 0x7f800000u ? 0x7e00 : 0x7c00;
+    } else if (bits < 0x38800000u) {
+        // Below the smallest normal half: adding 0.5 aligns the 10 mantissa bits at the
+        // bottom of the float and the FPU rounds them to nearest even
+        const uint32_t magic = 126u << 23;
+        const float aligned  = bitsFloat(bits) + bitsFloat(magic);
+        half                 = uint16_t(floatBits(aligned) - magic);
+    } else {
+        // Rebias the exponent and round the 13 dropped mantissa bits to nearest even
+        const uint32_t odd = (bits >> 13) & 1;
+        bits += (uint32_t(15 - 127) << 23) + 0xfff + odd;
+        half = uint16_t(bits >> 13);
+    }
+    return uint16_t((sign >> 16) | half);
+}
+
+SampleConverter::SampleConverter(const std::string& format, float scale)
+    : scale(scale), isa(bestConvertIsa())
+{
+    if (format == "sc16") {
+        this->format = FORMAT_SC16;
+    } else if (format == "fc32") {
+        this->format = FORMAT_FC32;
+    } else if (format == "fc16") {
+        this->format = FORMAT_FC16;
+    } else {
+        throw std::runtime_error("Unknown conversion format " + format);
+    }
+}
+
+size_t SampleConverter::sampleSize() const
+{
+    return format == FORMAT_FC32 ? sizeof(std::complex<float>) : 2 * sizeof(uint16_t);
+}
+
+void SampleConverter::convert(const void* in, void* out, size_t nsamps) const
+{
+    const std::complex<int16_t>* samples = (const std::complex<int16_t>*)in;
+    switch (format) {
+        case FORMAT_FC32:
+            convertSc16ToFc32(samples, (std::complex<float>*)out, nsamps, scale, isa);
+            break;
+        case FORMAT_FC16:
+            convertSc16ToFc16(samples, (uint16_t*)out, nsamps, scale, isa);
+            break;
+        default:
+            memcpy(out, in, nsamps * sizeof(std::complex<int16_t>));
+            break;
+    }
+}
@@ -0,0 +1,81 @@
+//
+// Copyright 2021-2022 Ettus Research, a National Instruments Brand
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+//
+
+#ifndef SAMPLECONVERT_H
+#define SAMPLECONVERT_H
+
+#include <complex>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/**
+ * @brief Instruction set of a conversion kernel. The AVX2 and AVX-512 kernels are
+ *  compiled with function level target attributes and picked at runtime, so the
+ *  library runs on any x86-64 host without -march flags.
+ */
+enum ConvertIsa { CONVERT_SCALAR, CONVERT_AVX2, CONVERT_AVX512 };
+
+/**
+ * @brief The fastest kernel the CPU supports, detected once.
+ */
+ConvertIsa bestConvertIsa();
+const char* convertIsaName(ConvertIsa isa);
+
+/**
+ * @brief Converts nsamps interleaved sc16 samples to complex float, multiplied by scale
+ *  (1/32768 maps full scale to +/-1.0).
+ */
+void convertSc16ToFc32(const std::complex<int16_t>* in,
+    std::complex<float>* out,
+    size_t nsamps,
+    float scale,
+    ConvertIsa isa = bestConvertIsa());
+/**
+ * @brief Same as convertSc16ToFc32() with IEEE 754 half precision output, two
+ *  uint16_t per sample, rounded to nearest even.
+ */
+void convertSc16ToFc16(const std::complex<int16_t>* in,
+    uint16_t* out,
+    size_t nsamps,
+    float scale,
+    ConvertIsa isa = bestConvertIsa());
+
+/**
+ * @brief Half precision bits of value, rounded to nearest even like F16C.
+ */
+uint16_t floatToHalf(float value);
+
+/**
+ * @brief Conversion stage for consumers that want float samples while the wire and
+ *  disk format stays sc16. format is "sc16" (no conversion), "fc32" or "fc16".
+ */
+class SampleConverter
+{
+public:
+    SampleConverter(const std::string& format = "sc16", float scale = 1.0f / 32768);
+    bool enabled() const
+    {
+        return format != FORMAT_SC16;
+    }
+    /**
+     * @brief Bytes per converted sample, 4 for sc16 and fc16, 8 for fc32.
+     */
+    size_t sampleSize() const;
+    /**
+     * @brief Converts nsamps sc16 samples at in to the output format at out, which
+     *  must hold nsamps * sampleSize() bytes.
+     */
+    void convert(const void* in, void* out, size_t nsamps) const;
+
+private:
+    enum Format { FORMAT_SC16, FORMAT_FC32, FORMAT_FC16 };
+    Format format;
+    float scale;
+    ConvertIsa isa;
+};
+
+#endif
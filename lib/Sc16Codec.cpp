@@ -0,0 +1,419 @@
+//
+// Copyright 2021-2022 Ettus Research, a National Instruments Brand
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+//
+
+#include "Sc16Codec.hpp"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#    include <immintrin.h>
+#    define RA_CODEC_X86 1
+#endif
+
+namespace {
+const size_t GROUP = RA_SC16Z_GROUP;
+const size_t LANES = 16;
+// Mode bytes and I and Q at 16 bits
+const size_t MAX_GROUP_BYTES = 2 + 2 * GROUP * sizeof(uint16_t);
+
+/**
+ * @brief Zigzag encoded samples and differences of one group, I and Q apart, and the
+ *  OR of each so the widths need no second pass.
+ */
+struct GroupValues
+{
+    alignas(32) uint16_t samples[2][GROUP];
+    alignas(32) uint16_t deltas[2][GROUP];
+    uint16_t samples_or[2];
+    uint16_t deltas_or[2];
+};
+
+uint16_t zigzag(int16_t value)
+{
+    return uint16_t(uint16_t(value) << 1) ^ uint16_t(value >> 15);
+}
+
+int16_t unzigzag(uint16_t value)
+{
+    return int16_t((value >> 1) ^ -(value & 1));
+}
+
+uint8_t bitWidth(uint16_t value)
+{
+    return value == 0 ? 0 : 32 - __builtin_clz(value);
+}
+
+/**
+ * @brief Splits GROUP interleaved samples at in into I and Q and zigzag encodes them
+ *  and their differences. prev holds the last I and Q of the previous group and is
+ *  updated.
+ */
+void prepareScalar(const int16_t* in, int16_t prev[2], GroupValues& values)
+{
+    for (size_t c = 0; c < 2; c++) {
+        uint16_t samples_or = 0;
+        uint16_t deltas_or  = 0;
+        int16_t last        = prev[c];
+        for (size_t n = 0; n < GROUP; n++) {
+            const int16_t value        = in[2 * n + c];
+            values.samples[c][n]       = zigzag(value);
+            values.deltas[c][n]        = zigzag(int16_t(value - last));
+            last                       = value;
+            samples_or |= values.samples[c][n];
+            deltas_or |= values.deltas[c][n];
+        }
+        values.samples_or[c] = samples_or;
+        values.deltas_or[c]  = deltas_or;
+        prev[c]              = last;
+    }
+}
+
+/**
+ * @brief Packs the GROUP values at width bits each, value n into lane n % LANES.
+ */
+void packScalar(const uint16_t* values, uint8_t width, uint8_t* out)
+{
+    for (size_t lane = 0; lane < LANES; lane++) {
+        uint32_t acc = 0;
+        uint8_t bits = 0;
+        size_t word  = 0;
+        for (size_t k = 0; k < GROUP / LANES; k++) {
+            acc |= uint32_t(values[k * LANES + lane]) << bits;
+            bits += width;
+            if (bits >= 16) {
+                const uint16_t packed = acc;
+                memcpy(out + (word * LANES + lane) * sizeof(uint16_t), &packed, 2);
+                acc >>= 16;
+                bits -= 16;
+                word++;
+            }
+        }
+    }
+}
+
+void unpackScalar(const uint8_t* in, uint8_t width, uint16_t* values)
+{
+    if (width == 0) {
+        std::fill(values, values + GROUP, 0);
+        return;
+    }
+    const uint32_t mask = (1u << width) - 1;
+    for (size_t lane = 0; lane < LANES; lane++) {
+        uint32_t acc = 0;
+        uint8_t bits = 0;
+        size_t word  = 0;
+        for (size_t k = 0; k < GROUP / LANES; k++) {
+            if (bits < width) {
+                uint16_t packed;
+                memcpy(&packed, in + (word * LANES + lane) * sizeof(uint16_t), 2);
+                acc |= uint32_t(packed) << bits;
+                bits += 16;
+                word++;
+            }
+            values[k * LANES + lane] = acc & mask;
+            acc >>= width;
+            bits -= width;
+        }
+    }
+}
+
+#ifdef RA_CODEC_X86
+__attribute__((target("avx2"))) __m256i zigzagAvx2(__m256i values)
+{
+    return _mm256_xor_si256(_mm256_slli_epi16(values, 1), _mm256_srai_epi16(values, 15));
+}
+
+__attribute__((target("avx2"))) uint16_t reduceOr(__m256i values)
+{
+    __m128i folded =
+        _mm_or_si128(_mm256_castsi256_si128(values), _mm256_extracti128_si256(values, 1));
+    folded = _mm_or_si128(folded, _mm_srli_si128(folded, 8));
+    folded = _mm_or_si128(folded, _mm_srli_si128(folded, 4));
+    folded = _mm_or_si128(folded, _mm_srli_si128(folded, 2));
+    return _mm_extract_epi16(folded, 0);
+}
+
+__attribute__((target("avx2"))) void prepareAvx2(
+    const int16_t* in, int16_t prev[2], GroupValues& values)
+{
+    // I values to the low half of each 128 bit lane, Q values to the high half
+    const __m256i split = _mm256_setr_epi8(0, 1, 4, 5, 8, 9, 12, 13, 2, 3, 6, 7, 10,
+        11, 14, 15, 0, 1, 4, 5, 8, 9, 12, 13, 2, 3, 6, 7, 10, 11, 14, 15);
+    __m256i last_i     = _mm256_set1_epi16(prev[0]);
+    __m256i last_q     = _mm256_set1_epi16(prev[1]);
+    __m256i or_zi      = _mm256_setzero_si256();
+    __m256i or_zq      = _mm256_setzero_si256();
+    __m256i or_di      = _mm256_setzero_si256();
+    __m256i or_dq      = _mm256_setzero_si256();
+    for (size_t n = 0; n < GROUP; n += 16) {
+        // [I0-3 Q0-3 | I4-7 Q4-7] to [I0-7 | Q0-7], then I0-15 and Q0-15
+        const __m256i a = _mm256_permute4x64_epi64(
+            _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i*)(in + 2 * n)), split),
+            0xd8);
+        const __m256i b = _mm256_permute4x64_epi64(
+            _mm256_shuffle_epi8(
+                _mm256_loadu_si256((const __m256i*)(in + 2 * n + 16)), split),
+            0xd8);
+        const __m256i i = _mm256_permute2x128_si256(a, b, 0x20);
+        const __m256i q = _mm256_permute2x128_si256(a, b, 0x31);
+        // Each value minus the one before it, the first minus the last of the previous
+        const __m256i prev_i = _mm256_alignr_epi8(
+            i, _mm256_permute2x128_si256(last_i, i, 0x21), 14);
+        const __m256i prev_q = _mm256_alignr_epi8(
+            q, _mm256_permute2x128_si256(last_q, q, 0x21), 14);
+        const __m256i zi = zigzagAvx2(i);
+        const __m256i zq = zigzagAvx2(q);
+        const __m256i di = zigzagAvx2(_mm256_sub_epi16(i, prev_i));
+        const __m256i dq = zigzagAvx2(_mm256_sub_epi16(q, prev_q));
+        _mm256_store_si256((__m256i*)(values.samples[0] + n), zi);
+        _mm256_store_si256((__m256i*)(values.samples[1] + n), zq);
+        _mm256_store_si256((__m256i*)(values.deltas[0] + n), di);
+        _mm256_store_si256((__m256i*)(values.deltas[1] + n), dq);
+        or_zi = _mm256_or_si256(or_zi, zi);
+        or_zq = _mm256_or_si256(or_zq, zq);
+        or_di = _mm256_or_si256(or_di, di);
+        or_dq = _mm256_or_si256(or_dq, dq);
+        last_i = i;
+        last_q = q;
+    }
+    values.samples_or[0] = reduceOr(or_zi);
+    values.samples_or[1] = reduceOr(or_zq);
+    values.deltas_or[0]  = reduceOr(or_di);
+    values.deltas_or[1]  = reduceOr(or_dq);
+    prev[0]              = _mm256_extract_epi16(last_i, 15);
+    prev[1]              = _mm256_extract_epi16(last_q, 15);
+}
+
+__attribute__((target("avx2"))) void packAvx2(
+    const uint16_t* values, uint8_t width, uint8_t* out)
+{
+    __m256i packed = _mm256_setzero_si256();
+    int shift      = 0;
+    for (size_t k = 0; k < GROUP / LANES; k++) {
+        const __m256i value = _mm256_load_si256((const __m256i*)(values + k * LANES));
+        packed =
+            _mm256_or_si256(packed, _mm256_sll_epi16(value, _mm_cvtsi32_si128(shift)));
+        shift += width;
+        if (shift >= 16) {
+            _mm256_storeu_si256((__m256i*)out, packed);
+            out += sizeof(__m256i);
+            shift -= 16;
+            packed = shift == 0
+                         ? _mm256_setzero_si256()
+                         : _mm256_srl_epi16(value, _mm_cvtsi32_si128(width - shift));
+        }
+    }
+}
+#endif
+
+void prepare(const int16_t* in, int16_t prev[2], GroupValues& values, ConvertIsa isa)
+{
+#ifdef RA_CODEC_X86
+    if (isa != CONVERT_SCALAR) {
+        prepareAvx2(in, prev, values);
+        return;
+    }
+#endif
+    prepareScalar(in, prev, values);
+}
+
+void pack(const uint16_t* values, uint8_t width, uint8_t* out, ConvertIsa isa)
+{
+    if (width == 0) {
+        return;
+    }
+#ifdef RA_CODEC_X86
+    if (isa != CONVERT_SCALAR) {
+        packAvx2(values, width, out);
+        return;
+    }
+#endif
+    packScalar(values, width, out);
+}
+
+size_t packedBytes(uint8_t width)
+{
+    return width * LANES * sizeof(uint16_t);
+}
+
+ra_sc16z_header readHeader(const uint8_t* in)
+{
+    ra_sc16z_header header;
+    memcpy(&header, in, sizeof(header));
+    return header;
+}
+
+[[noreturn]] void corrupt()
+{
+    throw std::runtime_error("Corrupt compressed sc16 block");
+}
+} // namespace
+
+size_t sc16CompressBound(size_t nsamps)
+{
+    const size_t groups = (nsamps + GROUP - 1) / GROUP;
+    return sizeof(ra_sc16z_header)
+           + std::max(groups * MAX_GROUP_BYTES, nsamps * sizeof(std::complex<int16_t>));
+}
+
+size_t compressSc16(
+    const std::complex<int16_t>* in, size_t nsamps, uint8_t* out, ConvertIsa isa)
+{
+    if (nsamps > UINT32_MAX / sizeof(std::complex<int16_t>)) {
+        throw std::runtime_error("Too many samples for one compressed block");
+    }
+    const size_t raw_bytes = nsamps * sizeof(std::complex<int16_t>);
+    uint8_t* payload       = out + sizeof(ra_sc16z_header);
+    uint8_t* position      = payload;
+    int16_t prev[2]        = {0, 0};
+    GroupValues values;
+    alignas(32) int16_t padded[2 * GROUP];
+    for (size_t start = 0; start < nsamps; start += GROUP) {
+        const size_t count = std::min(GROUP, nsamps - start);
+        const int16_t* src = (const int16_t*)(in + start);
+        if (count < GROUP) {
+            // Repeat the last sample, its differences are zero
+            memcpy(padded, src, count * sizeof(std::complex<int16_t>));
+            for (size_t n = count; n < GROUP; n++) {
+                padded[2 * n]     = src[2 * count - 2];
+                padded[2 * n + 1] = src[2 * count - 1];
+            }
+            src = padded;
+        }
+        prepare(src, prev, values, isa);
+        uint8_t* modes = position;
+        position += 2;
+        for (size_t c = 0; c < 2; c++) {
+            const uint8_t sample_width = bitWidth(values.samples_or[c]);
+            const uint8_t delta_width  = bitWidth(values.deltas_or[c]);
+            if (delta_width < sample_width) {
+                modes[c] = delta_width | RA_SC16Z_DELTA;
+                pack(values.deltas[c], delta_width, position, isa);
+                position += packedBytes(delta_width);
+            } else {
+                modes[c] = sample_width;
+                pack(values.samples[c], sample_width, position, isa);
+                position += packedBytes(sample_width);
+            }
+        }
+    }
+    ra_sc16z_header header;
+    header.magic   = RA_SC16Z_MAGIC;
+    header.samples = nsamps;
+    header.version = RA_SC16Z_VERSION;
+    header.flags   = 0;
+    header.bytes   = position - payload;
+    if (header.bytes >= raw_bytes) {
+        memcpy(payload, in, raw_bytes);
+        header.flags = RA_SC16Z_RAW;
+        header.bytes = raw_bytes;
+    }
+    memcpy(out, &header, sizeof(header));
+    return sizeof(header) + header.bytes;
+}
+
+size_t sc16BlockSize(const uint8_t* in, size_t nbytes)
+{
+    if (nbytes < sizeof(ra_sc16z_header)) {
+        return 0;
+    }
+    const ra_sc16z_header header = readHeader(in);
+    if (header.magic != RA_SC16Z_MAGIC || header.version != RA_SC16Z_VERSION) {
+        throw std::runtime_error("Not a compressed sc16 block");
+    }
+    if ((header.flags & RA_SC16Z_RAW)
+        && header.bytes != header.samples * sizeof(std::complex<int16_t>)) {
+        corrupt();
+    }
+    const size_t size = sizeof(header) + header.bytes;
+    return nbytes >= size ? size : 0;
+}
+
+size_t sc16BlockSamples(const uint8_t* in)
+{
+    return readHeader(in).samples;
+}
+
+void decompressSc16(const uint8_t* in, std::complex<int16_t>* out)
+{
+    const ra_sc16z_header header = readHeader(in);
+    const uint8_t* position      = in + sizeof(header);
+    const uint8_t* end           = position + header.bytes;
+    if (header.flags & RA_SC16Z_RAW) {
+        memcpy(out, position, header.bytes);
+        return;
+    }
+    int16_t prev[2] = {0, 0};
+    alignas(32) uint16_t values[GROUP];
+    for (size_t start = 0; start < header.samples; start += GROUP) {
+        const size_t count = std::min<size_t>(GROUP, header.samples - start);
+        if (end - position < 2) {
+            corrupt();
+        }
+        const uint8_t modes[2] = {position[0], position[1]};
+        position += 2;
+        for (size_t c = 0; c < 2; c++) {
+            const uint8_t width = modes[c] & RA_SC16Z_WIDTH;
+            if (width > 16 || size_t(end - position) < packedBytes(width)) {
+                corrupt();
+            }
+            unpackScalar(position, width, values);
+            position += packedBytes(width);
+            int16_t* dst = (int16_t*)(out + start) + c;
+            if (modes[c] & RA_SC16Z_DELTA) {
+                int16_t last = prev[c];
+                for (size_t n = 0; n < count; n++) {
+                    last       = int16_t(last + unzigzag(values[n]));
+                    dst[2 * n] = last;
+                }
+                // The padding repeats the last sample, its differences are zero
+                prev[c] = last;
+            } else {
+                for (size_t n = 0; n < count; n++) {
+                    dst[2 * n] = unzigzag(values[n]);
+                }
+                prev[c] = unzigzag(values[GROUP - 1]);
+            }
+        }
+    }
+}
+
+uint64_t decompressCapture(const std::string& src, const std::string& dst)
+{
+    std::ifstream infile(src, std::ifstream::binary);
+    if (!infile) {
+        throw std::runtime_error("Unable to open " + src);
+    }
+    std::ofstream outfile(dst, std::ofstream::binary);
+    if (!outfile) {
+        throw std::runtime_error("Unable to create " + dst);
+    }
+    std::vector<uint8_t> block(sizeof(ra_sc16z_header));
+    std::vector<std::complex<int16_t>> samples;
+    uint64_t total = 0;
+    while (infile.read((char*)block.data(), sizeof(ra_sc16z_header))) {
+        sc16BlockSize(block.data(), block.size()); // throws on a foreign header
+        const ra_sc16z_header header = readHeader(block.data());
+        block.resize(sizeof(header) + header.bytes);
+        if (!infile.read((char*)block.data() + sizeof(header), header.bytes)
+            || sc16BlockSize(block.data(), block.size()) == 0) {
+            std::cerr << src << " ends in a truncated block, it is dropped" << std::endl;
+            break;
+        }
+        samples.resize(header.samples);
+        decompressSc16(block.data(), samples.data());
+        outfile.write(
+            (const char*)samples.data(), samples.size() * sizeof(std::complex<int16_t>));
+        total += samples.size();
+    }
+    if (!outfile) {
+        throw std::runtime_error("Unable to write " + dst);
+    }
+    return total;
+}
@@ -0,0 +1,93 @@
+//
+// Copyright 2021-2022 Ettus Research, a National Instruments Brand
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+//
+
+#ifndef SC16CODEC_H
+#define SC16CODEC_H
+
+#include "SampleConvert.hpp"
+#include <complex>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#define RA_SC16Z_MAGIC 0x5241535a /* "RASZ" */
+#define RA_SC16Z_VERSION 1
+#define RA_SC16Z_RAW 0x1
+#define RA_SC16Z_GROUP 256
+
+/**
+ * @brief Header of every compressed block. A compressed capture is a sequence of
+ *  blocks, each decodable on its own. Unless the block is RA_SC16Z_RAW (samples stored
+ *  as is because they did not compress), the payload holds one group per
+ *  RA_SC16Z_GROUP samples, the last one padded with its final sample. A group is a
+ *  mode byte for I and one for Q, then the I and the Q values of the group bit packed
+ *  at the width of their mode.
+ *
+ *  The mode byte holds the width in bits (0 to 16) and RA_SC16Z_DELTA when the values
+ *  are differences from the previous sample of the block rather than the samples.
+ *  Values are zigzag encoded, so small negative numbers have small widths. The 256
+ *  values of a group are packed in 16 interleaved lanes, value n in lane n % 16, each
+ *  lane taking one 16 bit word of every 16 * width bits, so the packing is vertical
+ *  SIMD and the groups of any width are whole words.
+ */
+struct ra_sc16z_header
+{
+    uint32_t magic;
+    uint32_t samples;
+    uint32_t bytes; /* payload following the header */
+    uint16_t version;
+    uint16_t flags;
+};
+
+#define RA_SC16Z_DELTA 0x80
+#define RA_SC16Z_WIDTH 0x1f
+
+/**
+ * @brief Largest block compressSc16() writes for nsamps samples, header included.
+ */
+size_t sc16CompressBound(size_t nsamps);
+
+/**
+ * @brief Compresses nsamps samples into one block at out, which holds at least
+ *  sc16CompressBound(nsamps) bytes. Every group is packed as samples or as
+ *  differences, whichever is narrower, so noise dominated captures shrink by the
+ *  unused upper bits and oversampled ones by their correlation. Lossless.
+ *
+ * @return size_t bytes written, header included
+ */
+size_t compressSc16(const std::complex<int16_t>* in,
+    size_t nsamps,
+    uint8_t* out,
+    ConvertIsa isa = bestConvertIsa());
+
+/**
+ * @brief Checks the block header at in, nbytes being what is available.
+ *
+ * @return size_t the block size including the header, 0 if in holds less than a
+ *  block. Throws on a corrupt header.
+ */
+size_t sc16BlockSize(const uint8_t* in, size_t nbytes);
+
+/**
+ * @brief Samples of the block at in, valid once sc16BlockSize() accepted it.
+ */
+size_t sc16BlockSamples(const uint8_t* in);
+
+/**
+ * @brief Decodes the block at in, which sc16BlockSize() accepted, into out, which
+ *  holds sc16BlockSamples(in) samples.
+ */
+void decompressSc16(const uint8_t* in, std::complex<int16_t>* out);
+
+/**
+ * @brief Expands the compressed capture at src into the plain sc16 capture dst, block
+ *  by block.
+ *
+ * @return uint64_t samples written
+ */
+uint64_t decompressCapture(const std::string& src, const std::string& dst);
+
+#endif
@@ -0,0 +1,517 @@
+//
+// Copyright 2021-2022 Ettus Research, a National Instruments Brand
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+//
+
+#include "Shard.hpp"
+#include <fcntl.h>
+#include <linux/mempolicy.h>
+#include <poll.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+namespace {
+std::string readSysfs(const std::string& path)
+{
+    std::ifstream file(path);
+    std::string line;
+    std::getline(file, line);
+    return line;
+}
+
+std::vector<std::string> splitWords(const std::string& text)
+{
+    std::istringstream in(text);
+    std::vector<std::string> words;
+    std::string word;
+    while (in >> word) {
+        words.push_back(word);
+    }
+    return words;
+}
+
+/**
+ * @brief Reads one line from fd without the newline, false on EOF or error.
+ */
+bool readLine(int fd, std::string& line)
+{
+    line.clear();
+    char c;
+    while (true) {
+        const ssize_t n = read(fd, &c, 1);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        if (c == '\n') {
+            return true;
+        }
+        line += c;
+    }
+}
+
+bool writeAll(int fd, const std::string& text)
+{
+    size_t written = 0;
+    while (written < text.size()) {
+        const ssize_t n = write(fd, text.data() + written, text.size() - written);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        written += n;
+    }
+    return true;
+}
+
+/**
+ * @brief path with .shard<shard> inserted before its extension.
+ */
+std::string shardPath(const std::string& path, size_t shard)
+{
+    const std::string suffix = ".shard" + std::to_string(shard);
+    const size_t slash       = path.find_last_of('/');
+    const size_t dot         = path.find_last_of('.');
+    if (dot == std::string::npos or (slash != std::string::npos and dot < slash)) {
+        return path + suffix;
+    }
+    return path.substr(0, dot) + suffix + path.substr(dot);
+}
+} // namespace
+
+ShardSync waitForShardSync(int fd)
+{
+    if (not writeAll(fd, "ready\n")) {
+        throw std::runtime_error(
+            std::string("Unable to reach the shard coordinator: ") + strerror(errno));
+    }
+    std::string line;
+    if (not readLine(fd, line)) {
+        throw std::runtime_error("The shard coordinator closed the connection");
+    }
+    ShardSync sync;
+    std::string command;
+    std::istringstream in(line);
+    if (not(in >> command >> sync.epoch >> sync.start) or command != "sync") {
+        throw std::runtime_error(
+            "Unexpected message from the shard coordinator: " + line);
+    }
+    return sync;
+}
+
+double hostUnixTime()
+{
+    return std::chrono::duration<double>(
+        std::chrono::system_clock::now().time_since_epoch())
+        .count();
+}
+
+void sleepUntilHostTime(double unix_s)
+{
+    std::this_thread::sleep_until(std::chrono::system_clock::time_point(
+        std::chrono::duration_cast<std::chrono::system_clock::duration>(
+            std::chrono::duration<double>(unix_s))));
+}
+
+std::vector<int> parseSysfsList(const std::string& list)
+{
+    std::vector<int> values;
+    std::istringstream in(list);
+    std::string range;
+    while (std::getline(in, range, ',')) {
+        if (range.empty()) {
+            continue;
+        }
+        const size_t dash = range.find('-');
+        const int first   = std::stoi(range.substr(0, dash));
+        const int last =
+            (dash == std::string::npos) ? first : std::stoi(range.substr(dash + 1));
+        for (int value = first; value <= last; value++) {
+            values.push_back(value);
+        }
+    }
+    return values;
+}
+
+ShardCoordinator::ShardCoordinator(const ShardSettings& settings)
+    : settings(settings)
+    , shard_addresses(splitAddresses(settings.addresses, settings.shards))
+    , online_nodes(parseSysfsList(readSysfs("/sys/devices/system/node/online")))
+{
+}
+
+ShardCoordinator::~ShardCoordinator()
+{
+    // Only left running when the run failed. Workers still waiting for the time base
+    // see the socket close and exit, the others are interrupted
+    interrupt();
+    for (auto& worker : workers) {
+        if (worker.fd >= 0) {
+            close(worker.fd);
+        }
+    }
+    for (auto& worker : workers) {
+        if (worker.running) {
+            waitpid(worker.pid, nullptr, 0);
+        }
+    }
+}
+
+std::vector<std::vector<std::string>> ShardCoordinator::splitAddresses(
+    const std::vector<std::string>& addresses, size_t shards)
+{
+    if (shards == 0 or shards > addresses.size()) {
+        throw std::runtime_error("Cannot split " + std::to_string(addresses.size())
+                                 + " addresses into " + std::to_string(shards)
+                                 + " shards");
+    }
+    std::vector<std::vector<std::string>> groups(shards);
+    for (size_t shard = 0; shard < shards; shard++) {
+        groups[shard].assign(addresses.begin() + shard * addresses.size() / shards,
+            addresses.begin() + (shard + 1) * addresses.size() / shards);
+    }
+    return groups;
+}
+
+int ShardCoordinator::numaNode(size_t shard) const
+{
+    if (shard < settings.numa_nodes.size()) {
+        return settings.numa_nodes[shard];
+    }
+    if (online_nodes.empty()) {
+        return -1;
+    }
+    return online_nodes[shard % online_nodes.size()];
+}
+
+std::vector<std::string> ShardCoordinator::workerArgs(size_t shard) const
+{
+    std::vector<std::string> args = {settings.worker};
+    args.insert(args.end(), settings.worker_args.begin(), settings.worker_args.end());
+    // Command line options take precedence over the configuration file
+    for (const auto& address : shard_addresses[shard]) {
+        args.push_back("--address");
+        args.push_back(address);
+    }
+    args.push_back("--rx-file");
+    args.push_back("shard" + std::to_string(shard) + "_" + settings.rx_file);
+    args.push_back("--metrics");
+    args.push_back("csv");
+    args.push_back("--metrics-file");
+    args.push_back(workers[shard].metrics_path);
+    args.push_back("--metrics-interval");
+    args.push_back(std::to_string(settings.metrics_interval));
+    if (shard < settings.shard_args.size()) {
+        const std::vector<std::string> extra = splitWords(settings.shard_args[shard]);
+        args.insert(args.end(), extra.begin(), extra.end());
+    }
+    return args;
+}
+
+void ShardCoordinator::start()
+{
+    for (size_t shard = 0; shard < shard_addresses.size(); shard++) {
+        int fds[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) != 0) {
+            throw std::runtime_error(
+                std::string("Unable to create the shard socket: ") + strerror(errno));
+        }
+        workers.emplace_back();
+        Worker& worker      = workers.back();
+        worker.fd           = fds[0];
+        worker.numa_node    = numaNode(shard);
+        worker.metrics_path = shardPath(
+            settings.metrics_file.empty() ? "metrics.csv" : settings.metrics_file, shard);
+        // The reporter appends, a previous run would be read as this one
+        std::remove(worker.metrics_path.c_str());
+
+        std::vector<std::string> args = workerArgs(shard);
+        args.push_back("--shard-fd");
+        args.push_back(std::to_string(fds[1]));
+        std::vector<char*> argv;
+        for (auto& arg : args) {
+            argv.push_back(&arg[0]);
+        }
+        argv.push_back(nullptr);
+
+        // Masks are prepared before fork, the child only makes system calls
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        const size_t mask_bits = sizeof(unsigned long) * CHAR_BIT;
+        std::vector<unsigned long> nodes;
+        if (worker.numa_node >= 0) {
+            const std::vector<int> node_cpus = parseSysfsList(
+                readSysfs("/sys/devices/system/node/node"
+                          + std::to_string(worker.numa_node) + "/cpulist"));
+            if (node_cpus.empty()) {
+                throw std::runtime_error(
+                    "NUMA node " + std::to_string(worker.numa_node) + " has no CPUs");
+            }
+            for (const int cpu : node_cpus) {
+                CPU_SET(cpu, &cpus);
+            }
+            nodes.resize(worker.numa_node / mask_bits + 1);
+            nodes[worker.numa_node / mask_bits] |= 1UL << (worker.numa_node % mask_bits);
+        }
+
+        const pid_t pid = fork();
+        if (pid < 0) {
+            throw std::runtime_error(
+                std::string("Unable to start a shard: ") + strerror(errno));
+        }
+        if (pid == 0) {
+            setpgid(0, 0);
+            fcntl(fds[1], F_SETFD, fcntl(fds[1], F_GETFD) & ~FD_CLOEXEC);
+            if (worker.numa_node >= 0) {
+                // Both survive exec, the worker allocates on its node from the start
+                if (sched_setaffinity(0, sizeof(cpus), &cpus) != 0) {
+                    perror("sched_setaffinity");
+                }
+                if (syscall(SYS_set_mempolicy,
+                        MPOL_BIND,
+                        nodes.data(),
+                        nodes.size() * mask_bits + 1)
+                    != 0) {
+                    perror("set_mempolicy");
+                }
+            }
+            execvp(argv[0], argv.data());
+            perror(argv[0]);
+            _exit(127);
+        }
+        close(fds[1]);
+        worker.pid     = pid;
+        worker.running = true;
+        std::cout << "Shard " << shard << ": pid " << pid << ", NUMA node "
+                  << worker.numa_node << ", addresses";
+        for (const auto& address : shard_addresses[shard]) {
+            std::cout << " " << address;
+        }
+        std::cout << std::endl;
+    }
+}
+
+ShardSync ShardCoordinator::synchronize()
+{
+    std::vector<bool> ready(workers.size(), false);
+    size_t num_ready = 0;
+    while (num_ready < workers.size()) {
+        std::vector<pollfd> fds;
+        std::vector<size_t> shards;
+        for (size_t shard = 0; shard < workers.size(); shard++) {
+            if (not ready[shard]) {
+                fds.push_back({workers[shard].fd, POLLIN, 0});
+                shards.push_back(shard);
+            }
+        }
+        if (poll(fds.data(), fds.size(), -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw std::runtime_error(std::string("poll: ") + strerror(errno));
+        }
+        for (size_t i = 0; i < fds.size(); i++) {
+            if (fds[i].revents == 0) {
+                continue;
+            }
+            std::string line;
+            if (not readLine(fds[i].fd, line) or line != "ready") {
+                throw std::runtime_error("Shard " + std::to_string(shards[i])
+                                         + " exited before synchronizing");
+            }
+            ready[shards[i]] = true;
+            num_ready++;
+        }
+    }
+    // Whole seconds, so the epoch is a PPS edge and the start time is aligned to one
+    ShardSync sync;
+    sync.epoch = std::floor(hostUnixTime() + settings.sync_margin) + 1;
+    sync.start = sync.epoch + std::max(1.0, std::ceil(settings.start_delay));
+    std::ostringstream message;
+    message << std::fixed << std::setprecision(0) << "sync " << sync.epoch << " "
+            << sync.start << "\n";
+    for (size_t shard = 0; shard < workers.size(); shard++) {
+        if (not writeAll(workers[shard].fd, message.str())) {
+            throw std::runtime_error(
+                "Shard " + std::to_string(shard) + " exited before synchronizing");
+        }
+    }
+    std::cout << std::fixed << std::setprecision(0) << "Shards set their time at epoch "
+              << sync.epoch << " and start at " << sync.start << std::endl;
+    return sync;
+}
+
+int ShardCoordinator::wait()
+{
+    const auto interval =
+        std::chrono::microseconds(int64_t(settings.metrics_interval * 1e6));
+    auto next_report = std::chrono::steady_clock::now() + interval;
+    size_t running   = workers.size();
+    while (running > 0) {
+        for (size_t shard = 0; shard < workers.size(); shard++) {
+            Worker& worker = workers[shard];
+            int status     = 0;
+            if (not worker.running
+                or waitpid(worker.pid, &status, WNOHANG) != worker.pid) {
+                continue;
+            }
+            worker.running     = false;
+            worker.exit_status = WIFEXITED(status) ? WEXITSTATUS(status)
+                                                   : 128 + WTERMSIG(status);
+            running--;
+            std::cout << "Shard " << shard << " exited with status "
+                      << worker.exit_status << std::endl;
+        }
+        if (std::chrono::steady_clock::now() >= next_report) {
+            for (auto& worker : workers) {
+                readMetrics(worker);
+            }
+            reportMetrics();
+            next_report += interval;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+    for (auto& worker : workers) {
+        readMetrics(worker);
+    }
+    printTotals();
+    return std::count_if(workers.begin(), workers.end(), [](const Worker& worker) {
+        return worker.exit_status != 0;
+    });
+}
+
+void ShardCoordinator::interrupt()
+{
+    for (const auto& worker : workers) {
+        if (worker.running) {
+            kill(worker.pid, SIGINT);
+        }
+    }
+}
+
+void ShardCoordinator::readMetrics(Worker& worker)
+{
+    std::ifstream file(worker.metrics_path);
+    if (not file.good()) {
+        return;
+    }
+    file.seekg(worker.metrics_offset);
+    const std::string text((std::istreambuf_iterator<char>(file)),
+        std::istreambuf_iterator<char>());
+    // Only whole lines, the worker may be halfway through a report
+    const size_t end = text.find_last_of('\n');
+    if (end == std::string::npos) {
+        return;
+    }
+    worker.metrics_offset += end + 1;
+    std::istringstream lines(text.substr(0, end));
+    std::string line;
+    while (std::getline(lines, line)) {
+        std::vector<std::string> fields;
+        std::istringstream in(line);
+        std::string field;
+        while (std::getline(in, field, ',')) {
+            fields.push_back(field);
+        }
+        if (fields.size() < 3) {
+            continue;
+        }
+        if (fields[0] == "time_s") {
+            worker.metrics_columns = fields;
+            continue;
+        }
+        if (fields[2] != "total" or fields.size() != worker.metrics_columns.size()) {
+            continue;
+        }
+        std::map<std::string, double>& total = worker.totals[fields[1]];
+        for (size_t i = 3; i < fields.size(); i++) {
+            total[worker.metrics_columns[i]] = std::stod(fields[i]);
+        }
+    }
+}
+
+void ShardCoordinator::reportMetrics() const
+{
+    std::set<std::string> kinds;
+    for (const auto& worker : workers) {
+        for (const auto& total : worker.totals) {
+            kinds.insert(total.first);
+        }
+    }
+    for (const auto& kind : kinds) {
+        double rate = 0, overflows = 0;
+        std::ostringstream shards;
+        shards << std::fixed << std::setprecision(1);
+        for (size_t shard = 0; shard < workers.size(); shard++) {
+            const auto total = workers[shard].totals.find(kind);
+            if (total == workers[shard].totals.end()) {
+                continue;
+            }
+            const double shard_rate = total->second.at("samples_per_s");
+            rate += shard_rate;
+            overflows += total->second.at("overflows");
+            shards << (shards.tellp() > 0 ? ", " : "") << shard << ": "
+                   << shard_rate / 1e6;
+        }
+        std::cout << std::fixed << std::setprecision(1) << "Shards " << kind << ": "
+                  << rate / 1e6 << " Msps (" << shards.str() << "), "
+                  << std::setprecision(0) << overflows << " overflows" << std::endl;
+    }
+}
+
+void ShardCoordinator::printTotals() const
+{
+    const std::vector<std::string> columns = {
+        "samples", "overflows", "sequence_errors", "timeouts"};
+    std::cout << std::endl
+              << std::left << std::setw(8) << "shard" << std::setw(8) << "kind";
+    for (const auto& column : columns) {
+        std::cout << std::right << std::setw(18) << column;
+    }
+    std::cout << std::endl;
+    std::map<std::string, std::map<std::string, double>> all;
+    for (size_t shard = 0; shard < workers.size(); shard++) {
+        for (const auto& total : workers[shard].totals) {
+            std::cout << std::left << std::setw(8) << shard << std::setw(8)
+                      << total.first;
+            for (const auto& column : columns) {
+                const double value = total.second.at(column);
+                all[total.first][column] += value;
+                std::cout << std::right << std::fixed << std::setprecision(0)
+                          << std::setw(18) << value;
+            }
+            std::cout << std::endl;
+        }
+    }
+    for (const auto& total : all) {
+        std::cout << std::left << std::setw(8) << "all" << std::setw(8) << total.first;
+        for (const auto& column : columns) {
+            std::cout << std::right << std::fixed << std::setprecision(0)
+                      << std::setw(18) << total.second.at(column);
+        }
+        std::cout << std::endl;
+    }
+}
@@ -0,0 +1,144 @@
+//
+// Copyright 2021-2022 Ettus Research, a National Instruments Brand
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+//
+
+#ifndef SHARD_H
+#define SHARD_H
+
+#include <sys/types.h>
+#include <map>
+#include <string>
+#include <vector>
+
+/**
+ * @brief Common time base a ShardCoordinator hands its workers: the device time set
+ *  at the PPS edge of host UNIX time epoch, and the PPS aligned start time.
+ */
+struct ShardSync
+{
+    double epoch = 0;
+    double start = 0;
+};
+
+/**
+ * @brief Worker side of the coordinator socket: reports the worker ready to
+ *  synchronize on fd and blocks until the coordinator answers with the time base.
+ *  Throws std::runtime_error if the coordinator went away.
+ */
+ShardSync waitForShardSync(int fd);
+
+/**
+ * @brief Host UNIX time in seconds, the clock the shard epochs are given in.
+ */
+double hostUnixTime();
+
+/**
+ * @brief Sleeps until host UNIX time unix_s.
+ */
+void sleepUntilHostTime(double unix_s);
+
+/**
+ * @brief Parses a sysfs list such as "0-3,8,10-11".
+ */
+std::vector<int> parseSysfsList(const std::string& list);
+
+struct ShardSettings
+{
+    // Worker executable and the arguments every worker gets, e.g. --cfgFile
+    std::string worker;
+    std::vector<std::string> worker_args;
+    // Device addresses, split in order over the shards
+    std::vector<std::string> addresses;
+    size_t shards = 2;
+    // NUMA node of every shard, -1 for unbound. Shard i defaults to node i modulo
+    // the online nodes
+    std::vector<int> numa_nodes;
+    // Extra arguments of every shard, whitespace separated, e.g. its rx-file-location
+    std::vector<std::string> shard_args;
+    // Seconds from the last worker ready to the epoch
+    double sync_margin = 2;
+    // Seconds from the epoch to the start time, rounded up to whole seconds
+    double start_delay = 2;
+    // Per worker CSV metrics are written next to this file as <stem>.shard<i><ext>,
+    // metrics.csv if empty
+    std::string metrics_file;
+    double metrics_interval = 1;
+    // Prefix of the rx files of shard i is shard<i>_ so shards never share a file
+    std::string rx_file = "test.dat";
+};
+
+/**
+ * @brief Runs a sharded capture: one worker process per group of addresses, each
+ *  bound to the CPUs and memory of one NUMA node so its RX threads, buffers and UHD
+ *  I/O stay next to the NIC and RAID of that node. Every worker runs an unmodified
+ *  example with --shard-fd; in RefArch::syncAllDevices() it reports ready and waits
+ *  for the common epoch and start time. The coordinator follows the CSV metrics of
+ *  every worker and prints the totals of all shards.
+ */
+class ShardCoordinator
+{
+public:
+    explicit ShardCoordinator(const ShardSettings& settings);
+    ~ShardCoordinator();
+    ShardCoordinator(const ShardCoordinator&) = delete;
+    ShardCoordinator& operator=(const ShardCoordinator&) = delete;
+
+    /**
+     * @brief Addresses of every shard, contiguous groups in order.
+     */
+    static std::vector<std::vector<std::string>> splitAddresses(
+        const std::vector<std::string>& addresses, size_t shards);
+    /**
+     * @brief Starts the workers, each in its own process group so Ctrl+C reaches
+     *  them through interrupt() only once.
+     */
+    void start();
+    /**
+     * @brief Waits until every worker is ready to synchronize, then sends all of them
+     *  the same epoch and start time. Throws std::runtime_error if a worker exits
+     *  first.
+     */
+    ShardSync synchronize();
+    /**
+     * @brief Reports the metrics of the shards every metrics interval until all
+     *  workers exited, then prints the totals.
+     *
+     * @return int number of workers that failed
+     */
+    int wait();
+    /**
+     * @brief Forwards SIGINT to every running worker, async-signal-safe.
+     */
+    void interrupt();
+
+private:
+    struct Worker
+    {
+        pid_t pid       = -1;
+        int fd          = -1;
+        int numa_node   = -1;
+        int exit_status = 0;
+        bool running    = false;
+        std::string metrics_path;
+        // Bytes of the metrics file parsed so far
+        size_t metrics_offset = 0;
+        std::vector<std::string> metrics_columns;
+        // Last total row of every kind, by column name
+        std::map<std::string, std::map<std::string, double>> totals;
+    };
+
+    std::vector<std::string> workerArgs(size_t shard) const;
+    int numaNode(size_t shard) const;
+    void readMetrics(Worker& worker);
+    void reportMetrics() const;
+    void printTotals() const;
+
+    ShardSettings settings;
+    std::vector<std::vector<std::string>> shard_addresses;
+    std::vector<int> online_nodes;
+    std::vector<Worker> workers;
+};
+
+#endif
@@ -0,0 +1,128 @@
+/*
+ * Copyright 2021-2022 Ettus Research, a National Instruments Brand
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+/*
+ * C API for the shared memory ring used by Arch_pipe (PipeTransport = shm).
+ *
+ * Each channel has its own single producer, single consumer ring in POSIX shared
+ * memory (/dev/shm/<name>). The producer (Arch_pipe) creates the ring, the consumer
+ * (MATLAB MEX, Python ctypes, ...) opens it by name. The data area is mapped twice
+ * back to back, so every span returned by ra_ring_acquire_read() is contiguous and
+ * can be used in place without copying.
+ *
+ * Typical consumer loop:
+ *      ra_shared_ring* ring = ra_ring_open("refarch_ring_0");
+ *      ra_ring_request(ring, num_of_samples);
+ *      while (remaining > 0) {
+ *          const void* samples;
+ *          int64_t n = ra_ring_acquire_read(ring, &samples, 4, 1000);
+ *          ... use n bytes of samples (ra_ring_sample_format()) at samples ...
+ *          ra_ring_release_read(ring, n);
+ *      }
+ *      ra_ring_close(ring);
+ */
+
+#ifndef SHARED_RING_H
+#define SHARED_RING_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define RA_RING_MAGIC 0x52415247 /* "RARG" */
+/* 2: sample_format replaced padding, version 1 consumers would read it as 0 (sc16) */
+#define RA_RING_VERSION 2
+#define RA_RING_HEADER_SIZE 4096
+
+/* Format of the samples in the data area (Arch_pipe PipeFormat) */
+#define RA_RING_FORMAT_SC16 0 /* interleaved int16 I/Q, 4 bytes per sample */
+#define RA_RING_FORMAT_FC32 1 /* interleaved float I/Q, 8 bytes per sample */
+#define RA_RING_FORMAT_FC16 2 /* interleaved IEEE 754 half I/Q, 4 bytes per sample */
+
+/*
+ * Layout of the first page of the shared memory object. Counters are only accessed
+ * with atomic operations. head and tail count bytes since creation, the position in
+ * the data area is counter % capacity. The *_seq fields are futex words.
+ */
+typedef struct ra_ring_header
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t capacity; /* bytes in the data area, a multiple of the page size */
+    uint64_t data_offset; /* offset of the data area, RA_RING_HEADER_SIZE */
+    uint32_t closed; /* set by the producer when no more data will be written */
+    uint32_t sample_format; /* RA_RING_FORMAT_*, set before the magic is published */
+    uint32_t pad0[8];
+
+    /* Consumer to producer: number of samples requested */
+    uint32_t request_seq;
+    uint32_t request_waiters;
+    int32_t request_samples;
+    uint32_t pad1[13];
+
+    /* Producer side */
+    uint64_t head;
+    uint32_t data_seq;
+    uint32_t data_waiters;
+    uint32_t pad2[12];
+
+    /* Consumer side */
+    uint64_t tail;
+    uint32_t space_seq;
+    uint32_t space_waiters;
+    uint32_t pad3[12];
+} ra_ring_header;
+
+typedef struct ra_shared_ring ra_shared_ring;
+
+/*
+ * Creates (or recreates) an RA_RING_FORMAT_SC16 ring. capacity is rounded up to the
+ * page size.
+ */
+ra_shared_ring* ra_ring_create(const char* name, uint64_t capacity);
+/*
+ * Opens a ring created by another process. Returns NULL without printing if it does
+ * not exist (errno ENOENT) or is still being created (errno EAGAIN), so consumers can
+ * poll until the producer is up. A ring of another RA_RING_VERSION fails with EPROTO.
+ * Both calls fail with EINVAL on hosts whose page size does not divide
+ * RA_RING_HEADER_SIZE.
+ */
+ra_shared_ring* ra_ring_open(const char* name);
+/* Unmaps the ring. The creator also removes it from /dev/shm. */
+void ra_ring_close(ra_shared_ring* ring);
+uint64_t ra_ring_capacity(const ra_shared_ring* ring);
+/* RA_RING_FORMAT_* of the samples in the ring. */
+uint32_t ra_ring_sample_format(const ra_shared_ring* ring);
+
+/* Consumer: asks the producer for num_of_samples samples, 0 ends the session. */
+void ra_ring_request(ra_shared_ring* ring, int32_t num_of_samples);
+/*
+ * Consumer: waits up to timeout_ms (-1 forever) for at least min_bytes readable bytes.
+ * Returns the number of contiguous readable bytes at *data, 0 on timeout or -1 if
+ * the producer closed the ring and everything has been read.
+ */
+int64_t ra_ring_acquire_read(
+    ra_shared_ring* ring, const void** data, uint64_t min_bytes, int timeout_ms);
+/* Consumer: hands nbytes back to the producer. */
+void ra_ring_release_read(ra_shared_ring* ring, uint64_t nbytes);
+
+/* Producer: waits for a new request. Returns 1 and sets *num_of_samples, 0 on timeout */
+int ra_ring_wait_request(ra_shared_ring* ring, int32_t* num_of_samples, int timeout_ms);
+/* Producer: same as the read side, for writable bytes. */
+int64_t ra_ring_acquire_write(
+    ra_shared_ring* ring, void** data, uint64_t min_bytes, int timeout_ms);
+/* Producer: publishes nbytes written at the span from ra_ring_acquire_write(). */
+void ra_ring_commit_write(ra_shared_ring* ring, uint64_t nbytes);
+/* Producer: no more data will be written. */
+void ra_ring_mark_closed(ra_shared_ring* ring);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
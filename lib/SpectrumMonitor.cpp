@@ -0,0 +1,360 @@
+//
+// Copyright 2021-2022 Ettus Research, a National Instruments Brand
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+//
+
+#include "SpectrumMonitor.hpp"
+#include "SampleConvert.hpp"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <type_traits>
+#if defined(__x86_64__) || defined(__i386__)
+#    include <immintrin.h>
+#    define RA_MONITOR_X86 1
+#endif
+
+namespace {
+struct BlockStats
+{
+    double sum_i = 0;
+    double sum_q = 0;
+    double power = 0;
+    double peak  = 0;
+};
+
+BlockStats blockStatsScalar(const float* values, size_t nsamps)
+{
+    BlockStats stats;
+    for (size_t n = 0; n < nsamps; n++) {
+        const float i      = values[2 * n];
+        const float q      = values[2 * n + 1];
+        const double power = double(i) * i + double(q) * q;
+        stats.sum_i += i;
+        stats.sum_q += q;
+        stats.power += power;
+        stats.peak = std::max(stats.peak, power);
+    }
+    return stats;
+}
+
+#ifdef RA_MONITOR_X86
+// Four samples per iteration, I in the even lanes and Q in the odd ones
+__attribute__((target("avx2"))) BlockStats blockStatsAvx2(
+    const float* values, size_t nsamps)
+{
+    __m256 sums  = _mm256_setzero_ps();
+    __m256 power = _mm256_setzero_ps();
+    __m256 peak  = _mm256_setzero_ps();
+    size_t n     = 0;
+    for (; n + 4 <= nsamps; n += 4) {
+        const __m256 v       = _mm256_loadu_ps(values + 2 * n);
+        const __m256 squares = _mm256_mul_ps(v, v);
+        // I^2 + Q^2 of each sample in both of its lanes
+        const __m256 magnitudes =
+            _mm256_add_ps(squares, _mm256_permute_ps(squares, 0xb1));
+        sums  = _mm256_add_ps(sums, v);
+        power = _mm256_add_ps(power, squares);
+        peak  = _mm256_max_ps(peak, magnitudes);
+    }
+    alignas(32) float lanes[3][8];
+    _mm256_store_ps(lanes[0], sums);
+    _mm256_store_ps(lanes[1], power);
+    _mm256_store_ps(lanes[2], peak);
+    BlockStats stats = blockStatsScalar(values + 2 * n, nsamps - n);
+    for (size_t lane = 0; lane < 8; lane += 2) {
+        stats.sum_i += lanes[0][lane];
+        stats.sum_q += lanes[0][lane + 1];
+        stats.power += double(lanes[1][lane]) + lanes[1][lane + 1];
+        stats.peak = std::max(stats.peak, double(lanes[2][lane]));
+    }
+    return stats;
+}
+#endif
+
+BlockStats blockStats(const std::complex<float>* samples, size_t nsamps)
+{
+#ifdef RA_MONITOR_X86
+    if (bestConvertIsa() != CONVERT_SCALAR) {
+        return blockStatsAvx2((const float*)samples, nsamps);
+    }
+#endif
+    return blockStatsScalar((const float*)samples, nsamps);
+}
+
+double powerDb(double power)
+{
+    return 10 * std::log10(std::max(power, 1e-20));
+}
+
+uint64_t monotonicNs(std::chrono::steady_clock::time_point time)
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(time.time_since_epoch())
+        .count();
+}
+} // namespace
+
+SpectrumMonitor::SpectrumMonitor(
+    size_t num_channels, double sample_rate, const MonitorSettings& settings)
+    : sample_rate(sample_rate)
+    , settings(settings)
+    , fft(settings.fft_size)
+    , window(hannWindow(settings.fft_size))
+    , work(settings.fft_size)
+{
+    if (settings.output != "console" && settings.output != "shm"
+        && settings.output != "both") {
+        throw std::runtime_error("Unknown monitor output " + settings.output);
+    }
+    if (settings.interval_s <= 0) {
+        throw std::runtime_error("Monitor interval must be positive");
+    }
+    for (size_t i = 0; i < num_channels; i++) {
+        channels.emplace_back(new Channel);
+        channels.back()->samples.resize(settings.fft_size);
+        channels.back()->spectrum.assign(settings.fft_size, float(powerDb(0)));
+    }
+}
+
+SpectrumMonitor::~SpectrumMonitor()
+{
+    stop();
+    if (snapshot != nullptr) {
+        munmap(snapshot, snapshot_size);
+        shm_unlink(("/" + settings.shm_name).c_str());
+    }
+}
+
+void SpectrumMonitor::start()
+{
+    if (monitor_thread.joinable()) {
+        return;
+    }
+    if (settings.output != "console" && snapshot == nullptr) {
+        openSnapshot();
+    }
+    stopping = false;
+    started  = std::chrono::steady_clock::now();
+    for (auto& channel : channels) {
+        channel->updated = started;
+    }
+    monitor_thread = std::thread([this]() { run(); });
+}
+
+void SpectrumMonitor::stop()
+{
+    if (!monitor_thread.joinable()) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(monitor_mutex);
+        stopping = true;
+    }
+    monitor_cv.notify_all();
+    monitor_thread.join();
+}
+
+void SpectrumMonitor::tap(
+    size_t channel, const std::complex<short>* samples, size_t nsamps)
+{
+    copyTap(channel, samples, nsamps);
+}
+
+void SpectrumMonitor::tap(
+    size_t channel, const std::complex<float>* samples, size_t nsamps)
+{
+    copyTap(channel, samples, nsamps);
+}
+
+void SpectrumMonitor::tap(
+    size_t channel, const std::complex<double>* samples, size_t nsamps)
+{
+    copyTap(channel, samples, nsamps);
+}
+
+template <typename samp_type>
+void SpectrumMonitor::copyTap(size_t channel, const samp_type* samples, size_t nsamps)
+{
+    if (channel >= channels.size()) {
+        return;
+    }
+    Channel& tapped = *channels[channel];
+    if (tapped.state.load(std::memory_order_acquire) != TAP_WANTED) {
+        return;
+    }
+    const size_t count       = std::min(nsamps, settings.fft_size - tapped.filled);
+    std::complex<float>* out = tapped.samples.data() + tapped.filled;
+    if (std::is_same<samp_type, std::complex<short>>::value) {
+        convertSc16ToFc32(
+            (const std::complex<int16_t>*)samples, out, count, 1.0f / 32768);
+    } else {
+        for (size_t n = 0; n < count; n++) {
+            out[n] = std::complex<float>(samples[n].real(), samples[n].imag());
+        }
+    }
+    tapped.filled += count;
+    if (tapped.filled == settings.fft_size) {
+        tapped.state.store(TAP_READY, std::memory_order_release);
+    }
+}
+
+ra_monitor_channel SpectrumMonitor::analyze(
+    const std::complex<float>* samples, float* spectrum_dbfs)
+{
+    const size_t size         = settings.fft_size;
+    const BlockStats stats    = blockStats(samples, size);
+    ra_monitor_channel result = {};
+    result.rms_dbfs           = powerDb(stats.power / size);
+    result.peak_dbfs          = powerDb(stats.peak);
+    result.dc_i               = stats.sum_i / size;
+    result.dc_q               = stats.sum_q / size;
+
+    for (size_t n = 0; n < size; n++) {
+        work[n] = samples[n] * window[n];
+    }
+    fft.forward(work.data());
+    // A full scale tone lands in one bin with magnitude size times the coherent gain
+    const double full_scale = 0.25 * double(size) * double(size);
+    size_t tone_bin         = 0;
+    double tone_power       = -1;
+    for (size_t k = 0; k < size; k++) {
+        const double power = std::norm(work[k]) / full_scale;
+        // Shift so the spectrum runs from -rate/2 to rate/2
+        spectrum_dbfs[(k + size / 2) % size] = float(powerDb(power));
+        // The DC offset leaks into the bins next to it through the window
+        const bool near_dc = k <= 1 || k >= size - 1;
+        if (!near_dc && power > tone_power) {
+            tone_power = power;
+            tone_bin   = k;
+        }
+    }
+    const double signed_bin =
+        tone_bin < size / 2 ? double(tone_bin) : double(tone_bin) - double(size);
+    result.tone_hz   = signed_bin * sample_rate / size;
+    result.tone_dbfs = powerDb(tone_power);
+    return result;
+}
+
+void SpectrumMonitor::run()
+{
+    const auto interval = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+        std::chrono::duration<double>(settings.interval_s));
+    auto next = std::chrono::steady_clock::now() + interval;
+    std::unique_lock<std::mutex> lock(monitor_mutex);
+    while (!monitor_cv.wait_until(lock, next, [this]() { return stopping; })) {
+        lock.unlock();
+        update();
+        lock.lock();
+        next += interval;
+    }
+}
+
+void SpectrumMonitor::update()
+{
+    const auto now = std::chrono::steady_clock::now();
+    for (auto& channel : channels) {
+        if (channel->state.load(std::memory_order_acquire) != TAP_READY) {
+            continue;
+        }
+        const uint64_t updates = channel->stats.updates;
+        channel->stats =
+            analyze(channel->samples.data(), channel->spectrum.data());
+        channel->stats.updates    = updates + 1;
+        channel->stats.updated_ns = monotonicNs(now);
+        channel->updated          = now;
+        // Hand the buffer back, the RX thread fills it again for the next interval
+        channel->filled = 0;
+        channel->state.store(TAP_WANTED, std::memory_order_release);
+    }
+    if (settings.output != "shm") {
+        printConsole();
+    }
+    if (snapshot != nullptr) {
+        writeSnapshot();
+    }
+}
+
+void SpectrumMonitor::printConsole()
+{
+    const auto now = std::chrono::steady_clock::now();
+    // A channel that has not filled one snapshot for this long stopped streaming
+    const double stale_s = std::max(1.0, 2 * settings.interval_s);
+    std::ostringstream out;
+    out << std::fixed << std::setprecision(2);
+    out << "[monitor " << std::chrono::duration<double>(now - started).count() << " s]"
+        << std::endl;
+    for (size_t i = 0; i < channels.size(); i++) {
+        const Channel& channel = *channels[i];
+        out << "  ch " << i << ": ";
+        if (std::chrono::duration<double>(now - channel.updated).count() > stale_s) {
+            out << "NO DATA" << std::endl;
+            continue;
+        }
+        if (channel.stats.updates == 0) {
+            out << "waiting" << std::endl;
+            continue;
+        }
+        const ra_monitor_channel& stats = channel.stats;
+        out << "rms " << stats.rms_dbfs << " dBFS, peak " << stats.peak_dbfs
+            << " dBFS, dc " << stats.dc_i << "/" << stats.dc_q << ", tone "
+            << stats.tone_hz / 1e6 << " MHz at " << stats.tone_dbfs << " dBFS";
+        if (stats.rms_dbfs < settings.min_dbfs) {
+            out << "  LOW POWER";
+        }
+        out << std::endl;
+    }
+    std::cout << out.str() << std::flush;
+}
+
+void SpectrumMonitor::openSnapshot()
+{
+    const std::string name = "/" + settings.shm_name;
+    snapshot_size = sizeof(ra_monitor_header)
+                    + channels.size() * sizeof(ra_monitor_channel)
+                    + channels.size() * settings.fft_size * sizeof(float);
+    shm_unlink(name.c_str());
+    const int shm_id = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0666);
+    if (shm_id < 0 || ftruncate(shm_id, snapshot_size) != 0) {
+        if (shm_id >= 0) {
+            close(shm_id);
+        }
+        throw std::runtime_error("Unable to create monitor snapshot " + name);
+    }
+    void* mapping =
+        mmap(nullptr, snapshot_size, PROT_READ | PROT_WRITE, MAP_SHARED, shm_id, 0);
+    close(shm_id);
+    if (mapping == MAP_FAILED) {
+        shm_unlink(name.c_str());
+        throw std::runtime_error("Unable to map monitor snapshot " + name);
+    }
+    snapshot              = (ra_monitor_header*)mapping;
+    snapshot->version     = RA_MONITOR_VERSION;
+    snapshot->channels    = channels.size();
+    snapshot->fft_size    = settings.fft_size;
+    snapshot->sample_rate = sample_rate;
+    __atomic_store_n(&snapshot->magic, RA_MONITOR_MAGIC, __ATOMIC_RELEASE);
+}
+
+void SpectrumMonitor::writeSnapshot()
+{
+    ra_monitor_channel* stats = (ra_monitor_channel*)(snapshot + 1);
+    float* spectra            = (float*)(stats + channels.size());
+    const uint64_t seq        = __atomic_load_n(&snapshot->seq, __ATOMIC_RELAXED);
+    __atomic_store_n(&snapshot->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    for (size_t i = 0; i < channels.size(); i++) {
+        stats[i] = channels[i]->stats;
+        memcpy(spectra + i * settings.fft_size,
+            channels[i]->spectrum.data(),
+            settings.fft_size * sizeof(float));
+    }
+    __atomic_store_n(&snapshot->seq, seq + 2, __ATOMIC_RELEASE);
+}
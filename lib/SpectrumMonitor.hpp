@@ -0,0 +1,128 @@
+//
+// Copyright 2021-2022 Ettus Research, a National Instruments Brand
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+//
+
+#ifndef SPECTRUMMONITOR_H
+#define SPECTRUMMONITOR_H
+
+#include "Fft.hpp"
+#include <atomic>
+#include <chrono>
+#include <complex>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define RA_MONITOR_MAGIC 0x52414d4e /* "RAMN" */
+#define RA_MONITOR_VERSION 1
+
+/**
+ * @brief Layout of the shared memory snapshot (/dev/shm/<monitor-shm-name>): the
+ *  header, one ra_monitor_channel per channel, then fft_size floats of dBFS spectrum
+ *  per channel, lowest frequency first. seq is odd while the monitor writes, readers
+ *  copy what they need and retry if seq changed or was odd.
+ */
+struct ra_monitor_header
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t channels;
+    uint32_t fft_size;
+    double sample_rate;
+    uint64_t seq;
+    uint64_t pad[4];
+};
+
+struct ra_monitor_channel
+{
+    double rms_dbfs;
+    double peak_dbfs;
+    double dc_i;
+    double dc_q;
+    double tone_hz; /* strongest bin other than DC */
+    double tone_dbfs;
+    uint64_t updates;
+    uint64_t updated_ns; /* CLOCK_MONOTONIC of the last update, 0 before the first */
+};
+
+struct MonitorSettings
+{
+    double interval_s = 0.5;
+    // Samples per snapshot and FFT size, a power of two
+    size_t fft_size = 1024;
+    // "console", "shm" or "both"
+    std::string output   = "console";
+    std::string shm_name = "refarch_monitor";
+    // Channels below this RMS power are flagged, a disconnected cable or dead LO
+    double min_dbfs = -60;
+};
+
+/**
+ * @brief Power and spectrum monitor of every RX channel while capturing. The RX
+ *  threads call tap() with each block they receive. Every interval the monitor
+ *  thread asks each channel for fft_size contiguous samples, which the next tap()
+ *  calls copy (converted to complex float), so the RX threads only pay for one
+ *  atomic load per block in between. The monitor thread computes the RMS power, peak,
+ *  DC offset and a Hann windowed spectrum of each snapshot and prints them, writes
+ *  them to the shared memory snapshot, or both. Channels below min_dbfs and channels
+ *  that stopped delivering samples are flagged.
+ */
+class SpectrumMonitor
+{
+public:
+    SpectrumMonitor(
+        size_t num_channels, double sample_rate, const MonitorSettings& settings);
+    ~SpectrumMonitor();
+    void start();
+    void stop();
+    void tap(size_t channel, const std::complex<short>* samples, size_t nsamps);
+    void tap(size_t channel, const std::complex<float>* samples, size_t nsamps);
+    void tap(size_t channel, const std::complex<double>* samples, size_t nsamps);
+
+private:
+    enum TapState { TAP_WANTED, TAP_READY };
+    struct alignas(64) Channel
+    {
+        // Owned by the RX thread while TAP_WANTED, by the monitor thread when READY
+        std::atomic<int> state{TAP_WANTED};
+        size_t filled = 0;
+        std::vector<std::complex<float>> samples;
+        ra_monitor_channel stats = {};
+        std::vector<float> spectrum;
+        std::chrono::steady_clock::time_point updated;
+    };
+    template <typename samp_type>
+    void copyTap(size_t channel, const samp_type* samples, size_t nsamps);
+    /**
+     * @brief Statistics of fft_size samples scaled to +/-1.0. spectrum_dbfs receives
+     *  fft_size bins, lowest frequency first, 0 dBFS being a full scale tone.
+     */
+    ra_monitor_channel analyze(const std::complex<float>* samples, float* spectrum_dbfs);
+    void run();
+    void update();
+    void printConsole();
+    void openSnapshot();
+    void writeSnapshot();
+
+    std::vector<std::unique_ptr<Channel>> channels;
+    double sample_rate;
+    MonitorSettings settings;
+    Fft fft;
+    std::vector<float> window;
+    std::vector<std::complex<float>> work;
+    std::chrono::steady_clock::time_point started;
+    ra_monitor_header* snapshot = nullptr;
+    size_t snapshot_size        = 0;
+    bool stopping               = false;
+    std::mutex monitor_mutex;
+    std::condition_variable monitor_cv;
+    std::thread monitor_thread;
+};
+
+#endif
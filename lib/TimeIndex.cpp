@@ -0,0 +1,175 @@
+//
+// Copyright 2021-2022 Ettus Research, a National Instruments Brand
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+//
+
+#include "TimeIndex.hpp"
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+namespace {
+/**
+ * @brief Sample periods from the start of the index to full_secs + frac_secs, the
+ *  whole and fractional seconds are subtracted apart to keep the precision of the
+ *  fraction.
+ */
+int64_t ticksSince(
+    const ra_time_index_header& header, int64_t full_secs, double frac_secs)
+{
+    return std::llround(double(full_secs - header.start_full_secs) * header.sample_rate
+                        + (frac_secs - header.start_frac_secs) * header.sample_rate);
+}
+
+template <typename T>
+void readEntries(std::ifstream& file, std::vector<T>& entries, uint64_t count)
+{
+    entries.resize(count);
+    file.read((char*)entries.data(), count * sizeof(T));
+    if (!file) {
+        throw std::runtime_error("Truncated time index");
+    }
+}
+} // namespace
+
+TimeIndexWriter::TimeIndexWriter(
+    const std::string& path, double sample_rate, size_t sample_size, size_t interval)
+    : file(path, std::ofstream::binary)
+{
+    if (!file) {
+        throw std::runtime_error("Unable to create time index " + path);
+    }
+    header.magic       = RA_TIME_INDEX_MAGIC;
+    header.version     = RA_TIME_INDEX_VERSION;
+    header.sample_size = sample_size;
+    header.interval    = std::max<size_t>(interval, 1);
+    header.sample_rate = sample_rate;
+    writeHeader();
+}
+
+TimeIndexWriter::~TimeIndexWriter()
+{
+    close();
+}
+
+void TimeIndexWriter::record(int64_t full_secs, double frac_secs, size_t nsamps)
+{
+    if (!started) {
+        started                = true;
+        header.start_full_secs = full_secs;
+        header.start_frac_secs = frac_secs;
+        writeHeader();
+    }
+    const int64_t tick = ticksSince(header, full_secs, frac_secs);
+    // Time running behind by a rounding error is taken as contiguous
+    if (tick > int64_t(next_tick)) {
+        gaps.push_back({samples, uint64_t(tick), tick - next_tick});
+        // Slots starting in the gap point at the first sample after it
+        while (header.slots * header.interval < uint64_t(tick)) {
+            writeSlot(samples, gaps.size() - 1, RA_TIME_INDEX_IN_GAP);
+        }
+        next_tick = tick;
+    }
+    while (header.slots * header.interval < next_tick + nsamps) {
+        writeSlot(samples + header.slots * header.interval - next_tick, gaps.size(), 0);
+    }
+    samples += nsamps;
+    next_tick += nsamps;
+}
+
+void TimeIndexWriter::writeSlot(uint64_t sample, uint32_t gaps_before, uint32_t flags)
+{
+    const ra_time_index_slot slot = {sample, gaps_before, flags};
+    file.write((const char*)&slot, sizeof(slot));
+    header.slots++;
+}
+
+void TimeIndexWriter::writeHeader()
+{
+    const auto end = file.tellp();
+    file.seekp(0);
+    file.write((const char*)&header, sizeof(header));
+    if (end > 0) {
+        file.seekp(end);
+    }
+}
+
+void TimeIndexWriter::close()
+{
+    if (!file.is_open()) {
+        return;
+    }
+    file.seekp(sizeof(header) + header.slots * sizeof(ra_time_index_slot));
+    file.write((const char*)gaps.data(), gaps.size() * sizeof(ra_time_index_gap));
+    header.gaps     = gaps.size();
+    header.complete = 1;
+    writeHeader();
+    file.close();
+}
+
+TimeIndex::TimeIndex(const std::string& path)
+{
+    std::ifstream file(path, std::ifstream::binary | std::ifstream::ate);
+    if (!file) {
+        throw std::runtime_error("Unable to open time index " + path);
+    }
+    const uint64_t size = file.tellg();
+    file.seekg(0);
+    file.read((char*)&header, sizeof(header));
+    if (!file || header.magic != RA_TIME_INDEX_MAGIC
+        || header.version != RA_TIME_INDEX_VERSION || header.interval == 0) {
+        throw std::runtime_error("Not a time index " + path);
+    }
+    if (!header.complete) {
+        // The capture did not close, the slots written so far are usable
+        header.slots = (size - sizeof(header)) / sizeof(ra_time_index_slot);
+        header.gaps  = 0;
+    }
+    readEntries(file, slots, header.slots);
+    readEntries(file, gap_list, header.gaps);
+}
+
+uint64_t TimeIndex::sampleAt(int64_t full_secs, double frac_secs) const
+{
+    const int64_t tick = ticksSince(header, full_secs, frac_secs);
+    if (tick <= 0 || slots.empty()) {
+        return 0;
+    }
+    const uint64_t t = tick;
+    const size_t k   = std::min<uint64_t>(t / header.interval, slots.size() - 1);
+    // Walk from the slot start over the gaps that follow it, there are none unless
+    // samples were dropped within this slot
+    uint64_t anchor_sample = slots[k].sample;
+    uint64_t anchor_tick   = k * header.interval;
+    size_t gap             = slots[k].gaps_before;
+    if (slots[k].flags & RA_TIME_INDEX_IN_GAP) {
+        if (gap >= gap_list.size()) {
+            return anchor_sample;
+        }
+        anchor_tick = gap_list[gap].tick;
+        if (t < anchor_tick) {
+            return anchor_sample;
+        }
+        gap++;
+    }
+    for (; gap < gap_list.size() && t >= gap_list[gap].tick - gap_list[gap].missing;
+         gap++) {
+        if (t < gap_list[gap].tick) {
+            return gap_list[gap].sample;
+        }
+        anchor_sample = gap_list[gap].sample;
+        anchor_tick   = gap_list[gap].tick;
+    }
+    return anchor_sample + (t - anchor_tick);
+}
+
+std::pair<uint64_t, uint64_t> TimeIndex::window(
+    int64_t full_secs, double frac_secs, double duration_s) const
+{
+    const double end_secs  = frac_secs + duration_s;
+    const int64_t end_full = full_secs + int64_t(std::floor(end_secs));
+    const uint64_t first   = sampleAt(full_secs, frac_secs);
+    const uint64_t last    = sampleAt(end_full, end_secs - std::floor(end_secs));
+    return {first, last > first ? last - first : 0};
+}
@@ -0,0 +1,152 @@
+//
+// Copyright 2021-2022 Ettus Research, a National Instruments Brand
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+//
+
+#ifndef TIMEINDEX_H
+#define TIMEINDEX_H
+
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#define RA_TIME_INDEX_MAGIC 0x52415449 /* "RATI" */
+#define RA_TIME_INDEX_VERSION 1
+#define RA_TIME_INDEX_IN_GAP 0x1
+
+/**
+ * @brief Layout of the time index written next to a capture (<capture>.idx): the
+ *  header, one ra_time_index_slot per interval ticks of device time since start, then
+ *  the gaps. Ticks count sample periods, so slot k starts interval * k samples after
+ *  the first sample if nothing was dropped. complete is 0 until the capture closed,
+ *  the slots of an incomplete index are counted from the file size and its gaps are
+ *  lost.
+ */
+struct ra_time_index_header
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t sample_size; /* bytes per sample of the capture */
+    uint32_t complete;
+    uint64_t interval; /* ticks per slot */
+    double sample_rate;
+    int64_t start_full_secs; /* time_spec of the first sample */
+    double start_frac_secs;
+    uint64_t slots;
+    uint64_t gaps;
+};
+
+struct ra_time_index_slot
+{
+    uint64_t sample; /* first sample at or after the slot start */
+    uint32_t gaps_before; /* gaps that ended at or before the slot start */
+    uint32_t flags; /* RA_TIME_INDEX_IN_GAP if the slot starts in dropped samples */
+};
+
+/**
+ * @brief Samples dropped by an overflow, ending at the sample written after them.
+ */
+struct ra_time_index_gap
+{
+    uint64_t sample;
+    uint64_t tick; /* ticks since start of the sample after the gap */
+    uint64_t missing; /* ticks dropped */
+};
+
+/**
+ * @brief Writes the time index of one capture from the time_spec of every received
+ *  block. Entries are appended as the capture grows, the gaps and the final header
+ *  are written by close().
+ */
+class TimeIndexWriter
+{
+public:
+    /**
+     * @param path Index file, <capture>.idx by convention
+     * @param sample_rate Samples per second of the capture
+     * @param sample_size Bytes per sample of the capture
+     * @param interval Samples per slot
+     */
+    TimeIndexWriter(
+        const std::string& path, double sample_rate, size_t sample_size, size_t interval);
+    ~TimeIndexWriter();
+    TimeIndexWriter(const TimeIndexWriter&) = delete;
+    TimeIndexWriter& operator=(const TimeIndexWriter&) = delete;
+
+    /**
+     * @brief Indexes nsamps samples appended to the capture, the first of them received
+     *  at full_secs + frac_secs of device time. A jump past the expected time is
+     *  recorded as a gap.
+     */
+    void record(int64_t full_secs, double frac_secs, size_t nsamps);
+    void close();
+
+private:
+    void writeSlot(uint64_t sample, uint32_t gaps_before, uint32_t flags);
+    void writeHeader();
+
+    std::ofstream file;
+    ra_time_index_header header = {};
+    std::vector<ra_time_index_gap> gaps;
+    bool started       = false;
+    uint64_t samples   = 0;
+    uint64_t next_tick = 0;
+};
+
+/**
+ * @brief Reader of a time index. A time maps to its slot by a division, and to a
+ *  sample by an offset from the slot start unless the slot holds a gap, in which case
+ *  the few gaps of that slot are walked. Seeking costs the same anywhere in the capture.
+ */
+class TimeIndex
+{
+public:
+    explicit TimeIndex(const std::string& path);
+
+    /**
+     * @brief The sample at device time full_secs + frac_secs, or the first sample after
+     *  it if it was dropped. Times before the start give 0, times past the last slot
+     *  are extrapolated, so callers clamp the result to the capture length.
+     */
+    uint64_t sampleAt(int64_t full_secs, double frac_secs) const;
+    /**
+     * @brief Samples [first, first + count) received during duration_s seconds from
+     *  full_secs + frac_secs.
+     */
+    std::pair<uint64_t, uint64_t> window(
+        int64_t full_secs, double frac_secs, double duration_s) const;
+    double sampleRate() const
+    {
+        return header.sample_rate;
+    }
+    size_t sampleSize() const
+    {
+        return header.sample_size;
+    }
+    int64_t startFullSecs() const
+    {
+        return header.start_full_secs;
+    }
+    double startFracSecs() const
+    {
+        return header.start_frac_secs;
+    }
+    bool complete() const
+    {
+        return header.complete != 0;
+    }
+    const std::vector<ra_time_index_gap>& gaps() const
+    {
+        return gap_list;
+    }
+
+private:
+    ra_time_index_header header;
+    std::vector<ra_time_index_slot> slots;
+    std::vector<ra_time_index_gap> gap_list;
+};
+
+#endif
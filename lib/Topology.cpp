@@ -0,0 +1,129 @@
+//
+// Copyright 2021-2022 Ettus Research, a National Instruments Brand
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+//
+
+#include "Topology.hpp"
+#include <algorithm>
+#include <stdexcept>
+#include <sstream>
+
+void Topology::clear()
+{
+    channel_list.clear();
+}
+
+size_t Topology::addChannel(size_t device, size_t radio, size_t radio_port)
+{
+    TopologyChannel channel;
+    channel.device     = device;
+    channel.radio      = radio;
+    channel.radio_port = radio_port;
+    channel_list.push_back(channel);
+    return channel_list.size() - 1;
+}
+
+size_t Topology::findChannel(size_t radio, size_t radio_port) const
+{
+    for (size_t i = 0; i < channel_list.size(); i++) {
+        if (channel_list[i].radio == radio and channel_list[i].radio_port == radio_port) {
+            return i;
+        }
+    }
+    return TopologyChannel::none;
+}
+
+size_t Topology::numDevices() const
+{
+    size_t devices = 0;
+    for (const auto& channel : channel_list) {
+        devices = std::max(devices, channel.device + 1);
+    }
+    return devices;
+}
+
+std::vector<size_t> Topology::deviceChannels(size_t device) const
+{
+    std::vector<size_t> channels;
+    for (size_t i = 0; i < channel_list.size(); i++) {
+        if (channel_list[i].device == device) {
+            channels.push_back(i);
+        }
+    }
+    return channels;
+}
+
+void Topology::assignReplay(size_t device, const std::vector<size_t>& entries)
+{
+    auto entry = entries.begin();
+    for (auto& channel : channel_list) {
+        if (entry == entries.end()) {
+            return;
+        }
+        if (channel.device == device and channel.replay == TopologyChannel::none) {
+            channel.replay = *entry++;
+        }
+    }
+}
+
+std::string Topology::describe() const
+{
+    std::ostringstream out;
+    for (size_t device = 0; device < numDevices(); device++) {
+        const std::vector<size_t> channels = deviceChannels(device);
+        out << "Device " << device << ": " << channels.size() << " channels";
+        for (const size_t i : channels) {
+            const TopologyChannel& channel = channel_list[i];
+            out << ", " << i << " on radio " << channel.radio << ":"
+                << channel.radio_port;
+        }
+        out << std::endl;
+    }
+    return out.str();
+}
+
+Topology uniformTopology(size_t num_devices, size_t channels_per_device)
+{
+    Topology topology;
+    for (size_t device = 0; device < num_devices; device++) {
+        for (size_t radio = 0; radio < channels_per_device; radio++) {
+            topology.addChannel(device, device * channels_per_device + radio, 0);
+        }
+    }
+    return topology;
+}
+
+std::vector<std::vector<size_t>> streamerLayout(
+    const Topology& topology, const std::string& layout)
+{
+    std::vector<std::vector<size_t>> streamers;
+    if (layout == "device") {
+        for (size_t device = 0; device < topology.numDevices(); device++) {
+            std::vector<size_t> channels = topology.deviceChannels(device);
+            if (not channels.empty()) {
+                streamers.push_back(std::move(channels));
+            }
+        }
+        return streamers;
+    }
+    size_t per_streamer = 0;
+    if (layout == "channel") {
+        per_streamer = 1;
+    } else if (layout == "global") {
+        per_streamer = std::max<size_t>(topology.numChannels(), 1);
+    } else if (not layout.empty()
+               and layout.find_first_not_of("0123456789") == std::string::npos) {
+        per_streamer = std::stoul(layout);
+    }
+    if (per_streamer == 0) {
+        throw std::runtime_error("Unknown streamer layout " + layout);
+    }
+    for (size_t i = 0; i < topology.numChannels(); i++) {
+        if (i % per_streamer == 0) {
+            streamers.emplace_back();
+        }
+        streamers.back().push_back(i);
+    }
+    return streamers;
+}
@@ -0,0 +1,110 @@
+//
+// Copyright 2021-2022 Ettus Research, a National Instruments Brand
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+//
+
+#ifndef TOPOLOGY_H
+#define TOPOLOGY_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+/**
+ * @brief One RF channel: a port of a radio block and the DDC, DUC and Replay ports in
+ *  front of it. Blocks are indices into the control vectors of RefArch, #none where
+ *  the channel has no such block.
+ */
+struct TopologyChannel
+{
+    static constexpr size_t none = size_t(-1);
+    size_t device = 0;
+    // Index into RA_radio_ctrls
+    size_t radio      = 0;
+    size_t radio_port = 0;
+    // Indices into RA_ddc_ctrls and RA_duc_ctrls
+    size_t ddc      = none;
+    size_t ddc_port = 0;
+    size_t duc      = none;
+    size_t duc_port = 0;
+    // Index into RA_replay_ctrls and RA_replay_chan_vector, one entry per Replay port
+    size_t replay = none;
+};
+
+/**
+ * @brief Devices, radios, channels and the DDC, DUC and Replay ports of the system, as
+ *  discovered in the RFNoC graph or simulated by the mock. Channels are numbered in
+ *  the order they are added, device by device, which is the channel number of the
+ *  rx files, the spectrum monitor and the captures.
+ */
+class Topology
+{
+public:
+    void clear();
+    /**
+     * @brief Adds the channel on port radio_port of radio.
+     *
+     * @return size_t the channel number
+     */
+    size_t addChannel(size_t device, size_t radio, size_t radio_port);
+    /**
+     * @brief Channel on port radio_port of radio, TopologyChannel::none if there is
+     *  none.
+     */
+    size_t findChannel(size_t radio, size_t radio_port) const;
+    TopologyChannel& channel(size_t channel)
+    {
+        return channel_list.at(channel);
+    }
+    const TopologyChannel& channel(size_t channel) const
+    {
+        return channel_list.at(channel);
+    }
+    const std::vector<TopologyChannel>& channels() const
+    {
+        return channel_list;
+    }
+    size_t numChannels() const
+    {
+        return channel_list.size();
+    }
+    /**
+     * @brief One past the highest device number with a channel.
+     */
+    size_t numDevices() const;
+    /**
+     * @brief Channel numbers of device in order.
+     */
+    std::vector<size_t> deviceChannels(size_t device) const;
+    /**
+     * @brief Gives the Replay port entries of device, in order, to its channels
+     *  without one. Replay blocks are not statically connected to the radios, so the
+     *  ports of a device are used in channel order.
+     */
+    void assignReplay(size_t device, const std::vector<size_t>& entries);
+    /**
+     * @brief One line per device listing its channels as radio:port.
+     */
+    std::string describe() const;
+
+private:
+    std::vector<TopologyChannel> channel_list;
+};
+
+/**
+ * @brief num_devices devices of channels_per_device single port radios, the
+ *  topology of the mock.
+ */
+Topology uniformTopology(size_t num_devices, size_t channels_per_device);
+
+/**
+ * @brief Channels of each RX streamer for a streamer layout: "channel" (one streamer
+ *  per channel), "device" (one per device), "global" (one for every channel) or a
+ *  number N (N consecutive channels per streamer, fewer in the last one). Throws
+ *  std::runtime_error for any other layout.
+ */
+std::vector<std::vector<size_t>> streamerLayout(
+    const Topology& topology, const std::string& layout);
+
+#endif
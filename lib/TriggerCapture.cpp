@@ -0,0 +1,413 @@
+//
+// Copyright 2021-2022 Ettus Research, a National Instruments Brand
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+//
+
+#include "TriggerCapture.hpp"
+#include "TimeIndex.hpp"
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+
+namespace {
+const size_t page_size = 4096;
+
+size_t roundToPage(size_t bytes)
+{
+    return (bytes + page_size - 1) / page_size * page_size;
+}
+} // namespace
+
+TriggerCapture::TriggerCapture(size_t num_channels,
+    double sample_rate,
+    size_t sample_size,
+    int64_t start_full_secs,
+    double start_frac_secs,
+    const TriggerSettings& settings,
+    PathFn path_for)
+    : sample_rate(sample_rate)
+    , sample_size(sample_size)
+    , start_full_secs(start_full_secs)
+    , start_frac_secs(start_frac_secs)
+    , settings(settings)
+    , path_for(std::move(path_for))
+    , capacity(uint64_t(std::ceil(settings.ring_s * sample_rate)))
+    , pre_ticks(uint64_t(std::llround(settings.pre_s * sample_rate)))
+    , post_ticks(uint64_t(std::llround(settings.post_s * sample_rate)))
+{
+    if (settings.pre_s < 0 || settings.post_s < 0 || settings.holdoff_s < 0) {
+        throw std::runtime_error("Trigger windows must not be negative");
+    }
+    // The window has to stay in the ring while the RX threads keep writing for as
+    // long as the dump takes, so insist on some slack
+    if (capacity < pre_ticks + post_ticks + post_ticks / 2 + 1) {
+        throw std::runtime_error("trigger-ring must exceed trigger-pre + trigger-post");
+    }
+    if (settings.window == 0) {
+        throw std::runtime_error("Trigger power window must not be empty");
+    }
+    const size_t ring_bytes = roundToPage(capacity * sample_size);
+    mapping_size            = ring_bytes * num_channels;
+    // Populated up front so the RX threads never take a page fault on the ring
+    mapping = mmap(nullptr,
+        mapping_size,
+        PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE,
+        -1,
+        0);
+    if (mapping == MAP_FAILED) {
+        mapping = nullptr;
+        throw std::runtime_error("Unable to allocate "
+                                 + std::to_string(mapping_size >> 20)
+                                 + " MB of trigger ring: " + std::strerror(errno));
+    }
+    for (size_t i = 0; i < num_channels; i++) {
+        channels.emplace_back(new Channel);
+        channels.back()->ring = (uint8_t*)mapping + i * ring_bytes;
+    }
+}
+
+TriggerCapture::~TriggerCapture()
+{
+    stop();
+    if (mapping != nullptr) {
+        munmap(mapping, mapping_size);
+    }
+}
+
+void TriggerCapture::start()
+{
+    if (dump_thread.joinable()) {
+        return;
+    }
+    if (!settings.socket_path.empty() && socket_fd < 0) {
+        socket_fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+        sockaddr_un address = {};
+        address.sun_family = AF_UNIX;
+        if (settings.socket_path.size() >= sizeof(address.sun_path)) {
+            throw std::runtime_error("Trigger socket path too long");
+        }
+        std::strcpy(address.sun_path, settings.socket_path.c_str());
+        unlink(address.sun_path);
+        if (socket_fd < 0 || bind(socket_fd, (sockaddr*)&address, sizeof(address)) != 0) {
+            throw std::runtime_error("Unable to bind trigger socket "
+                                     + settings.socket_path + ": "
+                                     + std::strerror(errno));
+        }
+    }
+    stopping    = false;
+    dump_thread = std::thread([this]() { runDumps(); });
+    if (socket_fd >= 0) {
+        socket_thread = std::thread([this]() { runSocket(); });
+    }
+    std::cout << "Trigger capture: " << channels.size() << " channels, "
+              << settings.ring_s << " s ring (" << (mapping_size >> 20) << " MB), "
+              << settings.pre_s << " s before and " << settings.post_s
+              << " s after each trigger";
+    if (settings.threshold_dbfs != 0) {
+        std::cout << ", power threshold " << settings.threshold_dbfs << " dBFS";
+    }
+    if (socket_fd >= 0) {
+        std::cout << ", socket " << settings.socket_path;
+    }
+    std::cout << std::endl;
+}
+
+void TriggerCapture::stop()
+{
+    if (!dump_thread.joinable()) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(trigger_mutex);
+        stopping = true;
+    }
+    trigger_cv.notify_all();
+    dump_thread.join();
+    if (socket_thread.joinable()) {
+        socket_thread.join();
+    }
+    if (socket_fd >= 0) {
+        close(socket_fd);
+        socket_fd = -1;
+        unlink(settings.socket_path.c_str());
+    }
+    std::cout << "Trigger capture: " << events_dumped << " of " << events_requested
+              << " events dumped" << std::endl;
+}
+
+void TriggerCapture::push(size_t channel,
+    int64_t full_secs,
+    double frac_secs,
+    const std::complex<short>* samples,
+    size_t nsamps)
+{
+    pushSamples(channel, full_secs, frac_secs, samples, nsamps, 32768.0);
+}
+
+void TriggerCapture::push(size_t channel,
+    int64_t full_secs,
+    double frac_secs,
+    const std::complex<float>* samples,
+    size_t nsamps)
+{
+    pushSamples(channel, full_secs, frac_secs, samples, nsamps, 1.0);
+}
+
+void TriggerCapture::push(size_t channel,
+    int64_t full_secs,
+    double frac_secs,
+    const std::complex<double>* samples,
+    size_t nsamps)
+{
+    pushSamples(channel, full_secs, frac_secs, samples, nsamps, 1.0);
+}
+
+template <typename samp_type>
+void TriggerCapture::pushSamples(size_t channel,
+    int64_t full_secs,
+    double frac_secs,
+    const samp_type* samples,
+    size_t nsamps,
+    double full_scale)
+{
+    Channel& ch = *channels[channel];
+    // Whole and fractional seconds apart to keep the precision of the fraction
+    int64_t tick = std::llround(double(full_secs - start_full_secs) * sample_rate
+                                + (frac_secs - start_frac_secs) * sample_rate);
+    if (tick < 0) {
+        const size_t skip = std::min<uint64_t>(-tick, nsamps);
+        samples += skip;
+        nsamps -= skip;
+        tick = 0;
+    }
+    if (nsamps == 0) {
+        return;
+    }
+    uint64_t head = ch.head.load(std::memory_order_relaxed);
+    if (ch.first.load(std::memory_order_relaxed) == UINT64_MAX) {
+        ch.first.store(tick, std::memory_order_relaxed);
+        head = tick;
+    } else if (uint64_t(tick) > head) {
+        // Dropped samples read as zero, keeping every tick at its place in the ring
+        zero(ch, head, tick - head);
+    }
+    // Time running behind by a rounding error is taken as contiguous
+    tick = head > uint64_t(tick) ? head : tick;
+    store(ch, tick, samples, nsamps);
+    ch.head.store(tick + nsamps, std::memory_order_release);
+
+    if (settings.threshold_dbfs == 0) {
+        return;
+    }
+    const double limit =
+        std::pow(10.0, settings.threshold_dbfs / 10) * full_scale * full_scale;
+    for (size_t start = 0; start < nsamps; start += settings.window) {
+        if (uint64_t(tick) + start < accept_from.load(std::memory_order_relaxed)) {
+            continue;
+        }
+        const size_t count = std::min(settings.window, nsamps - start);
+        double power       = 0;
+        for (size_t n = start; n < start + count; n++) {
+            const double i = samples[n].real();
+            const double q = samples[n].imag();
+            power += i * i + q * q;
+        }
+        if (power > limit * count) {
+            request(tick + start,
+                "power on channel " + std::to_string(channel) + " at "
+                    + std::to_string(10 * std::log10(power / count / full_scale
+                                                     / full_scale))
+                    + " dBFS");
+        }
+    }
+}
+
+void TriggerCapture::store(Channel& ch, uint64_t tick, const void* samples, size_t nsamps)
+{
+    const uint8_t* in = (const uint8_t*)samples;
+    if (nsamps > capacity) {
+        in += (nsamps - capacity) * sample_size;
+        tick += nsamps - capacity;
+        nsamps = capacity;
+    }
+    const uint64_t offset = tick % capacity;
+    const size_t first    = std::min<uint64_t>(nsamps, capacity - offset);
+    std::memcpy(ch.ring + offset * sample_size, in, first * sample_size);
+    std::memcpy(ch.ring, in + first * sample_size, (nsamps - first) * sample_size);
+}
+
+void TriggerCapture::zero(Channel& ch, uint64_t tick, uint64_t nsamps)
+{
+    if (nsamps > capacity) {
+        tick += nsamps - capacity;
+        nsamps = capacity;
+    }
+    const uint64_t offset = tick % capacity;
+    const size_t first    = std::min<uint64_t>(nsamps, capacity - offset);
+    std::memset(ch.ring + offset * sample_size, 0, first * sample_size);
+    std::memset(ch.ring, 0, (nsamps - first) * sample_size);
+}
+
+uint64_t TriggerCapture::commonHead() const
+{
+    uint64_t head = UINT64_MAX;
+    for (const auto& ch : channels) {
+        head = std::min(head, ch->head.load(std::memory_order_acquire));
+    }
+    return head;
+}
+
+void TriggerCapture::trigger(const std::string& source)
+{
+    const uint64_t head = commonHead();
+    if (head == 0) {
+        std::cout << "Trigger from " << source << " ignored, nothing received yet"
+                  << std::endl;
+        return;
+    }
+    request(head - 1, source);
+}
+
+void TriggerCapture::request(uint64_t tick, const std::string& source)
+{
+    {
+        std::lock_guard<std::mutex> lock(trigger_mutex);
+        if (tick < accept_from || stopping) {
+            return;
+        }
+        // The next window may start once this one and the holdoff have passed
+        accept_from = tick + post_ticks + uint64_t(settings.holdoff_s * sample_rate);
+        events.push_back({tick, source});
+        events_requested++;
+    }
+    trigger_cv.notify_all();
+}
+
+void TriggerCapture::runDumps()
+{
+    std::unique_lock<std::mutex> lock(trigger_mutex);
+    size_t number = 0;
+    while (true) {
+        trigger_cv.wait(lock, [this]() { return stopping || !events.empty(); });
+        if (events.empty()) {
+            return;
+        }
+        const Event event = events.front();
+        // The RX threads do not signal, poll until every channel is past the window
+        while (!stopping && commonHead() < event.tick + post_ticks) {
+            trigger_cv.wait_for(lock, std::chrono::milliseconds(10));
+        }
+        lock.unlock();
+        dump(event, number++);
+        lock.lock();
+        events.pop_front();
+    }
+}
+
+void TriggerCapture::dump(const Event& event, size_t number)
+{
+    const uint64_t start = event.tick > pre_ticks ? event.tick - pre_ticks : 0;
+    const uint64_t end   = event.tick + post_ticks;
+    const double trigger_secs = start_frac_secs + event.tick / sample_rate;
+    std::cout << "Trigger " << number << " from " << event.source << " at "
+              << std::fixed << double(start_full_secs) + trigger_secs
+              << std::defaultfloat << " s, dumping " << end - start
+              << " samples per channel" << std::endl;
+    for (size_t channel = 0; channel < channels.size(); channel++) {
+        dumpChannel(channel, start, end, number);
+    }
+    events_dumped++;
+}
+
+void TriggerCapture::dumpChannel(
+    size_t channel, uint64_t start, uint64_t end, size_t number)
+{
+    const Channel& ch = *channels[channel];
+    std::string path;
+    try {
+        path = path_for(channel, number);
+    } catch (const std::exception& e) {
+        std::cerr << "No trigger capture file for channel " << channel << ": "
+                  << e.what() << std::endl;
+        return;
+    }
+    std::ofstream file(path, std::ofstream::binary);
+    if (!file) {
+        std::cerr << "Unable to create trigger capture " << path << std::endl;
+        return;
+    }
+    // Samples still in the ring, a stop before the window completes leaves its end
+    // empty and zeros are written for it as for anything before the first sample
+    const uint64_t head  = ch.head.load(std::memory_order_acquire);
+    const uint64_t first = ch.first.load(std::memory_order_relaxed);
+    const uint64_t oldest = head > capacity ? head - capacity : 0;
+    const uint64_t lo = std::max({start, first == UINT64_MAX ? end : first, oldest});
+    const uint64_t hi = std::max(lo, std::min(end, head));
+    const std::vector<char> zeros(page_size * sample_size);
+    auto writeZeros = [&](uint64_t nsamps) {
+        while (nsamps > 0) {
+            const uint64_t count = std::min<uint64_t>(nsamps, page_size);
+            file.write(zeros.data(), count * sample_size);
+            nsamps -= count;
+        }
+    };
+    writeZeros(std::min(lo, end) - start);
+    for (uint64_t tick = lo; tick < hi;) {
+        const uint64_t offset = tick % capacity;
+        const uint64_t count  = std::min(hi - tick, capacity - offset);
+        file.write((const char*)ch.ring + offset * sample_size, count * sample_size);
+        tick += count;
+    }
+    writeZeros(end - std::max(hi, std::min(lo, end)));
+    if (!file) {
+        std::cerr << "Failed writing trigger capture " << path << std::endl;
+    }
+    if (hi > lo && ch.head.load(std::memory_order_acquire) > lo + capacity) {
+        std::cerr << "Trigger capture " << path << " was overwritten while dumping, "
+                  << "increase trigger-ring" << std::endl;
+    }
+    if (settings.index_interval > 0) {
+        const double secs = start_frac_secs + start / sample_rate;
+        TimeIndexWriter index(
+            path + ".idx", sample_rate, sample_size, settings.index_interval);
+        index.record(start_full_secs + int64_t(std::floor(secs)),
+            secs - std::floor(secs),
+            end - start);
+    }
+}
+
+void TriggerCapture::runSocket()
+{
+    char message[256];
+    while (true) {
+        {
+            std::lock_guard<std::mutex> lock(trigger_mutex);
+            if (stopping) {
+                return;
+            }
+        }
+        pollfd fd = {socket_fd, POLLIN, 0};
+        if (poll(&fd, 1, 100) <= 0) {
+            continue;
+        }
+        const ssize_t size = recv(socket_fd, message, sizeof(message) - 1, 0);
+        if (size < 0) {
+            continue;
+        }
+        // Any datagram triggers, its text names the source
+        std::string source(message, size);
+        source.erase(source.find_last_not_of(" \r\n") + 1);
+        trigger(source.empty() ? "socket" : "socket (" + source + ")");
+    }
+}
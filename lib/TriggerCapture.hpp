@@ -0,0 +1,161 @@
+//
+// Copyright 2021-2022 Ettus Research, a National Instruments Brand
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+//
+
+#ifndef TRIGGERCAPTURE_H
+#define TRIGGERCAPTURE_H
+
+#include <atomic>
+#include <complex>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct TriggerSettings
+{
+    // Seconds of every channel kept in RAM, more than pre_s + post_s so a window is
+    // dumped before the RX threads wrap over it
+    double ring_s = 4;
+    // Seconds dumped before and after the trigger
+    double pre_s  = 0.5;
+    double post_s = 0.5;
+    // Power over window samples of any channel above this triggers, 0 to disable
+    double threshold_dbfs = 0;
+    size_t window         = 256;
+    // Unix datagram socket taking trigger requests, empty for none
+    std::string socket_path = "/tmp/refarch_trigger";
+    // Seconds after the end of a dumped window before another trigger is accepted
+    double holdoff_s = 0;
+    // Samples per entry of the time index written next to every dump, 0 for none
+    size_t index_interval = 1048576;
+};
+
+/**
+ * @brief Pre-trigger capture. Every channel keeps the last ring_s seconds in a
+ *  preallocated, prefaulted ring, written by the RX threads with push() and addressed
+ *  by the sample tick since the common start time, so the rings of all channels are
+ *  aligned. A trigger, from the power of any channel or a request on the socket,
+ *  picks a tick; once every channel has received post_s seconds past it, the dump
+ *  thread writes pre_s + post_s seconds of every channel around it to disk. Nothing
+ *  is written between events.
+ */
+class TriggerCapture
+{
+public:
+    /**
+     * @brief Capture file of channel for event, e.g. from RefArch::generateRxFilename()
+     *  with the event as run number.
+     */
+    using PathFn = std::function<std::string(size_t channel, size_t event)>;
+
+    /**
+     * @param sample_size Bytes per sample pushed, the capture format
+     * @param start_full_secs Device time of tick 0, the stream start time
+     */
+    TriggerCapture(size_t num_channels,
+        double sample_rate,
+        size_t sample_size,
+        int64_t start_full_secs,
+        double start_frac_secs,
+        const TriggerSettings& settings,
+        PathFn path_for);
+    ~TriggerCapture();
+    TriggerCapture(const TriggerCapture&) = delete;
+    TriggerCapture& operator=(const TriggerCapture&) = delete;
+
+    void start();
+    /**
+     * @brief Dumps the pending events with the samples received so far and stops.
+     */
+    void stop();
+    /**
+     * @brief Stores nsamps samples of channel received at full_secs + frac_secs and
+     *  checks them against the power threshold. Dropped samples read as zero.
+     */
+    void push(size_t channel,
+        int64_t full_secs,
+        double frac_secs,
+        const std::complex<short>* samples,
+        size_t nsamps);
+    void push(size_t channel,
+        int64_t full_secs,
+        double frac_secs,
+        const std::complex<float>* samples,
+        size_t nsamps);
+    void push(size_t channel,
+        int64_t full_secs,
+        double frac_secs,
+        const std::complex<double>* samples,
+        size_t nsamps);
+    /**
+     * @brief Triggers at the newest sample every channel has received.
+     */
+    void trigger(const std::string& source);
+    size_t eventsDumped() const
+    {
+        return events_dumped;
+    }
+
+private:
+    struct alignas(64) Channel
+    {
+        uint8_t* ring = nullptr;
+        // One past the newest tick written, and the first tick ever written
+        std::atomic<uint64_t> head{0};
+        std::atomic<uint64_t> first{UINT64_MAX};
+    };
+    struct Event
+    {
+        uint64_t tick;
+        std::string source;
+    };
+    template <typename samp_type>
+    void pushSamples(size_t channel,
+        int64_t full_secs,
+        double frac_secs,
+        const samp_type* samples,
+        size_t nsamps,
+        double full_scale);
+    void store(Channel& channel, uint64_t tick, const void* samples, size_t nsamps);
+    void zero(Channel& channel, uint64_t tick, uint64_t nsamps);
+    void request(uint64_t tick, const std::string& source);
+    uint64_t commonHead() const;
+    void dump(const Event& event, size_t number);
+    void dumpChannel(size_t channel, uint64_t start, uint64_t end, size_t number);
+    void runDumps();
+    void runSocket();
+
+    std::vector<std::unique_ptr<Channel>> channels;
+    double sample_rate;
+    size_t sample_size;
+    int64_t start_full_secs;
+    double start_frac_secs;
+    TriggerSettings settings;
+    PathFn path_for;
+    uint64_t capacity;
+    uint64_t pre_ticks;
+    uint64_t post_ticks;
+    void* mapping       = nullptr;
+    size_t mapping_size = 0;
+    // Triggers before this tick are ignored, the window of the last one and holdoff
+    std::atomic<uint64_t> accept_from{0};
+    std::atomic<size_t> events_dumped{0};
+    size_t events_requested = 0;
+    std::deque<Event> events;
+    bool stopping = false;
+    std::mutex trigger_mutex;
+    std::condition_variable trigger_cv;
+    std::thread dump_thread;
+    std::thread socket_thread;
+    int socket_fd = -1;
+};
+
+#endif
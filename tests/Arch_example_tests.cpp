@@ -0,0 +1,124 @@
+//
+// Copyright 2021-2022 Ettus Research, a National Instruments Brand
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+//
+
+/*******************************************************************************************************************
+End to end runs of the examples on the mock devices. Arch_iterative_loopback
+(ARCH_ITERATIVE_LOOPBACK) plays a noise file from every mock Replay port in turn, captures
+every channel to file and correlates the loopback while streaming, so the captures and the
+delay matrix must both show the mock loopback delay.
+*******************************************************************************************************************/
+
+#define BOOST_TEST_MODULE Arch_example_tests
+#include <boost/filesystem.hpp>
+#include <boost/test/unit_test.hpp>
+#include <algorithm>
+#include <complex>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace {
+const size_t test_channels = 4;
+const size_t test_delay    = 37;
+
+boost::filesystem::path tempDir()
+{
+    const auto dir = boost::filesystem::temp_directory_path()
+                     / boost::filesystem::unique_path("example-%%%%-%%%%");
+    boost::filesystem::create_directories(dir);
+    return dir;
+}
+
+std::vector<std::complex<int16_t>> readSamples(const boost::filesystem::path& path)
+{
+    std::ifstream in(path.string(), std::ifstream::binary);
+    std::vector<std::complex<int16_t>> samples(
+        boost::filesystem::file_size(path) / sizeof(std::complex<int16_t>));
+    in.read((char*)samples.data(), samples.size() * sizeof(std::complex<int16_t>));
+    return samples;
+}
+} // namespace
+
+BOOST_AUTO_TEST_CASE(mock_iterative_loopback)
+{
+    const auto dir     = tempDir();
+    const auto cfg     = dir / "iterative.cfg";
+    const auto tx_file = dir / "tx.dat";
+    std::vector<std::complex<int16_t>> noise(50000);
+    std::mt19937 generator(1);
+    std::uniform_int_distribution<int> level(-8000, 8000);
+    for (auto& sample : noise) {
+        sample = std::complex<int16_t>(level(generator), level(generator));
+    }
+    {
+        std::ofstream tx(tx_file.string(), std::ofstream::binary);
+        tx.write((const char*)noise.data(), noise.size() * sizeof(noise[0]));
+        std::ofstream out(cfg.string());
+        out << "mock = true\n"
+            << "address = addr=1\n"
+            << "address = addr=2\n"
+            << "file = " << tx_file.string() << "\n"
+            << "rx-rate = 10e6\n"
+            << "tx-rate = 10e6\n"
+            << "spb = 10000\n"
+            << "nsamps = 200000\n"
+            << "time_requested = 0\n"
+            << "time_delay = 0.3\n"
+            << "rx-file-location = " << dir.string() << "/\n"
+            << "rx-file-channels = 0 1 2 3\n"
+            << "loopback-delay = true\n"
+            << "loopback-fft-size = 4096\n"
+            << "mock-loopback-delay = " << test_delay << "\n";
+    }
+    const std::string command = std::string(ARCH_ITERATIVE_LOOPBACK) + " --cfgFile "
+                                + cfg.string() + " > " + (dir / "run.log").string()
+                                + " 2>&1";
+    BOOST_REQUIRE_EQUAL(std::system(command.c_str()), 0);
+
+    // One capture per TX and RX channel, silence until the loopback arrives
+    size_t captures = 0;
+    std::vector<boost::filesystem::path> delay_files;
+    for (const auto& entry : boost::filesystem::recursive_directory_iterator(dir)) {
+        const std::string name = entry.path().filename().string();
+        if (name.find("_loopback.csv") != std::string::npos) {
+            delay_files.push_back(entry.path());
+        } else if (name.find(".tx_") != std::string::npos) {
+            const auto samples = readSamples(entry.path());
+            BOOST_REQUIRE_GT(samples.size(), test_delay + noise.size());
+            for (size_t n = 0; n < test_delay; n++) {
+                BOOST_REQUIRE(samples[n] == std::complex<int16_t>());
+            }
+            BOOST_CHECK(std::equal(
+                noise.begin(), noise.end(), samples.begin() + test_delay));
+            captures++;
+        }
+    }
+    BOOST_CHECK_EQUAL(captures, test_channels * test_channels);
+
+    // run,tx,rx,delay_samples,...: every path has the mock loopback delay
+    BOOST_REQUIRE_EQUAL(delay_files.size(), 1);
+    std::ifstream csv(delay_files[0].string());
+    std::string line;
+    std::getline(csv, line);
+    size_t paths = 0;
+    while (std::getline(csv, line)) {
+        std::vector<std::string> fields;
+        std::istringstream row(line);
+        std::string field;
+        while (std::getline(row, field, ',')) {
+            fields.push_back(field);
+        }
+        BOOST_REQUIRE_GT(fields.size(), 3);
+        BOOST_CHECK_SMALL(std::stod(fields[3]) - test_delay, 0.1);
+        paths++;
+    }
+    BOOST_CHECK_EQUAL(paths, test_channels * test_channels);
+    boost::filesystem::remove_all(dir);
+}
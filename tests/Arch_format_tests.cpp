@@ -0,0 +1,217 @@
+//
+// Copyright 2021-2022 Ettus Research, a National Instruments Brand
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+//
+
+/*******************************************************************************************************************
+Round trip tests of the on-disk capture formats: the compressed sc16 blocks (.sc16z),
+the time index (.idx) and the SIMD sc16 conversion kernels against the scalar ones.
+*******************************************************************************************************************/
+
+#define BOOST_TEST_MODULE Arch_format_tests
+#include "SampleConvert.hpp"
+#include "Sc16Codec.hpp"
+#include "TimeIndex.hpp"
+#include <boost/filesystem.hpp>
+#include <boost/test/unit_test.hpp>
+#include <cmath>
+#include <cstring>
+#include <random>
+#include <stdexcept>
+#include <vector>
+
+namespace {
+typedef std::vector<std::complex<int16_t>> Samples;
+
+// Every instruction set the host can run, the scalar kernels first
+std::vector<ConvertIsa> hostIsas()
+{
+    std::vector<ConvertIsa> isas;
+    for (int isa = CONVERT_SCALAR; isa <= bestConvertIsa(); isa++) {
+        isas.push_back(ConvertIsa(isa));
+    }
+    return isas;
+}
+
+// The waveforms the codec packs differently: full scale noise, low level noise, an
+// oversampled tone for the delta mode and the extremes of int16
+std::vector<Samples> waveforms(size_t nsamps)
+{
+    std::mt19937 rng(nsamps);
+    std::uniform_int_distribution<int> full(-32768, 32767);
+    std::uniform_int_distribution<int> low(-20, 20);
+    std::vector<Samples> result(5, Samples(nsamps));
+    for (size_t n = 0; n < nsamps; n++) {
+        const double phase = 2 * M_PI * n / 100.0;
+        result[0][n]       = {int16_t(full(rng)), int16_t(full(rng))};
+        result[1][n]       = {int16_t(low(rng)), int16_t(low(rng))};
+        result[2][n]       = {
+            int16_t(30000 * std::cos(phase)), int16_t(30000 * std::sin(phase))};
+        result[3][n] = {int16_t(n % 2 ? -32768 : 32767), int16_t(n % 3 ? 32767 : -32768)};
+        result[4][n] = {-32768, -32768};
+    }
+    return result;
+}
+
+Samples roundTrip(const Samples& in, ConvertIsa isa)
+{
+    std::vector<uint8_t> block(sc16CompressBound(in.size()));
+    const size_t nbytes = compressSc16(in.data(), in.size(), block.data(), isa);
+    BOOST_REQUIRE_LE(nbytes, block.size());
+    BOOST_REQUIRE_EQUAL(sc16BlockSize(block.data(), nbytes), nbytes);
+    BOOST_REQUIRE_EQUAL(sc16BlockSamples(block.data()), in.size());
+    Samples out(in.size());
+    decompressSc16(block.data(), out.data());
+    return out;
+}
+
+boost::filesystem::path tempPath(const std::string& suffix)
+{
+    return boost::filesystem::temp_directory_path()
+           / boost::filesystem::unique_path("%%%%-%%%%" + suffix);
+}
+} // namespace
+
+BOOST_AUTO_TEST_CASE(sc16_codec_round_trip)
+{
+    for (ConvertIsa isa : hostIsas()) {
+        for (size_t nsamps = 0; nsamps <= 4097; nsamps++) {
+            for (const auto& in : waveforms(nsamps)) {
+                const Samples out = roundTrip(in, isa);
+                BOOST_REQUIRE_MESSAGE(
+                    std::memcmp(in.data(), out.data(), nsamps * sizeof(in[0])) == 0,
+                    convertIsaName(isa) << " round trip of " << nsamps << " samples");
+            }
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(sc16_codec_isas_agree)
+{
+    // The block layout does not depend on the kernel that wrote it
+    for (const auto& in : waveforms(4097)) {
+        std::vector<uint8_t> scalar(sc16CompressBound(in.size()));
+        const size_t scalar_bytes =
+            compressSc16(in.data(), in.size(), scalar.data(), CONVERT_SCALAR);
+        for (ConvertIsa isa : hostIsas()) {
+            std::vector<uint8_t> block(sc16CompressBound(in.size()));
+            const size_t nbytes = compressSc16(in.data(), in.size(), block.data(), isa);
+            BOOST_REQUIRE_EQUAL(nbytes, scalar_bytes);
+            BOOST_CHECK(std::memcmp(block.data(), scalar.data(), nbytes) == 0);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(sc16_codec_partial_and_corrupt_blocks)
+{
+    const Samples in = waveforms(1000)[2];
+    std::vector<uint8_t> block(sc16CompressBound(in.size()));
+    const size_t nbytes = compressSc16(in.data(), in.size(), block.data());
+    // Less than a whole block is not an error, the reader waits for more
+    BOOST_CHECK_EQUAL(sc16BlockSize(block.data(), 0), 0u);
+    BOOST_CHECK_EQUAL(sc16BlockSize(block.data(), sizeof(ra_sc16z_header) - 1), 0u);
+    BOOST_CHECK_EQUAL(sc16BlockSize(block.data(), nbytes - 1), 0u);
+    block[0] ^= 0xff;
+    BOOST_CHECK_THROW(sc16BlockSize(block.data(), nbytes), std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(sc16_capture_decompress)
+{
+    const auto src = tempPath(".sc16z");
+    const auto dst = tempPath(".dat");
+    Samples expected;
+    {
+        std::ofstream file(src.string(), std::ofstream::binary);
+        for (size_t nsamps : {0, 1, 255, 256, 4097}) {
+            const Samples in = waveforms(nsamps)[0];
+            std::vector<uint8_t> block(sc16CompressBound(in.size()));
+            file.write((const char*)block.data(),
+                compressSc16(in.data(), in.size(), block.data()));
+            expected.insert(expected.end(), in.begin(), in.end());
+        }
+    }
+    BOOST_CHECK_EQUAL(decompressCapture(src.string(), dst.string()), expected.size());
+    Samples out(expected.size());
+    std::ifstream file(dst.string(), std::ifstream::binary);
+    file.read((char*)out.data(), out.size() * sizeof(out[0]));
+    BOOST_CHECK(file.gcount() == std::streamsize(out.size() * sizeof(out[0])));
+    BOOST_CHECK(out == expected);
+    boost::filesystem::remove(src);
+    boost::filesystem::remove(dst);
+}
+
+BOOST_AUTO_TEST_CASE(time_index_gaps_and_seeks)
+{
+    const double rate     = 1e6;
+    const int64_t full    = 10;
+    const size_t interval = 1000;
+    // Runs of received blocks as {first tick, blocks of 250 samples}: a gap ending
+    // between slots and one within a slot
+    const std::vector<std::pair<uint64_t, size_t>> runs = {{0, 25}, {8550, 4}, {9560, 8}};
+    const auto path = tempPath(".idx");
+    {
+        TimeIndexWriter writer(
+            path.string(), rate, sizeof(std::complex<float>), interval);
+        for (const auto& run : runs) {
+            for (size_t block = 0; block < run.second; block++) {
+                writer.record(full, (run.first + 250 * block) / rate, 250);
+            }
+        }
+    }
+    TimeIndex index(path.string());
+    boost::filesystem::remove(path);
+    BOOST_CHECK(index.complete());
+    BOOST_CHECK_EQUAL(index.sampleSize(), sizeof(std::complex<float>));
+    BOOST_CHECK_EQUAL(index.sampleRate(), rate);
+    BOOST_CHECK_EQUAL(index.startFullSecs(), full);
+    BOOST_CHECK_EQUAL(index.gaps().size(), runs.size() - 1);
+    // The sample at every tick, or the first one after a gap, extrapolated past the end
+    for (uint64_t tick = 0; tick < 12000; tick++) {
+        uint64_t expected = 0;
+        uint64_t sample   = 0;
+        for (const auto& run : runs) {
+            if (tick < run.first) {
+                expected = sample;
+                break;
+            }
+            expected = sample + (tick - run.first);
+            if (tick < run.first + 250 * run.second) {
+                break;
+            }
+            sample += 250 * run.second;
+        }
+        BOOST_REQUIRE_MESSAGE(index.sampleAt(full, tick / rate) == expected,
+            "tick " << tick << ": " << index.sampleAt(full, tick / rate)
+                    << " != " << expected);
+    }
+    BOOST_CHECK_EQUAL(index.sampleAt(full - 1, 0.5), 0u);
+    const auto window = index.window(full, 1000 / rate, 2000 / rate);
+    BOOST_CHECK_EQUAL(window.first, 1000u);
+    BOOST_CHECK_EQUAL(window.second, 2000u);
+}
+
+BOOST_AUTO_TEST_CASE(sc16_conversion_simd_matches_scalar)
+{
+    const float scale = 1.0f / 32768;
+    for (size_t nsamps : {0, 1, 7, 8, 15, 16, 17, 31, 33, 1000, 4097}) {
+        for (const auto& in : waveforms(nsamps)) {
+            std::vector<std::complex<float>> fc32(nsamps);
+            std::vector<uint16_t> fc16(2 * nsamps);
+            convertSc16ToFc32(in.data(), fc32.data(), nsamps, scale, CONVERT_SCALAR);
+            convertSc16ToFc16(in.data(), fc16.data(), nsamps, scale, CONVERT_SCALAR);
+            for (size_t n = 0; n < nsamps; n++) {
+                BOOST_REQUIRE_EQUAL(fc32[n].real(), in[n].real() * scale);
+                BOOST_REQUIRE_EQUAL(fc16[2 * n], floatToHalf(in[n].real() * scale));
+            }
+            for (ConvertIsa isa : hostIsas()) {
+                std::vector<std::complex<float>> simd32(nsamps);
+                std::vector<uint16_t> simd16(2 * nsamps);
+                convertSc16ToFc32(in.data(), simd32.data(), nsamps, scale, isa);
+                convertSc16ToFc16(in.data(), simd16.data(), nsamps, scale, isa);
+                BOOST_REQUIRE_MESSAGE(simd32 == fc32, convertIsaName(isa) << " fc32");
+                BOOST_REQUIRE_MESSAGE(simd16 == fc16, convertIsaName(isa) << " fc16");
+            }
+        }
+    }
+}
@@ -0,0 +1,121 @@
+//
+// Copyright 2021-2022 Ettus Research, a National Instruments Brand
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+//
+
+/*******************************************************************************************************************
+Tests of the shard coordinator. The run test starts a coordinator with two mock workers
+(ARCH_SHARD_WORKER, Arch_rx_to_mem) on this host and checks that both synchronize once,
+capture and exit cleanly. The workers benchmark their streamer layouts first, which must
+not synchronize them a second time.
+*******************************************************************************************************************/
+
+#define BOOST_TEST_MODULE Arch_shard_tests
+#include "Shard.hpp"
+#include <boost/filesystem.hpp>
+#include <boost/test/unit_test.hpp>
+#include <cmath>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace {
+const size_t test_nsamps = 100000;
+
+boost::filesystem::path tempDir()
+{
+    const auto dir = boost::filesystem::temp_directory_path()
+                     / boost::filesystem::unique_path("shard-%%%%-%%%%");
+    boost::filesystem::create_directories(dir);
+    return dir;
+}
+
+// Samples of the last rx total row of a worker metrics file, -1 if there is none
+double rxTotalSamples(const boost::filesystem::path& path)
+{
+    std::ifstream in(path.string());
+    std::string line;
+    double samples = -1;
+    while (std::getline(in, line)) {
+        std::vector<std::string> fields;
+        std::istringstream row(line);
+        std::string field;
+        while (std::getline(row, field, ',')) {
+            fields.push_back(field);
+        }
+        if (fields.size() > 3 and fields[1] == "rx" and fields[2] == "total") {
+            samples = std::stod(fields[3]);
+        }
+    }
+    return samples;
+}
+} // namespace
+
+BOOST_AUTO_TEST_CASE(split_addresses)
+{
+    const std::vector<std::string> addresses = {"a", "b", "c", "d", "e"};
+    // Contiguous groups, the last shard takes the remainder
+    const auto groups = ShardCoordinator::splitAddresses(addresses, 2);
+    BOOST_REQUIRE_EQUAL(groups.size(), 2);
+    BOOST_CHECK((groups[0] == std::vector<std::string>{"a", "b"}));
+    BOOST_CHECK((groups[1] == std::vector<std::string>{"c", "d", "e"}));
+    BOOST_CHECK_THROW(ShardCoordinator::splitAddresses(addresses, 0), std::runtime_error);
+    BOOST_CHECK_THROW(ShardCoordinator::splitAddresses(addresses, 6), std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(parse_sysfs_list)
+{
+    BOOST_CHECK(
+        (parseSysfsList("0-3,8,10-11") == std::vector<int>{0, 1, 2, 3, 8, 10, 11}));
+    BOOST_CHECK((parseSysfsList("5") == std::vector<int>{5}));
+    BOOST_CHECK(parseSysfsList("").empty());
+}
+
+BOOST_AUTO_TEST_CASE(mock_shards_synchronize_once)
+{
+    const auto dir     = tempDir();
+    const auto cfg     = dir / "shard.cfg";
+    const auto tx_file = dir / "tx.dat";
+    {
+        // The workers load a TX file even when they only receive
+        std::ofstream tx(tx_file.string(), std::ofstream::binary);
+        const std::vector<int16_t> zeros(2 * 1000);
+        tx.write((const char*)zeros.data(), zeros.size() * sizeof(int16_t));
+        std::ofstream out(cfg.string());
+        out << "mock = true\n"
+            << "file = " << tx_file.string() << "\n"
+            << "rx-rate = 1e6\n"
+            << "spb = 10000\n"
+            << "nsamps = " << test_nsamps << "\n"
+            << "time_requested = 0\n"
+            << "time_delay = 0.2\n"
+            << "rx-streamers = auto\n"
+            << "rx-streamers-bench-time = 0.2\n";
+    }
+    ShardSettings settings;
+    settings.worker           = ARCH_SHARD_WORKER;
+    settings.worker_args      = {"--cfgFile", cfg.string()};
+    settings.addresses        = {"addr=1", "addr=2", "addr=3", "addr=4"};
+    settings.shards           = 2;
+    settings.numa_nodes       = {-1, -1};
+    settings.sync_margin      = 0.5;
+    settings.start_delay      = 1;
+    settings.metrics_file     = (dir / "metrics.csv").string();
+    settings.metrics_interval = 0.2;
+
+    ShardCoordinator coordinator(settings);
+    coordinator.start();
+    const ShardSync sync = coordinator.synchronize();
+    BOOST_CHECK_EQUAL(sync.epoch, std::floor(sync.epoch));
+    BOOST_CHECK_GE(sync.start, sync.epoch + 1);
+    BOOST_CHECK_EQUAL(coordinator.wait(), 0);
+    // Two mock devices of two channels per shard
+    for (size_t shard = 0; shard < settings.shards; shard++) {
+        BOOST_CHECK_EQUAL(
+            rxTotalSamples(dir / ("metrics.shard" + std::to_string(shard) + ".csv")),
+            4 * test_nsamps);
+    }
+    boost::filesystem::remove_all(dir);
+}
@@ -0,0 +1,128 @@
+//
+// Copyright 2021-2022 Ettus Research, a National Instruments Brand
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+//
+
+// Channel to channel delay, phase and amplitude of the per channel captures written by
+// the examples. The captures of every tx channel and run are cross correlated against
+// the reference rx channel and the results are written as CSV, one line per channel.
+//
+//      Arch_channel_align /data/CW_2.000000_GHz_10192026_104624_test.dat
+//          --reference 0 --rate 250e6 --output alignment.csv
+
+#include "ChannelAlign.hpp"
+#include <boost/program_options.hpp>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+int main(int argc, char* argv[])
+{
+    namespace po = boost::program_options;
+    AlignSettings settings;
+    std::vector<std::string> paths;
+    size_t reference;
+    double rate;
+    std::string output;
+    po::options_description desc("Arch_channel_align options");
+    // clang-format off
+    desc.add_options()
+        ("help", "print this message")
+        ("captures",
+            po::value<std::vector<std::string>>(&paths)->multitoken(),
+            "capture files or directories searched recursively")
+        ("reference",
+            po::value<size_t>(&reference)->default_value(0),
+            "rx channel the others are aligned to")
+        ("fft-size",
+            po::value<size_t>(&settings.fft_size)->default_value(16384),
+            "correlation FFT size, a power of two, blocks are half of it")
+        ("max-lag",
+            po::value<size_t>(&settings.max_lag)->default_value(1000),
+            "largest delay in samples searched for, less than half the FFT size")
+        ("offset",
+            po::value<uint64_t>(&settings.offset)->default_value(0),
+            "samples skipped at the start of every capture")
+        ("samples",
+            po::value<uint64_t>(&settings.max_samples)->default_value(0),
+            "samples analyzed per channel, 0 for all")
+        ("threads",
+            po::value<size_t>(&settings.threads)->default_value(0),
+            "worker threads, 0 for one per CPU")
+        ("rate",
+            po::value<double>(&rate)->default_value(0),
+            "sample rate of the captures, adds the delay in ns when set")
+        ("output",
+            po::value<std::string>(&output)->default_value(""),
+            "CSV output file, stdout if empty")
+        ;
+    // clang-format on
+    po::positional_options_description positional;
+    positional.add("captures", -1);
+    po::variables_map vm;
+    po::store(
+        po::command_line_parser(argc, argv).options(desc).positional(positional).run(),
+        vm);
+    if (vm.count("help") || !vm.count("captures")) {
+        std::cout << desc << std::endl;
+        return vm.count("help") ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    po::notify(vm);
+
+    // Every tx channel and run is aligned on its own
+    std::map<std::pair<int, int>, std::vector<CaptureFile>> runs;
+    for (const auto& file : findCaptureFiles(paths)) {
+        runs[{file.tx_channel, file.run}].push_back(file);
+    }
+    if (runs.empty()) {
+        std::cerr << "No captures found" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::ofstream outfile;
+    if (!output.empty()) {
+        outfile.open(output, std::ofstream::trunc);
+    }
+    std::ostream& out = output.empty() ? std::cout : outfile;
+    out << "tx,run,rx,delay_samples,delay_ns,phase_deg,amplitude_db,coherence,samples\n";
+    out << std::setprecision(9);
+    for (const auto& run : runs) {
+        const std::vector<CaptureFile>& files = run.second;
+        size_t index = files.size();
+        for (size_t i = 0; i < files.size(); i++) {
+            if (files[i].rx_channel == reference) {
+                index = i;
+            }
+        }
+        if (index == files.size()) {
+            std::cerr << "tx " << run.first.first << " run " << run.first.second
+                      << " has no capture of rx channel " << reference << ", skipped"
+                      << std::endl;
+            continue;
+        }
+        const auto start = std::chrono::steady_clock::now();
+        const std::vector<ChannelAlignment> alignments =
+            alignChannels(files, index, settings);
+        const double elapsed_s =
+            std::chrono::duration<double>(std::chrono::steady_clock::now() - start)
+                .count();
+        std::cerr << "tx " << run.first.first << " run " << run.first.second << ": "
+                  << files.size() << " channels of " << alignments[0].samples
+                  << " samples in " << elapsed_s << " s" << std::endl;
+        for (const auto& alignment : alignments) {
+            out << run.first.first << "," << run.first.second << ","
+                << alignment.rx_channel << "," << alignment.delay_samples << ","
+                << (rate > 0 ? alignment.delay_samples / rate * 1e9 : 0) << ","
+                << alignment.phase_deg << "," << alignment.amplitude_db << ","
+                << alignment.coherence << "," << alignment.samples << "\n";
+        }
+    }
+    return EXIT_SUCCESS;
+}
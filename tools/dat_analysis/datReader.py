@@ -0,0 +1,157 @@
+#!/usr/bin/env python3
+
+"""
+Copyright 2021-2022 Ettus Research, a National Instruments Brand
+SPDX-License-Identifier: GPL-3.0-or-later
+
+Streams per channel captures through the C API in lib/DatReader.h without loading
+them into RAM. Requires libArch_dat_reader.so from the build directory. Captures
+written with --rx-compress (.sc16z) are expanded to their .dat name first.
+
+Example: python3 datReader.py /mnt/md0/CW_*/test.tx_00_rx_0*_run_00_*.dat --chunk 1048576
+"""
+
+import argparse
+import ctypes
+import numpy as np
+
+
+def decompress(src, dst=None, library="build/lib/libArch_dat_reader.so"):
+    """Expand a compressed capture (<capture>.sc16z) into the plain sc16 capture dst,
+    by default the name without .sc16z. Returns dst."""
+    if dst is None:
+        dst = src[:-len(".sc16z")] if src.endswith(".sc16z") else src + ".dat"
+    lib = ctypes.CDLL(library)
+    lib.ra_dat_decompress.restype = ctypes.c_int64
+    lib.ra_dat_decompress.argtypes = [ctypes.c_char_p, ctypes.c_char_p]
+    if lib.ra_dat_decompress(src.encode(), dst.encode()) < 0:
+        raise RuntimeError("Unable to decompress " + src)
+    return dst
+
+
+class DatReader(object):
+    """Lockstep chunked reader of a set of sc16 captures, one per channel"""
+
+    def __init__(self, paths, library="build/lib/libArch_dat_reader.so", threads=0):
+        self.lib = ctypes.CDLL(library)
+        self.lib.ra_dat_open.restype = ctypes.c_void_p
+        self.lib.ra_dat_open.argtypes = [
+            ctypes.POINTER(ctypes.c_char_p), ctypes.c_uint32, ctypes.c_uint32]
+        self.lib.ra_dat_close.argtypes = [ctypes.c_void_p]
+        self.lib.ra_dat_common_samples.restype = ctypes.c_uint64
+        self.lib.ra_dat_common_samples.argtypes = [ctypes.c_void_p]
+        self.lib.ra_dat_set_range.restype = ctypes.c_int
+        self.lib.ra_dat_set_range.argtypes = [
+            ctypes.c_void_p, ctypes.c_uint64, ctypes.c_uint64, ctypes.c_uint64]
+        self.lib.ra_dat_next.restype = ctypes.c_int64
+        self.lib.ra_dat_next.argtypes = [
+            ctypes.c_void_p, ctypes.POINTER(ctypes.c_void_p), ctypes.POINTER(ctypes.c_uint64)]
+        self.lib.ra_dat_sample_at.restype = ctypes.c_int64
+        self.lib.ra_dat_sample_at.argtypes = [
+            ctypes.c_void_p, ctypes.c_uint32, ctypes.c_int64, ctypes.c_double]
+        self.lib.ra_dat_start_time.restype = ctypes.c_int
+        self.lib.ra_dat_start_time.argtypes = [
+            ctypes.c_void_p, ctypes.c_uint32,
+            ctypes.POINTER(ctypes.c_int64), ctypes.POINTER(ctypes.c_double)]
+        self.lib.ra_dat_read_fc32.restype = ctypes.c_int64
+        self.lib.ra_dat_read_fc32.argtypes = [
+            ctypes.c_void_p, ctypes.c_uint64, ctypes.c_uint64, ctypes.POINTER(ctypes.c_void_p)]
+        self.channels = len(paths)
+        names = (ctypes.c_char_p * self.channels)(*[p.encode() for p in paths])
+        self.reader = self.lib.ra_dat_open(names, self.channels, threads)
+        if not self.reader:
+            raise RuntimeError("Unable to open the captures")
+
+    def close(self):
+        if self.reader:
+            self.lib.ra_dat_close(self.reader)
+            self.reader = None
+
+    def common_samples(self):
+        return self.lib.ra_dat_common_samples(self.reader)
+
+    def start_time(self, channel=0):
+        """Device time of the first sample of channel as (full secs, frac secs), from its
+        time index"""
+        full = ctypes.c_int64()
+        frac = ctypes.c_double()
+        if self.lib.ra_dat_start_time(self.reader, channel, ctypes.byref(full),
+                                      ctypes.byref(frac)) != 0:
+            raise RuntimeError("Channel %d has no time index" % channel)
+        return full.value, frac.value
+
+    def sample_at(self, seconds, channel=0):
+        """The sample of channel received seconds after its first one, looked up in
+        its time index. Dropped samples are accounted for."""
+        full, frac = self.start_time(channel)
+        frac += seconds
+        sample = self.lib.ra_dat_sample_at(
+            self.reader, channel, full + int(frac // 1), frac % 1)
+        if sample < 0:
+            raise RuntimeError("Channel %d has no time index" % channel)
+        return sample
+
+    def chunks(self, start=0, count=0, chunk_samples=1 << 20):
+        """Yields (first sample, [int16 array of interleaved I/Q per channel]). The
+        arrays point into the file mappings and are only valid until close()."""
+        if self.lib.ra_dat_set_range(self.reader, start, count, chunk_samples) != 0:
+            raise RuntimeError("Invalid sample range")
+        spans = (ctypes.c_void_p * self.channels)()
+        first = ctypes.c_uint64()
+        while True:
+            nsamps = self.lib.ra_dat_next(self.reader, spans, ctypes.byref(first))
+            if nsamps <= 0:
+                return
+            yield first.value, [
+                np.ctypeslib.as_array(ctypes.cast(span, ctypes.POINTER(ctypes.c_int16)),
+                                      shape=(2 * nsamps,)) for span in spans]
+
+    def read_complex(self, start, count):
+        """Samples [start, start + count) of every channel as complex64 arrays, converted
+        by the reader's threads"""
+        samples = [np.empty(count, dtype=np.complex64) for _ in range(self.channels)]
+        outputs = (ctypes.c_void_p * self.channels)(
+            *[s.ctypes.data_as(ctypes.c_void_p) for s in samples])
+        converted = self.lib.ra_dat_read_fc32(self.reader, start, count, outputs)
+        if converted < 0:
+            raise RuntimeError("Unable to read the captures")
+        return [s[:converted] for s in samples]
+
+
+def parse_args():
+    """Parse the command line arguments"""
+    parser = argparse.ArgumentParser()
+    parser.add_argument("captures", nargs="+", type=str)
+    parser.add_argument("-l", "--library", default="build/lib/libArch_dat_reader.so", type=str)
+    parser.add_argument("-c", "--chunk", default=1 << 20, type=int)
+    parser.add_argument("-s", "--start", default=None, type=float,
+                        help="seconds after the first sample to start at, from the time index")
+    parser.add_argument("-d", "--duration", default=None, type=float,
+                        help="seconds to read from --start")
+    return parser.parse_args()
+
+
+def main():
+    """Print the mean power of every channel, streamed chunk by chunk"""
+    args = parse_args()
+    args.captures = [decompress(path, library=args.library) if path.endswith(".sc16z")
+                     else path for path in args.captures]
+    reader = DatReader(args.captures, args.library)
+    start = 0 if args.start is None else reader.sample_at(args.start)
+    count = 0
+    if args.duration is not None:
+        count = reader.sample_at((args.start or 0) + args.duration) - start
+    power = np.zeros(reader.channels)
+    total = 0
+    for _, chunk in reader.chunks(start, count, args.chunk):
+        total += len(chunk[0]) // 2
+        for channel, samples in enumerate(chunk):
+            power[channel] += np.sum(samples.astype(np.float64) ** 2) / 32768.0 ** 2
+    total = max(total, 1)
+    for channel, path in enumerate(args.captures):
+        print("%s: %d samples, mean power %f" % (path, total, power[channel] / total))
+    reader.close()
+
+
+if __name__ == "__main__":
+    main()
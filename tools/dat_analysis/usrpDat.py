@@ -73,7 +73,6 @@ class usrpDat(object):
            sys.exit() 
 
     def convert_to_complex(self):
-        complex_data = []
-        for x in range(0,len(self.i)):
-            self.complex_data.append(np.complex(self.q[x], self.i[x]))
+        """Vectorized, Arch_channel_align computes the alignment without Python"""
+        self.complex_data = np.asarray(self.q, dtype=np.float64) + 1j * np.asarray(self.i, dtype=np.float64)
         
\ No newline at end of file
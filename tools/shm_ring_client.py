@@ -0,0 +1,98 @@
+#!/usr/bin/env python3
+
+"""
+Copyright 2021-2022 Ettus Research, a National Instruments Brand
+SPDX-License-Identifier: GPL-3.0-or-later
+
+Reads samples from the shared memory rings created by Arch_pipe (PipeTransport = shm).
+Requires libArch_shared_ring.so from the build directory.
+DISCLAIMER: This is meant as an example of the C API in lib/SharedRing.h.
+
+"""
+
+import argparse
+import ctypes
+import os
+import numpy as np
+
+# RA_RING_FORMAT_* in lib/SharedRing.h: numpy type of I and Q
+RING_FORMATS = {0: np.int16, 1: np.float32, 2: np.float16}
+
+
+def parse_args():
+    """Parse the command line arguments"""
+    parser = argparse.ArgumentParser()
+    parser.add_argument("-l", "--library", default="build/lib/libArch_shared_ring.so", type=str)
+    parser.add_argument("-c", "--channels", default=1, type=int)
+    parser.add_argument("-n", "--num-samples", default=1000000, type=int)
+    parser.add_argument("-r", "--requests", default=1, type=int)
+    return parser.parse_args()
+
+
+def load_library(path):
+    """Load the ring library and declare the functions used"""
+    lib = ctypes.CDLL(path, use_errno=True)
+    lib.ra_ring_open.restype = ctypes.c_void_p
+    lib.ra_ring_open.argtypes = [ctypes.c_char_p]
+    lib.ra_ring_close.argtypes = [ctypes.c_void_p]
+    lib.ra_ring_request.argtypes = [ctypes.c_void_p, ctypes.c_int32]
+    lib.ra_ring_acquire_read.restype = ctypes.c_int64
+    lib.ra_ring_acquire_read.argtypes = [
+        ctypes.c_void_p, ctypes.POINTER(ctypes.c_void_p), ctypes.c_uint64, ctypes.c_int]
+    lib.ra_ring_release_read.argtypes = [ctypes.c_void_p, ctypes.c_uint64]
+    lib.ra_ring_sample_format.restype = ctypes.c_uint32
+    lib.ra_ring_sample_format.argtypes = [ctypes.c_void_p]
+    return lib
+
+
+def read_available(lib, ring, samples, received):
+    """Copy what is readable in the ring into samples[received:], returns the new count"""
+    dtype = np.dtype(RING_FORMATS[lib.ra_ring_sample_format(ring)])
+    sample_size = 2 * dtype.itemsize
+    data = ctypes.c_void_p()
+    nbytes = lib.ra_ring_acquire_read(ring, ctypes.byref(data), sample_size, 10)
+    nsamps = min(max(nbytes, 0) // sample_size, len(samples) - received)
+    if nsamps == 0:
+        return received
+    raw = np.frombuffer(
+        (ctypes.c_char * (nsamps * sample_size)).from_address(data.value), dtype=dtype)
+    samples[received:received + nsamps] = raw[0::2] + 1j * raw[1::2]
+    lib.ra_ring_release_read(ring, nsamps * sample_size)
+    return received + nsamps
+
+
+def read_samples(lib, rings, num_samples):
+    """Read num_samples from every ring. Arch_pipe fills the rings in lockstep, so the
+    rings are drained round robin rather than one after the other."""
+    samples = [np.empty(num_samples, dtype=np.complex64) for _ in rings]
+    received = [0] * len(rings)
+    while min(received) < num_samples:
+        for channel, ring in enumerate(rings):
+            received[channel] = read_available(lib, ring, samples[channel], received[channel])
+    return samples
+
+
+def main():
+    """Request samples from each channel and print their mean power"""
+    args = parse_args()
+    lib = load_library(args.library)
+    rings = []
+    for channel in range(args.channels):
+        ring = lib.ra_ring_open(("refarch_ring_%d" % channel).encode())
+        if not ring:
+            raise RuntimeError("Unable to open refarch_ring_%d (%s), is Arch_pipe running?"
+                               % (channel, os.strerror(ctypes.get_errno())))
+        rings.append(ring)
+    for _ in range(args.requests):
+        for ring in rings:
+            lib.ra_ring_request(ring, args.num_samples)
+        for channel, samples in enumerate(read_samples(lib, rings, args.num_samples)):
+            print("Channel %d: %d samples, mean power %f" % (
+                channel, len(samples), np.mean(np.abs(samples) ** 2)))
+    for ring in rings:
+        lib.ra_ring_request(ring, 0)
+        lib.ra_ring_close(ring)
+
+
+if __name__ == "__main__":
+    main()